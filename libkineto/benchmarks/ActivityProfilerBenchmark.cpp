@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <fmt/format.h>
+#include <iostream>
+#include <set>
+#include <thread>
+
+#include "benchmarks/Benchmark.h"
+#include "include/ActivityType.h"
+#include "src/ActivityProfilerController.h"
+#include "src/Config.h"
+#include "src/CuptiActivityInterface.h"
+#include "src/LatencyHistogram.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+// Per-op cost of pushing and popping correlation ids,
+// with and without a trace recording them.
+KINETO_BENCHMARK(Correlation) {
+  constexpr int kOps = 1000000;
+  const std::set<ActivityType> activities{ActivityType::EXTERNAL_CORRELATION};
+  auto opCost = [&]() {
+    return timeIt([&]() {
+             for (int i = 0; i < kOps; i++) {
+               CuptiActivityInterface::pushCorrelationID(i);
+               CuptiActivityInterface::popCorrelationID();
+             }
+           }) /
+        kOps;
+  };
+
+  auto idle = opCost();
+  CuptiActivityInterface::setCorrelationMirroring(activities, true);
+  auto active = opCost();
+  CuptiActivityInterface::setCorrelationMirroring(activities, false);
+
+  std::cout << "Correlation push + pop, idle: " << idle.count()
+            << "ns, active: " << active.count() << "ns" << std::endl;
+}
+
+// Wait for the controller to reach the given state, returning the time
+static time_point<system_clock> waitForActive(
+    ActivityProfilerController& controller, bool active) {
+  auto timeout = system_clock::now() + seconds(5);
+  while (controller.isActive() != active && system_clock::now() < timeout) {
+    std::this_thread::sleep_for(microseconds(50));
+  }
+  return system_clock::now();
+}
+
+// Time from an async trace request to the start of tracing,
+// and how far past the requested duration the trace ends.
+KINETO_BENCHMARK(TriggerLatency) {
+  constexpr int kRequests = 10;
+  constexpr milliseconds kDuration(50);
+  ActivityProfilerController controller(/*cpu only*/ true);
+  LatencyHistogram startLatency;
+  LatencyHistogram endLatency;
+
+  Config cfg;
+  cfg.parse(fmt::format(R"CFG(
+    ACTIVITIES_WARMUP_PERIOD_SECS = 0
+    ACTIVITIES_DURATION_MSECS = {}
+  )CFG", kDuration.count()));
+  // Log to memory to leave out file system latency
+  cfg.setClientDefaults();
+
+  for (int i = 0; i < kRequests; i++) {
+    auto requestTime = system_clock::now();
+    controller.scheduleTrace(cfg);
+    auto startTime = waitForActive(controller, true);
+    auto endTime = waitForActive(controller, false);
+    startLatency.add(duration_cast<microseconds>(startTime - requestTime));
+    endLatency.add(
+        duration_cast<microseconds>(endTime - (startTime + kDuration)));
+  }
+
+  std::cout << "Request to start: " << startLatency << std::endl;
+  std::cout << "End overshoot: " << endLatency << std::endl;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace KINETO_NAMESPACE {
+
+// Benchmarks print their own measurements, and are kept out of the unit
+// tests since timings depend on the machine and its load.
+using BenchmarkFn = void (*)();
+
+bool registerBenchmark(const char* name, BenchmarkFn fn);
+
+// Time taken by fn
+template <class Fn>
+std::chrono::nanoseconds timeIt(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::steady_clock::now() - start;
+}
+
+} // namespace KINETO_NAMESPACE
+
+// Defines a benchmark, run by kineto_benchmark
+#define KINETO_BENCHMARK(name)                                 \
+  static void name();                                          \
+  static const bool name##Registered =                         \
+      KINETO_NAMESPACE::registerBenchmark(#name, name);        \
+  static void name()
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmarks/Benchmark.h"
+#include "include/TraceSpan.h"
+#include "src/Config.h"
+#include "src/CuptiActivity.h"
+#include "src/output_json.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+namespace {
+
+// Kernel launches and kernels, with the op that launched them
+struct TestTrace {
+  explicit TestTrace(int count) {
+    op.startTime = 100;
+    op.endTime = 200;
+    op.correlation = 1;
+    op.device = 0;
+    op.threadId = pthread_self();
+    op.opType = "op";
+    runtime.resize(count);
+    kernels.resize(count);
+    for (int i = 0; i < count; i++) {
+      runtime[i] = {};
+      runtime[i].cbid = CUPTI_RUNTIME_TRACE_CBID_cudaLaunchKernel_v7000;
+      runtime[i].start = 1000 * i;
+      runtime[i].end = 1000 * i + 500;
+      runtime[i].correlationId = i;
+      runtime[i].threadId = 7;
+      kernels[i] = {};
+      kernels[i].name = "_Z6kernelPfi";
+      kernels[i].start = 1000 * i + 600;
+      kernels[i].end = 1000 * i + 900;
+      kernels[i].streamId = i % 4;
+      kernels[i].correlationId = i;
+      kernels[i].gridX = kernels[i].gridY = kernels[i].gridZ = 2;
+      kernels[i].blockX = kernels[i].blockY = kernels[i].blockZ = 32;
+    }
+  }
+
+  void write(const std::string& fileName, int threads, bool timeOrdered)
+      const {
+    std::vector<RuntimeActivity> runtimeActivities;
+    std::vector<GpuActivity<CUpti_ActivityKernel4>> kernelActivities;
+    for (size_t i = 0; i < runtime.size(); i++) {
+      runtimeActivities.emplace_back(&runtime[i], op);
+      kernelActivities.emplace_back(&kernels[i], op);
+    }
+    ChromeTraceLogger logger(fileName, threads, timeOrdered);
+    TraceSpan span{100, 200, 1, 0, "net", ""};
+    logger.handleTraceSpan(span);
+    logger.handleCpuActivity(op, span);
+    logger.handleRuntimeActivities(runtimeActivities);
+    logger.handleGpuActivities(kernelActivities);
+    Config config;
+    logger.finalizeTrace(config, nullptr);
+  }
+
+  ClientTraceActivity op;
+  std::vector<CUpti_ActivityAPI> runtime;
+  std::vector<CUpti_ActivityKernel4> kernels;
+};
+
+} // namespace
+
+// Events formatted per second, by number of format threads.
+// Scaling is limited by the cores available and by the writing thread,
+// so numbers from a single core machine say nothing about scaling.
+// Traces are written to /dev/null, since writeback of large files to
+// disk can throttle the writer and dominate the time.
+KINETO_BENCHMARK(ChromeTraceFormatting) {
+  constexpr int kActivities = 200000;
+  constexpr int64_t kEvents = 2 * kActivities;
+  TestTrace trace(kActivities);
+  const std::string fileName = "/dev/null";
+  auto eventsPerSec = [&](int threads, bool timeOrdered) {
+    auto elapsed = duration_cast<microseconds>(
+        timeIt([&]() { trace.write(fileName, threads, timeOrdered); }));
+    return kEvents * 1000000 / (elapsed.count() + 1);
+  };
+
+  std::cout << std::thread::hardware_concurrency() << " cores" << std::endl;
+  for (int threads : {1, 2, 4, 8}) {
+    int64_t rate = eventsPerSec(threads, false);
+    std::cout << threads << " format threads: " << rate << " events/s"
+              << std::endl;
+  }
+  int64_t rate = eventsPerSec(1, true);
+  std::cout << "Time ordered, 1 format thread: " << rate << " events/s"
+            << std::endl;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "benchmarks/Benchmark.h"
+#include "src/Config.h"
+#include "src/VersionedSnapshot.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+// Per-iteration cost of checking the base and on-demand configs for
+// changes, as done by each event profiler, when nothing has changed.
+KINETO_BENCHMARK(ConfigCheck) {
+  constexpr int kIterations = 1000000;
+
+  // Previously, under a lock and comparing timestamps
+  std::mutex lock;
+  Config config;
+  Config onDemandConfig;
+  auto configCopy = config.clone();
+  auto onDemandCopy = onDemandConfig.clone();
+  int changes = 0;
+  auto locked = timeIt([&]() {
+    for (int i = 0; i < kIterations; i++) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        changes += config.timestamp() > configCopy->timestamp();
+      }
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        changes += onDemandConfig.eventProfilerOnDemandStartTime() >
+            onDemandCopy->eventProfilerOnDemandStartTime();
+      }
+    }
+  });
+
+  VersionedSnapshot<Config> configs(std::make_shared<Config>());
+  VersionedSnapshot<Config> onDemandConfigs(std::make_shared<Config>());
+  std::shared_ptr<const Config> configSnapshot;
+  std::shared_ptr<const Config> onDemandSnapshot;
+  uint64_t configVersion = 0;
+  uint64_t onDemandVersion = 0;
+  configs.refresh(configSnapshot, configVersion);
+  onDemandConfigs.refresh(onDemandSnapshot, onDemandVersion);
+  auto snapshot = timeIt([&]() {
+    for (int i = 0; i < kIterations; i++) {
+      changes += configs.refresh(configSnapshot, configVersion);
+      changes += onDemandConfigs.refresh(onDemandSnapshot, onDemandVersion);
+    }
+  });
+
+  std::cout << "Locked check: " << double(locked.count()) / kIterations
+            << "ns" << std::endl;
+  std::cout << "Snapshot check: " << double(snapshot.count()) / kIterations
+            << "ns" << std::endl;
+  if (changes != 0) {
+    std::cerr << "Unexpected config changes: " << changes << std::endl;
+  }
+}
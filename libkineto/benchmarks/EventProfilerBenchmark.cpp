@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <fmt/format.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmarks/Benchmark.h"
+#include "src/Config.h"
+#include "src/CuptiEventInterface.h"
+#include "src/CuptiMetricInterface.h"
+#include "src/EventProfiler.h"
+#include "src/SampleListener.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+namespace {
+
+// All events in a single group, read with generated values
+class FakeCuptiEvents : public CuptiEventInterface {
+ public:
+  explicit FakeCuptiEvents(int eventCount, int instanceCount)
+      : instanceCount_(instanceCount) {
+    for (int i = 0; i < eventCount; i++) {
+      ids_.push_back(i);
+    }
+    groupSet_.numEventGroups = 1;
+    groupSet_.eventGroups = &group_;
+    groupSets_.numSets = 1;
+    groupSets_.sets = &groupSet_;
+  }
+
+  CUpti_EventGroupSets* createGroupSets(
+      std::vector<CUpti_EventID>& /*unused*/) override {
+    return &groupSets_;
+  }
+  void destroyGroupSets(CUpti_EventGroupSets* /*unused*/) override {}
+  void setContinuousMode() override {}
+  void enablePerInstance(CUpti_EventGroup /*unused*/) override {}
+  uint32_t instanceCount(CUpti_EventGroup /*unused*/) override {
+    return instanceCount_;
+  }
+  void enableGroupSet(CUpti_EventGroupSet& /*unused*/) override {}
+  void disableGroupSet(CUpti_EventGroupSet& /*unused*/) override {}
+  void readAllEvents(
+      CUpti_EventGroup /*unused*/,
+      std::vector<int64_t>& vals,
+      std::vector<CUpti_EventID>& /*unused*/) override {
+    for (auto& v : vals) {
+      v = (counter_++ * 7919) % 10007;
+    }
+  }
+  std::vector<CUpti_EventID> eventsInGroup(
+      CUpti_EventGroup /*unused*/) override {
+    return ids_;
+  }
+  CUpti_EventID eventId(const std::string& name) override {
+    return std::stoi(name.substr(name.find('_') + 1));
+  }
+
+ private:
+  uint32_t instanceCount_;
+  std::vector<CUpti_EventID> ids_;
+  int64_t counter_{0};
+  CUpti_EventGroup group_{nullptr};
+  CUpti_EventGroupSet groupSet_;
+  CUpti_EventGroupSets groupSets_;
+};
+
+class NullListener : public SampleListener {
+ public:
+  void handleSample(int /*unused*/, const Sample& sample) override {
+    stats_ += sample.stats.size();
+  }
+  void update(const Config& /*unused*/) override {}
+
+ private:
+  size_t stats_{0};
+};
+
+} // namespace
+
+// Report aggregation cost for a large configuration:
+// 200 events at 80 domain instances each, 10 slices per report.
+KINETO_BENCHMARK(DispatchSamples) {
+  constexpr int kEventCount = 200;
+  constexpr int kInstanceCount = 80;
+  constexpr int kSamplesPerReport = 10;
+  constexpr int kReportCount = 20;
+
+  std::vector<std::unique_ptr<SampleListener>> loggers;
+  std::vector<std::unique_ptr<SampleListener>> onDemandLoggers;
+  loggers.push_back(std::make_unique<NullListener>());
+  EventProfiler profiler(
+      std::make_unique<FakeCuptiEvents>(kEventCount, kInstanceCount),
+      std::make_unique<CuptiMetricInterface>(0),
+      loggers,
+      onDemandLoggers);
+
+  std::string events;
+  for (int i = 0; i < kEventCount; i++) {
+    events += (i > 0 ? "," : "") + std::string("event_") + std::to_string(i);
+  }
+  Config cfg, onDemandCfg;
+  if (!cfg.parse(fmt::format(R"(
+    EVENTS = {}
+    SAMPLE_PERIOD_MSECS = 100
+    REPORT_PERIOD_SECS = 1
+    SAMPLES_PER_REPORT = {}
+  )", events, kSamplesPerReport))) {
+    std::cerr << "Failed to parse config" << std::endl;
+    return;
+  }
+  profiler.configure(cfg, onDemandCfg);
+
+  nanoseconds elapsed(0);
+  for (int r = 0; r < kReportCount; r++) {
+    for (int i = 0; i < kSamplesPerReport; i++) {
+      profiler.collectSample();
+    }
+    elapsed += timeIt([&]() { profiler.reportSamples(); });
+    profiler.eraseReportedSamples();
+  }
+
+  std::cout << "dispatchSamples (" << kEventCount << " stats x "
+            << kInstanceCount << " instances x " << kSamplesPerReport
+            << " slices): "
+            << duration_cast<microseconds>(elapsed).count() / kReportCount
+            << " us per report" << std::endl;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Runs libkineto benchmarks and prints their measurements.
+//
+//   kineto_benchmark            run all benchmarks
+//   kineto_benchmark <name>...  run the named benchmarks
+
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "benchmarks/Benchmark.h"
+
+namespace KINETO_NAMESPACE {
+
+static std::map<std::string, BenchmarkFn>& benchmarks() {
+  static std::map<std::string, BenchmarkFn> benchmarks;
+  return benchmarks;
+}
+
+bool registerBenchmark(const char* name, BenchmarkFn fn) {
+  return benchmarks().emplace(name, fn).second;
+}
+
+} // namespace KINETO_NAMESPACE
+
+using namespace KINETO_NAMESPACE;
+
+static void run(const std::string& name, BenchmarkFn fn) {
+  std::cout << "== " << name << std::endl;
+  fn();
+}
+
+int main(int argc, char** argv) {
+  if (argc == 1) {
+    for (const auto& benchmark : benchmarks()) {
+      run(benchmark.first, benchmark.second);
+    }
+    return 0;
+  }
+  for (int i = 1; i < argc; i++) {
+    auto it = benchmarks().find(argv[i]);
+    if (it == benchmarks().end()) {
+      std::cerr << "Unknown benchmark: " << argv[i] << std::endl;
+      std::cerr << "Benchmarks:";
+      for (const auto& benchmark : benchmarks()) {
+        std::cerr << " " << benchmark.first;
+      }
+      std::cerr << std::endl;
+      return 2;
+    }
+    run(it->first, it->second);
+  }
+  return 0;
+}
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <set>
 #include <vector>
@@ -68,6 +69,9 @@ class ActivityProfilerInterface {
   virtual void transferCpuTrace(
       std::unique_ptr<CpuTraceBuffer> traceBuffer){}
 
+  // Invoked by LibkinetoApi::step() once the requested step is reached
+  virtual void step(int64_t stepCount) {}
+
   // Include regions with this name
   virtual bool enableForRegion(const std::string& match) {
     return true;
@@ -48,6 +48,10 @@ struct ClientTraceActivity : TraceActivity {
     return opType;
   }
 
+  StringView nameView() const override {
+    return opType;
+  }
+
   const TraceActivity* linkedActivity() const override {
     return nullptr;
   }
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <ostream>
+#include <string>
+
+namespace libkineto {
+
+// Non-owning reference to a string, standing in for std::string_view
+// until C++17. The referenced characters must outlive the view.
+class StringView {
+ public:
+  constexpr StringView() : data_(""), size_(0) {}
+  constexpr StringView(const char* data, size_t size)
+      : data_(data), size_(size) {}
+  StringView(const char* str) : data_(str), size_(strlen(str)) {}
+  StringView(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+  constexpr const char* data() const {
+    return data_;
+  }
+
+  constexpr size_t size() const {
+    return size_;
+  }
+
+  constexpr bool empty() const {
+    return size_ == 0;
+  }
+
+  std::string str() const {
+    return std::string(data_, size_);
+  }
+
+  friend bool operator==(StringView a, StringView b) {
+    return a.size_ == b.size_ && memcmp(a.data_, b.data_, a.size_) == 0;
+  }
+
+  friend bool operator!=(StringView a, StringView b) {
+    return !(a == b);
+  }
+
+  friend std::ostream& operator<<(std::ostream& out, StringView s) {
+    return out.write(s.data_, s.size_);
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+} // namespace libkineto
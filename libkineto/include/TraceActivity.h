@@ -12,6 +12,7 @@
 #include <unistd.h>
 
 #include "ActivityType.h"
+#include "StringView.h"
 
 namespace libkineto {
 
@@ -33,6 +34,17 @@ struct TraceActivity {
   virtual int64_t correlationId() const = 0;
   virtual ActivityType type() const = 0;
   virtual const std::string name() const = 0;
+  // Name without a copy, preferred on hot paths.
+  // Activities in this library return views of storage that lives as long
+  // as the activity, except kernel names past the bound of the demangle
+  // cache, which are valid until the next such call on the thread.
+  // The fallback for other activities copies name() into a thread local
+  // buffer, also valid until the next such call on the thread.
+  virtual StringView nameView() const {
+    static thread_local std::string buffer;
+    buffer = name();
+    return buffer;
+  }
   // Optional linked activity
   virtual const TraceActivity* linkedActivity() const = 0;
   // Log activity
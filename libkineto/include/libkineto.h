@@ -12,7 +12,9 @@
 #include <signal.h>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -72,6 +74,25 @@ class LibkinetoApi {
     return activityProfiler_ != nullptr;
   }
 
+  // Called by the client once per step, e.g. training iteration, so that
+  // traces can start and stop exactly on step boundaries.
+  // Only an atomic increment unless the profiler waits for this step.
+  void step() {
+    int64_t step = ++stepCount_;
+    if (step >= nextStepEvent_.load(std::memory_order_relaxed)) {
+      activityProfiler_->step(step);
+    }
+  }
+
+  int64_t stepCount() const {
+    return stepCount_;
+  }
+
+  // Notify the activity profiler when this step is reached
+  void setNextStepEvent(int64_t step) {
+    nextStepEvent_ = step;
+  }
+
   void setNetSizeThreshold(int gpu_ops) {
     netSizeThreshold_ = gpu_ops;
   }
@@ -93,6 +114,8 @@ class LibkinetoApi {
 
   bool isLoaded_{false};
   std::atomic_int netSizeThreshold_{};
+  std::atomic<int64_t> stepCount_{0};
+  std::atomic<int64_t> nextStepEvent_{std::numeric_limits<int64_t>::max()};
 };
 
 // Singleton
@@ -9,22 +9,38 @@ def get_libkineto_srcs():
         "src/ActivityProfiler.cpp",
         "src/ActivityProfilerController.cpp",
         "src/ActivityProfilerProxy.cpp",
+        "src/ActivitySpillFile.cpp",
+        "src/ActivityTraceSession.cpp",
         "src/Config.cpp",
         "src/ConfigLoader.cpp",
+        "src/ControlServer.cpp",
         "src/CuptiActivityInterface.cpp",
         "src/CuptiEventInterface.cpp",
         "src/CuptiMetricInterface.cpp",
         "src/Demangle.cpp",
         "src/EventProfiler.cpp",
         "src/EventProfilerController.cpp",
+        "src/FileWatcher.cpp",
+        "src/HostTraceAggregator.cpp",
+        "src/IpcDaemonConfigLoader.cpp",
+        "src/IpcSocket.cpp",
+        "src/IterationSampler.cpp",
+        "src/LatencyHistogram.cpp",
         "src/Logger.cpp",
+        "src/NetFilter.cpp",
         "src/ProcessInfo.cpp",
+        "src/Scheduler.cpp",
+        "src/SharedRing.cpp",
         "src/ThreadName.cpp",
+        "src/TraceRequestQueue.cpp",
+        "src/WarmupMonitor.cpp",
         "src/cupti_strings.cpp",
         "src/init.cpp",
         "src/libkineto_api.cpp",
+        "src/output_aggregate.cpp",
         "src/output_csv.cpp",
         "src/output_json.cpp",
+        "src/output_shm.cpp",
     ]
 
 def get_libkineto_public_headers():
@@ -32,6 +48,7 @@ def get_libkineto_public_headers():
         "include/ActivityProfilerInterface.h",
         "include/ActivityType.h",
         "include/ClientInterface.h",
+        "include/StringView.h",
         "include/TraceActivity.h",
         "include/TraceSpan.h",
         "include/libkineto.h",
@@ -7,11 +7,10 @@
 
 #include "ActivityProfiler.h"
 
-#include <fmt/format.h>
-#include <libgen.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <atomic>
 #include <iomanip>
 #include <string>
@@ -22,8 +21,6 @@
 
 #include "Config.h"
 #include "time_since_epoch.h"
-#include "CuptiActivity.h"
-#include "CuptiActivity.tpp"
 #include "CuptiActivityInterface.h"
 #include "output_base.h"
 
@@ -35,11 +32,19 @@ using std::string;
 
 namespace KINETO_NAMESPACE {
 
+// Number of profiler steps (one per 200ms during warmup) over which
+// tracing overhead must be stable to end warmup early
+constexpr int kWarmupMonitorWindowSize(5);
+// Bounds the per-thread cache of net filter decisions
+constexpr size_t kMaxCachedNetFilterDecisions(4096);
+// Cancel or stop step based traces if the client stops calling step()
+constexpr seconds kStepTracingTimeout(300);
+
 bool ActivityProfiler::iterationTargetMatch(
     const libkineto::CpuTraceBuffer& trace) {
   const string& name = trace.span.name;
   bool match = (name == netIterationsTarget_);
-  if (!match && applyNetFilterInternal(name) &&
+  if (!match && applyNetFilter(name) &&
       passesGpuOpCountThreshold(trace)) {
     if (netIterationsTarget_.empty()) {
       match = true;
@@ -58,9 +63,31 @@ bool ActivityProfiler::iterationTargetMatch(
   return match;
 }
 
+std::function<void()> ActivityProfiler::takeWakeup() {
+  if (!wakeupRequested_) {
+    return nullptr;
+  }
+  wakeupRequested_ = false;
+  return wakeupCallback_;
+}
+
 void ActivityProfiler::transferCpuTrace(
     std::unique_ptr<libkineto::CpuTraceBuffer> cpuTrace) {
-  std::lock_guard<std::mutex> guard(mutex_);
+  std::function<void()> wakeup;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    transferCpuTraceInternal(std::move(cpuTrace));
+    wakeup = takeWakeup();
+  }
+  // Without the lock, since the callback takes the controller lock,
+  // which is held while configuring the profiler
+  if (wakeup) {
+    wakeup();
+  }
+}
+
+void ActivityProfiler::transferCpuTraceInternal(
+    std::unique_ptr<libkineto::CpuTraceBuffer> cpuTrace) {
   // FIXME: It's theoretically possible to receive a buffer from a
   // previous trace request. Probably should add a serial number.
   const string& trace_name = cpuTrace->span.name;
@@ -79,7 +106,13 @@ void ActivityProfiler::transferCpuTrace(
   VLOG(0) << "Received iteration " << cpuTrace->span.iteration << " of net "
           << trace_name << " (" << cpuTrace->activities.size() << " activities / "
           << cpuTrace->gpuOpCount << " gpu activities)";
-  if (currentRunloopState_ == RunloopState::CollectTrace &&
+  if (iterationSampler_.enabled()) {
+    if (!sampleIteration(*cpuTrace)) {
+      VLOG(1) << "Not sampled - discarding trace of net " << trace_name;
+      return;
+    }
+  } else if (!stepTracing_ &&
+      currentRunloopState_ == RunloopState::CollectTrace &&
       iterationTargetMatch(*cpuTrace)) {
     if (cpuTrace->span.iteration == 0) {
       VLOG(0) << "Setting profile start time from net to "
@@ -92,260 +125,132 @@ void ActivityProfiler::transferCpuTrace(
       // Tell the runloop to stop collection
       stopCollection_ = true;
       captureWindowEndTime_ = cpuTrace->span.endTime;
+      wakeupRequested_ = true;
     }
   }
 
   traceBuffers_->cpu.push_back(std::move(cpuTrace));
 }
 
-bool ActivityProfiler::applyNetFilterInternal(const std::string& name) {
-  if (netNameFilter_.empty()) {
-    return true;
-  }
-  for (const std::string& match : netNameFilter_) {
-    if (name.find(match) != name.npos) {
-      return true;
-    }
-  }
-  return false;
-}
-
-ActivityProfiler::ActivityProfiler(CuptiActivityInterface& cupti, bool cpuOnly)
-    : cupti_(cupti),
-      flushOverhead_{0, 0},
-      setupOverhead_{0, 0},
-      cpuOnly_{cpuOnly},
-      currentRunloopState_{RunloopState::WaitForRequest},
-      stopCollection_{false} {}
-
-void ActivityProfiler::processTraceInternal(ActivityLogger& logger) {
-  LOG(INFO) << "Processing " << traceBuffers_->cpu.size()
-      << " CPU buffers";
-  VLOG(0) << "Profile time range: " << captureWindowStartTime_ << " - "
-          << captureWindowEndTime_;
-  for (auto& cpu_trace : traceBuffers_->cpu) {
-    string trace_name = cpu_trace->span.name;
-    VLOG(0) << "Processing CPU buffer for " << trace_name << " ("
-            << cpu_trace->span.iteration << ") - "
-            << cpu_trace->activities.size() << " records";
-    bool log_net = applyNetFilterInternal(trace_name) &&
-        passesGpuOpCountThreshold(*cpu_trace) &&
-        cpu_trace->span.startTime < captureWindowEndTime_ &&
-        cpu_trace->span.endTime > captureWindowStartTime_;
-    VLOG(0) << "Net time range: " << cpu_trace->span.startTime << " - "
-            << cpu_trace->span.endTime;
-    VLOG(0) << "Log net: " << (log_net ? "Yes" : "No");
-    processCpuTrace(*cpu_trace, logger, log_net);
-  }
-
-  if (!cpuOnly_) {
-    traceBuffers_->gpu = cupti_.activityBuffers();
-    if (VLOG_IS_ON(1)) {
-      addOverheadSample(flushOverhead_, cupti_.flushOverhead);
-    }
-    if (traceBuffers_->gpu) {
-      const auto count_and_size = cupti_.processActivities(
-          *traceBuffers_->gpu,
-          std::bind(&ActivityProfiler::handleCuptiActivity, this, std::placeholders::_1, &logger));
-      LOG(INFO) << "Processed " << count_and_size.first
-                << " GPU records (" << count_and_size.second << " bytes)";
-    }
+void ActivityProfiler::setGpuSampling(bool enable) {
+  if (enable == gpuSampling_) {
+    return;
   }
-
-  finalizeTrace(*config_, logger);
-}
-
-ActivityProfiler::CpuGpuSpanPair& ActivityProfiler::recordTraceSpan(
-    TraceSpan& span, int gpuOpCount) {
-  TraceSpan gpu_span{
-      0, 0, gpuOpCount, span.iteration, span.name, "GPU: "};
-  auto& iterations = traceSpans_[span.name];
-  iterations.push_back({span, gpu_span});
-  return iterations.back();
-}
-
-void ActivityProfiler::processCpuTrace(
-    libkineto::CpuTraceBuffer& cpuTrace,
-    ActivityLogger& logger,
-    bool logTrace) {
-  if (cpuTrace.activities.size() == 0) {
-    LOG(WARNING) << "CPU trace is empty!";
+  gpuSampling_ = enable;
+  if (cpuOnly_) {
     return;
   }
-
-  CpuGpuSpanPair& span_pair = recordTraceSpan(cpuTrace.span, cpuTrace.gpuOpCount);
-  TraceSpan& cpu_span = span_pair.first;
-  for (auto const& act : cpuTrace.activities) {
-    VLOG(2) << act.correlationId() << ": OP " << act.opType
-            << " tid: " << act.threadId;
-    if (logTrace) {
-      logger.handleCpuActivity(act, cpu_span);
-      recordThreadName(act.threadId);
-    }
-    // Stash event so we can look it up later when processing GPU trace
-    externalEvents_.insertEvent(&act);
-    clientActivityTraceMap_[act.correlationId()] = &span_pair;
-  }
-  if (logTrace) {
-    logger.handleTraceSpan(cpu_span);
-    if (cpu_span.name == netIterationsTarget_) {
-      logger.handleIterationStart(cpu_span);
-    }
+  if (enable) {
+    cupti_.enableCuptiActivities(config_->selectedActivityTypes());
   } else {
-    disabledTraceSpans_.insert(cpu_span.name);
+    cupti_.disableCuptiActivities(config_->selectedActivityTypes());
   }
 }
 
-inline void ActivityProfiler::handleCorrelationActivity(
-    const CUpti_ActivityExternalCorrelation* correlation) {
-  externalEvents_.addCorrelation(
-      correlation->externalId, correlation->correlationId);
-  VLOG(2) << correlation->correlationId
-          << ": CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION";
-}
-
-const libkineto::ClientTraceActivity&
-ActivityProfiler::ExternalEventMap::operator[](uint32_t id) {
-  static const libkineto::ClientTraceActivity nullOp_{};
-  auto* res = events_[correlationMap_[id]];
-  if (res == nullptr) {
-    // Entry may be missing because cpu trace hasn't been processed yet
-    // Insert a dummy element so that we can check for this in insertEvent
-    events_[correlationMap_[id]] = &nullOp_;
-    res = &nullOp_;
-  }
-  return *res;
-}
-
-void ActivityProfiler::ExternalEventMap::insertEvent(
-    const libkineto::ClientTraceActivity* op) {
-  if (events_[op->correlationId()] != nullptr) {
-    LOG_EVERY_N(WARNING, 100)
-        << "Events processed out of order - link will be missing";
+bool ActivityProfiler::sampleIteration(const libkineto::CpuTraceBuffer& trace) {
+  if (currentRunloopState_ != RunloopState::CollectTrace) {
+    // Only keep traces that GPU activities were recorded for
+    return gpuSampling_;
   }
-  events_[op->correlationId()] = op;
-}
-
-static uint64_t usecs(uint64_t nsecs) {
-  return nsecs / 1000;
-}
-
-inline bool ActivityProfiler::outOfRange(const TraceActivity& act) {
-  return act.timestamp() < captureWindowStartTime_ ||
-      (act.timestamp() + act.duration()) > captureWindowEndTime_;
-}
-
-inline void ActivityProfiler::handleRuntimeActivity(
-    const CUpti_ActivityAPI* activity,
-    ActivityLogger* logger) {
-  // Some CUDA calls that are very frequent and also not very interesting.
-  // Filter these out to reduce trace size.
-  if (activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaGetDevice_v3020 ||
-      activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaSetDevice_v3020 ||
-      activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaGetLastError_v3020) {
-    // Ignore these
-    return;
+  if (!iterationTargetMatch(trace)) {
+    // Other nets are kept if they ran while sampling the target
+    return gpuSampling_;
   }
-  VLOG(2) << activity->correlationId
-          << ": CUPTI_ACTIVITY_KIND_RUNTIME, cbid=" << activity->cbid
-          << " tid=" << activity->threadId;
-  const ClientTraceActivity& ext = externalEvents_[activity->correlationId];
-  RuntimeActivity runtimeActivity(activity, ext);
-  if (ext.correlationId() == 0 && outOfRange(runtimeActivity)) {
-    return;
+  if (stopCollection_) {
+    // Target sample count reached - waiting for the trace to stop
+    return false;
   }
-  if (!loggingDisabled(ext)) {
-    runtimeActivity.log(*logger);
+  int iteration = trace.span.iteration;
+  bool sampled = gpuSampling_ && iterationSampler_.sampled(iteration);
+  if (sampled && ++sampledIterations_ >= netIterationsTargetCount_) {
+    VLOG(0) << "Completed target sample count for net "
+            << trace.span.name;
+    libkineto::api().client()->stop();
+    // GPU activities stay enabled until the trace is stopped, which
+    // flushes the GPU work of this iteration before disabling them.
+    // Tell the runloop to stop collection
+    stopCollection_ = true;
+    captureWindowEndTime_ = trace.span.endTime;
+    wakeupRequested_ = true;
+    return true;
   }
+  // GPU work of a sampled iteration may still be running when its CPU
+  // trace ends, so GPU activities are only disabled at the end of the
+  // iteration after it, unless the next one is sampled too.
+  setGpuSampling(sampled || iterationSampler_.sampled(iteration + 1));
+  return sampled;
 }
 
-inline void ActivityProfiler::updateGpuNetSpan(const TraceActivity& gpuOp) {
-  const auto& it = clientActivityTraceMap_.find(
-      gpuOp.linkedActivity()->correlationId());
-  if (it == clientActivityTraceMap_.end()) {
-    // No correlation id mapping?
-    return;
+bool ActivityProfiler::applyNetFilter(const std::string& name) {
+  // Decisions are cached per thread until the filter is replaced
+  struct DecisionCache {
+    std::shared_ptr<const NetFilter> filter;
+    uint64_t version{0};
+    std::unordered_map<std::string, bool> decisions;
+  };
+  static thread_local DecisionCache cache;
+  if (netFilter_.refresh(cache.filter, cache.version)) {
+    cache.decisions.clear();
+  }
+  if (cache.filter->empty()) {
+    return true;
   }
-  TraceSpan& gpu_span = it->second->second;
-  if (gpuOp.timestamp() < gpu_span.startTime || gpu_span.startTime == 0) {
-    gpu_span.startTime = gpuOp.timestamp();
+  auto it = cache.decisions.find(name);
+  if (it != cache.decisions.end()) {
+    return it->second;
   }
-  if ((gpuOp.timestamp() + gpuOp.duration()) > gpu_span.endTime) {
-    gpu_span.endTime = gpuOp.timestamp() + gpuOp.duration();
+  if (cache.decisions.size() >= kMaxCachedNetFilterDecisions) {
+    cache.decisions.clear();
   }
+  bool match = cache.filter->matches(name);
+  cache.decisions.emplace(name, match);
+  return match;
 }
 
-// I've observed occasional broken timestamps attached to GPU events...
-static bool timestampsInCorrectOrder(
-    const TraceActivity& ext,
-    const TraceActivity& gpuOp) {
-  if (ext.timestamp() > gpuOp.timestamp()) {
-    LOG(WARNING) << "GPU op timestamp (" << gpuOp.timestamp()
-                 << ") < runtime timestamp (" << ext.timestamp() << ")";
-    LOG(WARNING) << "Name: " << gpuOp.name()
-                 << " Device: " << gpuOp.deviceId()
-                 << " Stream: " << gpuOp.resourceId();
-    return false;
-  }
-  return true;
-}
+ActivityProfiler::ActivityProfiler(CuptiActivityInterface& cupti, bool cpuOnly)
+    : cupti_(cupti),
+      flushOverhead_{0, 0},
+      setupOverhead_{0, 0},
+      cpuOnly_{cpuOnly},
+      currentRunloopState_{RunloopState::WaitForRequest},
+      stopCollection_{false} {}
 
-inline void ActivityProfiler::handleGpuActivity(
-    const TraceActivity& act,
-    ActivityLogger* logger) {
-  const TraceActivity& ext = *act.linkedActivity();
-  if (ext.timestamp() == 0 && outOfRange(act)) {
-    return;
-  }
-  if (!timestampsInCorrectOrder(ext, act)) {
-    return;
+void ActivityProfiler::setWakeupCallback(std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    wakeupCallback_ = callback;
   }
-
-  VLOG(2) << ext.correlationId() << "," << act.correlationId() << ": "
-          << act.name();
-  if (!loggingDisabled(ext)) {
-    act.log(*logger);
-    updateGpuNetSpan(act);
+  if (!cpuOnly_) {
+    cupti_.setStopCollectionCallback(std::move(callback));
   }
 }
 
-template <class T>
-inline void ActivityProfiler::handleGpuActivity(const T* act, ActivityLogger* logger) {
-  const ClientTraceActivity& ext = externalEvents_[act->correlationId];
-  handleGpuActivity(GpuActivity<T>(act, ext), logger);
-}
-
-void ActivityProfiler::handleCuptiActivity(const CUpti_Activity* record, ActivityLogger* logger) {
-  switch (record->kind) {
-    case CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION:
-      handleCorrelationActivity(
-          reinterpret_cast<const CUpti_ActivityExternalCorrelation*>(
-              record));
-      break;
-    case CUPTI_ACTIVITY_KIND_RUNTIME:
-      handleRuntimeActivity(
-          reinterpret_cast<const CUpti_ActivityAPI*>(record), logger);
-      break;
-    case CUPTI_ACTIVITY_KIND_CONCURRENT_KERNEL:
-      handleGpuActivity(
-          reinterpret_cast<const CUpti_ActivityKernel4*>(record), logger);
-      break;
-    case CUPTI_ACTIVITY_KIND_MEMCPY:
-      handleGpuActivity(
-          reinterpret_cast<const CUpti_ActivityMemcpy*>(record), logger);
-      break;
-    case CUPTI_ACTIVITY_KIND_MEMCPY2:
-      handleGpuActivity(
-          reinterpret_cast<const CUpti_ActivityMemcpy2*>(record), logger);
-      break;
-    case CUPTI_ACTIVITY_KIND_MEMSET:
-      handleGpuActivity(
-          reinterpret_cast<const CUpti_ActivityMemset*>(record), logger);
-      break;
-    default:
-      LOG(WARNING) << "Unexpected activity type: " << record->kind;
-      break;
+std::unique_ptr<ActivityTraceSession>
+ActivityProfiler::detachSessionInternal() {
+  if (!cpuOnly_ && traceBuffers_) {
+    if (config_ && config_->activitiesStandby() && !cupti_.inStandby()) {
+      // Entered before detaching, so that buffers completed from now on
+      // are discarded rather than collected for a trace that has ended
+      cupti_.enterStandby(config_->selectedActivityTypes());
+    }
+    traceBuffers_->gpu = cupti_.activityBuffers();
+    if (VLOG_IS_ON(1)) {
+      addOverheadSample(flushOverhead_, cupti_.flushOverhead);
+    }
   }
+  auto session = std::make_unique<ActivityTraceSession>(
+      cupti_,
+      config_ ? config_->clone() : std::make_unique<Config>(),
+      std::move(traceBuffers_),
+      logger_,
+      cpuOnly_);
+  session->setCaptureWindow(captureWindowStartTime_, captureWindowEndTime_);
+  session->setNetFilter(
+      netFilter_.get(), netGpuOpCountThreshold_, netIterationsTarget_);
+  session->setNetIterationCounts(std::move(netIterationCountMap_));
+  resetInternal();
+  VLOG(0) << "ProcessTrace -> WaitForRequest";
+  return session;
 }
 
 void ActivityProfiler::configure(
@@ -369,57 +274,159 @@ void ActivityProfiler::configure(
     LOG(INFO) << "GPU-only tracing for "
               << config_->activitiesOnDemandDuration().count() << "ms";
   } else {
-    netNameFilter_ = config_->activitiesOnDemandExternalFilter();
+    netFilter_.publish(std::make_shared<NetFilter>(
+        config_->activitiesOnDemandExternalFilter()));
     netGpuOpCountThreshold_ =
         config_->activitiesOnDemandExternalGpuOpCountThreshold();
     netIterationsTarget_ = config_->activitiesOnDemandExternalTarget();
     libkineto::api().setNetSizeThreshold(
         config_->activitiesOnDemandExternalNetSizeThreshold());
     netIterationsTargetCount_ = config_->activitiesOnDemandExternalIterations();
+    iterationSampler_ = IterationSampler(
+        config_->activitiesIterationStride(),
+        config_->activitiesIterationStrideOffset(),
+        config_->activitiesIterationStrideJitter());
 
   }
 
   // Ensure we're starting in a clean state
   resetTraceData();
 
+  stepTracing_ = config_->activitiesSteps() > 0;
+  stepsGpuDeferred_ = false;
+  if (stepTracing_) {
+    int64_t step = libkineto::api().stepCount();
+    stepsWarmupStart_ = step + config_->activitiesSkipSteps();
+    // Never start part way through a step
+    stepsCollectStart_ = std::max(
+        stepsWarmupStart_ + config_->activitiesWarmupSteps(), step + 1);
+    stepsCollectEnd_ = stepsCollectStart_ + config_->activitiesSteps();
+    stepsDeadline_ = now + kStepTracingTimeout;
+    // Enable GPU tracing once the skipped steps are done
+    stepsGpuDeferred_ = !cpuOnly_ && stepsWarmupStart_ > step;
+    LOG(INFO) << "Tracing steps " << stepsCollectStart_ << " - "
+              << stepsCollectEnd_ << " (current step " << step << ")";
+  }
+
+  auto warmup = config_->activitiesWarmupDuration();
   if (!cpuOnly_) {
-    // Enabling CUPTI activity tracing incurs a larger perf hit at first,
-    // presumably because structures are allocated and initialized, callbacks
-    // are activated etc. After a while the overhead decreases and stabilizes.
-    // It's therefore useful to perform some warmup before starting recording.
-    LOG(INFO) << "Enabling GPU tracing";
     cupti_.setMaxBufferSize(config_->activitiesMaxGpuBufferSize());
-
-    time_point<high_resolution_clock> timestamp;
-    if (VLOG_IS_ON(1)) {
-      timestamp = high_resolution_clock::now();
-    }
-    cupti_.enableCuptiActivities(config_->selectedActivityTypes());
-    if (VLOG_IS_ON(1)) {
-      auto t2 = high_resolution_clock::now();
-      addOverheadSample(
-          setupOverhead_, duration_cast<microseconds>(t2 - timestamp).count());
+    cupti_.setSpillDirectory(config_->activitiesSpillDir());
+    if (!stepsGpuDeferred_ && enableGpuTracing()) {
+      warmup = seconds(0);
     }
   }
 
-  profileStartTime_ = (config_->requestTimestamp() + config_->maxRequestAge()) +
-      config_->activitiesWarmupDuration();
-  if (profileStartTime_ < now) {
-    profileStartTime_ = now + config_->activitiesWarmupDuration();
+  warmupMonitor_ = nullptr;
+  if (stepTracing_) {
+    // Started and stopped by the client calling step()
+    profileStartTime_ = time_point<system_clock>::max();
+    libkineto::api().setNextStepEvent(
+        stepsGpuDeferred_ ? stepsWarmupStart_ : stepsCollectStart_);
+  } else {
+    profileStartTime_ =
+        (config_->requestTimestamp() + config_->maxRequestAge()) + warmup;
+    if (profileStartTime_ < now) {
+      profileStartTime_ = now + warmup;
+    }
+    // Synchronized starts across hosts keep the fixed warmup
+    if (!cpuOnly_ && config_->activitiesWarmupAdaptive() &&
+        warmup.count() > 0 && !config_->hasRequestTimestamp()) {
+      warmupMonitor_ = std::make_unique<WarmupMonitor>(
+          kWarmupMonitorWindowSize,
+          config_->activitiesWarmupMaxVariation() / 100.0);
+      lastWarmupStepTime_ = now;
+      lastWarmupCompletedBytes_ = cupti_.completedBytes();
+    }
+    LOG(INFO) << "Tracing starting in "
+              << duration_cast<seconds>(profileStartTime_ - now).count()
+              << "s";
   }
-  LOG(INFO) << "Tracing starting in "
-            << duration_cast<seconds>(profileStartTime_ - now).count() << "s";
 
   traceBuffers_ = std::make_unique<ActivityBuffers>();
   captureWindowStartTime_ = captureWindowEndTime_ = 0;
   currentRunloopState_ = RunloopState::Warmup;
 }
 
+bool ActivityProfiler::enableGpuTracing() {
+  // Enabling CUPTI activity tracing incurs a larger perf hit at first,
+  // presumably because structures are allocated and initialized, callbacks
+  // are activated etc. After a while the overhead decreases and stabilizes.
+  // It's therefore useful to perform some warmup before starting recording.
+  if (cupti_.exitStandby(config_->selectedActivityTypes())) {
+    LOG(INFO) << "GPU tracing enabled from standby - skipping warmup";
+    return true;
+  }
+  LOG(INFO) << "Enabling GPU tracing";
+  time_point<high_resolution_clock> timestamp;
+  if (VLOG_IS_ON(1)) {
+    timestamp = high_resolution_clock::now();
+  }
+  cupti_.enableCuptiActivities(config_->selectedActivityTypes());
+  if (VLOG_IS_ON(1)) {
+    auto t2 = high_resolution_clock::now();
+    addOverheadSample(
+        setupOverhead_, duration_cast<microseconds>(t2 - timestamp).count());
+  }
+  return false;
+}
+
+void ActivityProfiler::step(
+    int64_t stepCount,
+    const time_point<system_clock>& now) {
+  std::function<void()> wakeup;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stepInternal(stepCount, now);
+    wakeup = takeWakeup();
+  }
+  if (wakeup) {
+    wakeup();
+  }
+}
+
+void ActivityProfiler::stepInternal(
+    int64_t stepCount,
+    const time_point<system_clock>& now) {
+  if (!stepTracing_) {
+    libkineto::api().setNextStepEvent(std::numeric_limits<int64_t>::max());
+    return;
+  }
+  if (currentRunloopState_ == RunloopState::Warmup) {
+    if (stepsGpuDeferred_ && stepCount >= stepsWarmupStart_) {
+      VLOG(0) << "Skipped steps done at step " << stepCount;
+      enableGpuTracing();
+      stepsGpuDeferred_ = false;
+    }
+    if (stepCount >= stepsCollectStart_) {
+      VLOG(0) << "Starting trace at step " << stepCount;
+      startTraceInternal(now);
+      libkineto::api().setNextStepEvent(stepsCollectEnd_);
+    } else {
+      libkineto::api().setNextStepEvent(stepsCollectStart_);
+    }
+  } else if (currentRunloopState_ == RunloopState::CollectTrace) {
+    if (stepCount >= stepsCollectEnd_) {
+      VLOG(0) << "Stopping trace at step " << stepCount;
+      libkineto::api().setNextStepEvent(std::numeric_limits<int64_t>::max());
+      // Tell the runloop to stop collection
+      stopCollection_ = true;
+      captureWindowEndTime_ = libkineto::timeSinceEpoch(now);
+      wakeupRequested_ = true;
+    }
+  }
+}
+
 void ActivityProfiler::startTraceInternal(const time_point<system_clock>& now) {
   captureWindowStartTime_ = libkineto::timeSinceEpoch(now);
   if (libkineto::api().client()) {
     libkineto::api().client()->start();
   }
+  if (iterationSampler_.enabled()) {
+    // GPU activities are enabled again before the first sampled iteration
+    gpuSampling_ = true;
+    setGpuSampling(iterationSampler_.sampled(0));
+  }
   VLOG(0) << "Warmup -> CollectTrace";
   currentRunloopState_ = RunloopState::CollectTrace;
 }
@@ -428,7 +435,9 @@ void ActivityProfiler::stopTraceInternal(const time_point<system_clock>& now) {
   if (captureWindowEndTime_ == 0) {
     captureWindowEndTime_ = libkineto::timeSinceEpoch(now);
   }
-  if (!cpuOnly_) {
+  gpuSampling_ = false;
+  // In standby, activities are left enabled once the trace is processed
+  if (!cpuOnly_ && !config_->activitiesStandby()) {
     time_point<high_resolution_clock> timestamp;
     if (VLOG_IS_ON(1)) {
       timestamp = high_resolution_clock::now();
@@ -452,9 +461,39 @@ void ActivityProfiler::stopTraceInternal(const time_point<system_clock>& now) {
 
 void ActivityProfiler::resetInternal() {
   resetTraceData();
+  if (stepTracing_) {
+    libkineto::api().setNextStepEvent(std::numeric_limits<int64_t>::max());
+    stepTracing_ = false;
+  }
+  if (!cpuOnly_ && config_ && config_->activitiesStandby() &&
+      !cupti_.inStandby()) {
+    cupti_.enterStandby(config_->selectedActivityTypes());
+  }
   currentRunloopState_ = RunloopState::WaitForRequest;
 }
 
+void ActivityProfiler::checkWarmupOverhead(
+    const time_point<system_clock>& now,
+    microseconds flushLatency) {
+  int64_t bytes = cupti_.completedBytes();
+  double secs = duration<double>(now - lastWarmupStepTime_).count();
+  if (secs > 0) {
+    warmupMonitor_->addSample(
+        flushLatency.count(), (bytes - lastWarmupCompletedBytes_) / secs);
+  }
+  lastWarmupStepTime_ = now;
+  lastWarmupCompletedBytes_ = bytes;
+  if (warmupMonitor_->stable()) {
+    LOG(INFO) << "Tracing overhead stable after "
+              << warmupMonitor_->sampleCount() << " warmup steps"
+              << " - ending warmup "
+              << duration_cast<milliseconds>(profileStartTime_ - now).count()
+              << "ms early";
+    profileStartTime_ = now;
+    warmupMonitor_ = nullptr;
+  }
+}
+
 const time_point<system_clock> ActivityProfiler::performRunLoopStep(
     const time_point<system_clock>& now,
     const time_point<system_clock>& nextWakeupTime) {
@@ -467,7 +506,34 @@ const time_point<system_clock> ActivityProfiler::performRunLoopStep(
     case RunloopState::Warmup:
       // Flushing can take a while so avoid doing it close to the start time
       if (!cpuOnly_ && nextWakeupTime < profileStartTime_) {
-        cupti_.clearActivities();
+        // Step based traces are started by the client, so hold the lock
+        // to not clear the buffers of a trace that has just started
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (stepTracing_) {
+          lock.lock();
+        }
+        if (currentRunloopState_ == RunloopState::Warmup) {
+          auto t1 = high_resolution_clock::now();
+          cupti_.clearActivities();
+          if (warmupMonitor_) {
+            checkWarmupOverhead(
+                now,
+                duration_cast<microseconds>(high_resolution_clock::now() - t1));
+          }
+        }
+      }
+
+      if (stepTracing_ && now >= stepsDeadline_) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (currentRunloopState_ == RunloopState::Warmup) {
+          LOG(WARNING) << "Step " << stepsCollectStart_ << " not reached in "
+                       << kStepTracingTimeout.count() << "s (current step "
+                       << libkineto::api().stepCount() << ") - cancelling trace";
+          stopTraceInternal(now);
+          resetInternal();
+          VLOG(0) << "Warmup -> WaitForRequest";
+          break;
+        }
       }
 
       if (cupti_.stopCollection) {
@@ -491,6 +557,11 @@ const time_point<system_clock> ActivityProfiler::performRunLoopStep(
           LOG(INFO) << "Tracing started";
         }
         startTrace(now);
+        // Wake up at the end time if it comes before the next step
+        auto end_time = now + config_->activitiesOnDemandDuration();
+        if (end_time < nextWakeupTime) {
+          new_wakeup_time = end_time;
+        }
       } else if (nextWakeupTime > profileStartTime_) {
         new_wakeup_time = profileStartTime_;
       }
@@ -503,9 +574,12 @@ const time_point<system_clock> ActivityProfiler::performRunLoopStep(
       // FIXME: Is this a good idea for synced start?
       {
         std::lock_guard<std::mutex> guard(mutex_);
-        profileEndTime_ = time_point<high_resolution_clock>(
-                              microseconds(captureWindowStartTime_)) +
-            config_->activitiesOnDemandDuration();
+        // Step based traces are stopped by the client
+        profileEndTime_ = stepTracing_
+            ? stepsDeadline_
+            : time_point<high_resolution_clock>(
+                  microseconds(captureWindowStartTime_)) +
+                config_->activitiesOnDemandDuration();
       }
 
       if (now >= profileEndTime_ || stopCollection_.exchange(false) ||
@@ -519,94 +593,39 @@ const time_point<system_clock> ActivityProfiler::performRunLoopStep(
         std::lock_guard<std::mutex> guard(mutex_);
         stopTraceInternal(now);
         VLOG_IF(0, now >= profileEndTime_) << "Reached profile end time";
+        // Process right away
+        new_wakeup_time = now;
       } else if (now < profileEndTime_ && profileEndTime_ < nextWakeupTime) {
         new_wakeup_time = profileEndTime_;
       }
+      if (!cpuOnly_ && cupti_.flushRequested &&
+          currentRunloopState_ == RunloopState::CollectTrace) {
+        // Move completed buffers to the spill file
+        cupti_.flushActivities();
+      }
 
       break;
 
-    case RunloopState::ProcessTrace:
-      // FIXME: Probably want to allow interruption here
-      // for quickly handling trace request via synchronous API
-      std::lock_guard<std::mutex> guard(mutex_);
-      processTraceInternal(*logger_);
-      resetInternal();
-      VLOG(0) << "ProcessTrace -> WaitForRequest";
-      break;
-  }
-
-  return new_wakeup_time;
-}
-
-// Extract process name from /proc/pid/cmdline. This does not have
-// the 16 character limit that /proc/pid/status and /prod/pid/comm has.
-const string processName(pid_t pid) {
-  FILE* cmdfile = fopen(fmt::format("/proc/{}/cmdline", pid).c_str(), "r");
-  if (cmdfile != nullptr) {
-    char* command = nullptr;
-    int scanned = fscanf(cmdfile, "%ms", &command);
-    if (scanned > 0 && command) {
-      string ret(basename(command));
-      free(command);
-      return ret;
-    }
-  }
-  VLOG(1) << "Failed to read process name for pid " << pid;
-  return "";
-}
-
-void ActivityProfiler::finalizeTrace(const Config& config, ActivityLogger& logger) {
-  LOG(INFO) << "Recorded nets:";
-  {
-    for (const auto& it : netIterationCountMap_) {
-      LOG(INFO) << it.first << ": " << it.second << " iterations";
-    }
-    netIterationCountMap_.clear();
-  }
-
-  // Process names
-  string process_name = processName(getpid());
-  if (!process_name.empty()) {
-    pid_t pid = getpid();
-    logger.handleProcessInfo(
-        {pid, process_name, "CPU"}, captureWindowStartTime_);
-    if (!cpuOnly_) {
-      // GPU events use device id as pid (0-7).
-      constexpr int kMaxGpuCount = 8;
-      for (int gpu = 0; gpu < kMaxGpuCount; gpu++) {
-        logger.handleProcessInfo(
-            {gpu, process_name, fmt::format("GPU {}", gpu)},
-            captureWindowStartTime_);
-      }
-    }
-  }
-  // Thread names
-  for (auto pair : threadNames_) {
-    logger.handleThreadInfo(
-        {(int32_t)pair.first, pair.second},
-        captureWindowStartTime_);
-  }
-
-  for (const auto& iterations : traceSpans_) {
-    for (const auto& span_pair : iterations.second) {
-      const TraceSpan& gpu_span = span_pair.second;
-      if (gpu_span.opCount > 0) {
-        logger.handleTraceSpan(gpu_span);
+    case RunloopState::ProcessTrace: {
+      // Processing does not hold the lock, so the next trace
+      // can be requested while this one is processed
+      auto session = detachSession();
+      if (session->logger()) {
+        session->process(*session->logger());
       }
+      break;
     }
   }
 
-  logger.finalizeTrace(config, std::move(traceBuffers_));
+  return new_wakeup_time;
 }
 
 void ActivityProfiler::resetTraceData() {
   if (!cpuOnly_) {
     cupti_.clearActivities();
   }
-  externalEvents_.clear();
-  traceSpans_.clear();
-  clientActivityTraceMap_.clear();
-  disabledTraceSpans_.clear();
+  sampledIterations_ = 0;
+  netIterationCountMap_.clear();
   traceBuffers_ = nullptr;
 }
 
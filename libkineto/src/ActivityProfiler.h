@@ -11,6 +11,8 @@
 #include <chrono>
 #include <condition_variable>
 #include <cupti.h>
+#include <functional>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
@@ -22,8 +24,13 @@
 #include <unordered_set>
 #include <vector>
 
+#include "ActivityTraceSession.h"
+#include "IterationSampler.h"
+#include "NetFilter.h"
 #include "ThreadName.h"
 #include "TraceSpan.h"
+#include "VersionedSnapshot.h"
+#include "WarmupMonitor.h"
 #include "libkineto.h"
 #include "output_base.h"
 
@@ -42,6 +49,12 @@ class ActivityProfiler {
     return currentRunloopState_ != RunloopState::WaitForRequest;
   }
 
+  // True when the collected trace is ready to be detached and processed,
+  // which the next runloop step does unless done by the caller.
+  bool isProcessingTrace() const {
+    return currentRunloopState_ == RunloopState::ProcessTrace;
+  }
+
   // Invoke at a regular interval to perform profiling activities.
   // When not active, an interval of 1-5 seconds is probably fine,
   // depending on required warm-up time and delayed start time.
@@ -56,6 +69,11 @@ class ActivityProfiler {
     logger_ = logger;
   }
 
+  // Invoked when an external event requires a runloop step as soon as
+  // possible, e.g. when the iteration target is reached or the GPU
+  // buffer limit is exceeded. Set before the profiler is used.
+  void setWakeupCallback(std::function<void()> callback);
+
   // Synchronous control API
   void startTrace(
       const std::chrono::time_point<std::chrono::system_clock>& now) {
@@ -68,10 +86,16 @@ class ActivityProfiler {
     stopTraceInternal(now);
   }
 
-  // Process CPU and GPU traces
-  void processTrace(ActivityLogger& logger) {
+  // Detach the collected trace from the profiler, which is then reset
+  // and ready for the next request. Call when the trace is stopped.
+  std::unique_ptr<ActivityTraceSession> detachSession() {
     std::lock_guard<std::mutex> guard(mutex_);
-    processTraceInternal(logger);
+    return detachSessionInternal();
+  }
+
+  // Process CPU and GPU traces, without blocking other calls
+  void processTrace(ActivityLogger& logger) {
+    detachSession()->process(logger);
   }
 
   void reset() {
@@ -79,6 +103,12 @@ class ActivityProfiler {
     resetInternal();
   }
 
+  // Invoked on the client thread at the step boundaries requested with
+  // LibkinetoApi::setNextStepEvent(), to start and stop step based traces
+  void step(
+      int64_t stepCount,
+      const std::chrono::time_point<std::chrono::system_clock>& now);
+
   // Set up profiler as specified in config.
   void configure(
       const Config& config,
@@ -89,53 +119,14 @@ class ActivityProfiler {
       std::unique_ptr<libkineto::CpuTraceBuffer> cpuTrace);
 
   // Registered with external API so that CPU-side tracer can filter which nets
-  // to trace
-  bool applyNetFilter(const std::string& name) {
-    std::lock_guard<std::mutex> guard(mutex_);
-    return applyNetFilterInternal(name);
-  }
-
-  bool applyNetFilterInternal(const std::string& name);
+  // to trace. Lock free, and cached per thread for each net name.
+  bool applyNetFilter(const std::string& name);
 
   Config& config() {
     return *config_;
   }
 
  private:
-  class ExternalEventMap {
-   public:
-    const libkineto::ClientTraceActivity& operator[](uint32_t id);
-    void insertEvent(const libkineto::ClientTraceActivity* op);
-
-    void addCorrelation(uint64_t external_id, uint32_t cuda_id) {
-      correlationMap_[cuda_id] = external_id;
-    }
-
-    void clear() {
-      events_.clear();
-      correlationMap_.clear();
-    }
-
-   private:
-    // Map extern correlation ID to Operator info.
-    // This is a map of regular pointers which is generally a bad idea,
-    // but this class also fully owns the objects it is pointing to so
-    // it's not so bad. This is done for performance reasons and is an
-    // implementation detail of this class that might change.
-    std::unordered_map<uint64_t, const libkineto::ClientTraceActivity*>
-        events_;
-
-    // Cuda correlation id -> external correlation id
-    // CUPTI provides a mechanism for correlating Cuda events to arbitrary
-    // external events, e.g.operator events from Caffe2.
-    // It also marks GPU activities with the Cuda event correlation ID.
-    // So by connecting the two, we get the complete picture.
-    std::unordered_map<
-        uint32_t, // Cuda correlation ID
-        uint64_t> // External correlation ID
-        correlationMap_;
-  };
-
   // data structure to collect cuptiActivityFlushAll() latency overhead
   struct profilerOverhead {
     int64_t overhead;
@@ -145,20 +136,32 @@ class ActivityProfiler {
   void startTraceInternal(
       const std::chrono::time_point<std::chrono::system_clock>& now);
 
+  void transferCpuTraceInternal(
+      std::unique_ptr<libkineto::CpuTraceBuffer> cpuTrace);
+
+  void stepInternal(
+      int64_t stepCount,
+      const std::chrono::time_point<std::chrono::system_clock>& now);
+
+  // Callback for a wakeup requested while holding the lock, if any.
+  // It is invoked after releasing the lock.
+  std::function<void()> takeWakeup();
+
   void stopTraceInternal(
       const std::chrono::time_point<std::chrono::system_clock>& now);
 
-  void processTraceInternal(ActivityLogger& logger);
+  std::unique_ptr<ActivityTraceSession> detachSessionInternal();
 
   void resetInternal();
 
-  void finalizeTrace(const Config& config, ActivityLogger& logger);
+  // Returns true if GPU activities were already enabled and warmed up
+  bool enableGpuTracing();
 
-  // Process a single CPU trace
-  void processCpuTrace(
-      libkineto::CpuTraceBuffer& cpuTrace,
-      ActivityLogger& logger,
-      bool logNet);
+  // Sample tracing overhead at a warmup step, and start tracing
+  // right away if it has stabilized
+  void checkWarmupOverhead(
+      const std::chrono::time_point<std::chrono::system_clock>& now,
+      std::chrono::microseconds flushLatency);
 
   bool inline passesGpuOpCountThreshold(
       const libkineto::CpuTraceBuffer& cpuTrace) {
@@ -166,48 +169,19 @@ class ActivityProfiler {
         cpuTrace.gpuOpCount >= netGpuOpCountThreshold_;
   }
 
-  // Record client trace span for subsequent lookups from activities
-  // Also creates a corresponding GPU-side span.
-  using CpuGpuSpanPair = std::pair<TraceSpan, TraceSpan>;
-  CpuGpuSpanPair& recordTraceSpan(TraceSpan& span, int gpuOpCount);
-
   // Returns true if net name is to be tracked for a specified number of
   // iterations.
   bool iterationTargetMatch(
       const libkineto::CpuTraceBuffer& trace);
 
+  // With an iteration stride, returns true if the trace should be kept,
+  // and records GPU activities only around sampled iterations.
+  bool sampleIteration(const libkineto::CpuTraceBuffer& trace);
+  void setGpuSampling(bool enable);
+
   // net name to id
   int netId(const std::string& netName);
 
-  // Process generic CUPTI activity
-  void handleCuptiActivity(const CUpti_Activity* record, ActivityLogger* logger);
-
-  // Process specific GPU activity types
-  void updateGpuNetSpan(const TraceActivity& gpuOp);
-  bool outOfRange(const TraceActivity& act);
-  void handleCorrelationActivity(
-      const CUpti_ActivityExternalCorrelation* correlation);
-  void handleRuntimeActivity(
-      const CUpti_ActivityAPI* activity, ActivityLogger* logger);
-  void handleGpuActivity(const TraceActivity& act, ActivityLogger* logger);
-  template <class T>
-  void handleGpuActivity(const T* act, ActivityLogger* logger);
-
-  // Is logging disabled for this event?
-  // Logging can be disabled due to operator count, net name filter etc.
-  inline bool loggingDisabled(const libkineto::TraceActivity& act) {
-    const auto& it = clientActivityTraceMap_.find(act.correlationId());
-    return it != clientActivityTraceMap_.end() &&
-        disabledTraceSpans_.find(it->second->first.name) !=
-        disabledTraceSpans_.end();
-  }
-
-  inline void recordThreadName(pthread_t pthreadId) {
-    if (threadNames_.find(pthreadId) == threadNames_.end()) {
-      threadNames_[pthreadId] = getThreadName(pthreadId);
-    }
-  }
-
   void resetTraceData();
 
   void addOverheadSample(profilerOverhead& counter, int64_t overhead) {
@@ -241,27 +215,6 @@ class ActivityProfiler {
   std::chrono::time_point<std::chrono::system_clock> profileStartTime_;
   std::chrono::time_point<std::chrono::system_clock> profileEndTime_;
 
-  ExternalEventMap externalEvents_;
-
-  // All recorded trace spans, both CPU and GPU
-  // Trace Id -> list of iterations.
-  // Using map of lists for the iterator semantics, since we are recording
-  // pointers to the elements in this structure.
-  std::map<std::string, std::list<CpuGpuSpanPair>> traceSpans_;
-
-  // Maintain a map of client trace activity to trace span.
-  // Maps correlation id -> TraceSpan* held by traceSpans_.
-  std::unordered_map<int64_t, CpuGpuSpanPair*> clientActivityTraceMap_;
-
-  // Cache thread names for pthread ids
-  std::unordered_map<uint64_t, std::string> threadNames_;
-
-  // Which trace spans are disabled. Together with the operator -> net id map
-  // this allows us to determine whether a GPU or CUDA API event should
-  // be included in the trace.
-  // If a CUDA event cannot be mapped to a net it will always be included.
-  std::unordered_set<std::string> disabledTraceSpans_;
-
   // the overhead to flush the activity buffer
   profilerOverhead flushOverhead_;
   // the overhead to enable/disable activity tracking
@@ -269,6 +222,10 @@ class ActivityProfiler {
 
   bool cpuOnly_{false};
 
+  std::function<void()> wakeupCallback_;
+  // Set under the lock when the runloop should be woken up
+  bool wakeupRequested_{false};
+
   // ***************************************************************************
   // Below state is shared with external threads.
   // These need to either be atomic, accessed under lock or only used
@@ -291,14 +248,34 @@ class ActivityProfiler {
 
   // net name -> iteration count
   std::map<std::string, int> netIterationCountMap_;
-  // Sub-strings used to filter nets by name
-  std::vector<std::string> netNameFilter_;
+  // Sub-strings used to filter nets by name.
+  // Replaced by configure, and read by client threads without locking.
+  VersionedSnapshot<NetFilter> netFilter_{std::make_shared<NetFilter>()};
   // Filter by GPU op count
   int netGpuOpCountThreshold_{0};
   // Net used to track iterations
   std::string netIterationsTarget_;
   // Number of iterations to track
   int netIterationsTargetCount_{0};
+  // Samples iterations of the target net when tracing with a stride
+  IterationSampler iterationSampler_;
+  int sampledIterations_{0};
+  // Are GPU activities recorded for the current iteration
+  bool gpuSampling_{false};
+
+  // Step based tracing - collect from the start step until the end step,
+  // as counted by LibkinetoApi::step(). Steps are reached on client threads.
+  bool stepTracing_{false};
+  bool stepsGpuDeferred_{false};
+  int64_t stepsWarmupStart_{0};
+  int64_t stepsCollectStart_{0};
+  int64_t stepsCollectEnd_{0};
+  std::chrono::time_point<std::chrono::system_clock> stepsDeadline_;
+
+  // Ends warmup early once overhead is stable, if enabled
+  std::unique_ptr<WarmupMonitor> warmupMonitor_;
+  std::chrono::time_point<std::chrono::system_clock> lastWarmupStepTime_;
+  int64_t lastWarmupCompletedBytes_{0};
 
   // Flag used to stop tracing from external api callback.
   // Needs to be atomic since it's set from a different thread.
@@ -12,9 +12,11 @@
 
 #include "ActivityTrace.h"
 #include "CuptiActivityInterface.h"
+#include "Scheduler.h"
 #include "ThreadName.h"
 #include "output_json.h"
 #include "output_membuf.h"
+#include "output_shm.h"
 
 #include "Logger.h"
 
@@ -24,19 +26,32 @@ namespace KINETO_NAMESPACE {
 
 constexpr milliseconds kDefaultInactiveProfilerIntervalMsecs(1000);
 constexpr milliseconds kDefaultActiveProfilerIntervalMsecs(200);
+constexpr size_t kMaxQueuedTraceRequests(8);
 
-ActivityProfilerController::ActivityProfilerController(bool cpuOnly) {
+ActivityProfilerController::ActivityProfilerController(bool cpuOnly)
+    : traceRequests_(kMaxQueuedTraceRequests) {
   profiler_ = std::make_unique<ActivityProfiler>(
       CuptiActivityInterface::singleton(), cpuOnly);
+  profiler_->setWakeupCallback([this]() { wakeup(); });
 }
 
 ActivityProfilerController::~ActivityProfilerController() {
-  if (profilerThread_) {
-    // signaling termination of the profiler loop
-    stopRunloop_ = true;
-    profilerThread_->join();
-    delete profilerThread_;
-    profilerThread_ = nullptr;
+  // signaling termination of the profiler loop
+  stopRunloop_ = true;
+  profiler_->setWakeupCallback(nullptr);
+  uint64_t taskId;
+  {
+    std::lock_guard<std::mutex> lock(asyncConfigLock_);
+    taskId = taskId_;
+  }
+  if (taskId) {
+    Scheduler::instance().cancel(taskId);
+  }
+  if (processingThread_.joinable()) {
+    processingThread_.join();
+  }
+  if (backgroundLogger_) {
+    backgroundLogger_->flush();
   }
   VLOG(0) << "Stopped activity profiler";
 }
@@ -58,7 +73,17 @@ static std::unique_ptr<ActivityLogger> makeLogger(const Config& config) {
   if (loggerFactory()) {
     return loggerFactory()(config);
   }
-  return std::make_unique<ChromeTraceLogger>(config.activitiesLogFile());
+  if (config.activitiesHostAggregation()) {
+    auto logger = SharedMemoryTraceLogger::create(config);
+    if (logger) {
+      return std::move(logger);
+    }
+    LOG(WARNING) << "Host trace aggregation failed, logging trace locally";
+  }
+  return std::make_unique<ChromeTraceLogger>(
+      config.activitiesLogFile(),
+      /*formatThreads=*/0,
+      config.activitiesTimeOrdered());
 }
 
 static milliseconds profilerInterval(bool profilerActive) {
@@ -66,54 +91,193 @@ static milliseconds profilerInterval(bool profilerActive) {
                         : kDefaultInactiveProfilerIntervalMsecs;
 }
 
-void ActivityProfilerController::profilerLoop() {
-  setThreadName("Kineto Activity Profiler");
-  VLOG(0) << "Entering activity profiler loop";
-
-  auto now = system_clock::now();
-  auto next_wakeup_time = now + profilerInterval(false);
-
-  while (!stopRunloop_) {
-    now = system_clock::now();
-
-    while (now < next_wakeup_time) {
-      /* sleep override */
-      std::this_thread::sleep_for(next_wakeup_time - now);
-      now = system_clock::now();
+time_point<system_clock> ActivityProfilerController::profilerStep(
+    const time_point<system_clock>& now,
+    uint64_t generation) {
+  if (stopRunloop_) {
+    return time_point<system_clock>::max();
+  }
+  {
+    // A wakeup that raced with retiring this task keeps it scheduled
+    // after a new task has taken over. Let it finish quietly.
+    std::lock_guard<std::mutex> lock(asyncConfigLock_);
+    if (generation != taskGeneration_) {
+      return time_point<system_clock>::max();
     }
-    if (!profiler_->isActive()) {
-      std::lock_guard<std::mutex> lock(asyncConfigLock_);
-      if (asyncRequestConfig_) {
-        LOG(INFO) << "Received on-demand activity trace request";
-        logger_ = makeLogger(*asyncRequestConfig_);
-        profiler_->setLogger(logger_.get());
-        profiler_->configure(*asyncRequestConfig_, now);
-        asyncRequestConfig_ = nullptr;
+  }
+  if (!processing_ && processingThread_.joinable()) {
+    processingThread_.join();
+  }
+  if (!profiler_->isActive()) {
+    std::lock_guard<std::mutex> lock(asyncConfigLock_);
+    auto config = traceRequests_.pop(now);
+    if (config) {
+      LOG(INFO) << "Starting on-demand activity trace request";
+      logger_ = makeLogger(*config);
+      profiler_->setLogger(logger_.get());
+      profiler_->configure(*config, now);
+    } else if (!startBackgroundTrace(now)) {
+      if (!backgroundConfig_) {
+        // Nothing to do until the next request, which schedules a new task
+        taskId_ = 0;
+        return time_point<system_clock>::max();
       }
+      return nextBackgroundTime_;
     }
+  }
 
-    while (next_wakeup_time < now) {
-      next_wakeup_time += kDefaultActiveProfilerIntervalMsecs;
-    }
+  while (nextWakeupTime_ <= now) {
+    nextWakeupTime_ += kDefaultActiveProfilerIntervalMsecs;
+  }
 
-    if (profiler_->isActive()) {
-      next_wakeup_time = profiler_->performRunLoopStep(now, next_wakeup_time);
-      VLOG(1) << "Profiler loop: "
-          << duration_cast<milliseconds>(system_clock::now() - now).count()
-          << "ms";
+  if (profiler_->isProcessingTrace()) {
+    if (processing_) {
+      // Woken up by the processing thread when the previous trace is done
+      return now + profilerInterval(false);
     }
+    if (processingThread_.joinable()) {
+      processingThread_.join();
+    }
+    // The profiler is ready for the next request as soon as the trace
+    // is detached. A logger owned by this request goes with the trace.
+    auto session = profiler_->detachSession();
+    std::unique_ptr<ActivityLogger> logger;
+    if (logger_ && logger_.get() == session->logger()) {
+      logger = std::move(logger_);
+    }
+    processing_ = true;
+    processingThread_ = std::thread(
+        &ActivityProfilerController::processTrace,
+        this,
+        std::move(session),
+        std::move(logger));
+    return now;
+  }
+
+  if (profiler_->isActive()) {
+    nextWakeupTime_ = profiler_->performRunLoopStep(now, nextWakeupTime_);
+    VLOG(1) << "Profiler loop: "
+        << duration_cast<milliseconds>(system_clock::now() - now).count()
+        << "ms";
   }
+  return nextWakeupTime_;
+}
 
-  VLOG(0) << "Exited activity profiling loop";
+void ActivityProfilerController::processTrace(
+    std::unique_ptr<ActivityTraceSession> session,
+    std::unique_ptr<ActivityLogger> /* logger */) {
+  setThreadName("Kineto Trace Processing");
+  auto start = system_clock::now();
+  if (session->logger()) {
+    std::lock_guard<std::mutex> guard(processingMutex_);
+    session->process(*session->logger());
+  } else {
+    LOG(WARNING) << "No logger set - discarding trace";
+  }
+  VLOG(1) << "Trace processing: "
+      << duration_cast<milliseconds>(system_clock::now() - start).count()
+      << "ms";
+  processing_ = false;
+  // Pick up any request received while processing
+  wakeup();
 }
 
-void ActivityProfilerController::scheduleTrace(const Config& config) {
+void ActivityProfilerController::wakeup() {
+  // Under the same lock as retiring the task, so a retired id is never
+  // rescheduled
   std::lock_guard<std::mutex> lock(asyncConfigLock_);
-  asyncRequestConfig_ = config.clone();
-  // start a profilerLoop() thread to handle request
-  if (!profilerThread_) {
-    profilerThread_ =
-        new std::thread(&ActivityProfilerController::profilerLoop, this);
+  if (taskId_) {
+    Scheduler::instance().reschedule(taskId_, system_clock::now());
+  }
+}
+
+bool ActivityProfilerController::startBackgroundTrace(
+    const time_point<system_clock>& now) {
+  if (!backgroundConfig_ || now < nextBackgroundTime_) {
+    return false;
+  }
+  auto config = backgroundConfig_->clone();
+  config->setActivitiesOnDemandDuration(
+      config->activitiesBackgroundDuration());
+  // Warm up before the first trace only. Later traces start right away,
+  // since the one-time CUPTI setup cost has already been paid.
+  if (backgroundWarmedUp_) {
+    config->setActivitiesWarmupDuration(seconds(0));
+  }
+  backgroundWarmedUp_ = true;
+  if (!backgroundLogger_) {
+    backgroundLogger_ = std::make_unique<AggregateTraceLogger>(
+        config->activitiesBackgroundSummaryFile(),
+        config->activitiesBackgroundFlushPeriod());
+  }
+  VLOG(0) << "Starting background activity trace";
+  profiler_->setLogger(backgroundLogger_.get());
+  profiler_->configure(*config, now);
+  nextBackgroundTime_ = now + config->activitiesBackgroundPeriod();
+  return true;
+}
+
+void ActivityProfilerController::scheduleStep(
+    const time_point<system_clock>& time) {
+  if (taskId_) {
+    Scheduler::instance().reschedule(taskId_, time);
+  } else {
+    nextWakeupTime_ = time;
+    uint64_t generation = ++taskGeneration_;
+    taskId_ = Scheduler::instance().schedule(
+        "activity profiler",
+        time,
+        [this, generation](const time_point<system_clock>& now) {
+          return profilerStep(now, generation);
+        });
+  }
+}
+
+bool ActivityProfilerController::scheduleTrace(
+    const Config& config,
+    TraceRequestSource source) {
+  std::lock_guard<std::mutex> lock(asyncConfigLock_);
+  auto now = system_clock::now();
+  LOG(INFO) << "Received on-demand activity trace request from "
+            << traceRequestSourceName(source);
+  auto result = traceRequests_.push(config, source, now);
+  if (result == TraceRequestQueue::Result::Rejected) {
+    return false;
+  }
+  // Handle the request right away, starting the profiler task if needed
+  scheduleStep(now);
+  return true;
+}
+
+bool ActivityProfilerController::acceptsTraceRequest(
+    TraceRequestSource source) {
+  std::lock_guard<std::mutex> lock(asyncConfigLock_);
+  return traceRequests_.accepts(source);
+}
+
+TraceRequestQueue::Status ActivityProfilerController::traceRequestStatus() {
+  std::lock_guard<std::mutex> lock(asyncConfigLock_);
+  return traceRequests_.status();
+}
+
+void ActivityProfilerController::setBackgroundConfig(const Config& config) {
+  std::lock_guard<std::mutex> lock(asyncConfigLock_);
+  if (config.activitiesBackgroundPeriod().count() <= 0) {
+    if (backgroundConfig_) {
+      LOG(INFO) << "Background activity tracing disabled";
+    }
+    backgroundConfig_ = nullptr;
+    return;
+  }
+  bool start = !backgroundConfig_;
+  backgroundConfig_ = config.clone();
+  if (start) {
+    LOG(INFO) << "Tracing " << config.activitiesBackgroundDuration().count()
+              << "ms every " << config.activitiesBackgroundPeriod().count()
+              << "s in the background, summary in "
+              << config.activitiesBackgroundSummaryFile();
+    nextBackgroundTime_ = system_clock::now();
+    scheduleStep(nextBackgroundTime_);
   }
 }
 
@@ -141,8 +305,10 @@ std::unique_ptr<ActivityTraceInterface> ActivityProfilerController::stopTrace()
   }
   profiler_->stopTrace(std::chrono::system_clock::now());
   auto logger = std::make_unique<MemoryTraceLogger>(profiler_->config());
-  profiler_->processTrace(*logger);
-  profiler_->reset();
+  auto session = profiler_->detachSession();
+  // Processed on this thread, after any trace on the processing thread
+  std::lock_guard<std::mutex> guard(processingMutex_);
+  session->process(*logger);
   return std::make_unique<ActivityTrace>(std::move(logger));
 }
 
@@ -8,12 +8,16 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "ActivityProfiler.h"
 #include "ActivityProfilerInterface.h"
 #include "ActivityTraceInterface.h"
+#include "TraceRequestQueue.h"
+#include "output_aggregate.h"
 
 namespace KINETO_NAMESPACE {
 
@@ -33,7 +37,18 @@ class ActivityProfilerController {
 
   static void setLoggerFactory(const ActivityLoggerFactory& factory);
 
-  void scheduleTrace(const Config& config);
+  // Queue an on-demand trace request. Returns false if it was rejected.
+  bool scheduleTrace(
+      const Config& config,
+      TraceRequestSource source = TraceRequestSource::Api);
+
+  bool acceptsTraceRequest(TraceRequestSource source);
+
+  TraceRequestQueue::Status traceRequestStatus();
+
+  // Trace periodically in the background when enabled in the config.
+  // On-demand requests take priority over background traces.
+  void setBackgroundConfig(const Config& config);
 
   void prepareTrace(const Config& config);
 
@@ -56,14 +71,55 @@ class ActivityProfilerController {
     return profiler_->transferCpuTrace(std::move(cpuTrace));
   }
 
- private:
-  void profilerLoop();
+  void step(int64_t stepCount) {
+    profiler_->step(stepCount, std::chrono::system_clock::now());
+  }
 
-  std::unique_ptr<Config> asyncRequestConfig_;
+ private:
+  // Periodic task - returns time of next step
+  std::chrono::time_point<std::chrono::system_clock> profilerStep(
+      const std::chrono::time_point<std::chrono::system_clock>& now,
+      uint64_t generation);
+  // Process a detached trace, keeping its logger alive until done
+  void processTrace(
+      std::unique_ptr<ActivityTraceSession> session,
+      std::unique_ptr<ActivityLogger> logger);
+  // Run the next step right away
+  void wakeup();
+  // Start the profiler task unless already running.
+  // Call with asyncConfigLock_ held.
+  void scheduleStep(
+      const std::chrono::time_point<std::chrono::system_clock>& time);
+  // Configure the profiler for a background trace if one is due.
+  // Call with asyncConfigLock_ held.
+  bool startBackgroundTrace(
+      const std::chrono::time_point<std::chrono::system_clock>& now);
+
+  // On-demand requests waiting for the profiler, protected by asyncConfigLock_
+  TraceRequestQueue traceRequests_;
   std::mutex asyncConfigLock_;
   std::unique_ptr<ActivityProfiler> profiler_;
   std::unique_ptr<ActivityLogger> logger_;
-  std::thread* profilerThread_{nullptr};
+  // Background tracing state, protected by asyncConfigLock_.
+  // The logger aggregates all background traces and outlives them.
+  std::unique_ptr<Config> backgroundConfig_;
+  std::unique_ptr<AggregateTraceLogger> backgroundLogger_;
+  std::chrono::time_point<std::chrono::system_clock> nextBackgroundTime_;
+  bool backgroundWarmedUp_{false};
+  // Zero when no task is scheduled. Protected by asyncConfigLock_.
+  uint64_t taskId_{0};
+  // Incremented for each new task, so a retired one can tell it is stale.
+  // Protected by asyncConfigLock_.
+  uint64_t taskGeneration_{0};
+  std::chrono::time_point<std::chrono::system_clock> nextWakeupTime_;
+  // Trace processing is slow, so it is run on a separate thread
+  // to avoid delaying other scheduled tasks and the next trace.
+  // Traces are processed one at a time.
+  std::thread processingThread_;
+  std::atomic_bool processing_{false};
+  // Held while a trace is processed, on the processing thread or by a
+  // synchronous stopTrace(), so that traces are processed one at a time
+  std::mutex processingMutex_;
   std::atomic_bool stopRunloop_{false};
 };
 
@@ -9,6 +9,7 @@
 
 #include "ActivityProfilerController.h"
 #include "Config.h"
+#include "ConfigLoader.h"
 #include "CuptiActivityInterface.h"
 
 namespace KINETO_NAMESPACE {
@@ -16,6 +17,11 @@ namespace KINETO_NAMESPACE {
 void ActivityProfilerProxy::init() {
   if (!controller_) {
     controller_ = new ActivityProfilerController(cpuOnly_);
+    if (!cpuOnly_) {
+      // Later updates are forwarded by the config loader
+      controller_->setBackgroundConfig(
+          *ConfigLoader::instance().getConfigCopy());
+    }
   }
 }
 
@@ -29,8 +35,21 @@ void ActivityProfilerProxy::scheduleTrace(const std::string& configStr) {
   controller_->scheduleTrace(config);
 }
 
-void ActivityProfilerProxy::scheduleTrace(const Config& config) {
-  controller_->scheduleTrace(config);
+bool ActivityProfilerProxy::scheduleTrace(
+    const Config& config, TraceRequestSource source) {
+  return controller_->scheduleTrace(config, source);
+}
+
+bool ActivityProfilerProxy::acceptsTraceRequest(TraceRequestSource source) {
+  return controller_->acceptsTraceRequest(source);
+}
+
+TraceRequestQueue::Status ActivityProfilerProxy::traceRequestStatus() {
+  return controller_->traceRequestStatus();
+}
+
+void ActivityProfilerProxy::setBackgroundConfig(const Config& config) {
+  controller_->setBackgroundConfig(config);
 }
 
 void ActivityProfilerProxy::prepareTrace(
@@ -68,6 +87,10 @@ void ActivityProfilerProxy::transferCpuTrace(
   controller_->transferCpuTrace(std::move(traceBuffer));
 }
 
+void ActivityProfilerProxy::step(int64_t stepCount) {
+  controller_->step(stepCount);
+}
+
 bool ActivityProfilerProxy::enableForRegion(const std::string& match) {
   return controller_->traceInclusionFilter(match);
 }
@@ -15,6 +15,7 @@
 
 #include "ActivityType.h"
 #include "TraceActivity.h"
+#include "TraceRequestQueue.h"
 
 namespace libkineto {
   class CpuTraceBuffer;
@@ -41,7 +42,15 @@ class ActivityProfilerProxy : public ActivityProfilerInterface {
   bool isActive() override;
 
   void scheduleTrace(const std::string& configStr) override;
-  void scheduleTrace(const Config& config);
+  // Returns false if the request was rejected
+  bool scheduleTrace(const Config& config, TraceRequestSource source);
+
+  // True if a trace request from source would be queued
+  bool acceptsTraceRequest(TraceRequestSource source);
+  TraceRequestQueue::Status traceRequestStatus();
+
+  // Update periodic background tracing settings
+  void setBackgroundConfig(const Config& config);
 
   void prepareTrace(const std::set<ActivityType>& activityTypes) override;
   void startTrace() override;
@@ -53,6 +62,8 @@ class ActivityProfilerProxy : public ActivityProfilerInterface {
   void transferCpuTrace(
      std::unique_ptr<CpuTraceBuffer> traceBuffer) override;
 
+  void step(int64_t stepCount) override;
+
   bool enableForRegion(const std::string& match) override;
 
  private:
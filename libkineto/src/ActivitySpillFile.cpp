@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ActivitySpillFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <system_error>
+#include <vector>
+
+#include "Logger.h"
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+ActivitySpillFile::ActivitySpillFile(const std::string& dir, size_t size) {
+  std::string path = dir + "/kineto_spill_XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  fd_ = mkostemp(name.data(), O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "Failed to create " + path);
+  }
+  unlink(name.data());
+  if (!reserve(size)) {
+    int err = errno;
+    ::close(fd_);
+    throw std::system_error(
+        err, std::generic_category(), "Failed to preallocate spill file");
+  }
+}
+
+ActivitySpillFile::~ActivitySpillFile() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool ActivitySpillFile::reserve(size_t size) {
+  if (size <= capacity_) {
+    return true;
+  }
+  size_t capacity = std::max(capacity_ * 2, size);
+  // Allocate blocks up front, so that appends do not
+  // need to update file metadata.
+  int err = posix_fallocate(fd_, 0, capacity);
+  if (err != 0) {
+    errno = err;
+    return false;
+  }
+  capacity_ = capacity;
+  return true;
+}
+
+int64_t ActivitySpillFile::append(const uint8_t* data, size_t size) {
+  if (fd_ < 0) {
+    return -1;
+  }
+  auto start = steady_clock::now();
+  if (!reserve(size_ + size)) {
+    PLOG(ERROR) << "Failed to grow spill file to " << size_ + size << " bytes";
+    return -1;
+  }
+  size_t written = 0;
+  while (written < size) {
+    ssize_t res = pwrite(fd_, data + written, size - written, size_ + written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "Failed to write spill file";
+      return -1;
+    }
+    written += res;
+  }
+  int64_t offset = size_;
+  size_ += size;
+  bufferCount_++;
+  writeTime_ += duration_cast<microseconds>(steady_clock::now() - start);
+  return offset;
+}
+
+void ActivitySpillFile::clear() {
+  // Keep the preallocated space for reuse
+  size_ = 0;
+  bufferCount_ = 0;
+  writeTime_ = microseconds(0);
+}
+
+std::shared_ptr<uint8_t> ActivitySpillFile::map() {
+  if (fd_ < 0 || size_ == 0) {
+    return nullptr;
+  }
+  // Private mapping, since records may be modified while processing
+  void* addr =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+  if (addr == MAP_FAILED) {
+    PLOG(ERROR) << "Failed to map spill file";
+    return nullptr;
+  }
+  madvise(addr, size_, MADV_SEQUENTIAL);
+  // The mapping keeps the file contents alive, and the file
+  // must not be modified while mapped.
+  ::close(fd_);
+  fd_ = -1;
+  size_t size = size_;
+  return std::shared_ptr<uint8_t>(
+      static_cast<uint8_t*>(addr),
+      [size](uint8_t* p) { munmap(p, size); });
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace KINETO_NAMESPACE {
+
+// Scratch file for activity buffers that do not fit in memory.
+// Buffers are appended sequentially, and mapped back into memory
+// when the trace is processed. The file is unlinked on creation,
+// so it is removed when the last reference to it goes away.
+class ActivitySpillFile {
+ public:
+  // Preallocates size bytes in a file created in dir.
+  // Throws std::system_error if the file cannot be created.
+  ActivitySpillFile(const std::string& dir, size_t size);
+  ~ActivitySpillFile();
+  ActivitySpillFile(const ActivitySpillFile&) = delete;
+  ActivitySpillFile& operator=(const ActivitySpillFile&) = delete;
+
+  // Returns the offset of the appended data, or -1 on failure
+  int64_t append(const uint8_t* data, size_t size);
+
+  // Discard everything appended so far
+  void clear();
+
+  // Map the appended data into memory. The mapping remains valid
+  // after this object is destroyed. No more data can be appended.
+  // Returns nullptr on failure.
+  std::shared_ptr<uint8_t> map();
+
+  // Number of bytes appended
+  size_t size() const {
+    return size_;
+  }
+
+  int bufferCount() const {
+    return bufferCount_;
+  }
+
+  // Time spent appending
+  std::chrono::microseconds writeTime() const {
+    return writeTime_;
+  }
+
+ private:
+  // Grow the preallocated space to fit size bytes
+  bool reserve(size_t size);
+
+  int fd_{-1};
+  size_t size_{0};
+  size_t capacity_{0};
+  int bufferCount_{0};
+  std::chrono::microseconds writeTime_{0};
+};
+
+} // namespace KINETO_NAMESPACE
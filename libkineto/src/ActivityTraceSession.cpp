@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ActivityTraceSession.h"
+
+#include <fmt/format.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "Config.h"
+#include "CuptiActivity.h"
+#include "CuptiActivity.tpp"
+#include "CuptiActivityInterface.h"
+#include "RadixSort.h"
+
+#include "Logger.h"
+
+using namespace libkineto;
+using std::string;
+
+namespace KINETO_NAMESPACE {
+
+ActivityTraceSession::ActivityTraceSession(
+    CuptiActivityInterface& cupti,
+    std::unique_ptr<Config> config,
+    std::unique_ptr<ActivityBuffers> traceBuffers,
+    ActivityLogger* logger,
+    bool cpuOnly)
+    : cupti_(cupti),
+      config_(std::move(config)),
+      traceBuffers_(std::move(traceBuffers)),
+      logger_(logger),
+      cpuOnly_(cpuOnly) {
+  if (!traceBuffers_) {
+    traceBuffers_ = std::make_unique<ActivityBuffers>();
+  }
+  // GPU activities are also recorded while the iteration after a sampled
+  // one runs, to catch GPU work still in flight. The CPU trace of that
+  // iteration is discarded, so records linked to no op are dropped.
+  sampledIterations_ = config_ && config_->activitiesIterationStride() > 0;
+}
+
+bool ActivityTraceSession::logNet(
+    const libkineto::CpuTraceBuffer& cpuTrace) const {
+  if (netFilter_ && !netFilter_->matches(cpuTrace.span.name)) {
+    return false;
+  }
+  bool passesGpuOpCountThreshold = cpuOnly_ || cpuTrace.gpuOpCount < 0 ||
+      cpuTrace.gpuOpCount >= netGpuOpCountThreshold_;
+  return passesGpuOpCountThreshold &&
+      cpuTrace.span.startTime < captureWindowEndTime_ &&
+      cpuTrace.span.endTime > captureWindowStartTime_;
+}
+
+void ActivityTraceSession::process(ActivityLogger& logger) {
+  LOG(INFO) << "Processing " << traceBuffers_->cpu.size()
+      << " CPU buffers";
+  VLOG(0) << "Profile time range: " << captureWindowStartTime_ << " - "
+          << captureWindowEndTime_;
+  for (auto& cpu_trace : traceBuffers_->cpu) {
+    string trace_name = cpu_trace->span.name;
+    VLOG(0) << "Processing CPU buffer for " << trace_name << " ("
+            << cpu_trace->span.iteration << ") - "
+            << cpu_trace->activities.size() << " records";
+    bool log_net = logNet(*cpu_trace);
+    VLOG(0) << "Net time range: " << cpu_trace->span.startTime << " - "
+            << cpu_trace->span.endTime;
+    VLOG(0) << "Log net: " << (log_net ? "Yes" : "No");
+    processCpuTrace(*cpu_trace, logger, log_net);
+  }
+
+  if (traceBuffers_->gpu) {
+    pruneGpuBuffers(*traceBuffers_->gpu);
+    const auto count_and_size =
+        processGpuActivities(*traceBuffers_->gpu, logger);
+    LOG(INFO) << "Processed " << count_and_size.first
+              << " GPU records (" << count_and_size.second << " bytes)";
+  }
+
+  finalizeTrace(logger);
+}
+
+ActivityTraceSession::CpuGpuSpanPair& ActivityTraceSession::recordTraceSpan(
+    TraceSpan& span, int gpuOpCount) {
+  TraceSpan gpu_span{
+      0, 0, gpuOpCount, span.iteration, span.name, "GPU: "};
+  auto& iterations = traceSpans_[span.name];
+  iterations.push_back({span, gpu_span});
+  return iterations.back();
+}
+
+void ActivityTraceSession::processCpuTrace(
+    libkineto::CpuTraceBuffer& cpuTrace,
+    ActivityLogger& logger,
+    bool logTrace) {
+  if (cpuTrace.activities.size() == 0) {
+    LOG(WARNING) << "CPU trace is empty!";
+    return;
+  }
+
+  CpuGpuSpanPair& span_pair = recordTraceSpan(cpuTrace.span, cpuTrace.gpuOpCount);
+  TraceSpan& cpu_span = span_pair.first;
+  for (auto const& act : cpuTrace.activities) {
+    VLOG(2) << act.correlationId() << ": OP " << act.opType
+            << " tid: " << act.threadId;
+    if (logTrace) {
+      logger.handleCpuActivity(act, cpu_span);
+      recordThreadName(act.threadId);
+    }
+    // Stash event so we can look it up later when processing GPU trace
+    externalEvents_.insertEvent(&act);
+    cpuOpsStartTime_ = std::min(cpuOpsStartTime_, act.timestamp());
+    cpuOpsEndTime_ =
+        std::max(cpuOpsEndTime_, act.timestamp() + act.duration());
+    clientActivityTraceMap_[act.correlationId()] = &span_pair;
+  }
+  if (logTrace) {
+    logger.handleTraceSpan(cpu_span);
+    if (cpu_span.name == netIterationsTarget_) {
+      logger.handleIterationStart(cpu_span);
+    }
+  } else {
+    disabledTraceSpans_.insert(cpu_span.name);
+  }
+}
+
+inline void ActivityTraceSession::handleCorrelationActivity(
+    const CUpti_ActivityExternalCorrelation* correlation) {
+  externalEvents_.addCorrelation(
+      correlation->externalId, correlation->correlationId);
+  VLOG(2) << correlation->correlationId
+          << ": CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION";
+}
+
+// Keeps the last of each run of equal keys.
+// Sorting is stable, so that is the one added last.
+template <class K, class V>
+static void uniqueKeepLast(std::vector<std::pair<K, V>>& items) {
+  size_t out = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (i + 1 < items.size() && items[i + 1].first == items[i].first) {
+      continue;
+    }
+    items[out++] = items[i];
+  }
+  items.resize(out);
+}
+
+void ActivityTraceSession::ExternalEventMap::sort() {
+  if (sorted_) {
+    return;
+  }
+  radixSort(events_, [](const decltype(events_)::value_type& e) {
+    return e.first;
+  });
+  uniqueKeepLast(events_);
+  radixSort(correlations_, [](const decltype(correlations_)::value_type& c) {
+    return c.first;
+  });
+  uniqueKeepLast(correlations_);
+  sorted_ = true;
+}
+
+std::vector<const libkineto::ClientTraceActivity*>
+ActivityTraceSession::ExternalEventMap::link(
+    const std::vector<uint32_t>& cudaIds) {
+  static const libkineto::ClientTraceActivity nullOp_{};
+  std::vector<const libkineto::ClientTraceActivity*> ops(
+      cudaIds.size(), &nullOp_);
+  sort();
+
+  // Join record cuda ids with correlations
+  std::vector<std::pair<uint32_t, uint32_t>> records;
+  records.reserve(cudaIds.size());
+  for (uint32_t i = 0; i < cudaIds.size(); i++) {
+    records.emplace_back(cudaIds[i], i);
+  }
+  radixSort(records, [](const std::pair<uint32_t, uint32_t>& r) {
+    return r.first;
+  });
+  std::vector<std::pair<uint64_t, uint32_t>> externalIds;
+  externalIds.reserve(records.size());
+  auto correlation = correlations_.begin();
+  for (const auto& record : records) {
+    while (correlation != correlations_.end() &&
+           correlation->first < record.first) {
+      ++correlation;
+    }
+    if (correlation != correlations_.end() &&
+        correlation->first == record.first) {
+      externalIds.emplace_back(correlation->second, record.second);
+    }
+  }
+
+  // Join external ids with CPU ops
+  radixSort(externalIds, [](const std::pair<uint64_t, uint32_t>& e) {
+    return e.first;
+  });
+  auto event = events_.begin();
+  for (const auto& externalId : externalIds) {
+    while (event != events_.end() && event->first < externalId.first) {
+      ++event;
+    }
+    if (event != events_.end() && event->first == externalId.first) {
+      ops[externalId.second] = event->second;
+    }
+  }
+  return ops;
+}
+
+static uint64_t usecs(uint64_t nsecs) {
+  return nsecs / 1000;
+}
+
+inline bool ActivityTraceSession::outOfRange(const TraceActivity& act) {
+  return act.timestamp() < captureWindowStartTime_ ||
+      (act.timestamp() + act.duration()) > captureWindowEndTime_;
+}
+
+// Records in a buffer are only logged if they are in the capture window,
+// or linked to a CPU op in the trace, which started before the record.
+// So a buffer can be dropped if it ended before both of these.
+// GPU ops may execute long after the CPU op that launched them, so
+// buffers after the window can only be dropped if they have no GPU ops.
+bool ActivityTraceSession::outOfRange(const CuptiActivityBufferIndex& index) {
+  if (!index.hasTimestamps()) {
+    return false;
+  }
+  if (index.maxEnd < std::min(captureWindowStartTime_, cpuOpsStartTime_)) {
+    return true;
+  }
+  return index.gpuCount == 0 &&
+      index.minStart > std::max(captureWindowEndTime_, cpuOpsEndTime_);
+}
+
+void ActivityTraceSession::pruneGpuBuffers(
+    std::list<CuptiActivityBuffer>& buffers) {
+  std::list<CuptiActivityBuffer> pruned;
+  std::list<CuptiActivityBuffer> correlations;
+  for (auto it = buffers.begin(); it != buffers.end();) {
+    auto next = std::next(it);
+    if (outOfRange(it->index)) {
+      auto& dest = it->index.correlationCount > 0 ? correlations : pruned;
+      dest.splice(dest.end(), buffers, it);
+    }
+    it = next;
+  }
+  if (pruned.empty() && correlations.empty()) {
+    return;
+  }
+  // Correlation records can link GPU ops in other buffers to CPU ops,
+  // so process those before dropping the buffers.
+  cupti_.processActivities(correlations, [this](const CUpti_Activity* record) {
+    if (record->kind == CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION) {
+      handleCorrelationActivity(
+          reinterpret_cast<const CUpti_ActivityExternalCorrelation*>(record));
+    }
+  });
+  LOG(INFO) << "Dropped " << pruned.size() + correlations.size()
+            << " GPU buffers outside of the capture window";
+}
+
+void ActivityTraceSession::handleRuntimeActivities(
+    const CuptiRecordBatch<CUpti_ActivityAPI>& batch,
+    ActivityLogger& logger) {
+  const auto ops = externalEvents_.link(batch.correlationIds);
+  std::vector<RuntimeActivity> activities;
+  activities.reserve(batch.records.size());
+  for (size_t i = 0; i < batch.records.size(); i++) {
+    const CUpti_ActivityAPI* activity = batch.records[i];
+    // Some CUDA calls that are very frequent and also not very interesting.
+    // Filter these out to reduce trace size.
+    if (activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaGetDevice_v3020 ||
+        activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaSetDevice_v3020 ||
+        activity->cbid == CUPTI_RUNTIME_TRACE_CBID_cudaGetLastError_v3020) {
+      // Ignore these
+      continue;
+    }
+    VLOG(2) << activity->correlationId
+            << ": CUPTI_ACTIVITY_KIND_RUNTIME, cbid=" << activity->cbid
+            << " tid=" << activity->threadId;
+    const ClientTraceActivity& ext = *ops[i];
+    RuntimeActivity runtimeActivity(activity, ext);
+    if (ext.correlationId() == 0 &&
+        (sampledIterations_ || outOfRange(runtimeActivity))) {
+      continue;
+    }
+    if (!loggingDisabled(ext)) {
+      activities.push_back(runtimeActivity);
+    }
+  }
+  if (!activities.empty()) {
+    logger.handleRuntimeActivities(activities);
+  }
+}
+
+inline void ActivityTraceSession::updateGpuNetSpan(
+    const TraceActivity& gpuOp) {
+  const auto& it = clientActivityTraceMap_.find(
+      gpuOp.linkedActivity()->correlationId());
+  if (it == clientActivityTraceMap_.end()) {
+    // No correlation id mapping?
+    return;
+  }
+  TraceSpan& gpu_span = it->second->second;
+  if (gpuOp.timestamp() < gpu_span.startTime || gpu_span.startTime == 0) {
+    gpu_span.startTime = gpuOp.timestamp();
+  }
+  if ((gpuOp.timestamp() + gpuOp.duration()) > gpu_span.endTime) {
+    gpu_span.endTime = gpuOp.timestamp() + gpuOp.duration();
+  }
+}
+
+// I've observed occasional broken timestamps attached to GPU events...
+static bool timestampsInCorrectOrder(
+    const TraceActivity& ext,
+    const TraceActivity& gpuOp) {
+  if (ext.timestamp() > gpuOp.timestamp()) {
+    LOG(WARNING) << "GPU op timestamp (" << gpuOp.timestamp()
+                 << ") < runtime timestamp (" << ext.timestamp() << ")";
+    LOG(WARNING) << "Name: " << gpuOp.nameView()
+                 << " Device: " << gpuOp.deviceId()
+                 << " Stream: " << gpuOp.resourceId();
+    return false;
+  }
+  return true;
+}
+
+inline bool ActivityTraceSession::acceptGpuActivity(const TraceActivity& act) {
+  const TraceActivity& ext = *act.linkedActivity();
+  if (ext.timestamp() == 0 && (sampledIterations_ || outOfRange(act))) {
+    return false;
+  }
+  if (!timestampsInCorrectOrder(ext, act)) {
+    return false;
+  }
+
+  VLOG(2) << ext.correlationId() << "," << act.correlationId() << ": "
+          << act.nameView();
+  if (loggingDisabled(ext)) {
+    return false;
+  }
+  updateGpuNetSpan(act);
+  return true;
+}
+
+template <class T>
+void ActivityTraceSession::handleGpuActivities(
+    const CuptiRecordBatch<T>& batch,
+    ActivityLogger& logger) {
+  const auto ops = externalEvents_.link(batch.correlationIds);
+  std::vector<GpuActivity<T>> activities;
+  activities.reserve(batch.records.size());
+  for (size_t i = 0; i < batch.records.size(); i++) {
+    GpuActivity<T> act(batch.records[i], *ops[i]);
+    if (acceptGpuActivity(act)) {
+      activities.push_back(act);
+    }
+  }
+  if (!activities.empty()) {
+    logger.handleGpuActivities(activities);
+  }
+}
+
+void ActivityTraceSession::CuptiRecordBatches::reserve(
+    const std::list<CuptiActivityBuffer>& buffers) {
+  int runtimeCount = 0;
+  int gpuCount = 0;
+  for (const auto& buf : buffers) {
+    runtimeCount += buf.index.runtimeCount;
+    gpuCount += buf.index.gpuCount;
+  }
+  runtime.reserve(runtimeCount);
+  // Kernels are usually the most common GPU activity
+  kernels.reserve(gpuCount);
+}
+
+void ActivityTraceSession::CuptiRecordBatches::add(
+    const CUpti_Activity* record) {
+  switch (record->kind) {
+    case CUPTI_ACTIVITY_KIND_RUNTIME:
+      runtime.add(record);
+      break;
+    case CUPTI_ACTIVITY_KIND_CONCURRENT_KERNEL:
+      kernels.add(record);
+      break;
+    case CUPTI_ACTIVITY_KIND_MEMCPY:
+      memcpys.add(record);
+      break;
+    case CUPTI_ACTIVITY_KIND_MEMCPY2:
+      memcpy2s.add(record);
+      break;
+    case CUPTI_ACTIVITY_KIND_MEMSET:
+      memsets.add(record);
+      break;
+    default:
+      LOG(WARNING) << "Unexpected activity type: " << record->kind;
+      break;
+  }
+}
+
+std::pair<int, int> ActivityTraceSession::processGpuActivities(
+    std::list<CuptiActivityBuffer>& buffers,
+    ActivityLogger& logger) {
+  // First pass only gathers correlations and groups other records by type.
+  // Records point into the buffers, which outlive this function.
+  CuptiRecordBatches batches;
+  batches.reserve(buffers);
+  const auto count_and_size = cupti_.processActivities(
+      buffers, [this, &batches](const CUpti_Activity* record) {
+        if (record->kind == CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION) {
+          handleCorrelationActivity(
+              reinterpret_cast<const CUpti_ActivityExternalCorrelation*>(
+                  record));
+        } else {
+          batches.add(record);
+        }
+      });
+
+  // All correlations are known now, so records link to CPU ops
+  // regardless of the order they arrived in.
+  // This is a deliberate trade-off: linking a buffer as it was read kept
+  // its records in cache, and with in-order correlations that was faster
+  // (about 21M vs 17M records/s on a synthetic trace). Linking early is
+  // only safe if no later correlation can match the records, which is not
+  // known until all buffers have been read.
+  handleRuntimeActivities(batches.runtime, logger);
+  handleGpuActivities(batches.kernels, logger);
+  handleGpuActivities(batches.memcpys, logger);
+  handleGpuActivities(batches.memcpy2s, logger);
+  handleGpuActivities(batches.memsets, logger);
+  return count_and_size;
+}
+
+// Extract process name from /proc/pid/cmdline. This does not have
+// the 16 character limit that /proc/pid/status and /prod/pid/comm has.
+static const string processName(pid_t pid) {
+  FILE* cmdfile = fopen(fmt::format("/proc/{}/cmdline", pid).c_str(), "r");
+  if (cmdfile != nullptr) {
+    char* command = nullptr;
+    int scanned = fscanf(cmdfile, "%ms", &command);
+    if (scanned > 0 && command) {
+      string ret(basename(command));
+      free(command);
+      return ret;
+    }
+  }
+  VLOG(1) << "Failed to read process name for pid " << pid;
+  return "";
+}
+
+void ActivityTraceSession::finalizeTrace(ActivityLogger& logger) {
+  LOG(INFO) << "Recorded nets:";
+  {
+    for (const auto& it : netIterationCountMap_) {
+      LOG(INFO) << it.first << ": " << it.second << " iterations";
+    }
+    netIterationCountMap_.clear();
+  }
+
+  // Process names
+  string process_name = processName(getpid());
+  if (!process_name.empty()) {
+    pid_t pid = getpid();
+    logger.handleProcessInfo(
+        {pid, process_name, "CPU"}, captureWindowStartTime_);
+    if (!cpuOnly_) {
+      // GPU events use device id as pid (0-7).
+      constexpr int kMaxGpuCount = 8;
+      for (int gpu = 0; gpu < kMaxGpuCount; gpu++) {
+        logger.handleProcessInfo(
+            {gpu, process_name, fmt::format("GPU {}", gpu)},
+            captureWindowStartTime_);
+      }
+    }
+  }
+  // Thread names
+  for (auto pair : threadNames_) {
+    logger.handleThreadInfo(
+        {(int32_t)pair.first, pair.second},
+        captureWindowStartTime_);
+  }
+
+  for (const auto& iterations : traceSpans_) {
+    for (const auto& span_pair : iterations.second) {
+      const TraceSpan& gpu_span = span_pair.second;
+      if (gpu_span.opCount > 0) {
+        logger.handleTraceSpan(gpu_span);
+      }
+    }
+  }
+
+  logger.finalizeTrace(*config_, std::move(traceBuffers_));
+}
+
+} // namespace KINETO_NAMESPACE
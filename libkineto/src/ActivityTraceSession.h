@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cupti.h>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ActivityBuffers.h"
+#include "NetFilter.h"
+#include "ThreadName.h"
+#include "TraceSpan.h"
+#include "libkineto.h"
+#include "output_base.h"
+
+namespace KINETO_NAMESPACE {
+
+class Config;
+class CuptiActivityInterface;
+
+// A trace whose collection has completed, detached from the profiler
+// together with everything needed to process it. The profiler can take
+// the next request while a session is processed on another thread.
+class ActivityTraceSession {
+ public:
+  ActivityTraceSession(
+      CuptiActivityInterface& cupti,
+      std::unique_ptr<Config> config,
+      std::unique_ptr<ActivityBuffers> traceBuffers,
+      ActivityLogger* logger,
+      bool cpuOnly);
+  ActivityTraceSession(const ActivityTraceSession&) = delete;
+  ActivityTraceSession& operator=(const ActivityTraceSession&) = delete;
+
+  // Time range of the trace. Activities not linked to a CPU op
+  // are dropped if they are outside of it.
+  void setCaptureWindow(int64_t startTime, int64_t endTime) {
+    captureWindowStartTime_ = startTime;
+    captureWindowEndTime_ = endTime;
+  }
+
+  // Nets are logged if they pass the filter and the GPU op count threshold
+  void setNetFilter(
+      std::shared_ptr<const NetFilter> filter,
+      int gpuOpCountThreshold,
+      const std::string& iterationsTarget) {
+    netFilter_ = std::move(filter);
+    netGpuOpCountThreshold_ = gpuOpCountThreshold;
+    netIterationsTarget_ = iterationsTarget;
+  }
+
+  void setNetIterationCounts(std::map<std::string, int> counts) {
+    netIterationCountMap_ = std::move(counts);
+  }
+
+  const Config& config() const {
+    return *config_;
+  }
+
+  // Logger the profiler was set up with when the trace was requested
+  ActivityLogger* logger() const {
+    return logger_;
+  }
+
+  // Process CPU and GPU traces. Only call once.
+  void process(ActivityLogger& logger);
+
+ private:
+  // Links CUPTI records to the CPU ops that launched them.
+  // CPU ops and correlations are gathered first, then joined with the
+  // records by sorting on correlation ids and merging, so links do not
+  // depend on the order in which ops, correlations and records arrive.
+  class ExternalEventMap {
+   public:
+    void insertEvent(const libkineto::ClientTraceActivity* op) {
+      events_.emplace_back(op->correlationId(), op);
+      sorted_ = false;
+    }
+
+    void addCorrelation(uint64_t external_id, uint32_t cuda_id) {
+      correlations_.emplace_back(cuda_id, external_id);
+      sorted_ = false;
+    }
+
+    // Returns the CPU op for each cuda correlation id, in the same order.
+    // Records without a known op are linked to an empty op.
+    std::vector<const libkineto::ClientTraceActivity*> link(
+        const std::vector<uint32_t>& cudaIds);
+
+   private:
+    void sort();
+
+    // External correlation ID -> Operator info.
+    // These are regular pointers into the CPU trace buffers,
+    // which outlive this map.
+    std::vector<std::pair<uint64_t, const libkineto::ClientTraceActivity*>>
+        events_;
+
+    // Cuda correlation id -> external correlation id
+    // CUPTI provides a mechanism for correlating Cuda events to arbitrary
+    // external events, e.g.operator events from Caffe2.
+    // It also marks GPU activities with the Cuda event correlation ID.
+    // So by connecting the two, we get the complete picture.
+    std::vector<std::pair<uint32_t, uint64_t>> correlations_;
+
+    // Both vectors sorted by key, and unique
+    bool sorted_{true};
+  };
+
+  void finalizeTrace(ActivityLogger& logger);
+
+  // Process a single CPU trace
+  void processCpuTrace(
+      libkineto::CpuTraceBuffer& cpuTrace,
+      ActivityLogger& logger,
+      bool logNet);
+
+  bool logNet(const libkineto::CpuTraceBuffer& cpuTrace) const;
+
+  // Record client trace span for subsequent lookups from activities
+  // Also creates a corresponding GPU-side span.
+  using CpuGpuSpanPair = std::pair<TraceSpan, TraceSpan>;
+  CpuGpuSpanPair& recordTraceSpan(TraceSpan& span, int gpuOpCount);
+
+  // CUPTI activity records of one type, with their correlation ids
+  // copied out while the records are in cache, so that linking them
+  // to CPU ops does not touch the records again.
+  template <class T>
+  struct CuptiRecordBatch {
+    std::vector<const T*> records;
+    std::vector<uint32_t> correlationIds;
+
+    void reserve(size_t size) {
+      records.reserve(size);
+      correlationIds.reserve(size);
+    }
+
+    void add(const CUpti_Activity* record) {
+      records.push_back(reinterpret_cast<const T*>(record));
+      correlationIds.push_back(records.back()->correlationId);
+    }
+  };
+
+  // CUPTI activity records grouped by type, so that each type is
+  // processed in a tight loop and logged in a single batch.
+  struct CuptiRecordBatches {
+    CuptiRecordBatch<CUpti_ActivityAPI> runtime;
+    CuptiRecordBatch<CUpti_ActivityKernel4> kernels;
+    CuptiRecordBatch<CUpti_ActivityMemcpy> memcpys;
+    CuptiRecordBatch<CUpti_ActivityMemcpy2> memcpy2s;
+    CuptiRecordBatch<CUpti_ActivityMemset> memsets;
+
+    void reserve(const std::list<CuptiActivityBuffer>& buffers);
+    void add(const CUpti_Activity* record);
+  };
+
+  // Process all GPU activity records, returning record count and size
+  std::pair<int, int> processGpuActivities(
+      std::list<CuptiActivityBuffer>& buffers, ActivityLogger& logger);
+
+  // Process specific GPU activity types
+  void updateGpuNetSpan(const TraceActivity& gpuOp);
+  bool outOfRange(const TraceActivity& act);
+  void handleCorrelationActivity(
+      const CUpti_ActivityExternalCorrelation* correlation);
+  void handleRuntimeActivities(
+      const CuptiRecordBatch<CUpti_ActivityAPI>& batch,
+      ActivityLogger& logger);
+  // Returns true if the activity should be logged
+  bool acceptGpuActivity(const TraceActivity& act);
+  // Drop GPU buffers that cannot contain any record to be logged
+  bool outOfRange(const CuptiActivityBufferIndex& index);
+  void pruneGpuBuffers(std::list<CuptiActivityBuffer>& buffers);
+  template <class T>
+  void handleGpuActivities(
+      const CuptiRecordBatch<T>& batch, ActivityLogger& logger);
+
+  // Is logging disabled for this event?
+  // Logging can be disabled due to operator count, net name filter etc.
+  inline bool loggingDisabled(const libkineto::TraceActivity& act) {
+    const auto& it = clientActivityTraceMap_.find(act.correlationId());
+    return it != clientActivityTraceMap_.end() &&
+        disabledTraceSpans_.find(it->second->first.name) !=
+        disabledTraceSpans_.end();
+  }
+
+  inline void recordThreadName(pthread_t pthreadId) {
+    if (threadNames_.find(pthreadId) == threadNames_.end()) {
+      threadNames_[pthreadId] = getThreadName(pthreadId);
+    }
+  }
+
+  // Calls to CUPTI is encapsulated behind this interface
+  CuptiActivityInterface& cupti_;
+
+  // Configuration of the trace request
+  std::unique_ptr<Config> config_;
+
+  // Buffers where trace data is stored
+  std::unique_ptr<ActivityBuffers> traceBuffers_;
+
+  ActivityLogger* logger_;
+
+  bool cpuOnly_;
+
+  // Tracing sampled iterations - only activities linked to a CPU op are kept
+  bool sampledIterations_{false};
+
+  int64_t captureWindowStartTime_{0};
+  int64_t captureWindowEndTime_{0};
+
+  // Time range of all CPU ops in the trace, which GPU events may link to
+  int64_t cpuOpsStartTime_{std::numeric_limits<int64_t>::max()};
+  int64_t cpuOpsEndTime_{std::numeric_limits<int64_t>::min()};
+
+  std::shared_ptr<const NetFilter> netFilter_;
+  int netGpuOpCountThreshold_{0};
+  std::string netIterationsTarget_;
+  // net name -> iteration count
+  std::map<std::string, int> netIterationCountMap_;
+
+  ExternalEventMap externalEvents_;
+
+  // All recorded trace spans, both CPU and GPU
+  // Trace Id -> list of iterations.
+  // Using map of lists for the iterator semantics, since we are recording
+  // pointers to the elements in this structure.
+  std::map<std::string, std::list<CpuGpuSpanPair>> traceSpans_;
+
+  // Maintain a map of client trace activity to trace span.
+  // Maps correlation id -> TraceSpan* held by traceSpans_.
+  std::unordered_map<int64_t, CpuGpuSpanPair*> clientActivityTraceMap_;
+
+  // Cache thread names for pthread ids
+  std::unordered_map<uint64_t, std::string> threadNames_;
+
+  // Which trace spans are disabled. Together with the operator -> net id map
+  // this allows us to determine whether a GPU or CUDA API event should
+  // be included in the trace.
+  // If a CUDA event cannot be mapped to a net it will always be included.
+  std::unordered_set<std::string> disabledTraceSpans_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -35,6 +35,9 @@ constexpr int kDefaultActivitiesExternalAPINetSizeThreshold(0);
 constexpr int kDefaultActivitiesExternalAPIGpuOpCountThreshold(0);
 constexpr int kDefaultActivitiesMaxGpuBufferSize(128 * 1024 * 1024);
 constexpr seconds kDefaultActivitiesWarmupDurationSecs(15);
+constexpr int kDefaultActivitiesWarmupMaxVariationPct(10);
+constexpr milliseconds kDefaultActivitiesBackgroundDurationMsecs(100);
+constexpr seconds kDefaultActivitiesBackgroundFlushSecs(300);
 constexpr seconds kDefaultReportPeriodSecs(1);
 constexpr int kDefaultSamplesPerReport(1);
 constexpr int kDefaultMaxEventProfilersPerGpu(1);
@@ -60,12 +63,35 @@ const string kActivitiesDurationKey = "ACTIVITIES_DURATION_SECS";
 const string kActivitiesDurationMsecsKey = "ACTIVITIES_DURATION_MSECS";
 const string kActivitiesIterationsKey = "ACTIVITIES_ITERATIONS";
 const string kActivitiesIterationsTargetKey = "ACTIVITIES_ITERATIONS_TARGET";
+const string kActivitiesStepsKey = "ACTIVITIES_STEPS";
+const string kActivitiesWarmupStepsKey = "ACTIVITIES_WARMUP_STEPS";
+const string kActivitiesSkipStepsKey = "ACTIVITIES_SKIP_STEPS";
+const string kActivitiesIterationStrideKey = "ACTIVITIES_ITERATION_STRIDE";
+const string kActivitiesIterationStrideOffsetKey =
+    "ACTIVITIES_ITERATION_STRIDE_OFFSET";
+const string kActivitiesIterationStrideJitterKey =
+    "ACTIVITIES_ITERATION_STRIDE_JITTER";
 const string kActivitiesNetFilterKey = "ACTIVITIES_NET_FILTER";
 const string kActivitiesMinNetSizeKey = "ACTIVITIES_MIN_NET_SIZE";
 const string kActivitiesMinGpuOpCountKey = "ACTIVITIES_MIN_GPU_OP_COUNT";
 const string kActivitiesWarmupDurationSecsKey = "ACTIVITIES_WARMUP_PERIOD_SECS";
+const string kActivitiesWarmupAdaptiveKey = "ACTIVITIES_WARMUP_ADAPTIVE";
+const string kActivitiesWarmupMaxVariationKey =
+    "ACTIVITIES_WARMUP_MAX_VARIATION_PCT";
 const string kActivitiesMaxGpuBufferSizeKey =
     "ACTIVITIES_MAX_GPU_BUFFER_SIZE_MB";
+const string kActivitiesHostAggregationKey = "ACTIVITIES_HOST_AGGREGATION";
+const string kActivitiesTimeOrderedKey = "ACTIVITIES_TIME_ORDERED";
+const string kActivitiesSpillDirKey = "ACTIVITIES_SPILL_DIR";
+const string kActivitiesStandbyKey = "ACTIVITIES_STANDBY";
+const string kActivitiesBackgroundPeriodSecsKey =
+    "ACTIVITIES_BACKGROUND_PERIOD_SECS";
+const string kActivitiesBackgroundDurationMsecsKey =
+    "ACTIVITIES_BACKGROUND_DURATION_MSECS";
+const string kActivitiesBackgroundFlushSecsKey =
+    "ACTIVITIES_BACKGROUND_FLUSH_SECS";
+const string kActivitiesBackgroundSummaryFileKey =
+    "ACTIVITIES_BACKGROUND_SUMMARY_FILE";
 
 // Valid configuration file entries for activity types
 const string kActivityMemcpy = "gpu_memcpy";
@@ -75,6 +101,7 @@ const string kActivityExternalCorrelation = "external_correlation";
 const string kActivityRuntime = "cuda_runtime";
 
 const string kDefaultLogFileFmt = "/tmp/libkineto_activities_{}.json";
+const string kDefaultSummaryFileFmt = "/tmp/libkineto_summary_{}.json";
 
 // Common
 
@@ -92,6 +119,20 @@ const string kRequestTimestampKey = "REQUEST_TIMESTAMP";
 // When triggered in this way, /tmp/libkineto.conf will be used as config.
 const string kEnableSigUsr2Key = "ENABLE_SIGUSR2";
 
+// Enable on-demand trigger by writing /tmp/libkineto.conf.
+// The file is watched for changes, and a change of its contents is
+// handled in the same way as SIGUSR2.
+const string kEnableOnDemandFileTriggerKey = "ENABLE_ON_DEMAND_FILE_TRIGGER";
+
+// Enable the control socket @libkineto_<pid> for trace requests and
+// status queries, e.g. with the kineto_ctl tool.
+const string kEnableIpcControlKey = "ENABLE_IPC_CONTROL";
+
+// Register with the host-local daemon @kineto_daemon (see kineto_daemon),
+// unless another daemon config loader has been registered.
+// Only read from the base config at startup.
+const string kEnableIpcDaemonKey = "ENABLE_IPC_DAEMON";
+
 // Verbose log level
 // The actual glog is not used and --v and --vmodule has no effect.
 // Instead set the verbose level and modules in the config file.
@@ -125,6 +166,10 @@ static string defaultTraceFileName() {
   return fmt::format(kDefaultLogFileFmt, getpid());
 }
 
+static string defaultSummaryFileName() {
+  return fmt::format(kDefaultSummaryFileFmt, getpid());
+}
+
 Config::Config()
     : verboseLogLevel_(-1),
       samplePeriod_(kDefaultSamplePeriodMsecs),
@@ -137,6 +182,11 @@ Config::Config()
       activitiesLogFile_(defaultTraceFileName()),
       activitiesMaxGpuBufferSize_(kDefaultActivitiesMaxGpuBufferSize),
       activitiesWarmupDuration_(kDefaultActivitiesWarmupDurationSecs),
+      activitiesWarmupMaxVariation_(kDefaultActivitiesWarmupMaxVariationPct),
+      activitiesBackgroundPeriod_(0),
+      activitiesBackgroundDuration_(kDefaultActivitiesBackgroundDurationMsecs),
+      activitiesBackgroundFlushPeriod_(kDefaultActivitiesBackgroundFlushSecs),
+      activitiesBackgroundSummaryFile_(defaultSummaryFileName()),
       activitiesOnDemandDuration_(kDefaultActivitiesProfileDurationMSecs),
       activitiesExternalAPIIterations_(kDefaultActivitiesExternalAPIIterations),
       activitiesExternalAPINetSizeThreshold_(
@@ -144,7 +194,10 @@ Config::Config()
       activitiesExternalAPIGpuOpCountThreshold_(
           kDefaultActivitiesExternalAPIGpuOpCountThreshold),
       requestTimestamp_(milliseconds(0)),
-      enableSigUsr2_(true) {
+      enableSigUsr2_(true),
+      enableOnDemandFileTrigger_(false),
+      enableIpcControl_(false),
+      enableIpcDaemon_(false) {
   for (const auto& p : configFactories()) {
     addFeature(p.first, p.second(*this));
   }
@@ -258,6 +311,18 @@ bool Config::handleOption(const std::string& name, std::string& val) {
     activitiesOnDemandTimestamp_ = timestamp();
   } else if (name == kActivitiesIterationsTargetKey) {
     activitiesExternalAPIIterationsTarget_ = val;
+  } else if (name == kActivitiesStepsKey) {
+    activitiesSteps_ = toInt32(val);
+  } else if (name == kActivitiesWarmupStepsKey) {
+    activitiesWarmupSteps_ = toInt32(val);
+  } else if (name == kActivitiesSkipStepsKey) {
+    activitiesSkipSteps_ = toInt32(val);
+  } else if (name == kActivitiesIterationStrideKey) {
+    activitiesIterationStride_ = toInt32(val);
+  } else if (name == kActivitiesIterationStrideOffsetKey) {
+    activitiesIterationStrideOffset_ = toInt32(val);
+  } else if (name == kActivitiesIterationStrideJitterKey) {
+    activitiesIterationStrideJitter_ = toInt32(val);
   } else if (name == kActivitiesNetFilterKey) {
     activitiesExternalAPIFilter_ = splitAndTrim(val, ',');
   } else if (name == kActivitiesMinNetSizeKey) {
@@ -277,6 +342,26 @@ bool Config::handleOption(const std::string& name, std::string& val) {
     activitiesMaxGpuBufferSize_ = toInt32(val) * 1024 * 1024;
   } else if (name == kActivitiesWarmupDurationSecsKey) {
     activitiesWarmupDuration_ = seconds(toInt32(val));
+  } else if (name == kActivitiesWarmupAdaptiveKey) {
+    activitiesWarmupAdaptive_ = toBool(val);
+  } else if (name == kActivitiesWarmupMaxVariationKey) {
+    activitiesWarmupMaxVariation_ = toInt32(val);
+  } else if (name == kActivitiesHostAggregationKey) {
+    activitiesHostAggregation_ = toBool(val);
+  } else if (name == kActivitiesTimeOrderedKey) {
+    activitiesTimeOrdered_ = toBool(val);
+  } else if (name == kActivitiesSpillDirKey) {
+    activitiesSpillDir_ = val;
+  } else if (name == kActivitiesStandbyKey) {
+    activitiesStandby_ = toBool(val);
+  } else if (name == kActivitiesBackgroundPeriodSecsKey) {
+    activitiesBackgroundPeriod_ = seconds(toInt32(val));
+  } else if (name == kActivitiesBackgroundDurationMsecsKey) {
+    activitiesBackgroundDuration_ = milliseconds(toInt32(val));
+  } else if (name == kActivitiesBackgroundFlushSecsKey) {
+    activitiesBackgroundFlushPeriod_ = seconds(toInt32(val));
+  } else if (name == kActivitiesBackgroundSummaryFileKey) {
+    activitiesBackgroundSummaryFile_ = val;
   }
 
   // Common
@@ -284,6 +369,12 @@ bool Config::handleOption(const std::string& name, std::string& val) {
     requestTimestamp_ = handleRequestTimestamp(toInt64(val));
   } else if (name == kEnableSigUsr2Key) {
     enableSigUsr2_ = toBool(val);
+  } else if (name == kEnableOnDemandFileTriggerKey) {
+    enableOnDemandFileTrigger_ = toBool(val);
+  } else if (name == kEnableIpcControlKey) {
+    enableIpcControl_ = toBool(val);
+  } else if (name == kEnableIpcDaemonKey) {
+    enableIpcDaemon_ = toBool(val);
   } else {
     return false;
   }
@@ -368,6 +459,15 @@ void Config::printActivityProfilerConfig(std::ostream& s) const {
     << std::endl;
   s << "Target net for iteration count: " << activitiesOnDemandExternalTarget()
     << std::endl;
+  if (activitiesSteps_ > 0) {
+    s << "Steps: " << activitiesSteps_ << " (skip " << activitiesSkipSteps_
+      << ", warmup " << activitiesWarmupSteps_ << ")" << std::endl;
+  }
+  if (activitiesIterationStride_ > 0) {
+    s << "Iteration stride: " << activitiesIterationStride_ << " (offset "
+      << activitiesIterationStrideOffset_ << ", jitter "
+      << activitiesIterationStrideJitter_ << ")" << std::endl;
+  }
   s << "Net Iterations: " << activitiesOnDemandExternalIterations()
     << std::endl;
   if (hasRequestTimestamp()) {
@@ -379,13 +479,33 @@ void Config::printActivityProfilerConfig(std::ostream& s) const {
   s << "Trace duration: " << activitiesOnDemandDuration().count() << "ms"
     << std::endl;
   s << "Warmup duration: " << activitiesWarmupDuration().count() << "s"
-    << std::endl;
+    << (activitiesWarmupAdaptive_ ? " (max)" : "") << std::endl;
+  if (activitiesWarmupAdaptive_) {
+    s << "Warmup ends at overhead variation: "
+      << activitiesWarmupMaxVariation_ << "%" << std::endl;
+  }
+  if (activitiesStandby_) {
+    s << "Standby after trace: Yes" << std::endl;
+  }
+  if (activitiesTimeOrdered_) {
+    s << "Time ordered output: Yes" << std::endl;
+  }
   s << "Net size threshold: " << activitiesOnDemandExternalNetSizeThreshold()
     << std::endl;
   s << "GPU op count threshold: "
     << activitiesOnDemandExternalGpuOpCountThreshold() << std::endl;
   s << "Max GPU buffer size: " << activitiesMaxGpuBufferSize() / 1024 / 1024
     << "MB" << std::endl;
+  if (!activitiesSpillDir_.empty()) {
+    s << "Spill directory: " << activitiesSpillDir_ << std::endl;
+  }
+  if (activitiesBackgroundPeriod_.count() > 0) {
+    s << "Background trace: " << activitiesBackgroundDuration_.count()
+      << "ms every " << activitiesBackgroundPeriod_.count() << "s" << std::endl;
+    s << "Background summary: " << activitiesBackgroundSummaryFile_
+      << " (every " << activitiesBackgroundFlushPeriod_.count() << "s)"
+      << std::endl;
+  }
 
   s << "Enabled activities: ";
   for (const auto& activity : selectedActivityTypes_) {
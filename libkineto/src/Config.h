@@ -57,6 +57,16 @@ class Config : public AbstractConfig {
     return activitiesLogToMemory_;
   }
 
+  // Merge the trace with those of other processes on the host
+  bool activitiesHostAggregation() const {
+    return activitiesHostAggregation_;
+  }
+
+  // Write trace events in order of time, rather than as they are processed
+  bool activitiesTimeOrdered() const {
+    return activitiesTimeOrdered_;
+  }
+
   // Is profiling enabled for the given device?
   bool eventProfilerEnabledForDevice(uint32_t dev) const {
     return 0 != (eventProfilerDeviceMask_ & (1 << dev));
@@ -177,6 +187,37 @@ class Config : public AbstractConfig {
     return activitiesExternalAPIIterationsTarget_;
   }
 
+  // Trace this many steps, as counted by LibkinetoApi::step().
+  // Steps are skipped first, then GPU tracing is warmed up for
+  // the warmup steps. Not step based if zero.
+  int activitiesSteps() const {
+    return activitiesSteps_;
+  }
+
+  int activitiesWarmupSteps() const {
+    return activitiesWarmupSteps_;
+  }
+
+  int activitiesSkipSteps() const {
+    return activitiesSkipSteps_;
+  }
+
+  // Trace one iteration out of every stride iterations of the target net,
+  // starting at offset into each stride, plus up to jitter iterations.
+  // GPU activities are only recorded for sampled iterations, and the
+  // iteration count is the number of samples. Disabled if 0.
+  int activitiesIterationStride() const {
+    return activitiesIterationStride_;
+  }
+
+  int activitiesIterationStrideOffset() const {
+    return activitiesIterationStrideOffset_;
+  }
+
+  int activitiesIterationStrideJitter() const {
+    return activitiesIterationStrideJitter_;
+  }
+
   const std::vector<std::string>& activitiesOnDemandExternalFilter() const {
     return activitiesExternalAPIFilter_;
   }
@@ -197,10 +238,56 @@ class Config : public AbstractConfig {
     return activitiesMaxGpuBufferSize_;
   }
 
+  // Spill GPU buffers beyond the max buffer size to this directory
+  const std::string& activitiesSpillDir() const {
+    return activitiesSpillDir_;
+  }
+
   std::chrono::seconds activitiesWarmupDuration() const {
     return activitiesWarmupDuration_;
   }
 
+  void setActivitiesWarmupDuration(std::chrono::seconds duration) {
+    activitiesWarmupDuration_ = duration;
+  }
+
+  // End warmup early once tracing overhead has stabilized, i.e. varies
+  // by less than the max variation (in percent). The warmup duration
+  // is then an upper bound.
+  bool activitiesWarmupAdaptive() const {
+    return activitiesWarmupAdaptive_;
+  }
+
+  int activitiesWarmupMaxVariation() const {
+    return activitiesWarmupMaxVariation_;
+  }
+
+  // Keep GPU activities enabled in standby after the trace, so that the
+  // next trace can start without warmup
+  bool activitiesStandby() const {
+    return activitiesStandby_;
+  }
+
+  // Background tracing: trace for the background duration once every
+  // background period, and aggregate the traces into a summary file.
+  // Disabled when the period is zero.
+  std::chrono::seconds activitiesBackgroundPeriod() const {
+    return activitiesBackgroundPeriod_;
+  }
+
+  std::chrono::milliseconds activitiesBackgroundDuration() const {
+    return activitiesBackgroundDuration_;
+  }
+
+  // The summary file is rewritten once per flush period
+  std::chrono::seconds activitiesBackgroundFlushPeriod() const {
+    return activitiesBackgroundFlushPeriod_;
+  }
+
+  const std::string& activitiesBackgroundSummaryFile() const {
+    return activitiesBackgroundSummaryFile_;
+  }
+
   // Request was initiated at this time
   const std::chrono::time_point<std::chrono::system_clock> requestTimestamp()
       const {
@@ -230,6 +317,18 @@ class Config : public AbstractConfig {
     return enableSigUsr2_;
   }
 
+  bool onDemandFileTriggerEnabled() const {
+    return enableOnDemandFileTrigger_;
+  }
+
+  bool ipcControlEnabled() const {
+    return enableIpcControl_;
+  }
+
+  bool ipcDaemonEnabled() const {
+    return enableIpcDaemon_;
+  }
+
   static std::chrono::milliseconds alignUp(
       std::chrono::milliseconds duration,
       std::chrono::milliseconds alignment) {
@@ -324,14 +423,38 @@ class Config : public AbstractConfig {
   // Log activities to memory buffer
   bool activitiesLogToMemory_{false};
 
+  // Stream activities to the host trace aggregator
+  bool activitiesHostAggregation_{false};
+
+  // Sort trace events by time before writing them
+  bool activitiesTimeOrdered_{false};
+
   int activitiesMaxGpuBufferSize_;
+  std::string activitiesSpillDir_;
   std::chrono::seconds activitiesWarmupDuration_;
+  bool activitiesWarmupAdaptive_{false};
+  int activitiesWarmupMaxVariation_;
+  bool activitiesStandby_{false};
+
+  // Periodic background tracing
+  std::chrono::seconds activitiesBackgroundPeriod_;
+  std::chrono::milliseconds activitiesBackgroundDuration_;
+  std::chrono::seconds activitiesBackgroundFlushPeriod_;
+  std::string activitiesBackgroundSummaryFile_;
 
   // Profile for specified iterations and duration
   std::chrono::milliseconds activitiesOnDemandDuration_;
   int activitiesExternalAPIIterations_;
   // Use this net name for iteration count
   std::string activitiesExternalAPIIterationsTarget_;
+  // Trace on step boundaries
+  int activitiesSteps_{0};
+  int activitiesWarmupSteps_{0};
+  int activitiesSkipSteps_{0};
+  // Sample iterations of the target net
+  int activitiesIterationStride_{0};
+  int activitiesIterationStrideOffset_{0};
+  int activitiesIterationStrideJitter_{0};
   // Only profile nets that includes this in the name
   std::vector<std::string> activitiesExternalAPIFilter_;
   // Only profile nets with at least this many operators
@@ -347,6 +470,15 @@ class Config : public AbstractConfig {
 
   // Enable profiling via SIGUSR2
   bool enableSigUsr2_;
+
+  // Enable profiling by writing the on-demand config file
+  bool enableOnDemandFileTrigger_;
+
+  // Enable the control socket
+  bool enableIpcControl_;
+
+  // Use the local kineto daemon when no daemon config loader is registered
+  bool enableIpcDaemon_;
 };
 
 } // namespace KINETO_NAMESPACE
@@ -7,14 +7,23 @@
 
 #include "ConfigLoader.h"
 
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <sstream>
+#include <system_error>
 
 #include "libkineto.h"
 #include "ActivityProfilerProxy.h"
 #include "DaemonConfigLoader.h"
+#include "IpcDaemonConfigLoader.h"
+#include "Scheduler.h"
 
 #include "Logger.h"
 
@@ -35,6 +44,12 @@ constexpr std::chrono::seconds kOnDemandConfigVerboseLogDurationSecs(120);
 
 static struct sigaction originalUsr2Handler = {};
 
+// Set by the signal handler, which also writes to the eventfd to wake
+// up the scheduler. Nothing else is async-signal-safe, so the request
+// is handled on the scheduler thread.
+static std::atomic_bool onDemandSignalPending{false};
+static std::atomic<int> onDemandSignalFd{-1};
+
 // Use SIGUSR2 to initiate profiling.
 // Look for an on-demand config file.
 // If none is found, default to base config.
@@ -46,7 +61,16 @@ static bool hasOriginalSignalHandler() {
 
 static void handle_signal(int signal) {
   if (signal == SIGUSR2) {
-    ConfigLoader::instance().handleOnDemandSignal();
+    int saved_errno = errno;
+    onDemandSignalPending = true;
+    int fd = onDemandSignalFd;
+    if (fd >= 0) {
+      uint64_t one = 1;
+      // On failure, the update task sees the flag the next time it runs
+      ssize_t res = write(fd, &one, sizeof(one));
+      (void)res;
+    }
+    errno = saved_errno;
     if (hasOriginalSignalHandler()) {
       // Invoke original handler and reinstate ours
       struct sigaction act;
@@ -90,6 +114,25 @@ static std::string readConfigFromConfigFile(const char* filename) {
   return conf;
 }
 
+static size_t configHash(const std::string& config_str) {
+  return std::hash<std::string>()(config_str);
+}
+
+// Returns true if the file may have changed since the previous call,
+// judging by modification time, size and inode.
+static bool fileStatChanged(const char* filename, struct stat& last) {
+  struct stat st = {};
+  if (stat(filename, &st) < 0) {
+    // Treat a missing file as empty
+    st = {};
+  }
+  bool changed = st.st_ino != last.st_ino || st.st_size != last.st_size ||
+      st.st_mtim.tv_sec != last.st_mtim.tv_sec ||
+      st.st_mtim.tv_nsec != last.st_mtim.tv_nsec;
+  last = st;
+  return changed;
+}
+
 static std::function<std::unique_ptr<DaemonConfigLoader>()>&
 daemonConfigLoaderFactory() {
   static std::function<std::unique_ptr<DaemonConfigLoader>()> factory = nullptr;
@@ -113,8 +156,13 @@ std::string ConfigLoader::readOnDemandConfigFromDaemon(
     return "";
   }
   bool events =
-      now > onDemandEventProfilerConfig_->eventProfilerOnDemandEndTime();
-  bool activities = !libkinetoApi_.activityProfiler().isActive();
+      now > onDemandEventProfilerConfig_.get()->eventProfilerOnDemandEndTime();
+  // Activity profiler requests are queued while a trace is running
+  auto profiler = dynamic_cast<ActivityProfilerProxy*>(
+      &libkinetoApi_.activityProfiler());
+  bool activities = profiler && profiler->isInitialized()
+      ? profiler->acceptsTraceRequest(TraceRequestSource::Daemon)
+      : !libkinetoApi_.activityProfiler().isActive();
   return daemonConfigLoader_->readOnDemandConfig(events, activities);
 }
 
@@ -126,71 +174,192 @@ int ConfigLoader::contextCountForGpu(uint32_t device) {
   return daemonConfigLoader_->gpuContextCount(device);
 }
 
+void ConfigLoader::gpuContextCreated(uint32_t device) {
+  if (daemonConfigLoader_) {
+    daemonConfigLoader_->gpuContextCreated(device);
+  }
+}
+
+void ConfigLoader::gpuContextDestroyed(uint32_t device) {
+  if (daemonConfigLoader_) {
+    daemonConfigLoader_->gpuContextDestroyed(device);
+  }
+}
+
 ConfigLoader::ConfigLoader(LibkinetoApi& api)
     : libkinetoApi_(api),
-      onDemandEventProfilerConfig_(new Config()),
+      config_(std::make_shared<Config>()),
+      onDemandEventProfilerConfig_(std::make_shared<Config>()),
       configUpdateIntervalSecs_(kConfigUpdateIntervalSecs),
       onDemandConfigUpdateIntervalSecs_(kOnDemandConfigUpdateIntervalSecs),
-      stopFlag_(false),
-      onDemandSignal_(false) {
+      onDemandConfig_(new Config()) {
   configFileName_ = getenv(kConfigFileEnvVar.data());
   if (configFileName_ == nullptr) {
     configFileName_ = kConfigFile.data();
   }
-  config_.parse(readConfigFromConfigFile(configFileName_));
-  SET_VERBOSE_LOG_LEVEL(config_.verboseLogLevel(), config_.verboseLogModules());
-  setupSignalHandler(config_.sigUsr2Enabled());
+  fileStatChanged(configFileName_, configFileStat_);
+  const std::string config_str = readConfigFromConfigFile(configFileName_);
+  configHash_ = configHash(config_str);
+  auto config = std::make_shared<Config>();
+  config->parse(config_str);
+  config_.publish(config);
+  SET_VERBOSE_LOG_LEVEL(config->verboseLogLevel(), config->verboseLogModules());
+  setupSignalWatch();
+  setupSignalHandler(config_.get()->sigUsr2Enabled());
   if (daemonConfigLoaderFactory && daemonConfigLoaderFactory()) {
     daemonConfigLoader_ = daemonConfigLoaderFactory()();
+  } else if (config_.get()->ipcDaemonEnabled()) {
+    daemonConfigLoader_ = IpcDaemonConfigLoader::create();
+  }
+  auto now = high_resolution_clock::now();
+  nextConfigLoadTime_ = now + configUpdateIntervalSecs_;
+  nextOnDemandLoadTime_ = now + onDemandConfigUpdateIntervalSecs_;
+  nextLogLevelResetTime_ = now;
+  auto task = [this](const time_point<system_clock>& now) {
+    return updateConfigStep();
+  };
+  setupFileWatcher();
+  if (fileWatcher_) {
+    // Only poll the config file if it cannot be watched
+    nextConfigLoadTime_ = time_point<high_resolution_clock>::max();
+    updateTaskId_ = Scheduler::instance().watch(
+        "config update",
+        fileWatcher_->fd(),
+        daemonConfigLoader_ ? system_clock::now() +
+                onDemandConfigUpdateIntervalSecs_
+                            : time_point<system_clock>::max(),
+        task);
+  } else {
+    seconds interval =
+        std::min(configUpdateIntervalSecs_, onDemandConfigUpdateIntervalSecs_);
+    updateTaskId_ = Scheduler::instance().schedule(
+        "config update", system_clock::now() + interval, task);
   }
-  updateThread_ =
-      std::make_unique<std::thread>(&ConfigLoader::updateConfigThread, this);
+  setupDaemonWatch();
+  setupControlServer(config_.get()->ipcControlEnabled());
 }
 
-ConfigLoader::~ConfigLoader() {
-  if (updateThread_) {
-    stopFlag_ = true;
-    {
-      std::lock_guard<std::mutex> lock(updateThreadMutex_);
-      updateThreadCondVar_.notify_one();
-    }
-    updateThread_->join();
+void ConfigLoader::setupDaemonWatch() {
+  int fd = daemonConfigLoader_ ? daemonConfigLoader_->replyFd() : -1;
+  if (fd < 0) {
+    return;
+  }
+  daemonTaskId_ = Scheduler::instance().watch(
+      "daemon replies",
+      fd,
+      time_point<system_clock>::max(),
+      [this](const time_point<system_clock>& now) {
+        std::string config_str = daemonConfigLoader_->readReply();
+        if (!config_str.empty()) {
+          daemonReply_ = std::move(config_str);
+          Scheduler::instance().reschedule(updateTaskId_, now);
+        }
+        return time_point<system_clock>::max();
+      });
+}
+
+void ConfigLoader::setupSignalWatch() {
+  signalFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (signalFd_ < 0) {
+    PLOG(ERROR) << "Failed to create eventfd - "
+                << "signals are handled on the next config update";
+    return;
+  }
+  signalTaskId_ = Scheduler::instance().watch(
+      "on-demand signal",
+      signalFd_,
+      time_point<system_clock>::max(),
+      [this](const time_point<system_clock>& now) {
+        uint64_t count;
+        while (read(signalFd_, &count, sizeof(count)) > 0) {
+        }
+        if (onDemandSignalPending) {
+          // Run update task right away
+          Scheduler::instance().reschedule(updateTaskId_, now);
+        }
+        return time_point<system_clock>::max();
+      });
+  onDemandSignalFd = signalFd_;
+}
+
+void ConfigLoader::setupFileWatcher() {
+  try {
+    fileWatcher_ = std::make_unique<FileWatcher>();
+  } catch (const std::system_error& e) {
+    LOG(WARNING) << e.what() << " - polling config files";
+    return;
+  }
+  if (!fileWatcher_->add(configFileName_, [this](const std::string&) {
+        baseConfigChanged_ = true;
+      })) {
+    fileWatcher_ = nullptr;
+    return;
+  }
+  setupOnDemandFileTrigger(config_.get()->onDemandFileTriggerEnabled());
+}
+
+void ConfigLoader::setupOnDemandFileTrigger(bool enable) {
+  if (!fileWatcher_) {
+    LOG_IF(WARNING, enable) << "On-demand file trigger requires inotify";
+    return;
+  }
+  bool watching = fileWatcher_->watching(kOnDemandConfigFile);
+  if (enable && !watching) {
+    // Only trigger on changes from the current contents
+    onDemandConfigHash_ =
+        configHash(readConfigFromConfigFile(kOnDemandConfigFile.data()));
+    fileWatcher_->add(kOnDemandConfigFile, [this](const std::string&) {
+      onDemandFileChanged_ = true;
+    });
+    LOG(INFO) << "Watching " << kOnDemandConfigFile << " for trace requests";
+  } else if (!enable && watching) {
+    fileWatcher_->remove(kOnDemandConfigFile);
   }
 }
 
-void ConfigLoader::handleOnDemandSignal() {
-  onDemandSignal_ = true;
-  {
-    std::lock_guard<std::mutex> lock(updateThreadMutex_);
-    updateThreadCondVar_.notify_one();
+ConfigLoader::~ConfigLoader() {
+  Scheduler::instance().cancel(updateTaskId_);
+  if (daemonTaskId_) {
+    Scheduler::instance().cancel(daemonTaskId_);
+  }
+  if (signalFd_ >= 0) {
+    onDemandSignalFd = -1;
+    Scheduler::instance().cancel(signalTaskId_);
+    close(signalFd_);
   }
 }
 
 void ConfigLoader::updateBaseConfig() {
   const std::string config_str = readConfigFromConfigFile(configFileName_);
-  if (config_str != config_.source()) {
-    std::lock_guard<std::mutex> lock(configLock_);
-    config_.~Config();
-    new (&config_) Config();
-    config_.parse(config_str);
+  size_t hash = configHash(config_str);
+  if (hash != configHash_) {
+    auto config = std::make_shared<Config>();
+    config->parse(config_str);
+    config_.publish(config);
+    configHash_ = hash;
+    if (libkinetoApi_.isProfilerInitialized()) {
+      auto profiler = dynamic_cast<ActivityProfilerProxy*>(
+          &libkinetoApi_.activityProfiler());
+      if (profiler) {
+        profiler->setBackgroundConfig(*config);
+      }
+    }
   }
-  setupSignalHandler(config_.sigUsr2Enabled());
+  setupSignalHandler(config_.get()->sigUsr2Enabled());
+  setupOnDemandFileTrigger(config_.get()->onDemandFileTriggerEnabled());
+  setupControlServer(config_.get()->ipcControlEnabled());
 }
 
-void ConfigLoader::configureFromSignal(
+bool ConfigLoader::configureOnDemand(
     time_point<high_resolution_clock> now,
+    const std::string& config_str,
     Config& config) {
-  LOG(INFO) << "Received on-demand profiling signal, "
-            << "reading config from " << kOnDemandConfigFile.data();
-  const std::string config_str =
-      readConfigFromConfigFile(kOnDemandConfigFile.data());
   config.parse(config_str);
   config.setSignalDefaults();
   if (eventProfilerRequest(config)) {
-    if (now > onDemandEventProfilerConfig_->eventProfilerOnDemandEndTime()) {
+    if (now > onDemandEventProfilerConfig_.get()->eventProfilerOnDemandEndTime()) {
       LOG(INFO) << "Starting on-demand event profiling from signal";
-      std::lock_guard<std::mutex> lock(configLock_);
-      onDemandEventProfilerConfig_ = config.clone();
+      onDemandEventProfilerConfig_.publish(config.clone());
     } else {
       LOG(ERROR) << "On-demand event profiler is busy";
     }
@@ -201,92 +370,178 @@ void ConfigLoader::configureFromSignal(
   try {
     auto& profiler = dynamic_cast<ActivityProfilerProxy&>(
         libkinetoApi_.activityProfiler());
-    profiler.scheduleTrace(config);
+    if (!profiler.scheduleTrace(config, TraceRequestSource::Signal)) {
+      LOG(ERROR) << "Profiler request rejected - too many queued requests";
+      return false;
+    }
   } catch (const std::exception& e) {
-    LOG(ERROR) << "Failed to schedule profiler request (busy?)";
+    LOG(ERROR) << "Failed to schedule profiler request";
+    return false;
+  }
+  return true;
+}
+
+std::string ConfigLoader::handleControlRequest(
+    const std::string& command,
+    const std::string& payload) {
+  auto& profiler = libkinetoApi_.activityProfiler();
+  if (command == "trace") {
+    if (!profiler.isInitialized()) {
+      return "ERROR activity profiler not initialized";
+    }
+    auto proxy = dynamic_cast<ActivityProfilerProxy*>(&profiler);
+    if (proxy && !proxy->acceptsTraceRequest(TraceRequestSource::Signal)) {
+      return "ERROR too many queued trace requests";
+    }
+    LOG(INFO) << "Received on-demand profiling request from control socket";
+    onDemandConfig_ = config_.get()->clone();
+    if (!configureOnDemand(high_resolution_clock::now(), payload,
+                           *onDemandConfig_)) {
+      return "ERROR failed to schedule trace";
+    }
+    return "OK " + onDemandConfig_->activitiesLogFile();
+  } else if (command == "status") {
+    std::stringstream s;
+    s << "OK" << std::endl;
+    s << "activity_profiler="
+      << (!profiler.isInitialized()
+              ? "uninitialized"
+              : (profiler.isActive() ? "active" : "idle"))
+      << std::endl;
+    bool events_busy = high_resolution_clock::now() <
+        onDemandEventProfilerConfig_.get()->eventProfilerOnDemandEndTime();
+    s << "event_profiler_on_demand=" << (events_busy ? "active" : "idle")
+      << std::endl;
+    auto proxy = dynamic_cast<ActivityProfilerProxy*>(&profiler);
+    if (proxy && proxy->isInitialized()) {
+      auto requests = proxy->traceRequestStatus();
+      s << "trace_requests_queued=" << requests.queued << "/"
+        << requests.capacity << std::endl;
+      s << "trace_requests_received=" << requests.received << std::endl;
+      s << "trace_requests_started=" << requests.started << std::endl;
+      s << "trace_requests_coalesced=" << requests.coalesced << std::endl;
+      s << "trace_requests_rejected=" << requests.rejected << std::endl;
+      s << "trace_requests_expired=" << requests.expired << std::endl;
+    }
+    return s.str();
+  } else if (command == "stats") {
+    std::stringstream s;
+    s << "OK" << std::endl;
+    Scheduler::instance().printLateness(s);
+    return s.str();
+  }
+  return "ERROR unknown command '" + command + "'";
+}
+
+void ConfigLoader::setupControlServer(bool enable) {
+  if (enable && !controlServer_) {
+    try {
+      controlServer_ = std::make_unique<ControlServer>(
+          [this](const std::string& command, const std::string& payload) {
+            return handleControlRequest(command, payload);
+          });
+    } catch (const std::system_error& e) {
+      LOG(ERROR) << "Failed to start control server: " << e.what();
+    }
+  } else if (!enable && controlServer_) {
+    controlServer_ = nullptr;
   }
 }
 
 void ConfigLoader::configureFromDaemon(
     time_point<high_resolution_clock> now,
+    const std::string& config_str,
     Config& config) {
-  const std::string config_str = readOnDemandConfigFromDaemon(now);
   LOG_IF(INFO, !config_str.empty()) << "Received config from dyno:\n"
                                     << config_str;
   config.parse(config_str);
   if (eventProfilerRequest(config)) {
-    std::lock_guard<std::mutex> lock(configLock_);
-    onDemandEventProfilerConfig_ = config.clone();
+    onDemandEventProfilerConfig_.publish(config.clone());
   }
-  if (config_.activityProfilerEnabled() &&
+  if (config_.get()->activityProfilerEnabled() &&
       config.activityProfilerRequestReceivedTime() > now) {
     try {
       auto& profiler = dynamic_cast<ActivityProfilerProxy&>(
           libkinetoApi_.activityProfiler());
-      profiler.scheduleTrace(config);
+      if (!profiler.scheduleTrace(config, TraceRequestSource::Daemon)) {
+        LOG(ERROR) << "Profiler request rejected - too many queued requests";
+      }
     } catch (const std::exception& e) {
-      LOG(ERROR) << "Failed to schedule profiler request (busy?)";
+      LOG(ERROR) << "Failed to schedule profiler request";
     }
   }
 }
 
-void ConfigLoader::updateConfigThread() {
+time_point<system_clock> ConfigLoader::updateConfigStep() {
+  if (fileWatcher_) {
+    fileWatcher_->handleEvents();
+  }
   auto now = high_resolution_clock::now();
-  auto next_config_load_time = now + configUpdateIntervalSecs_;
-  auto next_on_demand_load_time = now + onDemandConfigUpdateIntervalSecs_;
-  auto next_log_level_reset_time = now;
-  seconds interval =
-      std::min(configUpdateIntervalSecs_, onDemandConfigUpdateIntervalSecs_);
-  auto onDemandConfig = std::make_unique<Config>();
-
-  // This can potentially sleep for long periods of time, so allow
-  // the desctructor to wake it to avoid a 5-minute long destruct period.
-  for (;;) {
-    {
-      std::unique_lock<std::mutex> lock(updateThreadMutex_);
-      updateThreadCondVar_.wait_for(lock, interval);
-    }
-    if (stopFlag_) {
-      break;
-    }
-    now = high_resolution_clock::now();
-    if (now > next_config_load_time) {
-      updateBaseConfig();
-      next_config_load_time = now + configUpdateIntervalSecs_;
-    }
-    if (onDemandSignal_.exchange(false)) {
-      onDemandConfig = config_.clone();
-      configureFromSignal(now, *onDemandConfig);
-    } else if (now > next_on_demand_load_time) {
-      configureFromDaemon(now, *onDemandConfig);
-      next_on_demand_load_time = now + onDemandConfigUpdateIntervalSecs_;
-    }
-    if (onDemandConfig->verboseLogLevel() >= 0) {
-      LOG(INFO) << "Setting verbose level to "
-                << onDemandConfig->verboseLogLevel()
-                << " from on-demand config";
-      SET_VERBOSE_LOG_LEVEL(
-          onDemandConfig->verboseLogLevel(),
-          onDemandConfig->verboseLogModules());
-      next_log_level_reset_time = now + kOnDemandConfigVerboseLogDurationSecs;
-    }
-    if (now > next_log_level_reset_time) {
-      VLOG(0) << "Resetting verbose level";
-      SET_VERBOSE_LOG_LEVEL(
-          config_.verboseLogLevel(), config_.verboseLogModules());
-    }
+  bool reload = baseConfigChanged_;
+  baseConfigChanged_ = false;
+  if (now > nextConfigLoadTime_) {
+    reload = reload || fileStatChanged(configFileName_, configFileStat_);
+    nextConfigLoadTime_ = now + configUpdateIntervalSecs_;
+  }
+  if (reload) {
+    updateBaseConfig();
   }
-}
 
-bool ConfigLoader::hasNewConfig(const Config& oldConfig) {
-  std::lock_guard<std::mutex> lock(configLock_);
-  return config_.timestamp() > oldConfig.timestamp();
-}
+  // A signal always triggers a request,
+  // a file write only when the contents changed.
+  // A missing or empty file is not a request.
+  bool trigger = onDemandSignalPending.exchange(false);
+  std::string on_demand_str;
+  if (trigger || onDemandFileChanged_) {
+    on_demand_str = readConfigFromConfigFile(kOnDemandConfigFile.data());
+    if (!on_demand_str.empty()) {
+      size_t hash = configHash(on_demand_str);
+      trigger = trigger || hash != onDemandConfigHash_;
+      onDemandConfigHash_ = hash;
+    }
+    onDemandFileChanged_ = false;
+  }
+  if (trigger) {
+    LOG(INFO) << "Received on-demand profiling request, "
+              << "using config from " << kOnDemandConfigFile.data();
+    onDemandConfig_ = config_.get()->clone();
+    configureOnDemand(now, on_demand_str, *onDemandConfig_);
+  } else if (!daemonReply_.empty()) {
+    configureFromDaemon(now, daemonReply_, *onDemandConfig_);
+    daemonReply_.clear();
+  } else if (daemonConfigLoader_ && now > nextOnDemandLoadTime_) {
+    configureFromDaemon(
+        now, readOnDemandConfigFromDaemon(now), *onDemandConfig_);
+    nextOnDemandLoadTime_ = now + onDemandConfigUpdateIntervalSecs_;
+  }
+  if (onDemandConfig_->verboseLogLevel() >= 0) {
+    LOG(INFO) << "Setting verbose level to "
+              << onDemandConfig_->verboseLogLevel()
+              << " from on-demand config";
+    SET_VERBOSE_LOG_LEVEL(
+        onDemandConfig_->verboseLogLevel(),
+        onDemandConfig_->verboseLogModules());
+    nextLogLevelResetTime_ = now + kOnDemandConfigVerboseLogDurationSecs;
+  }
+  if (now > nextLogLevelResetTime_) {
+    VLOG(0) << "Resetting verbose level";
+    SET_VERBOSE_LOG_LEVEL(
+        config_.get()->verboseLogLevel(), config_.get()->verboseLogModules());
+  }
 
-bool ConfigLoader::hasNewEventProfilerOnDemandConfig(const Config& oldConfig) {
-  std::lock_guard<std::mutex> lock(configLock_);
-  return onDemandEventProfilerConfig_->eventProfilerOnDemandStartTime() >
-      oldConfig.eventProfilerOnDemandStartTime();
+  // Only wake up when there is something to do
+  auto next = nextConfigLoadTime_;
+  if (daemonConfigLoader_) {
+    next = std::min(next, nextOnDemandLoadTime_);
+  }
+  if (nextLogLevelResetTime_ > now) {
+    next = std::min(next, nextLogLevelResetTime_);
+  }
+  if (next == time_point<high_resolution_clock>::max()) {
+    return time_point<system_clock>::max();
+  }
+  return system_clock::now() +
+      duration_cast<system_clock::duration>(next - now);
 }
 
 } // namespace KINETO_NAMESPACE
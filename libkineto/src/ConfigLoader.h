@@ -7,14 +7,15 @@
 
 #pragma once
 
-#include <atomic>
+#include <sys/stat.h>
 #include <chrono>
-#include <condition_variable>
-#include <mutex>
+#include <memory>
 #include <string>
-#include <thread>
 
 #include "Config.h"
+#include "ControlServer.h"
+#include "FileWatcher.h"
+#include "VersionedSnapshot.h"
 
 namespace libkineto {
   class LibkinetoApi;
@@ -30,20 +31,28 @@ class ConfigLoader {
   static ConfigLoader& instance();
 
   inline std::unique_ptr<Config> getConfigCopy() {
-    std::lock_guard<std::mutex> lock(configLock_);
-    return config_.clone();
+    return config_.get()->clone();
   }
 
-  inline std::unique_ptr<Config> getEventProfilerOnDemandConfigCopy() {
-    std::lock_guard<std::mutex> lock(configLock_);
-    return onDemandEventProfilerConfig_->clone();
+  // Replace config with the current base config if it has changed since
+  // version was last updated. Lock free, and nothing is copied unless it
+  // has changed. Start with version 0 and a null config.
+  inline bool refreshConfig(
+      std::shared_ptr<const Config>& config,
+      uint64_t& version) const {
+    return config_.refresh(config, version);
   }
 
-  bool hasNewConfig(const Config& oldConfig);
-  bool hasNewEventProfilerOnDemandConfig(const Config& oldConfig);
+  // As above, for the on-demand event profiler config
+  inline bool refreshEventProfilerOnDemandConfig(
+      std::shared_ptr<const Config>& config,
+      uint64_t& version) const {
+    return onDemandEventProfilerConfig_.refresh(config, version);
+  }
   int contextCountForGpu(uint32_t gpu);
-
-  void handleOnDemandSignal();
+  // Forwarded to the daemon, if any, which counts contexts across processes
+  void gpuContextCreated(uint32_t gpu);
+  void gpuContextDestroyed(uint32_t gpu);
 
   static void setDaemonConfigLoaderFactory(
       std::function<std::unique_ptr<DaemonConfigLoader>()> factory);
@@ -52,42 +61,86 @@ class ConfigLoader {
   explicit ConfigLoader(libkineto::LibkinetoApi& api);
   ~ConfigLoader();
 
-  void updateConfigThread();
+  // Runs on a timer and when a watched file changes.
+  // Returns time of next update.
+  std::chrono::time_point<std::chrono::system_clock> updateConfigStep();
   void updateBaseConfig();
 
-  // Create configuration when receiving SIGUSR2
-  void configureFromSignal(
+  // Handle SIGUSR2 on the scheduler thread
+  void setupSignalWatch();
+  // Receive asynchronous daemon replies on the scheduler thread
+  void setupDaemonWatch();
+  void setupFileWatcher();
+  void setupOnDemandFileTrigger(bool enable);
+  void setupControlServer(bool enable);
+
+  // Create configuration for an on-demand request received via SIGUSR2,
+  // file trigger or control socket. Returns true if a trace was scheduled.
+  bool configureOnDemand(
       std::chrono::time_point<std::chrono::high_resolution_clock> now,
+      const std::string& config_str,
       Config& config);
 
+  // Reply to a control socket request
+  std::string handleControlRequest(
+      const std::string& command,
+      const std::string& payload);
+
   // Create configuration when receiving request from a daemon
   void configureFromDaemon(
       std::chrono::time_point<std::chrono::high_resolution_clock> now,
+      const std::string& config_str,
       Config& config);
 
   inline bool eventProfilerRequest(const Config& config) {
     return (
         config.eventProfilerOnDemandStartTime() >
-        onDemandEventProfilerConfig_->eventProfilerOnDemandStartTime());
+        onDemandEventProfilerConfig_.get()->eventProfilerOnDemandStartTime());
   }
 
   std::string readOnDemandConfigFromDaemon(
       std::chrono::time_point<std::chrono::high_resolution_clock> now);
 
   LibkinetoApi& libkinetoApi_;
-  std::mutex configLock_;
   const char* configFileName_;
-  Config config_;
-  std::unique_ptr<Config> onDemandEventProfilerConfig_;
+  // Published by the update task on the scheduler thread
+  VersionedSnapshot<Config> config_;
+  VersionedSnapshot<Config> onDemandEventProfilerConfig_;
   std::unique_ptr<DaemonConfigLoader> daemonConfigLoader_;
 
   std::chrono::seconds configUpdateIntervalSecs_;
   std::chrono::seconds onDemandConfigUpdateIntervalSecs_;
-  std::unique_ptr<std::thread> updateThread_;
-  std::condition_variable updateThreadCondVar_;
-  std::mutex updateThreadMutex_;
-  std::atomic_bool stopFlag_{false};
-  std::atomic_bool onDemandSignal_{false};
+  uint64_t updateTaskId_{0};
+  // eventfd written by the signal handler, watched by a scheduler task
+  int signalFd_{-1};
+  uint64_t signalTaskId_{0};
+  // Watches the daemon reply descriptor, if any
+  uint64_t daemonTaskId_{0};
+  // Config received from the daemon, consumed by the update task
+  std::string daemonReply_;
+
+  // Null if inotify is unavailable, in which case files are polled
+  std::unique_ptr<FileWatcher> fileWatcher_;
+  // Set by file watcher callbacks
+  bool baseConfigChanged_{false};
+  bool onDemandFileChanged_{false};
+  // Used to skip parsing unchanged files
+  size_t configHash_;
+  size_t onDemandConfigHash_{0};
+  // Used to skip reading unchanged files when polling
+  struct stat configFileStat_{};
+
+  // Null unless enabled in the base config
+  std::unique_ptr<ControlServer> controlServer_;
+
+  // Update task state
+  std::unique_ptr<Config> onDemandConfig_;
+  std::chrono::time_point<std::chrono::high_resolution_clock>
+      nextConfigLoadTime_;
+  std::chrono::time_point<std::chrono::high_resolution_clock>
+      nextOnDemandLoadTime_;
+  std::chrono::time_point<std::chrono::high_resolution_clock>
+      nextLogLevelResetTime_;
 };
 
 } // namespace KINETO_NAMESPACE
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ControlServer.h"
+
+#include <unistd.h>
+
+#include "Scheduler.h"
+
+#include "Logger.h"
+
+namespace KINETO_NAMESPACE {
+
+void ControlServer::parseRequest(
+    const std::string& request,
+    std::string& command,
+    std::string& payload) {
+  size_t pos = request.find('\n');
+  if (pos == std::string::npos) {
+    command = request;
+    payload.clear();
+  } else {
+    command = request.substr(0, pos);
+    payload = request.substr(pos + 1);
+  }
+}
+
+ControlServer::ControlServer(Handler handler)
+    : socket_(socketName(getpid())), handler_(std::move(handler)) {
+  LOG(INFO) << "Listening for requests on @" << socket_.name();
+  taskId_ = Scheduler::instance().watch(
+      "control server",
+      socket_.fd(),
+      Scheduler::TimePoint::max(),
+      [this](const Scheduler::TimePoint&) {
+        handleRequests();
+        return Scheduler::TimePoint::max();
+      });
+}
+
+ControlServer::~ControlServer() {
+  Scheduler::instance().cancel(taskId_);
+}
+
+void ControlServer::handleRequests() {
+  std::string request;
+  std::string src;
+  std::string command;
+  std::string payload;
+  int fd;
+  struct ucred cred;
+  while (socket_.recv(request, src, fd, cred)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!IpcSocket::trusted(cred)) {
+      LOG(WARNING) << "Ignoring request from @" << src << " (pid " << cred.pid
+                   << ", uid " << cred.uid << ")";
+      continue;
+    }
+    parseRequest(request, command, payload);
+    VLOG(0) << "Received '" << command << "' request from @" << src;
+    std::string reply = handler_(command, payload);
+    if (!src.empty() && !socket_.send(src, reply)) {
+      PLOG(WARNING) << "Failed to reply to @" << src;
+    }
+  }
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <functional>
+#include <string>
+
+#include "IpcSocket.h"
+
+namespace KINETO_NAMESPACE {
+
+// Control endpoint for a single process, on the abstract Unix socket
+// named by socketName(pid). Each request is one datagram,
+// "<command>\n<payload>", and is answered with one reply datagram.
+// Requests are handled on the scheduler thread. Requests from other
+// users than the process's effective user, except root, are dropped.
+class ControlServer {
+ public:
+  // Returns the reply to a request
+  using Handler = std::function<std::string(
+      const std::string& command,
+      const std::string& payload)>;
+
+  // Throws std::system_error if the socket cannot be created
+  explicit ControlServer(Handler handler);
+  ~ControlServer();
+  ControlServer(const ControlServer&) = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+
+  // Inline so that clients need not link the server
+  static std::string socketName(pid_t pid) {
+    return "libkineto_" + std::to_string(pid);
+  }
+
+  // Split a request into command and payload
+  static void parseRequest(
+      const std::string& request,
+      std::string& command,
+      std::string& payload);
+
+ private:
+  void handleRequests();
+
+  IpcSocket socket_;
+  Handler handler_;
+  uint64_t taskId_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -52,6 +52,7 @@ struct RuntimeActivity : public CuptiActivity<CUpti_ActivityAPI> {
   int64_t resourceId() const override {return activity_.threadId;}
   ActivityType type() const override {return ActivityType::CUDA_RUNTIME;}
   const std::string name() const override {return runtimeCbidName(activity_.cbid);}
+  StringView nameView() const override {return runtimeCbidName(activity_.cbid);}
   void log(ActivityLogger& logger) const override;
 };
 
@@ -64,7 +65,8 @@ struct GpuActivity : public CuptiActivity<T> {
   int64_t deviceId() const override {return raw().deviceId;}
   int64_t resourceId() const override {return raw().streamId;}
   ActivityType type() const override;
-  const std::string name() const override;
+  const std::string name() const override {return nameView().str();}
+  StringView nameView() const override;
   void log(ActivityLogger& logger) const override;
   const T& raw() const {return CuptiActivity<T>::raw();}
 };
@@ -7,8 +7,6 @@
 
 #include "CuptiActivity.h"
 
-#include <fmt/format.h>
-
 #include "Demangle.h"
 #include "output_base.h"
 
@@ -17,8 +15,8 @@ namespace KINETO_NAMESPACE {
 using namespace libkineto;
 
 template<>
-inline const std::string GpuActivity<CUpti_ActivityKernel4>::name() const {
-  return demangle(raw().name);
+inline StringView GpuActivity<CUpti_ActivityKernel4>::nameView() const {
+  return demangleCached(raw().name);
 }
 
 template<>
@@ -26,21 +24,13 @@ inline ActivityType GpuActivity<CUpti_ActivityKernel4>::type() const {
   return ActivityType::CONCURRENT_KERNEL;
 }
 
-static inline std::string memcpyName(uint8_t kind, uint8_t src, uint8_t dst) {
-  return fmt::format(
-      "Memcpy {} ({} -> {})",
-      memcpyKindString((CUpti_ActivityMemcpyKind)kind),
-      memoryKindString((CUpti_ActivityMemoryKind)src),
-      memoryKindString((CUpti_ActivityMemoryKind)dst));
-}
-
 template<>
 inline ActivityType GpuActivity<CUpti_ActivityMemcpy>::type() const {
   return ActivityType::GPU_MEMCPY;
 }
 
 template<>
-inline const std::string GpuActivity<CUpti_ActivityMemcpy>::name() const {
+inline StringView GpuActivity<CUpti_ActivityMemcpy>::nameView() const {
   return memcpyName(raw().copyKind, raw().srcKind, raw().dstKind);
 }
 
@@ -50,15 +40,13 @@ inline ActivityType GpuActivity<CUpti_ActivityMemcpy2>::type() const {
 }
 
 template<>
-inline const std::string GpuActivity<CUpti_ActivityMemcpy2>::name() const {
+inline StringView GpuActivity<CUpti_ActivityMemcpy2>::nameView() const {
   return memcpyName(raw().copyKind, raw().srcKind, raw().dstKind);
 }
 
 template<>
-inline const std::string GpuActivity<CUpti_ActivityMemset>::name() const {
-  const char* memory_kind =
-    memoryKindString((CUpti_ActivityMemoryKind)raw().memoryKind);
-  return fmt::format("Memset ({})", memory_kind);
+inline StringView GpuActivity<CUpti_ActivityMemset>::nameView() const {
+  return memsetName(raw().memoryKind);
 }
 
 template<>
@@ -10,12 +10,32 @@
 #include <cupti.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <limits>
+#include <memory>
 
 #include "TraceActivity.h"
 #include "cupti_strings.h"
 
 namespace KINETO_NAMESPACE {
 
+// Summary of the records in a buffer, collected when CUPTI hands the
+// buffer over, so that buffers outside of the capture window can be
+// dropped without processing every record.
+struct CuptiActivityBufferIndex {
+  // Time range in microseconds of all records with timestamps
+  int64_t minStart{std::numeric_limits<int64_t>::max()};
+  int64_t maxEnd{std::numeric_limits<int64_t>::min()};
+  int runtimeCount{0};
+  // Kernels, memcpys and memsets
+  int gpuCount{0};
+  int correlationCount{0};
+  int otherCount{0};
+
+  bool hasTimestamps() const {
+    return minStart <= maxEnd;
+  }
+};
+
 class CuptiActivityBuffer {
  public:
   // data must be allocated using malloc.
@@ -23,15 +43,38 @@ class CuptiActivityBuffer {
   CuptiActivityBuffer(uint8_t* data, size_t validSize)
       : data(data), validSize(validSize) {}
 
+  // Buffer spilled to disk at the given offset of the spill file.
+  // Data is set when the spill file is mapped.
+  CuptiActivityBuffer(int64_t spillOffset, size_t validSize)
+      : validSize(validSize), spillOffset(spillOffset) {}
+
   ~CuptiActivityBuffer() {
-    free(data);
+    if (!spilled()) {
+      free(data);
+    }
+  }
+
+  bool spilled() const {
+    return spillOffset >= 0;
+  }
+
+  void setSpillMapping(std::shared_ptr<uint8_t> mapping) {
+    data = mapping.get() + spillOffset;
+    spillMapping_ = std::move(mapping);
   }
 
-  // Allocated by malloc
+  // Allocated by malloc, or points into the spill file mapping
   uint8_t* data{nullptr};
 
   // Number of bytes used
   size_t validSize;
+
+  int64_t spillOffset{-1};
+
+  CuptiActivityBufferIndex index;
+
+ private:
+  std::shared_ptr<uint8_t> spillMapping_;
 };
 
 } // namespace KINETO_NAMESPACE
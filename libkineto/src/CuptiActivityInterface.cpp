@@ -7,7 +7,9 @@
 
 #include "CuptiActivityInterface.h"
 
+#include <algorithm>
 #include <chrono>
+#include <system_error>
 
 #include "cupti_call.h"
 
@@ -22,21 +24,79 @@ namespace KINETO_NAMESPACE {
 // that has many small memcpy such as sparseNN)
 // Consider putting this on huge pages?
 constexpr size_t kBufSize(2 * 1024 * 1024);
+// Records are discarded in standby, so keep buffers small and recycle them
+constexpr size_t kStandbyBufSize(256 * 1024);
+constexpr size_t kStandbyBufferPoolSize(4);
+// Report standby stats periodically while in standby
+constexpr int kStandbyStatsBufferInterval(10000);
+// Spilling blocks the CUPTI thread completing a buffer. A buffer is
+// normally written in a few ms - stop spilling if the disk is much slower.
+constexpr milliseconds kMaxSpillWriteTime(50);
 
 CuptiActivityInterface& CuptiActivityInterface::singleton() {
   static CuptiActivityInterface instance;
   return instance;
 }
 
+std::atomic_bool CuptiActivityInterface::correlationMirroring_{false};
+
+namespace {
+// Correlation ids of the ops in flight on this thread.
+// The bottom mirrored ids have also been pushed to CUPTI.
+struct CorrelationStack {
+  std::vector<int> ids;
+  size_t mirrored{0};
+};
+thread_local CorrelationStack correlationStack;
+
+CuptiActivityInterface::PushCorrelationFn pushCorrelationFn =
+    cuptiActivityPushExternalCorrelationId;
+CuptiActivityInterface::PopCorrelationFn popCorrelationFn =
+    cuptiActivityPopExternalCorrelationId;
+} // namespace
+
 void CuptiActivityInterface::pushCorrelationID(int id) {
   VLOG(2) << "pushCorrelationID(" << id << ")";
-  CUPTI_CALL(cuptiActivityPushExternalCorrelationId(
-      CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, id));
+  auto& stack = correlationStack;
+  stack.ids.push_back(id);
+  if (correlationMirroring_.load(std::memory_order_relaxed)) {
+    // Catch up with ops started before recording was enabled
+    while (stack.mirrored < stack.ids.size()) {
+      CUPTI_CALL(pushCorrelationFn(
+          CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0,
+          stack.ids[stack.mirrored++]));
+    }
+  }
 }
 
 void CuptiActivityInterface::popCorrelationID() {
-  CUPTI_CALL(cuptiActivityPopExternalCorrelationId(
-      CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, nullptr));
+  auto& stack = correlationStack;
+  if (stack.ids.empty()) {
+    LOG_EVERY_N(WARNING, 1000) << "Unbalanced correlation id pop";
+    return;
+  }
+  // Keep CUPTI balanced, also after recording has stopped
+  if (stack.mirrored == stack.ids.size()) {
+    CUPTI_CALL(popCorrelationFn(
+        CUPTI_EXTERNAL_CORRELATION_KIND_CUSTOM0, nullptr));
+    stack.mirrored--;
+  }
+  stack.ids.pop_back();
+}
+
+void CuptiActivityInterface::setCorrelationMirroring(
+    const std::set<ActivityType>& selected_activities,
+    bool enable) {
+  if (selected_activities.count(ActivityType::EXTERNAL_CORRELATION)) {
+    correlationMirroring_ = enable;
+  }
+}
+
+void CuptiActivityInterface::setCorrelationFunctions(
+    PushCorrelationFn push,
+    PopCorrelationFn pop) {
+  pushCorrelationFn = push ? push : cuptiActivityPushExternalCorrelationId;
+  popCorrelationFn = pop ? pop : cuptiActivityPopExternalCorrelationId;
 }
 
 static int getSMCount() {
@@ -71,7 +131,7 @@ int CuptiActivityInterface::smCount() {
   return sm_count;
 }
 
-static bool nextActivityRecord(
+bool CuptiActivityInterface::nextActivityRecord(
     uint8_t* buffer,
     size_t valid_size,
     CUpti_Activity*& record) {
@@ -90,15 +150,62 @@ void CuptiActivityInterface::setMaxBufferSize(int size) {
   maxGpuBufferCount_ = 1 + size / kBufSize;
 }
 
+void CuptiActivityInterface::setSpillDirectory(const std::string& dir) {
+  std::unique_ptr<ActivitySpillFile> spill_file;
+  if (!dir.empty()) {
+    try {
+      spill_file = std::make_unique<ActivitySpillFile>(
+          dir, maxGpuBufferCount_ * kBufSize);
+    } catch (const std::system_error& e) {
+      LOG(ERROR) << "Activity buffer spilling disabled: " << e.what();
+    }
+  }
+  std::lock_guard<std::mutex> guard(bufferMutex_);
+  spillFile_ = std::move(spill_file);
+  spillTooSlow_ = false;
+}
+
+void CuptiActivityInterface::invokeStopCollectionCallback() {
+  std::lock_guard<std::mutex> guard(callbackMutex_);
+  if (stopCollectionCallback_) {
+    stopCollectionCallback_();
+  }
+}
+
 void CUPTIAPI CuptiActivityInterface::bufferRequested(
     uint8_t** buffer,
     size_t* size,
     size_t* maxNumRecords) {
-  if (singleton().allocatedGpuBufferCount > singleton().maxGpuBufferCount_) {
-    singleton().stopCollection = true;
-    LOG(WARNING) << "Exceeded max GPU buffer count ("
-                 << singleton().allocatedGpuBufferCount
-                 << ") - terminating tracing";
+  auto& cupti = singleton();
+  if (cupti.standby_) {
+    *size = kStandbyBufSize;
+    *maxNumRecords = 0;
+    *buffer = cupti.standbyBuffer();
+    cupti.allocatedGpuBufferCount++;
+    return;
+  }
+
+  if (cupti.allocatedGpuBufferCount > cupti.maxGpuBufferCount_) {
+    bool spilling;
+    {
+      std::lock_guard<std::mutex> guard(cupti.bufferMutex_);
+      spilling = cupti.spillFile_ && !cupti.spillTooSlow_;
+    }
+    // When spilling, completed buffers only need to be flushed to disk,
+    // unless CUPTI itself holds on to more than twice the limit
+    if (spilling &&
+        cupti.allocatedGpuBufferCount <= 2 * cupti.maxGpuBufferCount_) {
+      if (!cupti.flushRequested.exchange(true)) {
+        cupti.invokeStopCollectionCallback();
+      }
+    } else {
+      LOG(WARNING) << "Exceeded max GPU buffer count ("
+                   << cupti.allocatedGpuBufferCount
+                   << ") - terminating tracing";
+      if (!cupti.stopCollection.exchange(true)) {
+        cupti.invokeStopCollectionCallback();
+      }
+    }
   }
 
   *size = kBufSize;
@@ -109,7 +216,119 @@ void CUPTIAPI CuptiActivityInterface::bufferRequested(
   // if we allocated new space from the heap)
   *buffer = (uint8_t*) malloc(kBufSize);
 
-  singleton().allocatedGpuBufferCount++;
+  cupti.allocatedGpuBufferCount++;
+}
+
+uint8_t* CuptiActivityInterface::standbyBuffer() {
+  std::lock_guard<std::mutex> guard(standbyMutex_);
+  if (standbyBufferPool_.empty()) {
+    return (uint8_t*) malloc(kStandbyBufSize);
+  }
+  uint8_t* buffer = standbyBufferPool_.back();
+  standbyBufferPool_.pop_back();
+  return buffer;
+}
+
+void CuptiActivityInterface::recycleStandbyBuffer(
+    uint8_t* buffer,
+    size_t size,
+    size_t validSize) {
+  standbyBytes_ += validSize;
+  if (++standbyBufferCount_ % kStandbyStatsBufferInterval == 0) {
+    logStandbyStats();
+  }
+  {
+    std::lock_guard<std::mutex> guard(standbyMutex_);
+    // Full size trace buffers completing after the trace are released
+    if (size == kStandbyBufSize &&
+        standbyBufferPool_.size() < kStandbyBufferPoolSize) {
+      standbyBufferPool_.push_back(buffer);
+      return;
+    }
+  }
+  free(buffer);
+}
+
+void CuptiActivityInterface::enterStandby(
+    const std::set<ActivityType>& selected_activities) {
+  // Complete the buffers of the trace before discarding records.
+  // Buffers completed by CUPTI threads after this are discarded, so the
+  // trace buffers can be detached without racing with new completions.
+  CUPTI_CALL(cuptiActivityFlushAll(0));
+  standbyStartTime_ = steady_clock::now();
+  standbyBufferCount_ = 0;
+  standbyBytes_ = 0;
+  {
+    std::lock_guard<std::mutex> guard(bufferMutex_);
+    standby_ = true;
+  }
+  // Activities may have been disabled when sampling iterations
+  enableCuptiActivities(selected_activities);
+  standbyActivities_ = selected_activities;
+  // Records are discarded, so correlation is not needed
+  setCorrelationMirroring(selected_activities, false);
+  LOG(INFO) << "GPU tracing in standby";
+}
+
+bool CuptiActivityInterface::exitStandby(
+    const std::set<ActivityType>& selected_activities) {
+  if (!standby_) {
+    return false;
+  }
+  // Discard records so far
+  CUPTI_CALL(cuptiActivityFlushAll(0));
+  standby_ = false;
+  logStandbyStats();
+  if (selected_activities != standbyActivities_) {
+    disableCuptiActivities(standbyActivities_);
+    return false;
+  }
+  setCorrelationMirroring(selected_activities, true);
+  return true;
+}
+
+CuptiActivityInterface::StandbyStats CuptiActivityInterface::standbyStats()
+    const {
+  return {duration_cast<seconds>(steady_clock::now() - standbyStartTime_),
+          standbyBufferCount_,
+          standbyBytes_};
+}
+
+void CuptiActivityInterface::logStandbyStats() const {
+  auto stats = standbyStats();
+  double secs = std::max<int64_t>(stats.duration.count(), 1);
+  LOG(INFO) << "GPU tracing standby for " << stats.duration.count()
+            << "s: discarded " << stats.bytes / 1024 << " KB of activity"
+            << " records in " << stats.bufferCount << " buffers ("
+            << stats.bytes / secs / 1024 << " KB/s)";
+}
+
+void CuptiActivityInterface::flushActivities() {
+  flushRequested = false;
+  CUPTI_CALL(cuptiActivityFlushAll(0));
+}
+
+void CuptiActivityInterface::mapSpilledBuffers() {
+  auto mapping = spillFile_->map();
+  double write_secs = spillFile_->writeTime().count() / 1e6;
+  LOG(INFO) << "Spilled " << spillFile_->bufferCount()
+            << " GPU buffers (" << spillFile_->size() / 1024 / 1024
+            << " MB) to disk at "
+            << (write_secs > 0 ? spillFile_->size() / write_secs / 1024 / 1024
+                               : 0)
+            << " MB/s";
+  // Spill file is single use - a new one is created for the next trace
+  spillFile_ = nullptr;
+  for (auto it = gpuTraceBuffers_->begin(); it != gpuTraceBuffers_->end();) {
+    if (!it->spilled()) {
+      ++it;
+    } else if (mapping) {
+      it->setSpillMapping(mapping);
+      ++it;
+    } else {
+      it = gpuTraceBuffers_->erase(it);
+    }
+  }
 }
 
 std::unique_ptr<std::list<CuptiActivityBuffer>> CuptiActivityInterface::activityBuffers() {
@@ -123,34 +342,12 @@ std::unique_ptr<std::list<CuptiActivityBuffer>> CuptiActivityInterface::activity
     flushOverhead =
         duration_cast<microseconds>(high_resolution_clock::now() - t1).count();
   }
-  return std::move(gpuTraceBuffers_);
-}
-
-int CuptiActivityInterface::processActivitiesForBuffer(
-    uint8_t* buf,
-    size_t validSize,
-    std::function<void(const CUpti_Activity*)> handler) {
-  int count = 0;
-  if (buf && validSize) {
-    CUpti_Activity* record{nullptr};
-    while ((nextActivityRecord(buf, validSize, record))) {
-      handler(record);
-      ++count;
-    }
-  }
-  return count;
-}
-
-const std::pair<int, int> CuptiActivityInterface::processActivities(
-    std::list<CuptiActivityBuffer>& buffers,
-    std::function<void(const CUpti_Activity*)> handler) {
-  std::pair<int, int> res{0, 0};
-  for (auto& buf : buffers) {
-    // No lock needed - only accessed from this thread
-    res.first += processActivitiesForBuffer(buf.data, buf.validSize, handler);
-    res.second += buf.validSize;
+  std::lock_guard<std::mutex> guard(bufferMutex_);
+  if (gpuTraceBuffers_ && spillFile_ && spillFile_->size() > 0) {
+    mapSpilledBuffers();
   }
-  return res;
+  residentGpuBufferCount_ = 0;
+  return std::move(gpuTraceBuffers_);
 }
 
 void CuptiActivityInterface::clearActivities() {
@@ -159,30 +356,127 @@ void CuptiActivityInterface::clearActivities() {
   // the same memory during warmup and tracing.
   // Also, try to use the amount of memory required
   // for active tracing during warmup.
+  std::lock_guard<std::mutex> guard(bufferMutex_);
   if (gpuTraceBuffers_) {
     gpuTraceBuffers_->clear();
   }
+  residentGpuBufferCount_ = 0;
+  if (spillFile_) {
+    spillFile_->clear();
+  }
+}
+
+template <class T>
+static void indexTimedRecord(
+    const CUpti_Activity* record,
+    CuptiActivityBufferIndex& index) {
+  const T* act = reinterpret_cast<const T*>(record);
+  index.minStart = std::min<int64_t>(index.minStart, act->start / 1000);
+  index.maxEnd = std::max<int64_t>(index.maxEnd, act->end / 1000);
 }
 
-void CuptiActivityInterface::addActivityBuffer(uint8_t* buffer, size_t validSize) {
+CuptiActivityBufferIndex CuptiActivityInterface::indexActivityBuffer(
+    uint8_t* buf,
+    size_t validSize) {
+  CuptiActivityBufferIndex index;
+  CUpti_Activity* record{nullptr};
+  while (buf && validSize && nextActivityRecord(buf, validSize, record)) {
+    switch (record->kind) {
+      case CUPTI_ACTIVITY_KIND_EXTERNAL_CORRELATION:
+        index.correlationCount++;
+        break;
+      case CUPTI_ACTIVITY_KIND_RUNTIME:
+        indexTimedRecord<CUpti_ActivityAPI>(record, index);
+        index.runtimeCount++;
+        break;
+      case CUPTI_ACTIVITY_KIND_CONCURRENT_KERNEL:
+        indexTimedRecord<CUpti_ActivityKernel4>(record, index);
+        index.gpuCount++;
+        break;
+      case CUPTI_ACTIVITY_KIND_MEMCPY:
+        indexTimedRecord<CUpti_ActivityMemcpy>(record, index);
+        index.gpuCount++;
+        break;
+      case CUPTI_ACTIVITY_KIND_MEMCPY2:
+        indexTimedRecord<CUpti_ActivityMemcpy2>(record, index);
+        index.gpuCount++;
+        break;
+      case CUPTI_ACTIVITY_KIND_MEMSET:
+        indexTimedRecord<CUpti_ActivityMemset>(record, index);
+        index.gpuCount++;
+        break;
+      default:
+        index.otherCount++;
+        break;
+    }
+  }
+  return index;
+}
+
+bool CuptiActivityInterface::addActivityBuffer(uint8_t* buffer, size_t validSize) {
+  auto index = indexActivityBuffer(buffer, validSize);
+  std::lock_guard<std::mutex> guard(bufferMutex_);
+  if (standby_) {
+    // Standby was entered after this buffer was completed
+    return false;
+  }
+  completedBytes_ += validSize;
   if (!gpuTraceBuffers_) {
     gpuTraceBuffers_ = std::make_unique<std::list<CuptiActivityBuffer>>();
   }
+  if (spillActivityBuffer(buffer, validSize, index)) {
+    return true;
+  }
   gpuTraceBuffers_->emplace_back(buffer, validSize);
+  gpuTraceBuffers_->back().index = index;
+  residentGpuBufferCount_++;
+  return true;
+}
+
+bool CuptiActivityInterface::spillActivityBuffer(
+    uint8_t* buffer,
+    size_t validSize,
+    const CuptiActivityBufferIndex& index) {
+  // Spill once completed and outstanding buffers reach the limit
+  if (!spillFile_ || spillTooSlow_ ||
+      residentGpuBufferCount_ + allocatedGpuBufferCount < maxGpuBufferCount_) {
+    return false;
+  }
+  auto start = steady_clock::now();
+  int64_t offset = spillFile_->append(buffer, validSize);
+  if (offset < 0) {
+    LOG_EVERY_N(WARNING, 100)
+        << "Failed to spill GPU buffer - keeping it in memory";
+    return false;
+  }
+  auto elapsed = steady_clock::now() - start;
+  if (elapsed > kMaxSpillWriteTime) {
+    // Buffers beyond the limit now terminate the trace as without spilling
+    LOG(WARNING) << "Spilling a GPU buffer took "
+                 << duration_cast<milliseconds>(elapsed).count()
+                 << "ms - no more buffers are spilled for this trace";
+    spillTooSlow_ = true;
+  }
+  free(buffer);
+  gpuTraceBuffers_->emplace_back(offset, validSize);
+  gpuTraceBuffers_->back().index = index;
+  return true;
 }
 
 void CUPTIAPI CuptiActivityInterface::bufferCompleted(
     CUcontext ctx,
     uint32_t streamId,
     uint8_t* buffer,
-    size_t /* unused */,
+    size_t size,
     size_t validSize) {
   singleton().allocatedGpuBufferCount--;
 
-  // lock should be uncessary here, because gpuTraceBuffers is read/written by
-  // profilerLoop only. CUPTI should handle the cuptiActivityFlushAll and
-  // bufferCompleted, so that there is no concurrency issues
-  singleton().addActivityBuffer(buffer, validSize);
+  if (singleton().standby_ ||
+      !singleton().addActivityBuffer(buffer, validSize)) {
+    // Not tracing - discard the records
+    singleton().recycleStandbyBuffer(buffer, size, validSize);
+    return;
+  }
 
   // report any records dropped from the queue; to avoid unnecessary cupti
   // API calls, we make it report only in verbose mode (it doesn't happen
@@ -222,8 +516,11 @@ void CuptiActivityInterface::enableCuptiActivities(
     }
   }
 
-  // Explicitly enabled, so reset this flag if set
+  setCorrelationMirroring(selected_activities, true);
+
+  // Explicitly enabled, so reset these flags if set
   stopCollection = false;
+  flushRequested = false;
 }
 
 void CuptiActivityInterface::disableCuptiActivities(
@@ -245,6 +542,7 @@ void CuptiActivityInterface::disableCuptiActivities(
       CUPTI_CALL(cuptiActivityDisable(CUPTI_ACTIVITY_KIND_RUNTIME));
     }
   }
+  setCorrelationMirroring(selected_activities, false);
 }
 
 } // namespace KINETO_NAMESPACE
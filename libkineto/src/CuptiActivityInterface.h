@@ -7,15 +7,20 @@
 
 #pragma once
 
+#include "ActivitySpillFile.h"
 #include "ActivityType.h"
 #include "CuptiActivityBuffer.h"
 
 #include <atomic>
+#include <chrono>
 #include <cupti.h>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace KINETO_NAMESPACE {
 
@@ -29,51 +34,186 @@ class CuptiActivityInterface {
   static CuptiActivityInterface& singleton();
 
   int smCount();
+
+  // Correlation ids are kept on a thread local stack, and only mirrored
+  // to CUPTI while external correlation activities are recorded.
+  // Ops already in flight when recording starts are mirrored at the next
+  // push on their thread.
   static void pushCorrelationID(int id);
   static void popCorrelationID();
 
+  static bool correlationMirroring() {
+    return correlationMirroring_;
+  }
+  // No-op unless external correlation is among the selected activities
+  static void setCorrelationMirroring(
+      const std::set<ActivityType>& selected_activities,
+      bool enable);
+
+  // CUPTI calls used for mirroring, replaceable so tests can observe them.
+  // Passing nullptr restores the CUPTI functions.
+  using PushCorrelationFn =
+      CUptiResult (*)(CUpti_ExternalCorrelationKind, uint64_t);
+  using PopCorrelationFn =
+      CUptiResult (*)(CUpti_ExternalCorrelationKind, uint64_t*);
+  static void setCorrelationFunctions(
+      PushCorrelationFn push,
+      PopCorrelationFn pop);
+
   void enableCuptiActivities(
     const std::set<ActivityType>& selected_activities);
   void disableCuptiActivities(
     const std::set<ActivityType>& selected_activities);
   void clearActivities();
 
-  void addActivityBuffer(uint8_t* buffer, size_t validSize);
+  // Returns false if the buffer was not kept because of standby
+  bool addActivityBuffer(uint8_t* buffer, size_t validSize);
   std::unique_ptr<std::list<CuptiActivityBuffer>> activityBuffers();
 
+  // Calls handler for each record in the buffers.
+  // Returns the number of records and bytes processed.
+  template <class Handler>
   const std::pair<int, int> processActivities(
       std::list<CuptiActivityBuffer>& buffers,
-      std::function<void(const CUpti_Activity*)> handler);
+      Handler&& handler);
 
   bool hasActivityBuffer() {
     return allocatedGpuBufferCount > 0;
   }
 
+  // Total size of activity records completed by CUPTI, excluding standby
+  int64_t completedBytes() const {
+    return completedBytes_;
+  }
+
   void setMaxBufferSize(int size);
 
+  // Spill completed buffers beyond the max buffer size to a file in dir,
+  // instead of terminating the trace. Disabled if dir is empty.
+  // Buffers are written on the CUPTI thread completing them, one buffer
+  // at a time. Spilling stops for the trace if a write is too slow, so
+  // that a slow disk delays at most one buffer completion.
+  void setSpillDirectory(const std::string& dir);
+
+  // Flush completed buffers so that they can be spilled
+  void flushActivities();
+
+  // In standby, activities stay enabled between traces and records are
+  // discarded into a small set of recycled buffers. This avoids the
+  // warmup needed after enabling activities for the next trace.
+  // Outstanding records are flushed into the trace buffers first, which
+  // are detached with activityBuffers() afterwards.
+  void enterStandby(const std::set<ActivityType>& selected_activities);
+
+  // Leave standby, discarding outstanding records. Returns true if
+  // the selected activities are already enabled and warmed up.
+  bool exitStandby(const std::set<ActivityType>& selected_activities);
+
+  bool inStandby() const {
+    return standby_;
+  }
+
+  // Activity records discarded in standby. This is the volume of records
+  // produced while idle, not the time spent producing them.
+  struct StandbyStats {
+    std::chrono::seconds duration;
+    int64_t bufferCount;
+    int64_t bytes;
+  };
+  StandbyStats standbyStats() const;
+
+  // Invoked (from a CUPTI thread) when stopCollection or flushRequested
+  // is first set, so that the profiler can react without waiting for
+  // its next step.
+  void setStopCollectionCallback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> guard(callbackMutex_);
+    stopCollectionCallback_ = std::move(callback);
+  }
+
   std::atomic_bool stopCollection{false};
+  // Set when buffers should be flushed to the spill file
+  std::atomic_bool flushRequested{false};
   int64_t flushOverhead{0};
 
  protected:
   CuptiActivityInterface() {}
 
  private:
-  int processActivitiesForBuffer(
+  static bool nextActivityRecord(
+      uint8_t* buffer,
+      size_t valid_size,
+      CUpti_Activity*& record);
+  static CuptiActivityBufferIndex indexActivityBuffer(
       uint8_t* buf,
+      size_t validSize);
+  // Returns true if the buffer was spilled to disk.
+  // Call with bufferMutex_ held.
+  bool spillActivityBuffer(
+      uint8_t* buffer,
       size_t validSize,
-      std::function<void(const CUpti_Activity*)> handler);
+      const CuptiActivityBufferIndex& index);
+  // Call with bufferMutex_ held
+  void mapSpilledBuffers();
+  void invokeStopCollectionCallback();
+  uint8_t* standbyBuffer();
+  void recycleStandbyBuffer(uint8_t* buffer, size_t size, size_t validSize);
+  void logStandbyStats() const;
   static void CUPTIAPI
   bufferRequested(uint8_t** buffer, size_t* size, size_t* maxNumRecords);
   static void CUPTIAPI bufferCompleted(
       CUcontext ctx,
       uint32_t streamId,
       uint8_t* buffer,
-      size_t /* unused */,
+      size_t size,
       size_t validSize);
 
+  // Set while external correlation activities are recorded
+  static std::atomic_bool correlationMirroring_;
+
+  std::mutex callbackMutex_;
+  std::function<void()> stopCollectionCallback_;
+
   int maxGpuBufferCount_{0};
   int allocatedGpuBufferCount{0};
+  std::atomic<int64_t> completedBytes_{0};
+  // Buffers are completed on CUPTI threads while the profiler thread
+  // takes or clears them, and sets up spilling for the next trace.
+  // Not held while flushing, since CUPTI completes buffers from within.
+  std::mutex bufferMutex_;
+  // Completed buffers held in memory, protected by bufferMutex_
+  int residentGpuBufferCount_{0};
   std::unique_ptr<std::list<CuptiActivityBuffer>> gpuTraceBuffers_;
+  std::unique_ptr<ActivitySpillFile> spillFile_;
+  // Set when writing a buffer was too slow, protected by bufferMutex_
+  bool spillTooSlow_{false};
+
+  // Standby state. Buffers are requested and completed on CUPTI threads.
+  std::atomic_bool standby_{false};
+  std::set<ActivityType> standbyActivities_;
+  std::mutex standbyMutex_;
+  std::vector<uint8_t*> standbyBufferPool_;
+  std::chrono::time_point<std::chrono::steady_clock> standbyStartTime_;
+  std::atomic<int64_t> standbyBufferCount_{0};
+  std::atomic<int64_t> standbyBytes_{0};
 };
 
+template <class Handler>
+const std::pair<int, int> CuptiActivityInterface::processActivities(
+    std::list<CuptiActivityBuffer>& buffers,
+    Handler&& handler) {
+  std::pair<int, int> res{0, 0};
+  for (auto& buf : buffers) {
+    // No lock needed - only accessed from this thread
+    if (buf.data && buf.validSize) {
+      CUpti_Activity* record{nullptr};
+      while (nextActivityRecord(buf.data, buf.validSize, record)) {
+        handler(record);
+        ++res.first;
+      }
+    }
+    res.second += buf.validSize;
+  }
+  return res;
+}
+
 } // namespace KINETO_NAMESPACE
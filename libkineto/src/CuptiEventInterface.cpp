@@ -89,6 +89,23 @@ void CuptiEventInterface::readEvent(
       reinterpret_cast<uint64_t*>(vals.data())));
 }
 
+void CuptiEventInterface::readAllEvents(
+    CUpti_EventGroup grp,
+    vector<int64_t>& vals,
+    vector<CUpti_EventID>& ids) {
+  size_t vals_size = sizeof(int64_t) * vals.size();
+  size_t ids_size = sizeof(CUpti_EventID) * ids.size();
+  size_t num_read = 0;
+  CUPTI_CALL(cuptiEventGroupReadAllEvents(
+      grp,
+      CUPTI_EVENT_READ_FLAG_NONE,
+      &vals_size,
+      reinterpret_cast<uint64_t*>(vals.data()),
+      &ids_size,
+      ids.data(),
+      &num_read));
+}
+
 vector<CUpti_EventID> CuptiEventInterface::eventsInGroup(CUpti_EventGroup grp) {
   uint32_t group_size = 0;
   size_t s = sizeof(group_size);
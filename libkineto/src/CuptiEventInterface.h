@@ -10,6 +10,7 @@
 #include <cupti.h>
 #include <queue>
 #include <string>
+#include <vector>
 
 namespace KINETO_NAMESPACE {
 
@@ -38,6 +39,14 @@ class CuptiEventInterface {
 
   virtual void
   readEvent(CUpti_EventGroup g, CUpti_EventID id, std::vector<int64_t>& vals);
+  // Read all events in a group with a single call.
+  // vals must hold (instances x events) values and ids one entry per event.
+  // Values are laid out by domain instance: vals[instance * ids.size() + i]
+  // is the value of event ids[i]. Event ids are written in CUPTI's order.
+  virtual void readAllEvents(
+      CUpti_EventGroup g,
+      std::vector<int64_t>& vals,
+      std::vector<CUpti_EventID>& ids);
   virtual std::vector<CUpti_EventID> eventsInGroup(CUpti_EventGroup g);
 
   virtual CUpti_EventID eventId(const std::string& name);
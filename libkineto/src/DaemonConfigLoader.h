@@ -19,9 +19,29 @@ class DaemonConfigLoader {
   // Return a configuration string from the daemon, if one has been posted.
   virtual std::string readOnDemandConfig(bool events, bool activities) = 0;
 
+  // For daemons that reply asynchronously, a descriptor that becomes
+  // readable when a reply has arrived, or -1. When set,
+  // readOnDemandConfig() sends the request without waiting for the reply,
+  // and the posted configuration is returned by readReply() instead.
+  virtual int replyFd() {
+    return -1;
+  }
+
+  // Consume replies without blocking and return a posted configuration,
+  // or an empty string if there is none.
+  virtual std::string readReply() {
+    return "";
+  }
+
   // Returns the number of tracked contexts for this device. The daemon has a
   // global view. If an unexpedted error occurs, return -1.
   virtual int gpuContextCount(uint32_t device) = 0;
+
+  // Notifications of context creation and destruction in this process,
+  // for daemons that track contexts themselves. Called from CUPTI
+  // callbacks, so must not block.
+  virtual void gpuContextCreated(uint32_t device) {}
+  virtual void gpuContextDestroyed(uint32_t device) {}
 };
 
 } // namespace KINETO_NAMESPACE
@@ -8,8 +8,13 @@
 #include "Demangle.h"
 
 #include <cxxabi.h>
+#include <stdint.h>
 #include <string.h>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 namespace KINETO_NAMESPACE {
 
@@ -36,4 +41,88 @@ std::string demangle(const char* name) {
   return res;
 }
 
+namespace {
+
+struct StringViewHash {
+  size_t operator()(libkineto::StringView s) const {
+    // FNV-1a
+    size_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < s.size(); i++) {
+      hash = (hash ^ (unsigned char)s.data()[i]) * 1099511628211ull;
+    }
+    return hash;
+  }
+};
+
+// Kernel names are usually a few hundred bytes,
+// so this keeps the cache below a few tens of MB
+constexpr size_t kMaxCachedNames = 64 * 1024;
+
+struct DemangledNames {
+  std::mutex mutex;
+  // Mangled and demangled names. A deque never moves its elements,
+  // so views into them stay valid.
+  std::deque<std::pair<std::string, std::string>> names;
+  std::unordered_map<
+      libkineto::StringView,
+      libkineto::StringView,
+      StringViewHash>
+      index;
+};
+
+// Records of the same kernel share the name string, so recent lookups
+// are cached per thread by pointer, and found without taking the lock.
+// The contents are compared too, in case the string was replaced.
+struct RecentName {
+  const char* name{nullptr};
+  libkineto::StringView mangled;
+  libkineto::StringView demangled;
+};
+constexpr size_t kRecentNames = 64;
+
+} // namespace
+
+// Sets views of the cached mangled and demangled names.
+// Returns false if the name is not cached and the cache is full.
+static bool demangleShared(
+    const char* name,
+    std::pair<libkineto::StringView, libkineto::StringView>& entry) {
+  static DemangledNames cache;
+  std::lock_guard<std::mutex> guard(cache.mutex);
+  auto it = cache.index.find(name);
+  if (it == cache.index.end()) {
+    if (cache.names.size() >= kMaxCachedNames) {
+      return false;
+    }
+    cache.names.emplace_back(name, demangle(name));
+    const auto& added = cache.names.back();
+    it = cache.index.emplace(added.first, added.second).first;
+  }
+  entry = *it;
+  return true;
+}
+
+libkineto::StringView demangleCached(const char* name) {
+  if (!name) {
+    return {};
+  }
+  static thread_local RecentName recent[kRecentNames];
+  RecentName& slot =
+      recent[(reinterpret_cast<uintptr_t>(name) >> 4) % kRecentNames];
+  if (slot.name == name &&
+      strncmp(name, slot.mangled.data(), slot.mangled.size()) == 0 &&
+      name[slot.mangled.size()] == '\0') {
+    return slot.demangled;
+  }
+  // Views into the shared cache, which never drops names
+  std::pair<libkineto::StringView, libkineto::StringView> entry;
+  if (!demangleShared(name, entry)) {
+    static thread_local std::string uncached;
+    uncached = demangle(name);
+    return uncached;
+  }
+  slot = {name, entry.first, entry.second};
+  return entry.second;
+}
+
 } // namespace KINETO_NAMESPACE
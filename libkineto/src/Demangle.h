@@ -9,8 +9,16 @@
 
 #include <string>
 
+#include "StringView.h"
+
 namespace KINETO_NAMESPACE {
 
 std::string demangle(const char* name);
 
+// Demangled names are kept for the lifetime of the process,
+// so each distinct name is only demangled once. Thread safe.
+// Up to a bounded number of names are kept. Views of names beyond that
+// are only valid until the next call on the same thread.
+libkineto::StringView demangleCached(const char* name);
+
 } // namespace KINETO_NAMESPACE
@@ -15,6 +15,7 @@
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <numeric>
 #include <thread>
 #include <vector>
@@ -49,11 +50,8 @@ PercentileList& Event::percentiles(
     PercentileList& pcs,
     const SampleSlice& slice) const {
   vector<int64_t> instance_values;
-  instance_values.reserve(instanceCount);
-  for (int i = 0; i < instanceCount; i++) {
-    instance_values.push_back(sumInstance(i, slice));
-  }
-  return KINETO_NAMESPACE::percentiles(instance_values, pcs);
+  sumInstances(slice, instance_values);
+  return KINETO_NAMESPACE::percentilesInPlace(instance_values, pcs);
 }
 
 // Add up all samples for a given domain instance
@@ -68,15 +66,56 @@ int64_t Event::sumInstance(int i, const SampleSlice& slice) const {
   });
 }
 
+// Add up samples per domain instance, visiting each sample once.
+// The inner loop is over contiguous values so it can be vectorized.
+void Event::sumInstances(const SampleSlice& slice, vector<int64_t>& sums)
+    const {
+  sums.assign(instanceCount, 0);
+  auto r = toIdxRange(slice);
+  auto it = samples_.cbegin();
+  std::advance(it, r.first);
+  int64_t* dst = sums.data();
+  for (int s = 0; s < r.second; s++, ++it) {
+    const int64_t* src = it->second.data();
+    for (int i = 0; i < instanceCount; i++) {
+      dst[i] += src[i];
+    }
+  }
+}
+
+static inline int64_t sumValues(const vector<int64_t>& vals) {
+  return accumulate(vals.begin(), vals.end(), int64_t(0));
+}
+
 // Add up all samples across all domain instances
 int64_t Event::sumAll(const SampleSlice& slice) const {
+  auto r = toIdxRange(slice);
+  auto it = samples_.cbegin();
+  std::advance(it, r.first);
   int64_t res = 0;
-  for (int i = 0; i < instanceCount; i++) {
-    res += sumInstance(i, slice);
+  for (int s = 0; s < r.second; s++, ++it) {
+    res += sumValues(it->second);
   }
   return res;
 }
 
+void Event::addSample(
+    time_point<system_clock> timestamp,
+    const int64_t* values,
+    int stride) {
+  if (freeSamples_.empty()) {
+    samples_.emplace_back(timestamp, vector<int64_t>(instanceCount));
+  } else {
+    samples_.splice(samples_.end(), freeSamples_, freeSamples_.begin());
+    samples_.back().first = timestamp;
+    samples_.back().second.resize(instanceCount);
+  }
+  int64_t* dst = samples_.back().second.data();
+  for (int i = 0; i < instanceCount; i++) {
+    dst[i] = values[i * stride];
+  }
+}
+
 // Print raw sample values for all domains
 void Event::printSamples(ostream& s, CUdevice device) const {
   // Don't mess up output with interleaved lines
@@ -114,33 +153,44 @@ struct Metric::CalculatedValues Metric::calculate(
     map<CUpti_EventID, Event>& event_map,
     nanoseconds sample_duration,
     const SampleSlice& slice) {
-  vector<SampleValue> metric_values;
-  vector<int64_t> ev_values;
-  ev_values.reserve(events_.size());
+  map<CUpti_EventID, vector<int64_t>> instance_sums;
+  for (CUpti_EventID event_id : events_) {
+    event_map[event_id].sumInstances(slice, instance_sums[event_id]);
+  }
+  CalculatedValues res{{}, SampleValue(0)};
+  calculate(instance_sums, sample_duration, res);
+  return res;
+}
+
+void Metric::calculate(
+    const map<CUpti_EventID, vector<int64_t>>& instance_sums,
+    nanoseconds sample_duration,
+    CalculatedValues& result) {
+  auto& metric_values = result.perInstance;
+  metric_values.clear();
   if (evalMode_ & CUPTI_METRIC_EVALUATION_MODE_PER_INSTANCE) {
-    int instance_count = instanceCount(event_map);
+    int instance_count = instance_sums.at(events_[0]).size();
     metric_values.reserve(instance_count);
     for (int i = 0; i < instance_count; i++) {
-      ev_values.clear();
+      evValues_.clear();
       for (CUpti_EventID event_id : events_) {
-        ev_values.push_back(event_map[event_id].sumInstance(i, slice));
+        evValues_.push_back(instance_sums.at(event_id)[i]);
       }
       metric_values.push_back(cuptiMetrics_.calculate(
-          id_, valueKind_, events_, ev_values, sample_duration.count()));
+          id_, valueKind_, events_, evValues_, sample_duration.count()));
     }
   }
 
   // FIXME: Check assumption that all instances are profiled
-  ev_values.clear();
+  evValues_.clear();
   for (CUpti_EventID event_id : events_) {
-    ev_values.push_back(event_map[event_id].sumAll(slice));
+    evValues_.push_back(sumValues(instance_sums.at(event_id)));
   }
-  SampleValue total = cuptiMetrics_.calculate(
-      id_, valueKind_, events_, ev_values, sample_duration.count());
+  result.total = cuptiMetrics_.calculate(
+      id_, valueKind_, events_, evValues_, sample_duration.count());
   if (evalMode_ & CUPTI_METRIC_EVALUATION_MODE_AGGREGATE) {
-    metric_values.push_back(total);
+    metric_values.push_back(result.total);
   }
-  return {metric_values, std::move(total)};
 }
 
 void Metric::printDescription(ostream& s) const {
@@ -166,10 +216,18 @@ EventGroupSet::EventGroupSet(
     // Profile all domain instances
     cuptiEvents_.enablePerInstance(grp);
     uint32_t instance_count = cuptiEvents_.instanceCount(grp);
-    for (const auto& id : cuptiEvents_.eventsInGroup(grp)) {
+    GroupReadBuffer buf;
+    buf.group = grp;
+    buf.eventIds = cuptiEvents_.eventsInGroup(grp);
+    for (const auto& id : buf.eventIds) {
       VLOG(0) << "Instance count for " << id << ":" << instance_count;
-      events_[id].instanceCount = instance_count;
+      Event& ev = events_[id];
+      ev.instanceCount = instance_count;
+      buf.events.push_back(&ev);
     }
+    buf.readIds.resize(buf.eventIds.size());
+    buf.values.resize(buf.eventIds.size() * instance_count);
+    groups_.push_back(std::move(buf));
   }
 }
 
@@ -190,43 +248,56 @@ void EventGroupSet::setEnabled(bool enabled) {
   enabled_ = enabled;
 }
 
+// Check for overflowed counters.
+// Written without early exit so that the compiler can vectorize the scan.
+static bool hasOverflow(const vector<int64_t>& vals) {
+  const int64_t* v = vals.data();
+  const size_t size = vals.size();
+  bool overflow = false;
+  for (size_t i = 0; i < size; i++) {
+    overflow |= (static_cast<uint64_t>(v[i]) == CUPTI_EVENT_OVERFLOW);
+  }
+  return overflow;
+}
+
 // Collect counter values for each counter in group set
 void EventGroupSet::collectSample() {
   auto timestamp = high_resolution_clock::now();
-  for (int g = 0; g < set_.numEventGroups; g++) {
-    CUpti_EventGroup grp = set_.eventGroups[g];
-    for (const auto& id : cuptiEvents_.eventsInGroup(grp)) {
-      Event& ev = events_[id];
-      vector<int64_t> vals(ev.instanceCount);
-      // FIXME: Use cuptiEventGroupReadAllEvents
-      cuptiEvents_.readEvent(grp, id, vals);
-
-      if (VLOG_IS_ON(0)) {
-        for (int64_t v : vals) {
-          if (v == CUPTI_EVENT_OVERFLOW) {
-            LOG(WARNING) << "Counter overflow detected "
-                         << "- decrease sample period!" << endl;
-          }
+  bool overflow = false;
+  for (auto& grp : groups_) {
+    // CUPTI may return events in a different order than eventsInGroup,
+    // so preset the expected order and only look up events on mismatch.
+    std::copy(grp.eventIds.begin(), grp.eventIds.end(), grp.readIds.begin());
+    cuptiEvents_.readAllEvents(grp.group, grp.values, grp.readIds);
+    overflow |= hasOverflow(grp.values);
+
+    // Values are laid out by domain instance - scatter per event
+    const int stride = grp.eventIds.size();
+    for (int i = 0; i < stride; i++) {
+      Event* ev = grp.events[i];
+      if (grp.readIds[i] != grp.eventIds[i]) {
+        auto it = events_.find(grp.readIds[i]);
+        if (it == events_.end()) {
+          continue;
         }
+        ev = &it->second;
       }
-
-      ev.addSample(timestamp, vals);
+      ev->addSample(timestamp, grp.values.data() + i, stride);
     }
   }
 
-  if (VLOG_IS_ON(1)) {
-    auto t2 = high_resolution_clock::now();
-    VLOG(1) << "Device " << cuptiEvents_.device() << " Sample (us): "
-            << duration_cast<microseconds>(t2 - timestamp).count();
+  if (overflow) {
+    LOG_EVERY_N(WARNING, 100) << "Counter overflow detected "
+                              << "- decrease sample period!";
   }
 }
 
 // Print names of events in this group set, ordered by group
 void EventGroupSet::printDescription(ostream& s) const {
-  for (int g = 0; g < set_.numEventGroups; g++) {
+  for (int g = 0; g < groups_.size(); g++) {
     s << "  Events in group " << g << ": ";
-    for (const auto& id : cuptiEvents_.eventsInGroup(set_.eventGroups[g])) {
-      s << id << " (" << events_[id].name << ") ";
+    for (int i = 0; i < groups_[g].eventIds.size(); i++) {
+      s << groups_[g].eventIds[i] << " (" << groups_[g].events[i]->name << ") ";
     }
     s << endl;
   }
@@ -250,6 +321,7 @@ static int nearestFactor(int count, int max) {
 
 void EventProfiler::initEvents(const std::set<std::string>& eventNames) {
   events_.clear();
+  instanceSums_.clear();
   // Build event map
   for (const auto& name : eventNames) {
     events_.emplace(cuptiEvents_->eventId(name), name);
@@ -442,6 +514,9 @@ EventProfiler::EventProfiler(
 void EventProfiler::reportSamples() {
   dispatchSamples(*config_, loggers_, baseSamples_);
   baseSamples_ += completeSamplesPerReport(*config_, sets_.size());
+
+  VLOG(0) << "Device " << device() << " sample latency: " << sampleLatency_;
+  sampleLatency_.clear();
 }
 
 void EventProfiler::reportOnDemandSamples() {
@@ -561,20 +636,25 @@ void EventProfiler::dispatchSamples(
     SampleSlice slice = {sample_offset, i, config.samplesPerReport()};
     VLOG(1) << "Slice: " << sample_offset << ", " << i << ", "
             << config.samplesPerReport();
+    // Instance sums are computed once per event and slice,
+    // and shared between event stats and metrics.
     for (const auto& pair : events_) {
       const Event& ev = pair.second;
-      int64_t total = std::round(sf * ev.sumAll(slice));
+      auto& sums = instanceSums_[pair.first];
+      ev.sumInstances(slice, sums);
+      int64_t total = std::round(sf * sumValues(sums));
       PercentileList pcs = initPercentiles(config.percentiles());
-      normalize(ev.percentiles(pcs, slice), sf);
+      selectBuffer_.assign(sums.begin(), sums.end());
+      normalize(percentilesInPlace(selectBuffer_, pcs), sf);
       sample.stats.push_back({ev.name, std::move(pcs), SampleValue(total)});
     }
 
     for (auto& m : metrics_) {
-      // calculate returns a pair of per-SM vector and a total
-      auto vals = m.calculate(events_, delta, slice);
+      // calculate produces a per-SM vector and a total
+      m.calculate(instanceSums_, delta, metricValues_);
       PercentileList pcs = initPercentiles(config.percentiles());
-      sample.stats.push_back(
-          {m.name, std::move(percentiles(vals.perInstance, pcs)), vals.total});
+      percentilesInPlace(metricValues_.perInstance, pcs);
+      sample.stats.push_back({m.name, std::move(pcs), metricValues_.total});
     }
 
     for (auto& logger : loggers) {
@@ -588,7 +668,9 @@ void EventProfiler::dispatchSamples(
   }
 }
 
-void EventProfiler::configure(Config& config, Config& onDemandConfig) {
+void EventProfiler::configure(
+    const Config& config,
+    const Config& onDemandConfig) {
   if (!sets_.empty()) {
     sets_[curEnabledSet_].setEnabled(false);
     clearSamples();
@@ -629,7 +711,10 @@ void EventProfiler::collectSample() {
   if (sets_.empty()) {
     return;
   }
+  auto start = high_resolution_clock::now();
   sets_[curEnabledSet_].collectSample();
+  sampleLatency_.add(duration_cast<microseconds>(
+      high_resolution_clock::now() - start));
   if (VLOG_IS_ON(1)) {
     printAllSamples(LIBKINETO_DBG_STREAM, device());
   }
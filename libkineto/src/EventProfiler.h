@@ -22,23 +22,50 @@
 #include "ConfigLoader.h"
 #include "CuptiEventInterface.h"
 #include "CuptiMetricInterface.h"
+#include "LatencyHistogram.h"
 #include "SampleListener.h"
 
 namespace KINETO_NAMESPACE {
 
 // Helper function for computing percentiles (nearest-rank).
-// Modifies the input.
+// When the percentile list is in ascending order, which is the common case,
+// all percentiles are selected in a single pass, each selection only
+// partitioning the range above the previous one. Otherwise the values are
+// sorted once. Reorders the input.
 template <typename T>
-inline PercentileList& percentiles(std::vector<T> values, PercentileList& pcs) {
+inline PercentileList& percentilesInPlace(
+    std::vector<T>& values,
+    PercentileList& pcs) {
   auto size = values.size();
+  if (size == 0) {
+    return pcs;
+  }
+  bool ascending = std::is_sorted(
+      pcs.begin(), pcs.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+      });
+  if (!ascending) {
+    std::sort(values.begin(), values.end());
+  }
+  auto begin = values.begin();
   for (auto& x : pcs) {
-    int idx = std::min(size - 1, (x.first * size) / 100);
-    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    size_t idx = std::min(size - 1, (x.first * size) / 100);
+    auto nth = values.begin() + idx;
+    if (ascending) {
+      std::nth_element(begin, nth, values.end());
+      begin = nth;
+    }
     x.second = SampleValue(values[idx]);
   }
   return pcs;
 }
 
+// As above, but operates on a copy of the input.
+template <typename T>
+inline PercentileList& percentiles(std::vector<T> values, PercentileList& pcs) {
+  return percentilesInPlace(values, pcs);
+}
+
 // Helper function for normalizing a percentile list
 // Modifies the input
 inline PercentileList& normalize(PercentileList& pcs, double sf) {
@@ -77,9 +104,23 @@ class Event {
     samples_.emplace_back(timestamp, values);
   }
 
+  // Add a sample from a strided buffer, e.g. as returned by a batched read
+  // of all events in a group: values[i * stride] is the value of instance i.
+  // Storage of erased samples is recycled so this does not allocate
+  // in steady state.
+  void addSample(
+      std::chrono::time_point<std::chrono::system_clock> timestamp,
+      const int64_t* values,
+      int stride);
+
   // Sum samples for a single domain instance
   int64_t sumInstance(int i, const SampleSlice& slice) const;
 
+  // Sum samples for all domain instances in a single pass.
+  // Resizes sums to instanceCount, reusing its storage.
+  void sumInstances(const SampleSlice& slice, std::vector<int64_t>& sums)
+      const;
+
   // Sum all samples across all domain instances
   int64_t sumAll(const SampleSlice& slice) const;
 
@@ -90,11 +131,11 @@ class Event {
   void eraseSamples(int count) {
     auto end = samples_.begin();
     std::advance(end, count);
-    samples_.erase(samples_.begin(), end);
+    freeSamples_.splice(freeSamples_.end(), samples_, samples_.begin(), end);
   }
 
   void clearSamples() {
-    samples_.clear();
+    freeSamples_.splice(freeSamples_.end(), samples_);
   }
 
   int sampleCount() {
@@ -121,6 +162,8 @@ class Event {
       std::chrono::time_point<std::chrono::system_clock>,
       std::vector<int64_t>>;
   std::list<Sample> samples_;
+  // Erased samples, kept around for reuse by addSample
+  std::list<Sample> freeSamples_;
 };
 
 class Metric {
@@ -142,6 +185,13 @@ class Metric {
       std::chrono::nanoseconds sample_duration,
       const SampleSlice& slice);
 
+  // Calculate from per-instance event sums computed by Event::sumInstances.
+  // The storage in result is reused.
+  void calculate(
+      const std::map<CUpti_EventID, std::vector<int64_t>>& instance_sums,
+      std::chrono::nanoseconds sample_duration,
+      CalculatedValues& result);
+
   int instanceCount(std::map<CUpti_EventID, Event>& events) {
     return events[events_[0]].instanceCount;
   }
@@ -157,6 +207,8 @@ class Metric {
   // Calls to CUPTI is encapsulated behind this interface
   CuptiMetricInterface& cuptiMetrics_;
   CUpti_MetricValueKind valueKind_;
+  // Scratch space for event values passed to CUPTI
+  std::vector<int64_t> evValues_;
 };
 
 /**
@@ -189,10 +241,23 @@ class EventGroupSet {
   void printDescription(std::ostream& s) const;
 
  private:
+  // Per-group state for batched reads, set up once at construction
+  // so that taking a sample does not allocate.
+  struct GroupReadBuffer {
+    CUpti_EventGroup group;
+    // Events in group, in the order returned by eventsInGroup
+    std::vector<CUpti_EventID> eventIds;
+    std::vector<Event*> events;
+    // Scratch space for readAllEvents
+    std::vector<CUpti_EventID> readIds;
+    std::vector<int64_t> values;
+  };
+
   CUpti_EventGroupSet& set_;
   std::map<CUpti_EventID, Event>& events_;
   // Calls to CUPTI is encapsulated behind this interface
   CuptiEventInterface& cuptiEvents_;
+  std::vector<GroupReadBuffer> groups_;
   bool enabled_;
 };
 
@@ -208,7 +273,7 @@ class EventProfiler {
   EventProfiler& operator=(const EventProfiler&) = delete;
   ~EventProfiler();
 
-  void configure(Config& config, Config& onDemandConfig);
+  void configure(const Config& config, const Config& onDemandConfig);
 
   // Print the counter sets. Multiple sets will be multiplexed.
   void printSets(std::ostream& s) const;
@@ -245,6 +310,11 @@ class EventProfiler {
   // Read values of currently running counters.
   void collectSample();
 
+  // Time taken by collectSample since the last report
+  const LatencyHistogram& sampleLatency() const {
+    return sampleLatency_;
+  }
+
   void reportSamples();
   void reportOnDemandSamples();
 
@@ -331,6 +401,13 @@ class EventProfiler {
   int baseSamples_{0};
   int onDemandSamples_{0};
 
+  LatencyHistogram sampleLatency_;
+
+  // Scratch space for aggregating samples, reused across slices and reports
+  std::map<CUpti_EventID, std::vector<int64_t>> instanceSums_;
+  std::vector<int64_t> selectBuffer_;
+  Metric::CalculatedValues metricValues_{{}, SampleValue(0)};
+
   // Shared between profiler threads
   // Vectors are read-only but calling loggers require lock
   const std::vector<std::unique_ptr<SampleListener>>& loggers_;
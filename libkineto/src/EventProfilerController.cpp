@@ -8,14 +8,13 @@
 #include "EventProfilerController.h"
 
 #include <chrono>
-#include <thread>
 #include <vector>
 
 #include "ConfigLoader.h"
 #include "CuptiEventInterface.h"
 #include "CuptiMetricInterface.h"
 #include "EventProfiler.h"
-#include "ThreadName.h"
+#include "Scheduler.h"
 #include "output_csv.h"
 
 #include "Logger.h"
@@ -94,16 +93,19 @@ EventProfilerController::EventProfilerController(
       std::move(cupti_metrics),
       loggers(*config),
       onDemandLoggers(*config));
-  profilerThread_ = std::make_unique<std::thread>(
-      &EventProfilerController::profilerLoop, this);
+  configLoader_.gpuContextCreated(profiler_->device());
+  taskId_ = Scheduler::instance().schedule(
+      "event profiler",
+      system_clock::now(),
+      [this](const time_point<system_clock>& now) { return profilerStep(); });
 }
 
 EventProfilerController::~EventProfilerController() {
-  if (profilerThread_) {
-    // signaling termination of the profiler loop
-    stopRunloop_ = true;
-    profilerThread_->join();
-  }
+  // signaling termination of the profiler loop
+  stopRunloop_ = true;
+  // Waits for the task to complete if it is running
+  Scheduler::instance().cancel(taskId_);
+  configLoader_.gpuContextDestroyed(profiler_->device());
   VLOG(0) << "Stopped event profiler";
 }
 
@@ -124,7 +126,7 @@ void EventProfilerController::stop(CUcontext ctx) {
   profilerMap()[ctx] = nullptr;
 }
 
-bool EventProfilerController::enableForDevice(Config& cfg) {
+bool EventProfilerController::enableForDevice(const Config& cfg) {
   // FIXME: Use device unique id!
   if (!cfg.eventProfilerEnabledForDevice(profiler_->device())) {
     return false;
@@ -136,148 +138,145 @@ bool EventProfilerController::enableForDevice(Config& cfg) {
 }
 
 void reportLateSample(
-    int sleepMs,
+    int wakeupMs,
     int sampleMs,
     int reportMs,
     int reprogramMs) {
-  LOG_EVERY_N(WARNING, 10) << "Lost sample due to delays (ms): " << sleepMs
+  LOG_EVERY_N(WARNING, 10) << "Lost sample due to delays (ms): " << wakeupMs
                            << ", " << sampleMs << ", " << reportMs << ", "
                            << reprogramMs;
 }
 
-void EventProfilerController::profilerLoop() {
-  // We limit the number of profilers that can exist per GPU
-  auto config = configLoader_.getConfigCopy();
-  if (!enableForDevice(*config)) {
-    VLOG(0) << "Not starting EventProfiler - profilers for GPU "
-            << profiler_->device() << " exceeds profilers per GPU limit ("
-            << config->maxEventProfilersPerGpu() << ")";
-    return;
+time_point<system_clock> EventProfilerController::profilerStep() {
+  constexpr auto kStop = time_point<system_clock>::max();
+  if (stopRunloop_) {
+    return kStop;
   }
 
-  VLOG(0) << "Starting Event Profiler for GPU " << profiler_->device();
-  setThreadName("CUPTI Event Profiler");
-
-  profiler_->setContinuousMode();
-  auto on_demand_config = std::make_unique<Config>();
-
-  time_point<high_resolution_clock> next_sample_time;
-  time_point<high_resolution_clock> next_report_time;
-  time_point<high_resolution_clock> next_on_demand_report_time;
-  time_point<high_resolution_clock> next_multiplex_time;
-  bool reconfigure = true;
-  int report_count = 0;
-  int on_demand_report_count = 0;
-  while (!stopRunloop_) {
-    if (configLoader_.hasNewConfig(*config)) {
-      config = configLoader_.getConfigCopy();
-      VLOG(0) << "Base config changed";
-      report_count = 0;
-      reconfigure = true;
-    }
-    if (configLoader_.hasNewEventProfilerOnDemandConfig(*on_demand_config)) {
-      on_demand_config = configLoader_.getEventProfilerOnDemandConfigCopy();
-      LOG(INFO) << "Received new on-demand config";
-      on_demand_report_count = 0;
-      reconfigure = true;
+  if (!config_) {
+    // We limit the number of profilers that can exist per GPU
+    configLoader_.refreshConfig(config_, configVersion_);
+    if (!enableForDevice(*config_)) {
+      VLOG(0) << "Not starting EventProfiler - profilers for GPU "
+              << profiler_->device() << " exceeds profilers per GPU limit ("
+              << config_->maxEventProfilersPerGpu() << ")";
+      return kStop;
     }
 
-    auto now = high_resolution_clock::now();
-    if (on_demand_config->eventProfilerOnDemandDuration().count() > 0 &&
-        now > (on_demand_config->eventProfilerOnDemandStartTime() +
-               on_demand_config->eventProfilerOnDemandDuration())) {
-      on_demand_config->setEventProfilerOnDemandDuration(seconds(0));
-      LOG(INFO) << "On-demand profiling complete";
-      reconfigure = true;
-    }
+    VLOG(0) << "Starting Event Profiler for GPU " << profiler_->device();
+    profiler_->setContinuousMode();
+  }
 
-    if (reconfigure) {
-      try {
-        profiler_->configure(*config, *on_demand_config);
-      } catch (const std::exception& ex) {
-        LOG(ERROR) << "Encountered error while configuring event profiler: "
-            << ex.what();
-        // Exit profiling entirely when encountering an error here
-        // as it indicates a serious problem or bug.
-        break;
-      }
-      now = high_resolution_clock::now();
-      next_sample_time = now + profiler_->samplePeriod();
-      next_report_time = now + profiler_->reportPeriod();
-      next_on_demand_report_time = now + profiler_->onDemandReportPeriod();
-      next_multiplex_time = now + profiler_->multiplexPeriod();
-      reconfigure = false;
-    }
-    auto start_sleep = now;
-    while (now < next_sample_time) {
-      /* sleep override */
-      std::this_thread::sleep_for(next_sample_time - now);
-      now = high_resolution_clock::now();
-    }
-    int sleep_time = duration_cast<milliseconds>(now - start_sleep).count();
+  // Checking for changes is a single atomic load per config
+  if (configLoader_.refreshConfig(config_, configVersion_)) {
+    VLOG(0) << "Base config changed";
+    reportCount_ = 0;
+    reconfigure_ = true;
+  }
+  if (configLoader_.refreshEventProfilerOnDemandConfig(
+          onDemandSnapshot_, onDemandVersion_)) {
+    onDemandConfig_ = onDemandSnapshot_;
+    LOG_IF(INFO, onDemandConfig_->eventProfilerOnDemandDuration().count() > 0)
+        << "Received new on-demand config";
+    onDemandReportCount_ = 0;
+    reconfigure_ = true;
+  }
 
-    next_sample_time += profiler_->samplePeriod();
+  if (onDemandConfig_->eventProfilerOnDemandDuration().count() > 0 &&
+      high_resolution_clock::now() >
+          (onDemandConfig_->eventProfilerOnDemandStartTime() +
+           onDemandConfig_->eventProfilerOnDemandDuration())) {
+    // Snapshots are shared and immutable
+    auto config = onDemandConfig_->clone();
+    config->setEventProfilerOnDemandDuration(seconds(0));
+    onDemandConfig_ = std::move(config);
+    LOG(INFO) << "On-demand profiling complete";
+    reconfigure_ = true;
+  }
 
-    if (now > next_sample_time) {
-      reportLateSample(sleep_time, 0, 0, 0);
-      reconfigure = true;
-      continue;
+  auto now = system_clock::now();
+  if (reconfigure_) {
+    try {
+      profiler_->configure(*config_, *onDemandConfig_);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Encountered error while configuring event profiler: "
+          << ex.what();
+      // Exit profiling entirely when encountering an error here
+      // as it indicates a serious problem or bug.
+      VLOG(0) << "Device " << profiler_->device()
+              << ": Exited event profiling loop";
+      return kStop;
     }
+    now = system_clock::now();
+    nextSampleTime_ = now + profiler_->samplePeriod();
+    nextReportTime_ = now + profiler_->reportPeriod();
+    nextOnDemandReportTime_ = now + profiler_->onDemandReportPeriod();
+    nextMultiplexTime_ = now + profiler_->multiplexPeriod();
+    reconfigure_ = false;
+    return nextSampleTime_;
+  }
 
-    auto start_sample = now;
-    profiler_->collectSample();
-    now = high_resolution_clock::now();
-    int sample_time = duration_cast<milliseconds>(now - start_sample).count();
+  // The scheduler runs this step at the sample time
+  int wakeup_time = duration_cast<milliseconds>(now - nextSampleTime_).count();
+  nextSampleTime_ += profiler_->samplePeriod();
 
-    if (now > next_sample_time) {
-      reportLateSample(sleep_time, sample_time, 0, 0);
-      reconfigure = true;
-      continue;
-    }
+  if (now > nextSampleTime_) {
+    reportLateSample(wakeup_time, 0, 0, 0);
+    reconfigure_ = true;
+    return now;
+  }
 
-    auto start_report = now;
-    if (now > next_report_time) {
-      VLOG(1) << "Report #" << report_count++;
-      profiler_->reportSamples();
-      next_report_time += profiler_->reportPeriod();
-    }
-    if (on_demand_config->eventProfilerOnDemandDuration().count() > 0 &&
-        now > next_on_demand_report_time) {
-      VLOG(1) << "OnDemand Report #" << on_demand_report_count++;
-      profiler_->reportOnDemandSamples();
-      next_on_demand_report_time += profiler_->onDemandReportPeriod();
-    }
-    profiler_->eraseReportedSamples();
-    now = high_resolution_clock::now();
-    int report_time = duration_cast<milliseconds>(now - start_report).count();
-
-    if (now > next_sample_time) {
-      reportLateSample(sleep_time, sample_time, report_time, 0);
-      reconfigure = true;
-      continue;
-    }
+  auto start_sample = now;
+  profiler_->collectSample();
+  now = system_clock::now();
+  int sample_time = duration_cast<milliseconds>(now - start_sample).count();
 
-    auto start_multiplex = now;
-    if (profiler_->multiplexEnabled() && now > next_multiplex_time) {
-      profiler_->enableNextCounterSet();
-      next_multiplex_time += profiler_->multiplexPeriod();
-    }
-    now = high_resolution_clock::now();
-    int multiplex_time =
-        duration_cast<milliseconds>(now - start_multiplex).count();
-
-    if (now > next_sample_time) {
-      reportLateSample(sleep_time, sample_time, report_time, multiplex_time);
-      reconfigure = true;
-      continue;
-    }
+  if (now > nextSampleTime_) {
+    reportLateSample(wakeup_time, sample_time, 0, 0);
+    reconfigure_ = true;
+    return now;
+  }
 
-    VLOG(0) << "Runloop execution time: "
-            << duration_cast<milliseconds>(now - start_sample).count() << "ms";
+  auto start_report = now;
+  if (now > nextReportTime_) {
+    VLOG(1) << "Report #" << reportCount_++;
+    profiler_->reportSamples();
+    nextReportTime_ += profiler_->reportPeriod();
+  }
+  if (onDemandConfig_->eventProfilerOnDemandDuration().count() > 0 &&
+      now > nextOnDemandReportTime_) {
+    VLOG(1) << "OnDemand Report #" << onDemandReportCount_++;
+    profiler_->reportOnDemandSamples();
+    nextOnDemandReportTime_ += profiler_->onDemandReportPeriod();
+  }
+  profiler_->eraseReportedSamples();
+  now = system_clock::now();
+  int report_time = duration_cast<milliseconds>(now - start_report).count();
+
+  if (now > nextSampleTime_) {
+    reportLateSample(wakeup_time, sample_time, report_time, 0);
+    reconfigure_ = true;
+    return now;
+  }
+
+  auto start_multiplex = now;
+  if (profiler_->multiplexEnabled() && now > nextMultiplexTime_) {
+    profiler_->enableNextCounterSet();
+    nextMultiplexTime_ += profiler_->multiplexPeriod();
+  }
+  now = system_clock::now();
+  int multiplex_time =
+      duration_cast<milliseconds>(now - start_multiplex).count();
+
+  if (now > nextSampleTime_) {
+    reportLateSample(wakeup_time, sample_time, report_time, multiplex_time);
+    reconfigure_ = true;
+    return now;
   }
 
-  VLOG(0) << "Device " << profiler_->device()
-          << ": Exited event profiling loop";
+  VLOG(0) << "Runloop execution time: "
+          << duration_cast<milliseconds>(now - start_sample).count() << "ms";
+  return nextSampleTime_;
 }
 
 } // namespace KINETO_NAMESPACE
@@ -8,9 +8,9 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
-#include <thread>
 
 #include <cupti.h>
 
@@ -41,13 +41,31 @@ class EventProfilerController {
   explicit EventProfilerController(
       CUcontext context,
       ConfigLoader& config_loader);
-  bool enableForDevice(Config& cfg);
-  void profilerLoop();
+  bool enableForDevice(const Config& cfg);
+
+  // One iteration of the profiler loop, run as a scheduled task.
+  // Returns the time of the next iteration.
+  std::chrono::time_point<std::chrono::system_clock> profilerStep();
 
   ConfigLoader& configLoader_;
   std::unique_ptr<EventProfiler> profiler_;
-  std::unique_ptr<std::thread> profilerThread_;
+  uint64_t taskId_{0};
   std::atomic_bool stopRunloop_{false};
+
+  // Profiler loop state
+  std::shared_ptr<const Config> config_;
+  uint64_t configVersion_{0};
+  // Last published on-demand config, and the one in effect
+  std::shared_ptr<const Config> onDemandSnapshot_;
+  uint64_t onDemandVersion_{0};
+  std::shared_ptr<const Config> onDemandConfig_;
+  bool reconfigure_{true};
+  int reportCount_{0};
+  int onDemandReportCount_{0};
+  std::chrono::time_point<std::chrono::system_clock> nextSampleTime_;
+  std::chrono::time_point<std::chrono::system_clock> nextReportTime_;
+  std::chrono::time_point<std::chrono::system_clock> nextOnDemandReportTime_;
+  std::chrono::time_point<std::chrono::system_clock> nextMultiplexTime_;
 };
 
 } // namespace KINETO_NAMESPACE
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "FileWatcher.h"
+
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <set>
+#include <system_error>
+
+#include "Logger.h"
+
+namespace KINETO_NAMESPACE {
+
+// Directories are only watched for entries appearing, which is rare
+// compared to writes, even in /tmp
+constexpr uint32_t kDirMask = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+constexpr uint32_t kFileMask = IN_CLOSE_WRITE | IN_MOVE_SELF;
+
+static std::pair<std::string, std::string> splitPath(const std::string& path) {
+  size_t pos = path.rfind('/');
+  if (pos == std::string::npos) {
+    return {".", path};
+  }
+  return {pos == 0 ? "/" : path.substr(0, pos), path.substr(pos + 1)};
+}
+
+FileWatcher::FileWatcher() {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "Failed to initialize inotify");
+  }
+}
+
+FileWatcher::~FileWatcher() {
+  close(fd_);
+}
+
+bool FileWatcher::add(const std::string& path, Callback callback) {
+  auto dir_file = splitPath(path);
+  auto it = dirs_.find(dir_file.first);
+  if (it == dirs_.end()) {
+    int wd = inotify_add_watch(fd_, dir_file.first.c_str(), kDirMask);
+    if (wd < 0) {
+      PLOG(WARNING) << "Failed to watch " << dir_file.first;
+      return false;
+    }
+    VLOG(0) << "Watching " << dir_file.first;
+    wdDirs_[wd] = dir_file.first;
+    it = dirs_.emplace(dir_file.first, Directory{wd, {}}).first;
+  }
+  File& file = it->second.files[dir_file.second];
+  file.callback = std::move(callback);
+  if (file.wd < 0) {
+    watchFile(path, file);
+  }
+  return true;
+}
+
+void FileWatcher::watchFile(const std::string& path, File& file) {
+  int wd = inotify_add_watch(fd_, path.c_str(), kFileMask);
+  if (wd < 0) {
+    if (errno != ENOENT) {
+      PLOG(WARNING) << "Failed to watch " << path;
+    }
+    // Otherwise picked up by the directory watch once created
+    return;
+  }
+  if (file.wd >= 0 && file.wd != wd) {
+    // Replaced by rename
+    unwatchFile(file);
+  }
+  file.wd = wd;
+  wdFiles_[wd] = path;
+}
+
+void FileWatcher::unwatchFile(File& file) {
+  if (file.wd >= 0) {
+    inotify_rm_watch(fd_, file.wd);
+    wdFiles_.erase(file.wd);
+    file.wd = -1;
+  }
+}
+
+FileWatcher::File* FileWatcher::findFile(const std::string& path) {
+  auto dir_file = splitPath(path);
+  auto it = dirs_.find(dir_file.first);
+  if (it == dirs_.end()) {
+    return nullptr;
+  }
+  auto file_it = it->second.files.find(dir_file.second);
+  return file_it == it->second.files.end() ? nullptr : &file_it->second;
+}
+
+void FileWatcher::remove(const std::string& path) {
+  auto dir_file = splitPath(path);
+  auto it = dirs_.find(dir_file.first);
+  if (it == dirs_.end()) {
+    return;
+  }
+  auto file_it = it->second.files.find(dir_file.second);
+  if (file_it != it->second.files.end()) {
+    unwatchFile(file_it->second);
+    it->second.files.erase(file_it);
+  }
+  if (it->second.files.empty()) {
+    inotify_rm_watch(fd_, it->second.wd);
+    wdDirs_.erase(it->second.wd);
+    dirs_.erase(it);
+  }
+}
+
+bool FileWatcher::watching(const std::string& path) const {
+  auto dir_file = splitPath(path);
+  auto it = dirs_.find(dir_file.first);
+  return it != dirs_.end() &&
+      it->second.files.find(dir_file.second) != it->second.files.end();
+}
+
+void FileWatcher::handleEvents() {
+  alignas(struct inotify_event) char buf[4096];
+  // Collect changes first, since an editor can generate several events
+  // for one save, and callbacks may add or remove watches.
+  std::set<std::string> changed;
+  ssize_t len;
+  while ((len = read(fd_, buf, sizeof(buf))) > 0) {
+    for (char* p = buf; p < buf + len;) {
+      const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      auto file_it = wdFiles_.find(event->wd);
+      if (file_it != wdFiles_.end()) {
+        // Copy, since the watch may be removed below
+        std::string path = file_it->second;
+        File* file = findFile(path);
+        if (event->mask & IN_CLOSE_WRITE) {
+          changed.insert(path);
+        } else if (file && file->wd == event->wd) {
+          // Moved away or deleted. Not a change in itself - a
+          // replacement is reported by the directory watch.
+          unwatchFile(*file);
+        }
+        continue;
+      }
+      auto wd_it = wdDirs_.find(event->wd);
+      if (wd_it == wdDirs_.end() || event->len == 0) {
+        continue;
+      }
+      const std::string& dir = wd_it->second;
+      std::string path = dir == "/" ? "/" + std::string(event->name)
+                                    : dir + "/" + event->name;
+      File* file = findFile(path);
+      if (file) {
+        // Created or renamed into place. A created file may not have
+        // been written yet - its close is seen by the new file watch.
+        watchFile(path, *file);
+        changed.insert(path);
+      }
+    }
+  }
+  if (len < 0 && errno != EAGAIN) {
+    PLOG(ERROR) << "Failed to read inotify events";
+  }
+  for (const auto& path : changed) {
+    VLOG(1) << "File changed: " << path;
+    File* file = findFile(path);
+    if (file) {
+      // Copy, since the callback may remove itself
+      Callback callback = file->callback;
+      callback(path);
+    }
+  }
+}
+
+} // namespace KINETO_NAMESPACE
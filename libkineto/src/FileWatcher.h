@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+namespace KINETO_NAMESPACE {
+
+// Watches files for changes with inotify, so that config files can be
+// reloaded as soon as they are written instead of being polled.
+// Writes are watched on the file itself, so that writes to other files in
+// a busy directory such as /tmp do not wake up the watcher. The parent
+// directory is only watched for files being created or renamed into place,
+// so files that do not exist yet or are replaced by rename are handled.
+// Not thread safe.
+class FileWatcher {
+ public:
+  using Callback = std::function<void(const std::string& path)>;
+
+  // Throws std::system_error if inotify is not available
+  FileWatcher();
+  ~FileWatcher();
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // Invoke callback when the file is written, created or replaced.
+  // Removing the file is not reported.
+  // Returns false if the file's directory cannot be watched.
+  bool add(const std::string& path, Callback callback);
+  void remove(const std::string& path);
+
+  bool watching(const std::string& path) const;
+
+  // Readable when there are events to handle
+  int fd() const {
+    return fd_;
+  }
+
+  // Consume pending events and invoke callbacks for changed files.
+  // Each callback is invoked at most once per call.
+  void handleEvents();
+
+ private:
+  struct File {
+    Callback callback;
+    // Watch on the file itself, -1 while it does not exist
+    int wd{-1};
+  };
+
+  struct Directory {
+    int wd;
+    // File name -> callback
+    std::map<std::string, File> files;
+  };
+
+  // Start watching writes to the file at path, if it exists
+  void watchFile(const std::string& path, File& file);
+  void unwatchFile(File& file);
+  File* findFile(const std::string& path);
+
+  int fd_;
+  // Directory path -> watch
+  std::map<std::string, Directory> dirs_;
+  // Watch descriptor -> directory path
+  std::map<int, std::string> wdDirs_;
+  // Watch descriptor -> file path
+  std::map<int, std::string> wdFiles_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "HostTraceAggregator.h"
+
+#include <fmt/format.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <system_error>
+#include <utility>
+
+#include "ThreadName.h"
+
+#include "Logger.h"
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+constexpr milliseconds kJoinReplyTimeout(1000);
+constexpr milliseconds kPollInterval(1);
+
+void HostTraceEvent::encode(std::string& buf) const {
+  HostTraceRecord rec = record;
+  rec.nameSize = std::min<size_t>(name.size(), UINT16_MAX);
+  rec.argSize = std::min<size_t>(arg.size(), UINT16_MAX);
+  buf.resize(sizeof(rec) + rec.nameSize + rec.argSize);
+  memcpy(&buf[0], &rec, sizeof(rec));
+  memcpy(&buf[sizeof(rec)], name.data(), rec.nameSize);
+  memcpy(&buf[sizeof(rec) + rec.nameSize], arg.data(), rec.argSize);
+}
+
+bool HostTraceEvent::decode(const std::string& buf) {
+  if (buf.size() < sizeof(record)) {
+    return false;
+  }
+  memcpy(&record, buf.data(), sizeof(record));
+  if (buf.size() != sizeof(record) + record.nameSize + record.argSize) {
+    return false;
+  }
+  name.assign(buf, sizeof(record), record.nameSize);
+  arg.assign(buf, sizeof(record) + record.nameSize, record.argSize);
+  return true;
+}
+
+std::string HostTraceAggregator::socketName() {
+  return "kineto_host_trace_" + std::to_string(getuid());
+}
+
+// The aggregator elected in this process, if any
+static std::mutex& electionMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+static std::unique_ptr<HostTraceAggregator>& electedAggregator() {
+  static std::unique_ptr<HostTraceAggregator> aggregator;
+  return aggregator;
+}
+
+// Wait for the expected reply from the aggregator. Rings are only
+// handed to an aggregator run by the same user, since another user
+// could have bound the socket name first.
+static bool awaitReply(
+    IpcSocket& socket,
+    const std::string& name,
+    const std::string& expected) {
+  struct pollfd pfd = {socket.fd(), POLLIN, 0};
+  if (poll(&pfd, 1, kJoinReplyTimeout.count()) != 1) {
+    return false;
+  }
+  std::string reply;
+  std::string src;
+  int fd;
+  struct ucred cred;
+  if (!socket.recv(reply, src, fd, cred)) {
+    return false;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (src != name || !IpcSocket::trusted(cred)) {
+    LOG(ERROR) << "Host trace socket @" << name << " is held by pid "
+               << cred.pid << " of uid " << cred.uid;
+    return false;
+  }
+  return reply == expected;
+}
+
+bool HostTraceAggregator::join(
+    const SharedRing& ring,
+    const std::string& logFile,
+    const std::string& name) {
+  IpcSocket socket;
+  // Retry once after trying to become the aggregator
+  for (int attempt = 0; attempt < 2; attempt++) {
+    // Check who is aggregating before passing the ring
+    if (socket.send(name, "join") && awaitReply(socket, name, "READY") &&
+        socket.send(name, "ring", ring.fd()) &&
+        awaitReply(socket, name, "OK")) {
+      return true;
+    }
+    std::lock_guard<std::mutex> lock(electionMutex());
+    auto& aggregator = electedAggregator();
+    if (aggregator && !aggregator->done()) {
+      // Still aggregating the previous trace in this process
+      continue;
+    }
+    try {
+      aggregator = std::make_unique<HostTraceAggregator>(name, logFile);
+      LOG(INFO) << "Aggregating host trace to " << logFile;
+    } catch (const std::system_error& e) {
+      // Another process won the election
+      VLOG(0) << "Not aggregating host trace: " << e.what();
+    }
+  }
+  LOG(ERROR) << "Failed to join host trace aggregator @" << name;
+  return false;
+}
+
+HostTraceAggregator::HostTraceAggregator(
+    const std::string& name,
+    const std::string& logFile,
+    milliseconds joinWindow,
+    milliseconds timeout)
+    : socket_(std::make_unique<IpcSocket>(name)),
+      logFile_(logFile),
+      joinWindow_(joinWindow),
+      timeout_(timeout) {
+  thread_ = std::thread(&HostTraceAggregator::run, this);
+}
+
+HostTraceAggregator::~HostTraceAggregator() {
+  stop_ = true;
+  thread_.join();
+}
+
+bool HostTraceAggregator::acceptRings() {
+  bool joined = false;
+  std::string msg;
+  std::string src;
+  int fd;
+  struct ucred cred;
+  while (socket_->recv(msg, src, fd, cred)) {
+    // Producers are identified by their credentials, not by the message
+    if (!IpcSocket::trusted(cred)) {
+      LOG(WARNING) << "Ignoring host trace request from pid " << cred.pid
+                   << " of uid " << cred.uid;
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+    if (msg == "join") {
+      socket_->send(src, "READY");
+    }
+    if (msg != "ring" || fd < 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+    try {
+      producers_.push_back({cred.pid, SharedRing::attach(fd), {}});
+    } catch (const std::system_error& e) {
+      LOG(WARNING) << "Rejected ring from pid " << cred.pid << ": "
+                   << e.what();
+      continue;
+    }
+    socket_->send(src, "OK");
+    VLOG(0) << "Pid " << cred.pid << " joined host trace";
+    joined = true;
+  }
+  return joined;
+}
+
+static bool onGpu(HostTraceRecord::Category category) {
+  return category == HostTraceRecord::Category::Kernel ||
+      category == HostTraceRecord::Category::Memcpy ||
+      category == HostTraceRecord::Category::Memset ||
+      category == HostTraceRecord::Category::Gpu;
+}
+
+bool HostTraceAggregator::drainRings() {
+  bool finished = true;
+  std::string buf;
+  for (auto& producer : producers_) {
+    // Check before draining, so that nothing written before closing is missed
+    bool closed = producer.ring->finished();
+    while (producer.ring->read(buf)) {
+      producer.events.emplace_back();
+      HostTraceEvent& event = producer.events.back();
+      if (!event.decode(buf)) {
+        producer.events.pop_back();
+        LOG_EVERY_N(WARNING, 1000) << "Invalid record from " << producer.pid;
+      } else {
+        // A producer can only write to its own process
+        event.record.source = producer.pid;
+        if (!onGpu(event.record.category)) {
+          event.record.pid = producer.pid;
+        }
+      }
+      closed = false;
+    }
+    finished = finished && closed && producer.ring->finished();
+  }
+  return finished;
+}
+
+void HostTraceAggregator::run() {
+  setThreadName("Kineto Host Trace");
+  auto start = steady_clock::now();
+  auto last_join = start;
+  while (!stop_) {
+    auto now = steady_clock::now();
+    if (acceptRings()) {
+      last_join = now;
+    }
+    bool finished = drainRings();
+    if (finished && !producers_.empty() && now - last_join >= joinWindow_) {
+      break;
+    }
+    if (now - start >= timeout_) {
+      LOG(WARNING) << "Timed out waiting for host trace from all processes";
+      break;
+    }
+    std::this_thread::sleep_for(kPollInterval);
+  }
+  // Later processes elect a new aggregator
+  socket_ = nullptr;
+  finish();
+  done_ = true;
+}
+
+void HostTraceAggregator::finish() {
+  std::vector<std::vector<HostTraceEvent>> events;
+  size_t count = 0;
+  for (auto& producer : producers_) {
+    count += producer.events.size();
+    events.push_back(std::move(producer.events));
+  }
+  producers_.clear();
+  std::ofstream out(logFile_, std::ofstream::out | std::ofstream::trunc);
+  if (!out) {
+    PLOG(ERROR) << "Failed to open '" << logFile_ << "'";
+    return;
+  }
+  writeTrace(events, out);
+  LOG(INFO) << "Host trace with " << count << " events from "
+            << events.size() << " processes written to " << logFile_;
+}
+
+static const char* categoryName(HostTraceRecord::Category category) {
+  switch (category) {
+    case HostTraceRecord::Category::Trace:
+      return "Trace";
+    case HostTraceRecord::Category::Operator:
+      return "Operator";
+    case HostTraceRecord::Category::Runtime:
+      return "Runtime";
+    case HostTraceRecord::Category::Kernel:
+      return "Kernel";
+    case HostTraceRecord::Category::Memcpy:
+      return "Memcpy";
+    case HostTraceRecord::Category::Memset:
+      return "Memset";
+    default:
+      return "";
+  }
+}
+
+// GPUs are shared by processes, so GPU rows are kept apart per process
+static std::string timelinePid(const HostTraceRecord& rec) {
+  if (onGpu(rec.category)) {
+    return fmt::format("\"GPU {} (pid {})\"", rec.pid, rec.source);
+  }
+  return std::to_string(rec.pid);
+}
+
+static void writeEvent(const HostTraceEvent& event, std::ostream& out) {
+  const HostTraceRecord& rec = event.record;
+  // clang-format off
+  switch (rec.kind) {
+    case HostTraceRecord::Kind::Process:
+      out << fmt::format(R"JSON(
+  {{
+    "name": "process_name", "ph": "M", "ts": {}, "pid": {}, "tid": 0,
+    "args": {{
+      "name": "{}"
+    }}
+  }},
+  {{
+    "name": "process_labels", "ph": "M", "ts": {}, "pid": {}, "tid": 0,
+    "args": {{
+      "labels": "{}"
+    }}
+  }},)JSON",
+          rec.ts, timelinePid(rec), event.name,
+          rec.ts, timelinePid(rec), event.arg);
+      break;
+    case HostTraceRecord::Kind::Thread:
+      out << fmt::format(R"JSON(
+  {{
+    "name": "thread_name", "ph": "M", "ts": {}, "pid": {}, "tid": "{}",
+    "args": {{
+      "name": "thread {} ({})"
+    }}
+  }},)JSON",
+          rec.ts, rec.pid, (uint32_t)rec.tid,
+          (uint32_t)rec.tid, event.name);
+      break;
+    case HostTraceRecord::Kind::Instant:
+      out << fmt::format(R"JSON(
+  {{
+    "name": "Iteration Start: {}", "ph": "i", "s": "g",
+    "pid": "Traces", "tid": "Trace {} (pid {})", "ts": {}
+  }},)JSON",
+          event.name,
+          event.name, rec.source, rec.ts);
+      break;
+    case HostTraceRecord::Kind::Event:
+      if (rec.category == HostTraceRecord::Category::Trace) {
+        out << fmt::format(R"JSON(
+  {{
+    "ph": "X", "cat": "Trace", "ts": {}, "dur": {},
+    "pid": "Traces", "tid": "{} (pid {})",
+    "name": "{}"
+  }},)JSON",
+            rec.ts, rec.dur,
+            event.arg, rec.source,
+            event.name);
+        break;
+      }
+      out << fmt::format(R"JSON(
+  {{
+    "ph": "X", "cat": "{}", "name": "{}", "pid": {}, "tid": "{}{}",
+    "ts": {}, "dur": {},
+    "args": {{
+      "process": {}, "correlation": {}
+    }}
+  }},)JSON",
+          categoryName(rec.category), event.name,
+          timelinePid(rec), onGpu(rec.category) ? "stream " : "",
+          (uint32_t)rec.tid,
+          rec.ts, rec.dur,
+          rec.source, rec.correlation);
+      break;
+  }
+  // clang-format on
+}
+
+void HostTraceAggregator::writeTrace(
+    std::vector<std::vector<HostTraceEvent>>& events,
+    std::ostream& out) {
+  out << "[";
+  size_t written = 0;
+  // Metadata first, once per process or GPU and thread
+  std::set<std::string> processes;
+  std::set<std::pair<int64_t, int64_t>> threads;
+  for (auto& producer : events) {
+    for (const auto& event : producer) {
+      const auto& rec = event.record;
+      if ((rec.kind == HostTraceRecord::Kind::Process &&
+           processes.insert(timelinePid(rec)).second) ||
+          (rec.kind == HostTraceRecord::Kind::Thread &&
+           threads.insert({rec.pid, rec.tid}).second)) {
+        writeEvent(event, out);
+        written++;
+      }
+    }
+    auto end = std::remove_if(
+        producer.begin(), producer.end(), [](const HostTraceEvent& event) {
+          return event.record.kind == HostTraceRecord::Kind::Process ||
+              event.record.kind == HostTraceRecord::Kind::Thread;
+        });
+    producer.erase(end, producer.end());
+    // Records are streamed in the order processed, not by time
+    std::stable_sort(
+        producer.begin(),
+        producer.end(),
+        [](const HostTraceEvent& a, const HostTraceEvent& b) {
+          return a.record.ts < b.record.ts;
+        });
+  }
+
+  // K-way merge of the sorted per-process streams
+  using Cursor = std::pair<int64_t, size_t>;
+  std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+  std::vector<size_t> next(events.size(), 0);
+  for (size_t i = 0; i < events.size(); i++) {
+    if (!events[i].empty()) {
+      heap.push({events[i][0].record.ts, i});
+    }
+  }
+  while (!heap.empty()) {
+    size_t i = heap.top().second;
+    heap.pop();
+    writeEvent(events[i][next[i]], out);
+    written++;
+    if (++next[i] < events[i].size()) {
+      heap.push({events[i][next[i]].record.ts, i});
+    }
+  }
+  if (written > 0) {
+    // Replace trailing comma with "]"
+    out.seekp(-1, std::ios_base::cur);
+  }
+  out << std::endl << "]";
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IpcSocket.h"
+#include "SharedRing.h"
+
+namespace KINETO_NAMESPACE {
+
+// Compact trace record streamed from each process to the host aggregator.
+// Encoded as this fixed size header followed by the name and arg strings.
+struct HostTraceRecord {
+  enum class Kind : uint8_t { Process, Thread, Event, Instant };
+  enum class Category : uint8_t {
+    None,
+    Trace,
+    Operator,
+    Runtime,
+    Kernel,
+    Memcpy,
+    Memset,
+    // Process metadata of a GPU row, with the device id as pid
+    Gpu
+  };
+
+  Kind kind;
+  Category category;
+  uint16_t nameSize;
+  uint16_t argSize;
+  // Process that produced the record, set by the aggregator
+  int32_t source;
+  // Process or GPU, thread or stream.
+  // The aggregator sets the process from the producer's credentials.
+  int64_t pid;
+  int64_t tid;
+  // Microseconds
+  int64_t ts;
+  int64_t dur;
+  int64_t correlation;
+};
+
+struct HostTraceEvent {
+  HostTraceRecord record;
+  std::string name;
+  // Process label, or timeline of a trace span
+  std::string arg;
+
+  void encode(std::string& buf) const;
+  // Returns false if the data is not a valid record
+  bool decode(const std::string& buf);
+};
+
+// Merges traces from all processes on a host that have enabled
+// ACTIVITIES_HOST_AGGREGATION into one time ordered trace file.
+//
+// Each process streams its trace into a SharedRing and passes the ring
+// to the aggregator with join(). The first process to join when no
+// aggregator is running becomes the aggregator - binding the abstract
+// socket is atomic, so exactly one process wins. Both sides check the
+// kernel credentials of the other, so rings are only exchanged between
+// processes of the same user. GPU rows are shown per process. The aggregator drains
+// rings while producers write them, so rings stay small. Once all rings
+// are closed and no process has joined for a while, it stops accepting
+// new rings, writes the combined trace and exits.
+class HostTraceAggregator {
+ public:
+  // Socket name shared by processes of the same user
+  static std::string socketName();
+
+  // Hand a ring to the aggregator, electing this process if there is none.
+  // An elected aggregator writes the combined trace to logFile.
+  // Returns false if the ring could not be handed over.
+  static bool join(
+      const SharedRing& ring,
+      const std::string& logFile,
+      const std::string& name = socketName());
+
+  // Throws std::system_error if another aggregator holds the socket
+  HostTraceAggregator(
+      const std::string& name,
+      const std::string& logFile,
+      std::chrono::milliseconds joinWindow = std::chrono::seconds(2),
+      std::chrono::milliseconds timeout = std::chrono::seconds(120));
+  ~HostTraceAggregator();
+  HostTraceAggregator(const HostTraceAggregator&) = delete;
+  HostTraceAggregator& operator=(const HostTraceAggregator&) = delete;
+
+  // True once the combined trace has been written
+  bool done() const {
+    return done_;
+  }
+
+  // Merge per-process events, each sorted by time, into one JSON trace
+  static void writeTrace(
+      std::vector<std::vector<HostTraceEvent>>& events,
+      std::ostream& out);
+
+ private:
+  struct Producer {
+    pid_t pid;
+    std::unique_ptr<SharedRing> ring;
+    std::vector<HostTraceEvent> events;
+  };
+
+  void run();
+  // Returns true if any new ring joined
+  bool acceptRings();
+  // Returns true if all rings are finished
+  bool drainRings();
+  void finish();
+
+  std::unique_ptr<IpcSocket> socket_;
+  const std::string logFile_;
+  const std::chrono::milliseconds joinWindow_;
+  const std::chrono::milliseconds timeout_;
+  std::vector<Producer> producers_;
+  std::atomic_bool stop_{false};
+  std::atomic_bool done_{false};
+  std::thread thread_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "IpcDaemonConfigLoader.h"
+
+#include <stdlib.h>
+#include <system_error>
+
+#include "Logger.h"
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+// The daemon is local and replies right away
+constexpr milliseconds kReplyTimeout(100);
+
+std::unique_ptr<DaemonConfigLoader> IpcDaemonConfigLoader::create() {
+  try {
+    return std::make_unique<IpcDaemonConfigLoader>();
+  } catch (const std::system_error& e) {
+    LOG(ERROR) << "Failed to create daemon socket: " << e.what();
+    return nullptr;
+  }
+}
+
+IpcDaemonConfigLoader::IpcDaemonConfigLoader(const std::string& daemon)
+    : daemon_(daemon) {
+  LOG(INFO) << "Polling daemon @" << daemon_ << " for on-demand configs";
+}
+
+bool IpcDaemonConfigLoader::send(
+    const std::string& command,
+    uint64_t seq,
+    const std::string& payload) {
+  return socket_.send(
+      daemon_, command + "\n" + std::to_string(seq) + "\n" + payload);
+}
+
+uint64_t IpcDaemonConfigLoader::handleReply(
+    const std::string& msg,
+    const std::string& src) {
+  size_t pos = msg.find('\n');
+  if (src != daemon_ || pos == std::string::npos) {
+    return 0;
+  }
+  uint64_t seq = strtoull(msg.c_str(), nullptr, 10);
+  // Replies to earlier polls are stale
+  if (seq == pollSeq_ && pos + 1 < msg.size()) {
+    config_ = msg.substr(pos + 1);
+  }
+  return seq;
+}
+
+bool IpcDaemonConfigLoader::request(
+    const std::string& command,
+    const std::string& payload,
+    std::string& reply) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t seq = ++seq_;
+  if (!send(command, seq, payload)) {
+    LOG_IF(WARNING, daemonReachable_)
+        << "Daemon @" << daemon_ << " is not running";
+    daemonReachable_ = false;
+    return false;
+  }
+  daemonReachable_ = true;
+  std::string msg;
+  std::string src;
+  auto deadline = steady_clock::now() + kReplyTimeout;
+  for (auto now = steady_clock::now(); now < deadline;
+       now = steady_clock::now()) {
+    if (!socket_.recv(msg, src, duration_cast<milliseconds>(deadline - now))) {
+      break;
+    }
+    // Poll replies are kept for readReply()
+    if (handleReply(msg, src) == seq) {
+      reply = msg.substr(msg.find('\n') + 1);
+      return true;
+    }
+  }
+  LOG(WARNING) << "No reply from daemon @" << daemon_ << " to " << command;
+  return false;
+}
+
+std::string IpcDaemonConfigLoader::readOnDemandConfig(
+    bool events,
+    bool activities) {
+  std::string payload = std::string(events ? "1" : "0") + " " +
+      (activities ? "1" : "0");
+  std::lock_guard<std::mutex> lock(mutex_);
+  pollSeq_ = ++seq_;
+  if (!send("poll", pollSeq_, payload)) {
+    LOG_IF(WARNING, daemonReachable_)
+        << "Daemon @" << daemon_ << " is not running";
+    daemonReachable_ = false;
+  } else {
+    daemonReachable_ = true;
+  }
+  // Received while waiting for another reply
+  std::string config;
+  config.swap(config_);
+  return config;
+}
+
+std::string IpcDaemonConfigLoader::readReply() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string msg;
+  std::string src;
+  while (socket_.recv(msg, src)) {
+    handleReply(msg, src);
+  }
+  std::string config;
+  config.swap(config_);
+  return config;
+}
+
+int IpcDaemonConfigLoader::gpuContextCount(uint32_t device) {
+  std::string reply;
+  if (!request("contexts", std::to_string(device), reply)) {
+    return -1;
+  }
+  char* end;
+  long count = strtol(reply.c_str(), &end, 10);
+  if (end == reply.c_str()) {
+    LOG(ERROR) << "Invalid context count from daemon: " << reply;
+    return -1;
+  }
+  return count;
+}
+
+void IpcDaemonConfigLoader::gpuContextCreated(uint32_t device) {
+  if (!send("context", 0, std::to_string(device) + " +1")) {
+    VLOG(0) << "Failed to notify daemon of context creation";
+  }
+}
+
+void IpcDaemonConfigLoader::gpuContextDestroyed(uint32_t device) {
+  if (!send("context", 0, std::to_string(device) + " -1")) {
+    VLOG(0) << "Failed to notify daemon of context destruction";
+  }
+}
+
+} // namespace KINETO_NAMESPACE
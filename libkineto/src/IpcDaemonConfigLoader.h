@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "DaemonConfigLoader.h"
+#include "IpcSocket.h"
+
+namespace KINETO_NAMESPACE {
+
+// Reference DaemonConfigLoader talking to a host-local daemon, such as
+// tools/kineto_daemon, on the abstract Unix socket @kineto_daemon.
+//
+// Requests are single datagrams, "<command>\n<seq>\n<payload>",
+// and replies "<seq>\n<body>". The sequence number lets a late reply to
+// a request that timed out be told apart from the current one.
+// The daemon identifies the sending process from the credentials the
+// kernel attaches to each datagram, so a process cannot pose as another.
+//
+//   poll      "<events> <activities>" (0 or 1) -> posted config or empty
+//   context   "<device> <+1|-1>"               -> no reply
+//   contexts  "<device>"                       -> context count
+//
+// Polling also registers the process with the daemon, which then includes
+// it when fanning out trace requests. Polls do not wait for the reply,
+// which is read from replyFd() once it arrives.
+class IpcDaemonConfigLoader : public DaemonConfigLoader {
+ public:
+  static constexpr const char* kDaemonSocketName = "kineto_daemon";
+
+  // Throws std::system_error if the socket cannot be created
+  explicit IpcDaemonConfigLoader(
+      const std::string& daemon = kDaemonSocketName);
+
+  // Returns nullptr on failure
+  static std::unique_ptr<DaemonConfigLoader> create();
+
+  // Sends a poll without waiting for the reply, which is returned by
+  // readReply(). Returns a config received earlier but not yet read.
+  std::string readOnDemandConfig(bool events, bool activities) override;
+
+  int replyFd() override {
+    return socket_.fd();
+  }
+
+  std::string readReply() override;
+
+  int gpuContextCount(uint32_t device) override;
+
+  void gpuContextCreated(uint32_t device) override;
+  void gpuContextDestroyed(uint32_t device) override;
+
+ private:
+  // Send a request and wait for the matching reply.
+  // Returns false if the daemon is not running or does not reply in time.
+  bool request(
+      const std::string& command,
+      const std::string& payload,
+      std::string& reply);
+
+  // Send a request without waiting for a reply.
+  // Call with mutex_ held when seq is not 0.
+  bool send(
+      const std::string& command,
+      uint64_t seq,
+      const std::string& payload);
+
+  // Keep the config from a reply to the outstanding poll.
+  // Returns the sequence number of the reply, or 0 if not from the daemon.
+  // Call with mutex_ held.
+  uint64_t handleReply(const std::string& msg, const std::string& src);
+
+  IpcSocket socket_;
+  const std::string daemon_;
+  // Serializes requests so that replies are not consumed by another caller
+  std::mutex mutex_;
+  uint64_t seq_{0};
+  // Last poll sent, and the config posted in reply to it
+  uint64_t pollSeq_{0};
+  std::string config_;
+  // Avoid flooding the log when no daemon is running
+  bool daemonReachable_{true};
+};
+
+} // namespace KINETO_NAMESPACE
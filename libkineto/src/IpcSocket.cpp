@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "IpcSocket.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <system_error>
+
+namespace KINETO_NAMESPACE {
+
+// Build an abstract socket address - a leading NUL followed by the name
+static socklen_t abstractAddress(
+    const std::string& name,
+    struct sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  size_t len = std::min(name.size(), sizeof(addr.sun_path) - 1);
+  memcpy(addr.sun_path + 1, name.data(), len);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static std::string addressName(const struct sockaddr_un& addr, socklen_t len) {
+  size_t offset = offsetof(struct sockaddr_un, sun_path) + 1;
+  if (len <= offset) {
+    return "";
+  }
+  return std::string(addr.sun_path + 1, len - offset);
+}
+
+IpcSocket::IpcSocket(const std::string& name) {
+  fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "Failed to create socket");
+  }
+  // Receive sender credentials with each message
+  int on = 1;
+  if (setsockopt(fd_, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0) {
+    int err = errno;
+    close(fd_);
+    throw std::system_error(
+        err, std::generic_category(), "Failed to enable credentials");
+  }
+  struct sockaddr_un addr;
+  socklen_t len = abstractAddress(name, addr);
+  if (name.empty()) {
+    // Let the kernel pick a unique name
+    len = sizeof(sa_family_t);
+  }
+  if (bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), len) < 0) {
+    int err = errno;
+    close(fd_);
+    throw std::system_error(
+        err, std::generic_category(), "Failed to bind socket " + name);
+  }
+  len = sizeof(addr);
+  if (getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr), &len) ==
+      0) {
+    name_ = addressName(addr, len);
+  }
+}
+
+IpcSocket::~IpcSocket() {
+  close(fd_);
+}
+
+bool IpcSocket::send(const std::string& dest, const std::string& message) {
+  return send(dest, message, -1);
+}
+
+bool IpcSocket::send(
+    const std::string& dest,
+    const std::string& message,
+    int fd) {
+  struct sockaddr_un addr;
+  socklen_t len = abstractAddress(dest, addr);
+  struct iovec iov = {const_cast<char*>(message.data()), message.size()};
+  struct msghdr msg = {};
+  msg.msg_name = &addr;
+  msg.msg_namelen = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  ssize_t res = sendmsg(fd_, &msg, 0);
+  return res == static_cast<ssize_t>(message.size());
+}
+
+bool IpcSocket::recv(std::string& message, std::string& src) {
+  int fd;
+  if (!recv(message, src, fd)) {
+    return false;
+  }
+  if (fd >= 0) {
+    // Not expected by the caller
+    close(fd);
+  }
+  return true;
+}
+
+bool IpcSocket::recv(std::string& message, std::string& src, int& fd) {
+  struct ucred cred;
+  return recv(message, src, fd, cred);
+}
+
+bool IpcSocket::recv(
+    std::string& message,
+    std::string& src,
+    int& fd,
+    struct ucred& cred) {
+  fd = -1;
+  cred = {0, static_cast<uid_t>(-1), static_cast<gid_t>(-1)};
+  // Find the size of the next message first.
+  // Passed descriptors are not received when peeking without control buffer.
+  ssize_t size = ::recv(fd_, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+  if (size < 0) {
+    return false;
+  }
+  message.resize(size);
+  struct sockaddr_un addr;
+  struct iovec iov = {&message[0], message.size()};
+  struct msghdr msg = {};
+  msg.msg_name = &addr;
+  msg.msg_namelen = sizeof(addr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  union {
+    char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(struct ucred))];
+    struct cmsghdr align;
+  } control;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  ssize_t res = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+  if (res < 0) {
+    return false;
+  }
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+    if (cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    } else if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+      memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+    }
+  }
+  message.resize(res);
+  src = addressName(addr, msg.msg_namelen);
+  return true;
+}
+
+bool IpcSocket::recv(
+    std::string& message,
+    std::string& src,
+    std::chrono::milliseconds timeout) {
+  struct pollfd pfd = {fd_, POLLIN, 0};
+  if (poll(&pfd, 1, timeout.count()) != 1) {
+    return false;
+  }
+  return recv(message, src);
+}
+
+bool IpcSocket::trusted(const struct ucred& cred) {
+  return cred.uid == geteuid() || cred.uid == 0;
+}
+
+} // namespace KINETO_NAMESPACE
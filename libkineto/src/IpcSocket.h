@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <chrono>
+#include <string>
+
+namespace KINETO_NAMESPACE {
+
+// Datagram socket in the abstract Unix domain socket namespace.
+// Abstract sockets need no file system path, are local to the network
+// namespace and disappear when closed, so there is nothing to clean up
+// after a crash. Each message is delivered whole or not at all.
+// Any local user can send to an abstract socket, so received messages
+// carry the sender's credentials as verified by the kernel.
+class IpcSocket {
+ public:
+  // Bind to the given abstract name. An empty name binds to a unique
+  // name chosen by the kernel, which is useful for clients.
+  // Throws std::system_error on failure.
+  explicit IpcSocket(const std::string& name = "");
+  ~IpcSocket();
+  IpcSocket(const IpcSocket&) = delete;
+  IpcSocket& operator=(const IpcSocket&) = delete;
+
+  // Readable when a message is available
+  int fd() const {
+    return fd_;
+  }
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  // Send a message to the socket bound to dest.
+  // Returns false if there is no such socket or it is not receiving.
+  bool send(const std::string& dest, const std::string& message);
+
+  // As above, also passing a file descriptor to the receiver,
+  // e.g. a memfd to share memory with it.
+  bool send(const std::string& dest, const std::string& message, int fd);
+
+  // Receive a pending message without blocking.
+  // Returns false if no message is available.
+  bool recv(std::string& message, std::string& src);
+
+  // As above, and sets fd to a descriptor passed with the message, or -1.
+  // The caller owns the received descriptor.
+  bool recv(std::string& message, std::string& src, int& fd);
+
+  // As above, and sets cred to the sender's pid, uid and gid.
+  // The uid is -1 if the kernel did not pass the credentials.
+  bool recv(
+      std::string& message,
+      std::string& src,
+      int& fd,
+      struct ucred& cred);
+
+  // Wait up to timeout for a message
+  bool recv(
+      std::string& message,
+      std::string& src,
+      std::chrono::milliseconds timeout);
+
+  // Whether a sender may control this process:
+  // the same effective user, or root
+  static bool trusted(const struct ucred& cred);
+
+ private:
+  int fd_;
+  std::string name_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "IterationSampler.h"
+
+#include <algorithm>
+
+namespace KINETO_NAMESPACE {
+
+IterationSampler::IterationSampler(
+    int stride,
+    int offset,
+    int jitter,
+    uint32_t seed)
+    : stride_(std::max(stride, 0)),
+      offset_(stride_ > 0 ? std::min(std::max(offset, 0), stride_ - 1) : 0),
+      // Keep the sample within its period
+      jitter_(std::min(std::max(jitter, 0), std::max(stride_ - 1 - offset_, 0))),
+      rng_(seed) {}
+
+bool IterationSampler::sampled(int iteration) {
+  if (stride_ == 0) {
+    return true;
+  }
+  int period = iteration / stride_;
+  if (period != period_) {
+    period_ = period;
+    int jitter = 0;
+    if (jitter_ > 0) {
+      jitter = std::uniform_int_distribution<int>(0, jitter_)(rng_);
+    }
+    sample_ = period * stride_ + offset_ + jitter;
+  }
+  return iteration == sample_;
+}
+
+} // namespace KINETO_NAMESPACE
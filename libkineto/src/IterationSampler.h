@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+namespace KINETO_NAMESPACE {
+
+// Picks one iteration out of every stride iterations, at a fixed offset
+// into each period plus a random jitter of up to the given number of
+// iterations. Jitter avoids aliasing with periodic behavior in the job.
+class IterationSampler {
+ public:
+  IterationSampler() : IterationSampler(0, 0, 0) {}
+  IterationSampler(int stride, int offset, int jitter)
+      : IterationSampler(stride, offset, jitter, std::random_device()()) {}
+  IterationSampler(int stride, int offset, int jitter, uint32_t seed);
+
+  bool enabled() const {
+    return stride_ > 0;
+  }
+
+  // Is this iteration sampled? Iterations must be queried in
+  // non-decreasing order.
+  bool sampled(int iteration);
+
+ private:
+  int stride_;
+  int offset_;
+  int jitter_;
+  std::mt19937 rng_;
+  int period_{-1};
+  int sample_{-1};
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+void LatencyHistogram::add(microseconds latency) {
+  int64_t us = std::max<int64_t>(0, latency.count());
+  int bucket = 0;
+  while (bucket < kBucketCount - 1 && us >= bucketLimitUs(bucket)) {
+    bucket++;
+  }
+  buckets_[bucket]++;
+  count_++;
+  sumUs_ += us;
+  maxUs_ = std::max(maxUs_, us);
+}
+
+void LatencyHistogram::clear() {
+  buckets_.fill(0);
+  count_ = 0;
+  sumUs_ = 0;
+  maxUs_ = 0;
+}
+
+microseconds LatencyHistogram::percentile(int pct) const {
+  if (count_ == 0) {
+    return microseconds(0);
+  }
+  int64_t rank = std::max<int64_t>(1, (pct * count_ + 99) / 100);
+  int64_t seen = 0;
+  for (int i = 0; i < kBucketCount; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return microseconds(std::min(bucketLimitUs(i), maxUs_));
+    }
+  }
+  return max();
+}
+
+void LatencyHistogram::print(std::ostream& s) const {
+  s << "count=" << count_ << " mean=" << mean().count() << "us"
+    << " p50<=" << percentile(50).count() << "us"
+    << " p99<=" << percentile(99).count() << "us"
+    << " max=" << maxUs_ << "us [";
+  bool first = true;
+  for (int i = 0; i < kBucketCount; i++) {
+    if (buckets_[i] > 0) {
+      if (!first) {
+        s << " ";
+      }
+      s << "<" << bucketLimitUs(i) << "us:" << buckets_[i];
+      first = false;
+    }
+  }
+  s << "]";
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+namespace KINETO_NAMESPACE {
+
+// Histogram of latencies with power-of-two microsecond buckets.
+// Bucket i holds values in [2^(i-1), 2^i) us, bucket 0 holds values < 1us.
+// Recording is allocation free and cheap enough for the sampling path.
+// Not thread safe - callers provide their own synchronization if needed.
+class LatencyHistogram {
+ public:
+  void add(std::chrono::microseconds latency);
+
+  void clear();
+
+  int64_t count() const {
+    return count_;
+  }
+
+  std::chrono::microseconds max() const {
+    return std::chrono::microseconds(maxUs_);
+  }
+
+  std::chrono::microseconds mean() const {
+    return std::chrono::microseconds(count_ > 0 ? sumUs_ / count_ : 0);
+  }
+
+  // Upper bound of the bucket holding the given percentile (nearest-rank)
+  std::chrono::microseconds percentile(int pct) const;
+
+  // Print as "count=N mean=Xus p50<=Yus p99<=Zus max=Wus [buckets]"
+  void print(std::ostream& s) const;
+
+ private:
+  static constexpr int kBucketCount = 32;
+
+  static int64_t bucketLimitUs(int bucket) {
+    return int64_t(1) << bucket;
+  }
+
+  std::array<int64_t, kBucketCount> buckets_{};
+  int64_t count_{0};
+  int64_t sumUs_{0};
+  int64_t maxUs_{0};
+};
+
+inline std::ostream& operator<<(std::ostream& s, const LatencyHistogram& h) {
+  h.print(s);
+  return s;
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "NetFilter.h"
+
+#include <queue>
+
+namespace KINETO_NAMESPACE {
+
+NetFilter::NetFilter(const std::vector<std::string>& substrings)
+    : empty_(substrings.empty()), nodes_(1) {
+  // Trie of all substrings
+  for (const std::string& s : substrings) {
+    int32_t node = 0;
+    for (char c : s) {
+      int32_t next = transition(node, c);
+      if (next < 0) {
+        next = nodes_.size();
+        nodes_[node].next.emplace_back(c, next);
+        nodes_.emplace_back();
+      }
+      node = next;
+    }
+    nodes_[node].match = true;
+  }
+
+  // Failure links, breadth first so that shorter suffixes are done first
+  std::queue<int32_t> queue;
+  for (const auto& edge : nodes_[0].next) {
+    queue.push(edge.second);
+  }
+  while (!queue.empty()) {
+    int32_t node = queue.front();
+    queue.pop();
+    for (const auto& edge : nodes_[node].next) {
+      char c = edge.first;
+      int32_t child = edge.second;
+      int32_t fail = nodes_[node].fail;
+      int32_t next;
+      while ((next = transition(fail, c)) < 0 && fail != 0) {
+        fail = nodes_[fail].fail;
+      }
+      nodes_[child].fail = next < 0 ? 0 : next;
+      nodes_[child].match |= nodes_[nodes_[child].fail].match;
+      queue.push(child);
+    }
+  }
+}
+
+int32_t NetFilter::transition(int32_t node, char c) const {
+  for (const auto& edge : nodes_[node].next) {
+    if (edge.first == c) {
+      return edge.second;
+    }
+  }
+  return -1;
+}
+
+bool NetFilter::matches(const std::string& name) const {
+  if (empty_ || nodes_[0].match) {
+    return true;
+  }
+  int32_t node = 0;
+  for (char c : name) {
+    int32_t next;
+    while ((next = transition(node, c)) < 0 && node != 0) {
+      node = nodes_[node].fail;
+    }
+    node = next < 0 ? 0 : next;
+    if (nodes_[node].match) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace KINETO_NAMESPACE {
+
+// Matches names against a set of substrings in a single pass over the name,
+// using an Aho-Corasick automaton built once from the substrings.
+// Immutable once built, so it can be shared between threads.
+class NetFilter {
+ public:
+  NetFilter() : NetFilter(std::vector<std::string>()) {}
+  explicit NetFilter(const std::vector<std::string>& substrings);
+
+  // No substrings - everything matches
+  bool empty() const {
+    return empty_;
+  }
+
+  // True if name contains any of the substrings, or if there are none
+  bool matches(const std::string& name) const;
+
+ private:
+  struct Node {
+    // Sparse transitions, as nets are typically filtered by a few names
+    std::vector<std::pair<char, int32_t>> next;
+    // Longest proper suffix that is also a prefix of a substring
+    int32_t fail{0};
+    // A substring ends here, or at a suffix of here
+    bool match{false};
+  };
+
+  // Returns -1 if there is no transition
+  int32_t transition(int32_t node, char c) const;
+
+  bool empty_;
+  std::vector<Node> nodes_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace KINETO_NAMESPACE {
+
+// Stable LSD radix sort on an unsigned integer key, 8 bits per pass.
+// Passes over bytes that are the same in all keys are skipped, so keys
+// in a narrow range, like correlation ids, take only a few passes.
+// Input that is already sorted, like ids in the order they were assigned,
+// is detected while counting and left as is.
+template <class T, class KeyFn>
+void radixSort(std::vector<T>& items, KeyFn key) {
+  using Key = typename std::decay<decltype(key(items.front()))>::type;
+  static_assert(std::is_unsigned<Key>::value, "Key must be unsigned");
+  constexpr int kPasses = sizeof(Key);
+  if (items.size() < 2) {
+    return;
+  }
+
+  // Count all digits up front, in a single pass over the input
+  std::vector<std::array<size_t, 256>> counts(kPasses);
+  for (auto& count : counts) {
+    count.fill(0);
+  }
+  bool sorted = true;
+  Key prev = key(items.front());
+  for (const T& item : items) {
+    Key k = key(item);
+    sorted = sorted && prev <= k;
+    prev = k;
+    for (int pass = 0; pass < kPasses; pass++) {
+      counts[pass][(k >> (pass * 8)) & 0xff]++;
+    }
+  }
+  if (sorted) {
+    return;
+  }
+
+  std::vector<T> buffer(items.size());
+  for (int pass = 0; pass < kPasses; pass++) {
+    auto& count = counts[pass];
+    const int shift = pass * 8;
+    if (count[(key(items.front()) >> shift) & 0xff] == items.size()) {
+      continue;
+    }
+    size_t offset = 0;
+    for (auto& c : count) {
+      size_t n = c;
+      c = offset;
+      offset += n;
+    }
+    for (T& item : items) {
+      buffer[count[(key(item) >> shift) & 0xff]++] = std::move(item);
+    }
+    items.swap(buffer);
+  }
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Scheduler.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <system_error>
+
+#include "ThreadName.h"
+
+#include "Logger.h"
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+constexpr seconds kLatenessReportInterval(60);
+
+// Number of ticks spanned by one slot at a level
+static inline int64_t levelSpan(int level) {
+  return int64_t(1) << (6 * level);
+}
+
+// Intentionally leaked so that components owned by other static objects
+// can cancel their tasks during static destruction in any order.
+// The thread is stopped and joined at exit.
+Scheduler& Scheduler::instance() {
+  static Scheduler* scheduler = []() {
+    auto s = new Scheduler();
+    std::atexit([]() { instance().stop(); });
+    return s;
+  }();
+  return *scheduler;
+}
+
+Scheduler::Scheduler() : epoch_(Clock::now()) {
+  wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeupFd_ < 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "Failed to create eventfd");
+  }
+  thread_ = std::thread(&Scheduler::run, this);
+  schedule(
+      "lateness report",
+      Clock::now() + kLatenessReportInterval,
+      [this](const TimePoint& now) {
+        if (VLOG_IS_ON(0)) {
+          printLateness(LIBKINETO_DBG_STREAM);
+        }
+        return now + kLatenessReportInterval;
+      });
+}
+
+Scheduler::~Scheduler() {
+  stop();
+  close(wakeupFd_);
+}
+
+void Scheduler::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  notify();
+  if (!thread_.joinable()) {
+    return;
+  }
+  if (onSchedulerThread()) {
+    // Called from a task, e.g. exit() - the thread stops after the task
+    thread_.detach();
+  } else {
+    thread_.join();
+  }
+}
+
+void Scheduler::notify() {
+  uint64_t one = 1;
+  if (write(wakeupFd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    PLOG(ERROR) << "Failed to wake up scheduler";
+  }
+}
+
+int64_t Scheduler::toTick(const TimePoint& t) const {
+  // Round up so that tasks never run early
+  auto d = duration_cast<nanoseconds>(t - epoch_);
+  return (d.count() + 999999) / 1000000;
+}
+
+int64_t Scheduler::elapsedTicks(const TimePoint& t) const {
+  return duration_cast<milliseconds>(t - epoch_).count();
+}
+
+Scheduler::TimePoint Scheduler::tickTime(int64_t tick) const {
+  return epoch_ + duration_cast<Clock::duration>(milliseconds(tick));
+}
+
+Scheduler::TaskId Scheduler::schedule(
+    const std::string& name,
+    const TimePoint& deadline,
+    Task task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TaskId id = nextTaskId_++;
+  TaskState& state = tasks_[id];
+  state.name = name;
+  state.task = std::move(task);
+  state.deadline = deadline;
+  enqueue(id, state);
+  notify();
+  return id;
+}
+
+Scheduler::TaskId Scheduler::watch(
+    const std::string& name,
+    int fd,
+    const TimePoint& deadline,
+    Task task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TaskId id = nextTaskId_++;
+  TaskState& state = tasks_[id];
+  state.name = name;
+  state.task = std::move(task);
+  state.deadline = deadline;
+  state.fd = fd;
+  enqueue(id, state);
+  notify();
+  return id;
+}
+
+void Scheduler::reschedule(TaskId id, const TimePoint& deadline) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tasks_.find(id);
+  if (it == tasks_.end() || it->second.cancelled) {
+    return;
+  }
+  TaskState& state = it->second;
+  if (state.running) {
+    state.wakeup = std::min(state.wakeup, deadline);
+    return;
+  }
+  state.generation++;
+  state.deadline = deadline;
+  enqueue(id, state);
+  notify();
+}
+
+void Scheduler::cancel(TaskId id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = tasks_.find(id);
+  if (it == tasks_.end()) {
+    return;
+  }
+  it->second.cancelled = true;
+  if (!it->second.running) {
+    tasks_.erase(it);
+    // Stop polling the fd, if any
+    notify();
+    return;
+  }
+  // Removed by runTask when complete
+  if (!onSchedulerThread()) {
+    cond_.wait(lock, [this, id] { return tasks_.find(id) == tasks_.end(); });
+  }
+}
+
+void Scheduler::printLateness(std::ostream& s) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  s << "Scheduler lateness:" << std::endl;
+  for (const auto& pair : lateness_) {
+    s << "  " << pair.first << ": " << pair.second << std::endl;
+  }
+}
+
+void Scheduler::enqueue(TaskId id, TaskState& state) {
+  if (state.deadline == TimePoint::max()) {
+    // Parked until rescheduled
+    return;
+  }
+  if (state.deadline <= Clock::now()) {
+    // Run on next iteration without waiting for the next tick
+    ready_.push_back({id, state.generation, currentTick_});
+    return;
+  }
+  // Not before the next unprocessed tick
+  int64_t tick = std::max(currentTick_ + 1, toTick(state.deadline));
+  insert({id, state.generation, tick});
+}
+
+void Scheduler::insert(const Entry& entry) {
+  // Entries may be due in the current tick when cascading
+  int64_t delta = std::max<int64_t>(0, entry.tick - currentTick_);
+  for (int level = 0; level < kLevelCount; level++) {
+    if (delta < levelSpan(level + 1)) {
+      int slot = (entry.tick >> (kSlotBits * level)) & (kSlotCount - 1);
+      wheel_[level][slot].push_back(entry);
+      levelEntryCount_[level]++;
+      return;
+    }
+  }
+  overflow_.push_back(entry);
+}
+
+// Redistribute entries of a higher level slot when the wheel
+// reaches the start of the range it covers.
+void Scheduler::cascade(int level, int64_t tick) {
+  std::vector<Entry> entries;
+  if (level < kLevelCount) {
+    int slot = (tick >> (kSlotBits * level)) & (kSlotCount - 1);
+    entries.swap(wheel_[level][slot]);
+    levelEntryCount_[level] -= entries.size();
+  } else {
+    entries.swap(overflow_);
+  }
+  for (const auto& entry : entries) {
+    insert(entry);
+  }
+}
+
+void Scheduler::advanceTo(int64_t tick, std::vector<Entry>& due) {
+  while (currentTick_ < tick) {
+    // Nothing can fire before the next slot boundary of the lowest
+    // non-empty level, so skip ahead.
+    int empty_levels = 0;
+    while (empty_levels < kLevelCount &&
+           levelEntryCount_[empty_levels] == 0) {
+      empty_levels++;
+    }
+    if (empty_levels == kLevelCount && overflow_.empty()) {
+      currentTick_ = tick;
+      break;
+    }
+    int64_t next = currentTick_ + 1;
+    if (empty_levels > 0) {
+      int64_t span = levelSpan(empty_levels);
+      next = ((currentTick_ / span) + 1) * span;
+      if (next > tick) {
+        currentTick_ = tick;
+        break;
+      }
+    }
+    currentTick_ = next;
+
+    for (int level = kLevelCount; level > 0; level--) {
+      if (next % levelSpan(level) == 0) {
+        cascade(level, next);
+      }
+    }
+
+    auto& slot = wheel_[0][next & (kSlotCount - 1)];
+    levelEntryCount_[0] -= slot.size();
+    due.insert(due.end(), slot.begin(), slot.end());
+    slot.clear();
+  }
+}
+
+int64_t Scheduler::nextWakeupTick() const {
+  if (levelEntryCount_[0] > 0) {
+    for (int64_t t = currentTick_ + 1; t <= currentTick_ + kSlotCount; t++) {
+      if (!wheel_[0][t & (kSlotCount - 1)].empty()) {
+        return t;
+      }
+    }
+  }
+  for (int level = 1; level <= kLevelCount; level++) {
+    if (level == kLevelCount ? !overflow_.empty()
+                             : levelEntryCount_[level] > 0) {
+      int64_t span = levelSpan(level);
+      return ((currentTick_ / span) + 1) * span;
+    }
+  }
+  return kNoTick;
+}
+
+void Scheduler::runTask(const Entry& entry, std::unique_lock<std::mutex>& lock) {
+  // Skip entries invalidated by reschedule or cancel
+  TaskId id = entry.id;
+  auto it = tasks_.find(id);
+  if (it == tasks_.end() || it->second.cancelled ||
+      it->second.generation != entry.generation) {
+    return;
+  }
+  TaskState& state = it->second;
+  state.running = true;
+  TimePoint deadline = state.deadline;
+  lock.unlock();
+
+  TimePoint now = Clock::now();
+  TimePoint next = state.task(now);
+
+  lock.lock();
+  state.running = false;
+  lateness_[state.name].add(duration_cast<microseconds>(now - deadline));
+  if (state.cancelled ||
+      (state.fd < 0 && next == TimePoint::max() &&
+       state.wakeup == TimePoint::max())) {
+    tasks_.erase(id);
+    cond_.notify_all();
+    return;
+  }
+  state.deadline = std::min(next, state.wakeup);
+  state.wakeup = TimePoint::max();
+  state.generation++;
+  enqueue(id, state);
+}
+
+void Scheduler::run() {
+  setThreadName("Kineto Scheduler");
+  VLOG(0) << "Starting scheduler";
+  std::vector<Entry> due;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    due.swap(ready_);
+    // Deadlines are rounded up to the tick, so all tasks in
+    // elapsed ticks are due.
+    advanceTo(elapsedTicks(Clock::now()), due);
+    for (const auto& entry : due) {
+      runTask(entry, lock);
+      if (stop_) {
+        break;
+      }
+    }
+    if (!due.empty()) {
+      due.clear();
+      continue;
+    }
+    wait(nextWakeupTick(), lock);
+  }
+  VLOG(0) << "Stopped scheduler";
+}
+
+void Scheduler::wait(int64_t tick, std::unique_lock<std::mutex>& lock) {
+  std::vector<struct pollfd> fds{{wakeupFd_, POLLIN, 0}};
+  std::vector<TaskId> ids{0};
+  for (const auto& pair : tasks_) {
+    if (pair.second.fd >= 0) {
+      fds.push_back({pair.second.fd, POLLIN, 0});
+      ids.push_back(pair.first);
+    }
+  }
+  int timeout_ms = -1;
+  if (tick != kNoTick) {
+    auto delay = tickTime(tick) - Clock::now();
+    // Round up so that the tick has elapsed when waking up
+    timeout_ms = std::max<int64_t>(
+        0, (duration_cast<microseconds>(delay).count() + 999) / 1000);
+  }
+
+  lock.unlock();
+  int res = poll(fds.data(), fds.size(), timeout_ms);
+  lock.lock();
+
+  if (res < 0) {
+    if (errno != EINTR) {
+      PLOG(ERROR) << "Scheduler poll failed";
+    }
+    return;
+  }
+  if (fds[0].revents) {
+    uint64_t count;
+    while (read(wakeupFd_, &count, sizeof(count)) > 0) {
+    }
+  }
+  for (size_t i = 1; i < fds.size(); i++) {
+    if (fds[i].revents == 0) {
+      continue;
+    }
+    // Tasks may have been cancelled while polling
+    auto it = tasks_.find(ids[i]);
+    if (it != tasks_.end() && !it->second.cancelled) {
+      TaskState& state = it->second;
+      // Run now, replacing any pending deadline
+      state.generation++;
+      state.deadline = Clock::now();
+      enqueue(ids[i], state);
+    }
+  }
+}
+
+} // namespace KINETO_NAMESPACE
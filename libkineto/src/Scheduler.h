@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "LatencyHistogram.h"
+
+namespace KINETO_NAMESPACE {
+
+// Runs periodic profiler work - counter sampling, multiplexing and
+// reporting, config polling and activity profiler runloop steps - as tasks
+// on a single shared thread, instead of one mostly idle thread per component.
+//
+// Deadlines are absolute. Pending tasks are kept in a hierarchical timer
+// wheel with 1ms ticks, so scheduling, rescheduling and cancelling do not
+// depend on the number of tasks. A task never runs before its deadline.
+//
+// Tasks run on the scheduler thread and should not block for long,
+// since that delays all other tasks. Lateness (time from deadline to
+// task start) is tracked per task name.
+//
+// A task can also watch a file descriptor, e.g. inotify or a socket,
+// in which case it also runs whenever the descriptor is readable.
+// The scheduler thread sleeps in poll() when there is nothing to do.
+class Scheduler {
+ public:
+  using Clock = std::chrono::system_clock;
+  using TimePoint = std::chrono::time_point<Clock>;
+  // Invoked at or shortly after the deadline.
+  // Returns the next deadline, or TimePoint::max() to remove the task.
+  using Task = std::function<TimePoint(const TimePoint& now)>;
+  using TaskId = uint64_t;
+
+  // Shared by all profiler components
+  static Scheduler& instance();
+
+  Scheduler();
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  TaskId schedule(const std::string& name, const TimePoint& deadline, Task task);
+
+  // Like schedule(), but the task also runs when fd is readable, and must
+  // then consume the available input. It is not removed when returning
+  // TimePoint::max(), only when cancelled. The caller owns fd and must
+  // keep it open until the task is cancelled.
+  TaskId watch(
+      const std::string& name,
+      int fd,
+      const TimePoint& deadline,
+      Task task);
+
+  // Change the deadline of a task, e.g. to wake it up early.
+  // If the task is currently running, the deadline it returns is
+  // replaced by this one if this one is earlier.
+  void reschedule(TaskId id, const TimePoint& deadline);
+
+  // Remove a task. If the task is running on the scheduler thread and this
+  // is called from another thread, waits for the task to complete.
+  void cancel(TaskId id);
+
+  // True if called from within a task
+  bool onSchedulerThread() const {
+    return std::this_thread::get_id() == thread_.get_id();
+  }
+
+  void printLateness(std::ostream& s);
+
+  // Stop running tasks and join the thread. Tasks can still be cancelled.
+  void stop();
+
+ private:
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlotCount = 1 << kSlotBits;
+  static constexpr int kLevelCount = 4;
+  static constexpr int kNoTick = -1;
+
+  struct TaskState {
+    std::string name;
+    Task task;
+    TimePoint deadline;
+    // Incremented when rescheduled, invalidating wheel entries
+    uint64_t generation{0};
+    bool running{false};
+    bool cancelled{false};
+    // Deadline requested while running
+    TimePoint wakeup{TimePoint::max()};
+    // Watched file descriptor, if any
+    int fd{-1};
+  };
+
+  struct Entry {
+    TaskId id;
+    uint64_t generation;
+    int64_t tick;
+  };
+
+  void run();
+  // Sleep until the given tick, a watched fd is readable or notify()
+  void wait(int64_t tick, std::unique_lock<std::mutex>& lock);
+  // Wake up the scheduler thread
+  void notify();
+
+  // Tick at or after t
+  int64_t toTick(const TimePoint& t) const;
+  // Ticks completed at time t
+  int64_t elapsedTicks(const TimePoint& t) const;
+  TimePoint tickTime(int64_t tick) const;
+
+  // Below functions must be called with mutex_ held
+  void insert(const Entry& entry);
+  void enqueue(TaskId id, TaskState& state);
+  void cascade(int level, int64_t tick);
+  void advanceTo(int64_t tick, std::vector<Entry>& due);
+  int64_t nextWakeupTick() const;
+  void runTask(const Entry& entry, std::unique_lock<std::mutex>& lock);
+
+  TimePoint epoch_;
+  // All ticks up to and including this one have been processed
+  int64_t currentTick_{0};
+  std::array<std::array<std::vector<Entry>, kSlotCount>, kLevelCount> wheel_;
+  std::array<int, kLevelCount> levelEntryCount_{};
+  // Deadlines beyond the range of the wheel
+  std::vector<Entry> overflow_;
+  // Tasks with deadlines already passed when scheduled
+  std::vector<Entry> ready_;
+
+  std::unordered_map<TaskId, TaskState> tasks_;
+  TaskId nextTaskId_{1};
+  std::map<std::string, LatencyHistogram> lateness_;
+
+  std::mutex mutex_;
+  // Signals completion of cancelled tasks
+  std::condition_variable cond_;
+  // eventfd used to wake up the scheduler thread
+  int wakeupFd_{-1};
+  bool stop_{false};
+  std::thread thread_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "SharedRing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+#include <system_error>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+namespace KINETO_NAMESPACE {
+
+constexpr uint64_t kRingMagic = 0x6b696e65746f5231; // "kinetoR1"
+
+// Positions only ever increase, and are reduced modulo capacity
+// when indexing. Producer and consumer counters are on separate cache lines.
+struct SharedRing::Header {
+  uint64_t magic;
+  uint64_t capacity;
+  alignas(64) std::atomic<uint64_t> writePos;
+  std::atomic<uint32_t> closed;
+  alignas(64) std::atomic<uint64_t> readPos;
+};
+
+// Records are prefixed by their size
+using RecordSize = uint32_t;
+
+static_assert(
+    ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+    "Shared memory atomics must be lock free");
+
+// The size is sealed, so that the consumer can rely on it
+constexpr int kRingSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+static int createMemfd(const std::string& name) {
+  // Use the syscall directly, the glibc wrapper is recent
+  return syscall(
+      SYS_memfd_create, name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+}
+
+std::unique_ptr<SharedRing> SharedRing::create(
+    const std::string& name,
+    size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  capacity = size;
+  int fd = createMemfd(name);
+  if (fd < 0) {
+    throw std::system_error(
+        errno, std::generic_category(), "Failed to create memfd");
+  }
+  size_t mapped_size = sizeof(Header) + capacity;
+  // Pages are only allocated when written
+  if (ftruncate(fd, mapped_size) < 0 ||
+      fcntl(fd, F_ADD_SEALS, kRingSeals) < 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(
+        err, std::generic_category(), "Failed to size and seal memfd");
+  }
+  void* base =
+      mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::generic_category(), "Failed to map ring");
+  }
+  Header* header = new (base) Header();
+  header->magic = kRingMagic;
+  header->capacity = capacity;
+  return std::unique_ptr<SharedRing>(
+      new SharedRing(fd, base, mapped_size, capacity));
+}
+
+std::unique_ptr<SharedRing> SharedRing::attach(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::generic_category(), "Invalid ring fd");
+  }
+  // Without seals the producer could shrink the file under the mapping
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || (seals & kRingSeals) != kRingSeals) {
+    ::close(fd);
+    throw std::system_error(
+        EINVAL, std::generic_category(), "Ring size not sealed");
+  }
+  size_t mapped_size = st.st_size;
+  if (mapped_size <= sizeof(Header)) {
+    ::close(fd);
+    throw std::system_error(EINVAL, std::generic_category(), "Ring too small");
+  }
+  // The header is writable by the producer, so the capacity is checked
+  // once here and not read from it again
+  uint64_t capacity = mapped_size - sizeof(Header);
+  if ((capacity & (capacity - 1)) != 0) {
+    ::close(fd);
+    throw std::system_error(EINVAL, std::generic_category(), "Not a ring");
+  }
+  void* base =
+      mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::generic_category(), "Failed to map ring");
+  }
+  auto ring = std::unique_ptr<SharedRing>(
+      new SharedRing(fd, base, mapped_size, capacity));
+  if (ring->header_->magic != kRingMagic ||
+      ring->header_->capacity != capacity) {
+    throw std::system_error(EINVAL, std::generic_category(), "Not a ring");
+  }
+  return ring;
+}
+
+SharedRing::SharedRing(
+    int fd,
+    void* base,
+    size_t mappedSize,
+    uint64_t capacity)
+    : fd_(fd),
+      mappedSize_(mappedSize),
+      capacity_(capacity),
+      header_(static_cast<Header*>(base)),
+      data_(static_cast<char*>(base) + sizeof(Header)) {}
+
+SharedRing::~SharedRing() {
+  munmap(header_, mappedSize_);
+  ::close(fd_);
+}
+
+size_t SharedRing::maxRecordSize() const {
+  return capacity_ - sizeof(RecordSize);
+}
+
+void SharedRing::copyIn(uint64_t pos, const void* data, size_t size) {
+  size_t offset = pos & (capacity_ - 1);
+  size_t first = std::min<size_t>(size, capacity_ - offset);
+  memcpy(data_ + offset, data, first);
+  memcpy(data_, static_cast<const char*>(data) + first, size - first);
+}
+
+void SharedRing::copyOut(uint64_t pos, void* data, size_t size) const {
+  size_t offset = pos & (capacity_ - 1);
+  size_t first = std::min<size_t>(size, capacity_ - offset);
+  memcpy(data, data_ + offset, first);
+  memcpy(static_cast<char*>(data) + first, data_, size - first);
+}
+
+bool SharedRing::write(const void* data, size_t size) {
+  if (size > maxRecordSize()) {
+    return false;
+  }
+  uint64_t write_pos = header_->writePos.load(std::memory_order_relaxed);
+  uint64_t read_pos = header_->readPos.load(std::memory_order_acquire);
+  size_t total = sizeof(RecordSize) + size;
+  if (write_pos + total - read_pos > capacity_) {
+    return false;
+  }
+  RecordSize record_size = size;
+  copyIn(write_pos, &record_size, sizeof(record_size));
+  copyIn(write_pos + sizeof(record_size), data, size);
+  // Publish the record
+  header_->writePos.store(write_pos + total, std::memory_order_release);
+  return true;
+}
+
+void SharedRing::close() {
+  header_->closed.store(1, std::memory_order_release);
+}
+
+bool SharedRing::read(std::string& record) {
+  uint64_t read_pos = header_->readPos.load(std::memory_order_relaxed);
+  uint64_t write_pos = header_->writePos.load(std::memory_order_acquire);
+  if (read_pos == write_pos) {
+    return false;
+  }
+  RecordSize size;
+  copyOut(read_pos, &size, sizeof(size));
+  if (write_pos - read_pos > capacity_ || size > maxRecordSize() ||
+      write_pos - read_pos < sizeof(size) + size) {
+    // Corrupted by the producer - give up on the rest
+    header_->readPos.store(write_pos, std::memory_order_release);
+    return false;
+  }
+  record.resize(size);
+  copyOut(read_pos + sizeof(size), &record[0], size);
+  // Release the space to the producer
+  header_->readPos.store(
+      read_pos + sizeof(size) + size, std::memory_order_release);
+  return true;
+}
+
+bool SharedRing::finished() const {
+  // Check closed first, so that no record written before closing is missed
+  bool closed = header_->closed.load(std::memory_order_acquire);
+  return closed &&
+      header_->readPos.load(std::memory_order_relaxed) ==
+      header_->writePos.load(std::memory_order_acquire);
+}
+
+} // namespace KINETO_NAMESPACE
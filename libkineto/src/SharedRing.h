@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace KINETO_NAMESPACE {
+
+// Single producer, single consumer ring of variable size records in
+// anonymous shared memory (memfd), so that the producer and consumer can
+// be in different processes. The creator passes fd() to the other process,
+// e.g. with IpcSocket, which maps it with attach(). The memfd size is
+// sealed, and the consumer does not trust sizes read from the shared
+// header, so a misbehaving producer cannot make it read out of bounds.
+//
+// Neither side blocks: write() fails when the ring is full and read()
+// when it is empty, and callers decide whether to wait or give up.
+class SharedRing {
+ public:
+  // Capacity is rounded up to a power of two.
+  // Throws std::system_error on failure.
+  static std::unique_ptr<SharedRing> create(
+      const std::string& name,
+      size_t capacity);
+
+  // Map a ring created by another process, taking ownership of fd.
+  // Throws std::system_error on failure, or if fd is not a sealed ring.
+  static std::unique_ptr<SharedRing> attach(int fd);
+
+  ~SharedRing();
+  SharedRing(const SharedRing&) = delete;
+  SharedRing& operator=(const SharedRing&) = delete;
+
+  int fd() const {
+    return fd_;
+  }
+
+  // Largest record that fits
+  size_t maxRecordSize() const;
+
+  // Producer: append a record. Returns false if there is no room.
+  bool write(const void* data, size_t size);
+
+  // Producer: no more records will be written
+  void close();
+
+  // Consumer: take the next record. Returns false if there is none.
+  bool read(std::string& record);
+
+  // Consumer: true once closed and all records have been read
+  bool finished() const;
+
+ private:
+  struct Header;
+
+  SharedRing(int fd, void* base, size_t mappedSize, uint64_t capacity);
+
+  void copyIn(uint64_t pos, const void* data, size_t size);
+  void copyOut(uint64_t pos, void* data, size_t size) const;
+
+  int fd_;
+  size_t mappedSize_;
+  // Private copy, since the shared header can be changed by the producer
+  uint64_t capacity_;
+  Header* header_;
+  char* data_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "TraceRequestQueue.h"
+
+#include <algorithm>
+
+#include "Config.h"
+#include "Logger.h"
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+const char* traceRequestSourceName(TraceRequestSource source) {
+  switch (source) {
+    case TraceRequestSource::Api:
+      return "api";
+    case TraceRequestSource::Signal:
+      return "signal";
+    case TraceRequestSource::Daemon:
+      return "daemon";
+  }
+  return "unknown";
+}
+
+static time_point<system_clock> requestDeadline(const Config& config) {
+  if (!config.hasRequestTimestamp()) {
+    return time_point<system_clock>::max();
+  }
+  return config.requestTimestamp() + config.maxRequestAge();
+}
+
+// Requests with the same activity profiler settings, including client
+// timestamp and log file, are duplicates. Settings are compared one by
+// one rather than through their printed form, which omits some of them.
+static bool sameRequest(const Config& a, const Config& b) {
+  return a.activitiesLogFile() == b.activitiesLogFile() &&
+      a.activitiesLogToMemory() == b.activitiesLogToMemory() &&
+      a.activitiesHostAggregation() == b.activitiesHostAggregation() &&
+      a.activitiesTimeOrdered() == b.activitiesTimeOrdered() &&
+      a.selectedActivityTypes() == b.selectedActivityTypes() &&
+      a.requestTimestamp() == b.requestTimestamp() &&
+      a.activitiesOnDemandDuration() == b.activitiesOnDemandDuration() &&
+      a.activitiesOnDemandExternalIterations() ==
+          b.activitiesOnDemandExternalIterations() &&
+      a.activitiesOnDemandExternalTarget() ==
+          b.activitiesOnDemandExternalTarget() &&
+      a.activitiesOnDemandExternalFilter() ==
+          b.activitiesOnDemandExternalFilter() &&
+      a.activitiesOnDemandExternalNetSizeThreshold() ==
+          b.activitiesOnDemandExternalNetSizeThreshold() &&
+      a.activitiesOnDemandExternalGpuOpCountThreshold() ==
+          b.activitiesOnDemandExternalGpuOpCountThreshold() &&
+      a.activitiesSteps() == b.activitiesSteps() &&
+      a.activitiesWarmupSteps() == b.activitiesWarmupSteps() &&
+      a.activitiesSkipSteps() == b.activitiesSkipSteps() &&
+      a.activitiesIterationStride() == b.activitiesIterationStride() &&
+      a.activitiesIterationStrideOffset() ==
+          b.activitiesIterationStrideOffset() &&
+      a.activitiesIterationStrideJitter() ==
+          b.activitiesIterationStrideJitter() &&
+      a.activitiesMaxGpuBufferSize() == b.activitiesMaxGpuBufferSize() &&
+      a.activitiesSpillDir() == b.activitiesSpillDir() &&
+      a.activitiesWarmupDuration() == b.activitiesWarmupDuration() &&
+      a.activitiesWarmupAdaptive() == b.activitiesWarmupAdaptive() &&
+      a.activitiesWarmupMaxVariation() == b.activitiesWarmupMaxVariation() &&
+      a.activitiesStandby() == b.activitiesStandby();
+}
+
+bool TraceRequestQueue::before(const Request& a, const Request& b) {
+  if (a.source != b.source) {
+    return a.source < b.source;
+  }
+  if (a.deadline != b.deadline) {
+    return a.deadline < b.deadline;
+  }
+  return a.sequence < b.sequence;
+}
+
+bool TraceRequestQueue::accepts(TraceRequestSource source) const {
+  if (requests_.size() < capacity_) {
+    return true;
+  }
+  for (const auto& request : requests_) {
+    if (source < request.source) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TraceRequestQueue::Result TraceRequestQueue::push(
+    const Config& config,
+    TraceRequestSource source,
+    const time_point<system_clock>& now) {
+  receivedCount_++;
+  auto deadline = requestDeadline(config);
+  if (deadline < now) {
+    LOG(WARNING) << "Trace request from " << traceRequestSourceName(source)
+                 << " expired before it was queued";
+    expiredCount_++;
+    return Result::Rejected;
+  }
+
+  for (auto& request : requests_) {
+    if (sameRequest(*request.config, config)) {
+      VLOG(0) << "Trace request from " << traceRequestSourceName(source)
+              << " coalesced with queued request from "
+              << traceRequestSourceName(request.source);
+      request.source = std::min(request.source, source);
+      coalescedCount_++;
+      return Result::Coalesced;
+    }
+  }
+
+  if (requests_.size() >= capacity_) {
+    // Replace the newest request of the lowest priority
+    auto last = std::max_element(
+        requests_.begin(),
+        requests_.end(),
+        [](const Request& a, const Request& b) {
+          return a.source < b.source ||
+              (a.source == b.source && a.sequence < b.sequence);
+        });
+    if (source >= last->source) {
+      LOG(WARNING) << "Trace request queue full - rejecting request from "
+                   << traceRequestSourceName(source);
+      rejectedCount_++;
+      return Result::Rejected;
+    }
+    LOG(WARNING) << "Trace request queue full - dropping request from "
+                 << traceRequestSourceName(last->source);
+    requests_.erase(last);
+    rejectedCount_++;
+  }
+
+  requests_.push_back(
+      {config.clone(), source, deadline, nextSequence_++});
+  VLOG(0) << "Queued trace request from " << traceRequestSourceName(source)
+          << " (" << requests_.size() << " queued)";
+  return Result::Queued;
+}
+
+std::unique_ptr<Config> TraceRequestQueue::pop(
+    const time_point<system_clock>& now) {
+  while (!requests_.empty()) {
+    auto next = std::min_element(requests_.begin(), requests_.end(), before);
+    Request request = std::move(*next);
+    requests_.erase(next);
+    if (request.deadline < now) {
+      LOG(WARNING) << "Dropping trace request from "
+                   << traceRequestSourceName(request.source)
+                   << " - start time passed while queued";
+      expiredCount_++;
+      continue;
+    }
+    startedCount_++;
+    return std::move(request.config);
+  }
+  return nullptr;
+}
+
+TraceRequestQueue::Status TraceRequestQueue::status() const {
+  return {requests_.size(),
+          capacity_,
+          receivedCount_,
+          startedCount_,
+          coalescedCount_,
+          rejectedCount_,
+          expiredCount_};
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace KINETO_NAMESPACE {
+
+class Config;
+
+// Where an on-demand trace request came from, in order of priority
+enum class TraceRequestSource {
+  // Client API, e.g. ActivityProfilerInterface::scheduleTrace()
+  Api,
+  // SIGUSR2, on-demand file trigger or control socket
+  Signal,
+  // Polled from the daemon
+  Daemon
+};
+
+const char* traceRequestSourceName(TraceRequestSource source);
+
+// Trace requests waiting for the profiler, bounded in size.
+// Requests are started in order of priority, then deadline, then arrival.
+// Requests with a client timestamp (REQUEST_TIMESTAMP) start at the same
+// time across hosts, and are dropped if that time passes while queued.
+// A request identical to a queued one is coalesced with it.
+// Not thread safe.
+class TraceRequestQueue {
+ public:
+  explicit TraceRequestQueue(size_t capacity) : capacity_(capacity) {}
+
+  enum class Result { Queued, Coalesced, Rejected };
+
+  // When full, a request replaces the newest one of lower priority,
+  // and is rejected if there is none.
+  Result push(
+      const Config& config,
+      TraceRequestSource source,
+      const std::chrono::time_point<std::chrono::system_clock>& now);
+
+  // Next request to start, or nullptr if there is none.
+  // Expired requests are dropped.
+  std::unique_ptr<Config> pop(
+      const std::chrono::time_point<std::chrono::system_clock>& now);
+
+  bool empty() const {
+    return requests_.empty();
+  }
+
+  // True if a request from source would be queued rather than rejected
+  bool accepts(TraceRequestSource source) const;
+
+  struct Status {
+    size_t queued;
+    size_t capacity;
+    int64_t received;
+    int64_t started;
+    int64_t coalesced;
+    // Rejected when full, or replaced by a request of higher priority
+    int64_t rejected;
+    int64_t expired;
+  };
+  Status status() const;
+
+ private:
+  struct Request {
+    std::unique_ptr<Config> config;
+    TraceRequestSource source;
+    std::chrono::time_point<std::chrono::system_clock> deadline;
+    uint64_t sequence;
+  };
+
+  static bool before(const Request& a, const Request& b);
+
+  size_t capacity_;
+  std::vector<Request> requests_;
+  uint64_t nextSequence_{0};
+  int64_t receivedCount_{0};
+  int64_t startedCount_{0};
+  int64_t coalescedCount_{0};
+  int64_t rejectedCount_{0};
+  int64_t expiredCount_{0};
+};
+
+} // namespace KINETO_NAMESPACE
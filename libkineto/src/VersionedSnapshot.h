@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace KINETO_NAMESPACE {
+
+// Versions are unique across all snapshots, so a reader may switch
+// between snapshots and still detect changes by version.
+inline uint64_t nextSnapshotVersion() {
+  static std::atomic<uint64_t> version{0};
+  return version.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// Holds an immutable, reference counted value that is replaced as a whole.
+// Each replacement bumps a version number, so readers polling for changes
+// do a single atomic load and only touch the value when it has changed.
+// Readers keep their snapshot alive for as long as they need it.
+//
+// Writers must be serialized by the caller.
+template <class T>
+class VersionedSnapshot {
+ public:
+  explicit VersionedSnapshot(std::shared_ptr<const T> value)
+      : value_(std::move(value)), version_(nextSnapshotVersion()) {}
+
+  VersionedSnapshot(const VersionedSnapshot&) = delete;
+  VersionedSnapshot& operator=(const VersionedSnapshot&) = delete;
+
+  void publish(std::shared_ptr<const T> value) {
+    std::atomic_store_explicit(
+        &value_, std::move(value), std::memory_order_release);
+    // Bump after storing, so that a reader seeing the new version
+    // also sees the new value.
+    version_.store(nextSnapshotVersion(), std::memory_order_release);
+  }
+
+  uint64_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  std::shared_ptr<const T> get() const {
+    return std::atomic_load_explicit(&value_, std::memory_order_acquire);
+  }
+
+  // Replace snapshot with the current value if it has been published since
+  // version was last updated here. Returns true if snapshot changed.
+  bool refresh(std::shared_ptr<const T>& snapshot, uint64_t& version) const {
+    uint64_t current = this->version();
+    if (current == version) {
+      return false;
+    }
+    version = current;
+    auto value = get();
+    if (value == snapshot) {
+      return false;
+    }
+    snapshot = std::move(value);
+    return true;
+  }
+
+ private:
+  std::shared_ptr<const T> value_;
+  // Never 0, so that readers can initialize their version to 0
+  std::atomic<uint64_t> version_;
+};
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "WarmupMonitor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace KINETO_NAMESPACE {
+
+constexpr double WarmupMonitor::kFlushLatencyNoiseFloorUs;
+constexpr double WarmupMonitor::kRecordRateNoiseFloor;
+
+void WarmupMonitor::add(Series& series, double sample) {
+  series.samples.push_back(sample);
+  if (series.samples.size() > windowSize_) {
+    series.samples.pop_front();
+  }
+}
+
+void WarmupMonitor::addSample(double flushLatencyUs, double recordBytesPerSec) {
+  add(flushLatency_, flushLatencyUs);
+  add(recordRate_, recordBytesPerSec);
+  sampleCount_++;
+}
+
+bool WarmupMonitor::stable(const Series& series) const {
+  if (series.samples.size() < windowSize_) {
+    return false;
+  }
+  double sum = 0;
+  for (double sample : series.samples) {
+    sum += sample;
+  }
+  double mean = sum / series.samples.size();
+  double sq_sum = 0;
+  for (double sample : series.samples) {
+    sq_sum += (sample - mean) * (sample - mean);
+  }
+  double stddev = std::sqrt(sq_sum / series.samples.size());
+  return stddev <= std::max(maxVariation_ * mean, series.noiseFloor);
+}
+
+bool WarmupMonitor::stable() const {
+  for (double rate : recordRate_.samples) {
+    if (rate <= 0) {
+      return false;
+    }
+  }
+  return stable(flushLatency_) && stable(recordRate_);
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+
+namespace KINETO_NAMESPACE {
+
+// Tracks the tracing overhead during warmup, sampled once per profiler step
+// as flush latency and activity record rate. Overhead is considered stable
+// once the variation over the last few samples of each is small: the
+// standard deviation is within the given fraction of the mean, or below
+// an absolute noise floor. Records must also have been completed in every
+// sample of the window: an idle GPU shows no overhead yet, so its flush
+// latency says nothing about the overhead once kernels run.
+// Not thread safe - only used from the profiler loop.
+class WarmupMonitor {
+ public:
+  WarmupMonitor(int windowSize, double maxVariation)
+      : windowSize_(windowSize), maxVariation_(maxVariation) {}
+
+  void addSample(double flushLatencyUs, double recordBytesPerSec);
+
+  bool stable() const;
+
+  int sampleCount() const {
+    return sampleCount_;
+  }
+
+ private:
+  struct Series {
+    std::deque<double> samples;
+    double noiseFloor;
+  };
+
+  void add(Series& series, double sample);
+  bool stable(const Series& series) const;
+
+  // Differences below these are insignificant
+  static constexpr double kFlushLatencyNoiseFloorUs = 100;
+  static constexpr double kRecordRateNoiseFloor = 64 * 1024;
+
+  const size_t windowSize_;
+  const double maxVariation_;
+  int sampleCount_{0};
+  Series flushLatency_{{}, kFlushLatencyNoiseFloorUs};
+  Series recordRate_{{}, kRecordRateNoiseFloor};
+};
+
+} // namespace KINETO_NAMESPACE
@@ -7,6 +7,9 @@
 
 #include "cupti_strings.h"
 
+#include <fmt/format.h>
+#include <string>
+
 namespace libkineto {
 
 const char* memcpyKindString(
@@ -348,4 +351,55 @@ const char* runtimeCbidName(CUpti_CallbackId cbid) {
   return runtimeCbidNames[cbid];
 }
 
+// Memory kinds past the last known one all share the name of this slot
+constexpr int kMemoryKindCount = CUPTI_ACTIVITY_MEMORY_KIND_MANAGED_STATIC + 2;
+// Unknown memcpy kinds share the name of CUPTI_ACTIVITY_MEMCPY_KIND_UNKNOWN
+constexpr int kMemcpyKindCount = CUPTI_ACTIVITY_MEMCPY_KIND_PTOP + 1;
+
+static int memoryKindIndex(uint8_t kind) {
+  return kind < kMemoryKindCount ? kind : kMemoryKindCount - 1;
+}
+
+namespace {
+
+struct MemoryNames {
+  MemoryNames() {
+    for (int src = 0; src < kMemoryKindCount; src++) {
+      const char* src_name = memoryKindString((CUpti_ActivityMemoryKind)src);
+      memset[src] = fmt::format("Memset ({})", src_name);
+      for (int kind = 0; kind < kMemcpyKindCount; kind++) {
+        for (int dst = 0; dst < kMemoryKindCount; dst++) {
+          memcpy[kind][src][dst] = fmt::format(
+              "Memcpy {} ({} -> {})",
+              memcpyKindString((CUpti_ActivityMemcpyKind)kind),
+              src_name,
+              memoryKindString((CUpti_ActivityMemoryKind)dst));
+        }
+      }
+    }
+  }
+
+  std::string memcpy[kMemcpyKindCount][kMemoryKindCount][kMemoryKindCount];
+  std::string memset[kMemoryKindCount];
+};
+
+const MemoryNames& memoryNames() {
+  static const MemoryNames names;
+  return names;
+}
+
+} // namespace
+
+StringView memcpyName(uint8_t kind, uint8_t src, uint8_t dst) {
+  if (kind >= kMemcpyKindCount) {
+    kind = CUPTI_ACTIVITY_MEMCPY_KIND_UNKNOWN;
+  }
+  return memoryNames()
+      .memcpy[kind][memoryKindIndex(src)][memoryKindIndex(dst)];
+}
+
+StringView memsetName(uint8_t memoryKind) {
+  return memoryNames().memset[memoryKindIndex(memoryKind)];
+}
+
 } // namespace libkineto
@@ -8,6 +8,9 @@
 #pragma once
 
 #include <cupti.h>
+#include <stdint.h>
+
+#include "StringView.h"
 
 namespace libkineto {
 
@@ -15,4 +18,9 @@ const char* memoryKindString(CUpti_ActivityMemoryKind kind);
 const char* memcpyKindString(CUpti_ActivityMemcpyKind kind);
 const char* runtimeCbidName(CUpti_CallbackId cbid);
 
+// Display names of memcpy and memset activities.
+// Precomputed for all kinds, so no string is built per activity.
+StringView memcpyName(uint8_t kind, uint8_t src, uint8_t dst);
+StringView memsetName(uint8_t memoryKind);
+
 } // namespace libkineto
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "output_aggregate.h"
+
+#include <fmt/format.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "Config.h"
+#include "CuptiActivity.h"
+#include "CuptiActivity.tpp"
+#include "time_since_epoch.h"
+
+#include "Logger.h"
+
+using namespace std::chrono;
+using namespace libkineto;
+
+namespace KINETO_NAMESPACE {
+
+void AggregateTraceLogger::Stats::add(int64_t duration) {
+  count++;
+  total += duration;
+  min = std::min(min, duration);
+  max = std::max(max, duration);
+}
+
+AggregateTraceLogger::AggregateTraceLogger(
+    const std::string& summaryFile,
+    seconds flushPeriod)
+    : summaryFile_(summaryFile),
+      flushPeriod_(flushPeriod),
+      periodStart_(system_clock::now()) {}
+
+void AggregateTraceLogger::add(
+    Category category,
+    const TraceActivity& activity) {
+  stats_[category][activity.name()].add(activity.duration());
+}
+
+void AggregateTraceLogger::handleCpuActivity(
+    const libkineto::ClientTraceActivity& op,
+    const TraceSpan& /*unused*/) {
+  add(Category::Operator, op);
+}
+
+void AggregateTraceLogger::handleRuntimeActivity(
+    const RuntimeActivity& activity) {
+  add(Category::Runtime, activity);
+}
+
+void AggregateTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityKernel4>& activity) {
+  add(Category::Kernel, activity);
+}
+
+void AggregateTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy>& activity) {
+  add(Category::Memory, activity);
+}
+
+void AggregateTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy2>& activity) {
+  add(Category::Memory, activity);
+}
+
+void AggregateTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemset>& activity) {
+  add(Category::Memory, activity);
+}
+
+void AggregateTraceLogger::finalizeTrace(
+    const Config& config,
+    std::unique_ptr<ActivityBuffers> /*unused*/) {
+  traceCount_++;
+  tracedTime_ += config.activitiesOnDemandDuration();
+  if (system_clock::now() >= periodStart_ + flushPeriod_) {
+    flush();
+  }
+}
+
+const AggregateTraceLogger::Stats* AggregateTraceLogger::stats(
+    Category category,
+    const std::string& name) const {
+  auto it = stats_.find(category);
+  if (it == stats_.end()) {
+    return nullptr;
+  }
+  auto stats_it = it->second.find(name);
+  return stats_it == it->second.end() ? nullptr : &stats_it->second;
+}
+
+static const char* categoryName(AggregateTraceLogger::Category category) {
+  switch (category) {
+    case AggregateTraceLogger::Category::Kernel:
+      return "kernels";
+    case AggregateTraceLogger::Category::Memory:
+      return "memory";
+    case AggregateTraceLogger::Category::Runtime:
+      return "runtime";
+    case AggregateTraceLogger::Category::Operator:
+      return "operators";
+  }
+  return "";
+}
+
+// Names are C++ symbols and user strings, which may contain quotes
+static std::string escapeJson(const std::string& str) {
+  std::string escaped;
+  escaped.reserve(str.size());
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+void AggregateTraceLogger::writeSummary(std::ostream& out) const {
+  // clang-format off
+  out << fmt::format(R"JSON({{
+  "pid": {}, "start": {}, "end": {},
+  "traces": {}, "traced_ms": {})JSON",
+      getpid(),
+      timeSinceEpoch(periodStart_), timeSinceEpoch(system_clock::now()),
+      traceCount_, tracedTime_.count());
+  for (const auto& category : stats_) {
+    // Most expensive first
+    using Entry = std::pair<const std::string, Stats>;
+    std::vector<const Entry*> entries;
+    for (const auto& entry : category.second) {
+      entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry* a, const Entry* b) {
+          return a->second.total > b->second.total;
+        });
+    out << fmt::format(R"JSON(,
+  "{}": [)JSON", categoryName(category.first));
+    const char* sep = "";
+    for (const Entry* entry : entries) {
+      const Stats& s = entry->second;
+      out << fmt::format(R"JSON({}
+    {{"name": "{}", "count": {}, "total_us": {}, "min_us": {}, "max_us": {}}})JSON",
+          sep, escapeJson(entry->first), s.count, s.total, s.min, s.max);
+      sep = ",";
+    }
+    out << "\n  ]";
+  }
+  out << "\n}\n";
+  // clang-format on
+}
+
+void AggregateTraceLogger::flush() {
+  // Write to a temporary file first, so readers never see a partial summary
+  const std::string tmp = summaryFile_ + ".tmp";
+  {
+    std::ofstream out(tmp, std::ofstream::out | std::ofstream::trunc);
+    if (!out) {
+      PLOG(ERROR) << "Failed to open '" << tmp << "'";
+      return;
+    }
+    writeSummary(out);
+  }
+  if (rename(tmp.c_str(), summaryFile_.c_str()) != 0) {
+    PLOG(ERROR) << "Failed to write '" << summaryFile_ << "'";
+    return;
+  }
+  LOG(INFO) << "Wrote summary of " << traceCount_ << " traces to "
+            << summaryFile_;
+  stats_.clear();
+  traceCount_ = 0;
+  tracedTime_ = milliseconds(0);
+  periodStart_ = system_clock::now();
+}
+
+} // namespace KINETO_NAMESPACE
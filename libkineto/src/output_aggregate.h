@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include <cupti.h>
+#include "ClientTraceActivity.h"
+#include "output_base.h"
+
+namespace libkineto {
+  class TraceSpan;
+}
+
+namespace KINETO_NAMESPACE {
+
+class Config;
+
+// Reduces traces to per-name duration statistics for kernels, memory
+// operations, CUDA runtime calls and CPU ops. Statistics are merged over
+// all traces logged, and written to a summary file once per flush period,
+// replacing the previous summary. Statistics are reset after each flush,
+// so each summary covers one flush period.
+class AggregateTraceLogger : public libkineto::ActivityLogger {
+ public:
+  AggregateTraceLogger(
+      const std::string& summaryFile,
+      std::chrono::seconds flushPeriod);
+
+  struct Stats {
+    int64_t count{0};
+    int64_t total{0};
+    int64_t min{INT64_MAX};
+    int64_t max{0};
+
+    void add(int64_t duration);
+  };
+
+  enum class Category { Kernel, Memory, Runtime, Operator };
+
+  // Note: the caller of these functions should handle concurrency
+  // i.e., we these functions are not thread-safe
+  void handleProcessInfo(
+      const ProcessInfo& /*unused*/,
+      uint64_t /*unused*/) override {}
+
+  void handleThreadInfo(
+      const ThreadInfo& /*unused*/,
+      int64_t /*unused*/) override {}
+
+  void handleTraceSpan(const TraceSpan& /*unused*/) override {}
+
+  void handleIterationStart(const TraceSpan& /*unused*/) override {}
+
+  void handleCpuActivity(
+      const libkineto::ClientTraceActivity& activity,
+      const TraceSpan& span) override;
+
+  void handleRuntimeActivity(
+      const RuntimeActivity& activity) override;
+
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityKernel4>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemcpy>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemcpy2>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemset>& activity) override;
+
+  // Merges the trace, and flushes the summary if the period has elapsed.
+  // The trace buffers are released right away.
+  void finalizeTrace(const Config& config, std::unique_ptr<ActivityBuffers> buffers) override;
+
+  // Write the summary file now
+  void flush();
+
+  const Stats* stats(Category category, const std::string& name) const;
+
+  void writeSummary(std::ostream& out) const;
+
+ private:
+  void add(Category category, const libkineto::TraceActivity& activity);
+
+  const std::string summaryFile_;
+  const std::chrono::seconds flushPeriod_;
+  std::chrono::time_point<std::chrono::system_clock> periodStart_;
+  std::map<Category, std::unordered_map<std::string, Stats>> stats_;
+  int traceCount_{0};
+  std::chrono::milliseconds tracedTime_{0};
+};
+
+} // namespace KINETO_NAMESPACE
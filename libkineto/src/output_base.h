@@ -12,6 +12,7 @@
 #include <ostream>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <cupti.h>
 #include "ActivityBuffers.h"
@@ -59,6 +60,31 @@ class ActivityLogger {
   virtual void handleGpuActivity(
       const GpuActivity<CUpti_ActivityMemset>& activity) = 0;
 
+  // Batched variants, called once per record type when processing
+  // GPU activity buffers. Override to avoid a virtual call per record.
+  virtual void handleRuntimeActivities(
+      const std::vector<RuntimeActivity>& activities) {
+    for (const auto& activity : activities) {
+      handleRuntimeActivity(activity);
+    }
+  }
+  virtual void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityKernel4>>& activities) {
+    handleEach(activities);
+  }
+  virtual void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy>>& activities) {
+    handleEach(activities);
+  }
+  virtual void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy2>>& activities) {
+    handleEach(activities);
+  }
+  virtual void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemset>>& activities) {
+    handleEach(activities);
+  }
+
   virtual void finalizeTrace(
       const KINETO_NAMESPACE::Config& config,
       std::unique_ptr<ActivityBuffers> buffers) = 0;
@@ -66,6 +92,13 @@ class ActivityLogger {
  protected:
   ActivityLogger() = default;
 
+  template <class T>
+  void handleEach(const std::vector<GpuActivity<T>>& activities) {
+    for (const auto& activity : activities) {
+      handleGpuActivity(activity);
+    }
+  }
+
   // get a cleaner thread id
   int renameThreadID(size_t tid) {
     // the tid here is the thread ID that schedules the operator
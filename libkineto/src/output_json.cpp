@@ -8,7 +8,13 @@
 #include "output_json.h"
 
 #include <fmt/format.h>
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <queue>
 #include <time.h>
 #include <map>
 #include <unistd.h>
@@ -19,6 +25,7 @@
 #include "CuptiActivity.tpp"
 #include "CuptiActivityInterface.h"
 #include "Demangle.h"
+#include "RadixSort.h"
 #include "TraceSpan.h"
 
 #include "Logger.h"
@@ -28,6 +35,13 @@ using namespace libkineto;
 
 namespace KINETO_NAMESPACE {
 
+// Activities per chunk, so that handing chunks to threads is cheap
+// compared to formatting them
+constexpr size_t kFormatChunkSize(1024);
+// Chunks formatted ahead of the writer, per thread
+constexpr size_t kFormatChunksPerThread(4);
+constexpr int kMaxFormatThreads(8);
+
 static void openTraceFile(std::string& name, std::ofstream& stream) {
   stream.open(name, std::ofstream::out | std::ofstream::trunc);
   if (!stream) {
@@ -38,11 +52,21 @@ static void openTraceFile(std::string& name, std::ofstream& stream) {
   }
 }
 
-ChromeTraceLogger::ChromeTraceLogger(const std::string& traceFileName)
-    : fileName_(traceFileName), pid_(getpid()) {
+ChromeTraceLogger::ChromeTraceLogger(
+    const std::string& traceFileName,
+    int formatThreads,
+    bool timeOrdered)
+    : fileName_(traceFileName),
+      formatThreads_(formatThreads),
+      timeOrdered_(timeOrdered),
+      pid_(getpid()) {
   traceOf_.clear(std::ios_base::badbit);
   openTraceFile(fileName_, traceOf_);
   smCount_ = CuptiActivityInterface::singleton().smCount();
+  if (formatThreads_ <= 0) {
+    formatThreads_ = std::min<int>(
+        kMaxFormatThreads, std::max(1u, std::thread::hardware_concurrency()));
+  }
 }
 
 int ChromeTraceLogger::renameThreadID(uint32_t tid) {
@@ -73,8 +97,9 @@ void ChromeTraceLogger::handleProcessInfo(
 
   // M is for metadata
   // process_name needs a pid and a name arg
+  std::string events;
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(events), R"JSON(,
   {{
     "name": "process_name", "ph": "M", "ts": {}, "pid": {}, "tid": 0,
     "args": {{
@@ -86,12 +111,13 @@ void ChromeTraceLogger::handleProcessInfo(
     "args": {{
       "labels": "{}"
     }}
-  }},)JSON",
+  }})JSON",
       time, processInfo.pid,
       processInfo.name,
       time, processInfo.pid,
       processInfo.label);
   // clang-format on
+  writeEvents(events);
 }
 
 void ChromeTraceLogger::handleThreadInfo(
@@ -103,26 +129,25 @@ void ChromeTraceLogger::handleThreadInfo(
 
   // M is for metadata
   // thread_name needs a pid and a name arg
+  std::string events;
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(events), R"JSON(,
   {{
     "name": "thread_name", "ph": "M", "ts": {}, "pid": {}, "tid": "{}",
     "args": {{
       "name": "thread {} ({})"
     }}
-  }},)JSON",
+  }})JSON",
       time, pid_, (uint32_t)threadInfo.tid,
       renameThreadID((uint32_t)threadInfo.tid), threadInfo.name);
   // clang-format on
+  writeEvents(events);
 }
 
-void ChromeTraceLogger::handleTraceSpan(const TraceSpan& span) {
-  if (!traceOf_) {
-    return;
-  }
-
+void ChromeTraceLogger::formatTraceSpan(
+    std::string& out, const TraceSpan& span) const {
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Trace", "ts": {}, "dur": {},
     "pid": "Traces", "tid": "{}",
@@ -130,7 +155,7 @@ void ChromeTraceLogger::handleTraceSpan(const TraceSpan& span) {
     "args": {{
       "Op count": {}
     }}
-  }},)JSON",
+  }})JSON",
       span.startTime, span.endTime - span.startTime,
       span.name,
       span.prefix, span.name, span.iteration,
@@ -138,42 +163,36 @@ void ChromeTraceLogger::handleTraceSpan(const TraceSpan& span) {
   // clang-format on
 }
 
-void ChromeTraceLogger::handleIterationStart(const TraceSpan& span) {
-  if (!traceOf_) {
-    return;
-  }
-
+void ChromeTraceLogger::formatIterationStart(
+    std::string& out, const TraceSpan& span) const {
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "name": "Iteration Start: {}", "ph": "i", "s": "g",
     "pid": "Traces", "tid": "Trace {}", "ts": {}
-  }},)JSON",
+  }})JSON",
       span.name,
       span.name, span.startTime);
   // clang-format on
 }
 
 static std::string traceActivityJson(const TraceActivity& activity, std::string tidPrefix) {
+  const StringView name = activity.nameView();
   // clang-format off
   return fmt::format(R"JSON(
     "name": "{}", "pid": {}, "tid": "{}{}",
     "ts": {}, "dur": {})JSON",
-      activity.name(), activity.deviceId(), tidPrefix, (uint32_t)activity.resourceId(),
+      fmt::string_view(name.data(), name.size()), activity.deviceId(), tidPrefix, (uint32_t)activity.resourceId(),
       activity.timestamp(), activity.duration());
   // clang-format on
 }
 
-void ChromeTraceLogger::handleCpuActivity(
+void ChromeTraceLogger::formatEvent(
+    std::string& out,
     const libkineto::ClientTraceActivity& op,
-    const TraceSpan& span) {
-  if (!traceOf_) {
-    return;
-  }
-
-  uint64_t duration = op.endTime - op.startTime;
+    const TraceSpan& span) const {
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Operator", {},
     "args": {{
@@ -182,7 +201,7 @@ void ChromeTraceLogger::handleCpuActivity(
        "Device": {}, "External id": {}, "Extra arguments": {},
        "Trace name": "{}", "Trace iteration": {}
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(op, ""),
       // args
       op.inputDims, op.inputTypes, op.inputNames,
@@ -192,53 +211,43 @@ void ChromeTraceLogger::handleCpuActivity(
   // clang-format on
 }
 
-void ChromeTraceLogger::handleLinkStart(const RuntimeActivity& s) {
-  if (!traceOf_) {
-    return;
-  }
-
+void ChromeTraceLogger::formatLinkStart(
+    std::string& out, const RuntimeActivity& s) const {
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "s", "id": {}, "pid": {}, "tid": {}, "ts": {},
     "cat": "async", "name": "launch"
-  }},)JSON",
+  }})JSON",
       s.correlationId(), pid_, s.resourceId(), s.timestamp());
   // clang-format on
-
 }
 
-void ChromeTraceLogger::handleLinkEnd(const TraceActivity& e) {
-  if (!traceOf_) {
-    return;
-  }
-
+void ChromeTraceLogger::formatLinkEnd(
+    std::string& out, const TraceActivity& e) const {
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "f", "id": {}, "pid": {}, "tid": "stream {}", "ts": {},
     "cat": "async", "name": "launch", "bp": "e"
-  }},)JSON",
+  }})JSON",
       e.correlationId(), e.deviceId(), e.resourceId(), e.timestamp());
   // clang-format on
 }
 
-void ChromeTraceLogger::handleRuntimeActivity(
-    const RuntimeActivity& activity) {
-  if (!traceOf_) {
-    return;
-  }
-
+void ChromeTraceLogger::formatEvent(
+    std::string& out, const RuntimeActivity& activity) const {
   const CUpti_CallbackId cbid = activity.raw().cbid;
   const TraceActivity& ext = *activity.linkedActivity();
-  traceOf_ << fmt::format(R"JSON(
+  // clang-format off
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Runtime", {},
     "args": {{
       "cbid": {}, "correlation": {},
       "external id": {}, "external ts": {}
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(activity, ""),
       // args
       cbid, activity.raw().correlationId,
@@ -254,23 +263,21 @@ void ChromeTraceLogger::handleRuntimeActivity(
           CUPTI_RUNTIME_TRACE_CBID_cudaLaunchCooperativeKernel_v9000 ||
       cbid ==
           CUPTI_RUNTIME_TRACE_CBID_cudaLaunchCooperativeKernelMultiDevice_v9000) {
-    handleLinkStart(activity);
+    formatLinkStart(out, activity);
   }
 }
 
 // GPU side kernel activity
-void ChromeTraceLogger::handleGpuActivity(
-    const GpuActivity<CUpti_ActivityKernel4>& activity) {
-  if (!traceOf_) {
-    return;
-  }
+void ChromeTraceLogger::formatEvent(
+    std::string& out,
+    const GpuActivity<CUpti_ActivityKernel4>& activity) const {
   const CUpti_ActivityKernel4* kernel = &activity.raw();
   const TraceActivity& ext = *activity.linkedActivity();
   constexpr int threads_per_warp = 32;
   float warps_per_sm = (kernel->gridX * kernel->gridY * kernel->gridZ) *
       (kernel->blockX * kernel->blockY * kernel->blockZ) / (float) threads_per_warp / smCount_;
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Kernel", {},
     "args": {{
@@ -282,7 +289,7 @@ void ChromeTraceLogger::handleGpuActivity(
       "grid": [{}, {}, {}],
       "block": [{}, {}, {}]
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(activity, "stream "),
       // args
       us(kernel->queued), kernel->deviceId, kernel->contextId,
@@ -294,20 +301,18 @@ void ChromeTraceLogger::handleGpuActivity(
       kernel->blockX, kernel->blockY, kernel->blockZ);
   // clang-format on
 
-  handleLinkEnd(activity);
+  formatLinkEnd(out, activity);
 }
 
 // GPU side memcpy activity
-void ChromeTraceLogger::handleGpuActivity(
-    const GpuActivity<CUpti_ActivityMemcpy>& activity) {
-  if (!traceOf_) {
-    return;
-  }
+void ChromeTraceLogger::formatEvent(
+    std::string& out,
+    const GpuActivity<CUpti_ActivityMemcpy>& activity) const {
   const CUpti_ActivityMemcpy& memcpy = activity.raw();
   const TraceActivity& ext = *activity.linkedActivity();
   VLOG(2) << memcpy.correlationId << ": MEMCPY";
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Memcpy", {},
     "args": {{
@@ -315,7 +320,7 @@ void ChromeTraceLogger::handleGpuActivity(
       "stream": {}, "correlation": {}, "external id": {},
       "bytes": {}, "memory bandwidth (GB/s)": {}
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(activity, "stream "),
       // args
       memcpy.deviceId, memcpy.contextId,
@@ -323,19 +328,17 @@ void ChromeTraceLogger::handleGpuActivity(
       memcpy.bytes, memcpy.bytes * 1.0 / (memcpy.end - memcpy.start));
   // clang-format on
 
-  handleLinkEnd(activity);
+  formatLinkEnd(out, activity);
 }
 
 // GPU side memcpy activity
-void ChromeTraceLogger::handleGpuActivity(
-    const GpuActivity<CUpti_ActivityMemcpy2>& activity) {
-  if (!traceOf_) {
-    return;
-  }
+void ChromeTraceLogger::formatEvent(
+    std::string& out,
+    const GpuActivity<CUpti_ActivityMemcpy2>& activity) const {
   const CUpti_ActivityMemcpy2& memcpy = activity.raw();
   const TraceActivity& ext = *activity.linkedActivity();
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Memcpy", {},
     "args": {{
@@ -344,7 +347,7 @@ void ChromeTraceLogger::handleGpuActivity(
       "stream": {}, "correlation": {}, "external id": {},
       "bytes": {}, "memory bandwidth (GB/s)": {}
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(activity, "stream "),
       // args
       memcpy.srcDeviceId, memcpy.deviceId, memcpy.dstDeviceId,
@@ -353,18 +356,16 @@ void ChromeTraceLogger::handleGpuActivity(
       memcpy.bytes, memcpy.bytes * 1.0 / (memcpy.end - memcpy.start));
   // clang-format on
 
-  handleLinkEnd(activity);
+  formatLinkEnd(out, activity);
 }
 
-void ChromeTraceLogger::handleGpuActivity(
-    const GpuActivity<CUpti_ActivityMemset>& activity) {
-  if (!traceOf_) {
-    return;
-  }
+void ChromeTraceLogger::formatEvent(
+    std::string& out,
+    const GpuActivity<CUpti_ActivityMemset>& activity) const {
   const CUpti_ActivityMemset& memset = activity.raw();
   const TraceActivity& ext = *activity.linkedActivity();
   // clang-format off
-  traceOf_ << fmt::format(R"JSON(
+  fmt::format_to(std::back_inserter(out), R"JSON(,
   {{
     "ph": "X", "cat": "Memset", {},
     "args": {{
@@ -372,7 +373,7 @@ void ChromeTraceLogger::handleGpuActivity(
       "stream": {}, "correlation": {}, "external id": {},
       "bytes": {}, "memory bandwidth (GB/s)": {}
     }}
-  }},)JSON",
+  }})JSON",
       traceActivityJson(activity, "stream "),
       // args
       memset.deviceId, memset.contextId,
@@ -380,7 +381,401 @@ void ChromeTraceLogger::handleGpuActivity(
       memset.bytes, memset.bytes * 1.0 / (memset.end - memset.start));
   // clang-format on
 
-  handleLinkEnd(activity);
+  formatLinkEnd(out, activity);
+}
+
+void ChromeTraceLogger::writeEvents(const std::string& events) {
+  if (events.empty()) {
+    return;
+  }
+  size_t skip = eventWritten_ ? 0 : 1;
+  traceOf_.write(events.data() + skip, events.size() - skip);
+  eventWritten_ = true;
+}
+
+template <class T>
+void ChromeTraceLogger::logEvent(const T& activity) {
+  if (!traceOf_) {
+    return;
+  }
+  std::string events;
+  formatEvent(events, activity);
+  writeEvents(events);
+}
+
+template <class T>
+void ChromeTraceLogger::logEvents(const std::vector<T>& activities) {
+  if (!traceOf_) {
+    return;
+  }
+  formatChunks(
+      activities.size(),
+      [this, &activities](std::string& out, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          formatEvent(out, activities[i]);
+        }
+      });
+}
+
+void ChromeTraceLogger::formatChunks(
+    size_t count,
+    const std::function<void(std::string&, size_t, size_t)>& format) {
+  const size_t chunks = (count + kFormatChunkSize - 1) / kFormatChunkSize;
+  const size_t threads = std::min<size_t>(formatThreads_, chunks);
+  if (threads <= 1) {
+    std::string events;
+    for (size_t begin = 0; begin < count; begin += kFormatChunkSize) {
+      events.clear();
+      format(events, begin, std::min(count, begin + kFormatChunkSize));
+      writeEvents(events);
+    }
+    return;
+  }
+
+  // Chunks are formatted into a ring of buffers, and written from this
+  // thread in order. A buffer is reused once its chunk has been written,
+  // which bounds the memory used regardless of the number of events.
+  const size_t slots = threads * kFormatChunksPerThread;
+  std::vector<std::string> buffers(slots);
+  std::vector<char> formatted(slots, false);
+  std::mutex mutex;
+  std::condition_variable formattedCond;
+  std::condition_variable writtenCond;
+  size_t nextChunk = 0;
+  size_t writtenChunks = 0;
+
+  auto formatter = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (nextChunk < chunks) {
+      size_t chunk = nextChunk++;
+      writtenCond.wait(
+          lock, [&]() { return chunk < writtenChunks + slots; });
+      lock.unlock();
+      size_t begin = chunk * kFormatChunkSize;
+      format(
+          buffers[chunk % slots],
+          begin,
+          std::min(count, begin + kFormatChunkSize));
+      lock.lock();
+      formatted[chunk % slots] = true;
+      formattedCond.notify_one();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads; i++) {
+    workers.emplace_back(formatter);
+  }
+
+  for (size_t chunk = 0; chunk < chunks; chunk++) {
+    std::string& events = buffers[chunk % slots];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      formattedCond.wait(lock, [&]() { return formatted[chunk % slots]; });
+    }
+    writeEvents(events);
+    events.clear();
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      formatted[chunk % slots] = false;
+      writtenChunks++;
+    }
+    writtenCond.notify_all();
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+// Timelines of held events, each sorted on its own before they are merged.
+// GPU devices are numbered from 0, so keep them apart from CPU pids.
+enum TimelineDomain { kTraceTimelines, kCpuTimelines, kGpuTimelines };
+
+void ChromeTraceLogger::holdEvent(
+    const TimelineKey& timeline,
+    int64_t timestamp,
+    EventKind kind,
+    size_t index) {
+  // Consecutive events tend to be on the same timeline
+  if (!lastTimeline_ || timeline != lastTimelineKey_) {
+    lastTimeline_ = &timelines_[timeline];
+    lastTimelineKey_ = timeline;
+  }
+  lastTimeline_->push_back({timestamp, kind, static_cast<uint32_t>(index)});
+}
+
+template <class T>
+void ChromeTraceLogger::holdGpuEvents(
+    std::vector<GpuActivity<T>>& held,
+    const std::vector<GpuActivity<T>>& activities,
+    EventKind kind) {
+  held.reserve(held.size() + activities.size());
+  for (const auto& activity : activities) {
+    holdEvent(
+        TimelineKey(kGpuTimelines, activity.deviceId(), activity.resourceId()),
+        activity.timestamp(),
+        kind,
+        held.size());
+    held.push_back(activity);
+  }
+}
+
+void ChromeTraceLogger::handleTraceSpan(const TraceSpan& span) {
+  if (!traceOf_) {
+    return;
+  }
+  if (timeOrdered_) {
+    holdEvent(
+        TimelineKey(kTraceTimelines, 0, 0),
+        span.startTime,
+        EventKind::TraceSpan,
+        heldSpans_.size());
+    heldSpans_.push_back(span);
+    return;
+  }
+  std::string events;
+  formatTraceSpan(events, span);
+  writeEvents(events);
+}
+
+void ChromeTraceLogger::handleIterationStart(const TraceSpan& span) {
+  if (!traceOf_) {
+    return;
+  }
+  if (timeOrdered_) {
+    holdEvent(
+        TimelineKey(kTraceTimelines, 0, 0),
+        span.startTime,
+        EventKind::IterationStart,
+        heldSpans_.size());
+    heldSpans_.push_back(span);
+    return;
+  }
+  std::string events;
+  formatIterationStart(events, span);
+  writeEvents(events);
+}
+
+void ChromeTraceLogger::handleCpuActivity(
+    const libkineto::ClientTraceActivity& op,
+    const TraceSpan& span) {
+  if (!traceOf_) {
+    return;
+  }
+  if (timeOrdered_) {
+    holdEvent(
+        TimelineKey(kCpuTimelines, op.deviceId(), op.resourceId()),
+        op.timestamp(),
+        EventKind::Cpu,
+        heldCpuOps_.size());
+    heldCpuOps_.emplace_back(&op, &span);
+    return;
+  }
+  std::string events;
+  formatEvent(events, op, span);
+  writeEvents(events);
+}
+
+void ChromeTraceLogger::handleRuntimeActivity(
+    const RuntimeActivity& activity) {
+  if (timeOrdered_) {
+    handleRuntimeActivities({activity});
+    return;
+  }
+  logEvent(activity);
+}
+
+void ChromeTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityKernel4>& activity) {
+  if (timeOrdered_) {
+    handleGpuActivities({activity});
+    return;
+  }
+  logEvent(activity);
+}
+
+void ChromeTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy>& activity) {
+  if (timeOrdered_) {
+    handleGpuActivities({activity});
+    return;
+  }
+  logEvent(activity);
+}
+
+void ChromeTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy2>& activity) {
+  if (timeOrdered_) {
+    handleGpuActivities({activity});
+    return;
+  }
+  logEvent(activity);
+}
+
+void ChromeTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemset>& activity) {
+  if (timeOrdered_) {
+    handleGpuActivities({activity});
+    return;
+  }
+  logEvent(activity);
+}
+
+void ChromeTraceLogger::handleRuntimeActivities(
+    const std::vector<RuntimeActivity>& activities) {
+  if (timeOrdered_ && traceOf_) {
+    heldRuntime_.reserve(heldRuntime_.size() + activities.size());
+    for (const auto& activity : activities) {
+      holdEvent(
+          TimelineKey(
+              kCpuTimelines, activity.deviceId(), activity.resourceId()),
+          activity.timestamp(),
+          EventKind::Runtime,
+          heldRuntime_.size());
+      heldRuntime_.push_back(activity);
+    }
+    return;
+  }
+  logEvents(activities);
+}
+
+void ChromeTraceLogger::handleGpuActivities(
+    const std::vector<GpuActivity<CUpti_ActivityKernel4>>& activities) {
+  if (timeOrdered_ && traceOf_) {
+    holdGpuEvents(heldKernels_, activities, EventKind::Kernel);
+    return;
+  }
+  logEvents(activities);
+}
+
+void ChromeTraceLogger::handleGpuActivities(
+    const std::vector<GpuActivity<CUpti_ActivityMemcpy>>& activities) {
+  if (timeOrdered_ && traceOf_) {
+    holdGpuEvents(heldMemcpys_, activities, EventKind::Memcpy);
+    return;
+  }
+  logEvents(activities);
+}
+
+void ChromeTraceLogger::handleGpuActivities(
+    const std::vector<GpuActivity<CUpti_ActivityMemcpy2>>& activities) {
+  if (timeOrdered_ && traceOf_) {
+    holdGpuEvents(heldMemcpy2s_, activities, EventKind::Memcpy2);
+    return;
+  }
+  logEvents(activities);
+}
+
+void ChromeTraceLogger::handleGpuActivities(
+    const std::vector<GpuActivity<CUpti_ActivityMemset>>& activities) {
+  if (timeOrdered_ && traceOf_) {
+    holdGpuEvents(heldMemsets_, activities, EventKind::Memset);
+    return;
+  }
+  logEvents(activities);
+}
+
+void ChromeTraceLogger::formatHeldEvent(
+    std::string& out, const HeldEvent& event) const {
+  switch (event.kind) {
+    case EventKind::TraceSpan:
+      formatTraceSpan(out, heldSpans_[event.index]);
+      break;
+    case EventKind::IterationStart:
+      formatIterationStart(out, heldSpans_[event.index]);
+      break;
+    case EventKind::Cpu:
+      formatEvent(
+          out,
+          *heldCpuOps_[event.index].first,
+          *heldCpuOps_[event.index].second);
+      break;
+    case EventKind::Runtime:
+      formatEvent(out, heldRuntime_[event.index]);
+      break;
+    case EventKind::Kernel:
+      formatEvent(out, heldKernels_[event.index]);
+      break;
+    case EventKind::Memcpy:
+      formatEvent(out, heldMemcpys_[event.index]);
+      break;
+    case EventKind::Memcpy2:
+      formatEvent(out, heldMemcpy2s_[event.index]);
+      break;
+    case EventKind::Memset:
+      formatEvent(out, heldMemsets_[event.index]);
+      break;
+  }
+}
+
+// Maps signed timestamps to unsigned keys in the same order
+static uint64_t timestampKey(int64_t timestamp) {
+  return static_cast<uint64_t>(timestamp) ^ (1ULL << 63);
+}
+
+void ChromeTraceLogger::writeHeldEvents() {
+  // Events on a timeline mostly arrive in order, so sorting each one
+  // on its own is cheap. A k-way merge then orders the timelines, which
+  // are few compared to the events. Ties go to the earlier timeline.
+  std::vector<std::vector<HeldEvent>> timelines;
+  timelines.reserve(timelines_.size());
+  size_t count = 0;
+  for (auto& timeline : timelines_) {
+    radixSort(timeline.second, [](const HeldEvent& event) {
+      return timestampKey(event.timestamp);
+    });
+    count += timeline.second.size();
+    timelines.push_back(std::move(timeline.second));
+  }
+  timelines_.clear();
+  lastTimeline_ = nullptr;
+
+  using Head = std::pair<int64_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  std::vector<size_t> next(timelines.size(), 0);
+  for (size_t i = 0; i < timelines.size(); i++) {
+    if (!timelines[i].empty()) {
+      heads.emplace(timelines[i].front().timestamp, i);
+    }
+  }
+  std::vector<HeldEvent> events;
+  events.reserve(count);
+  while (!heads.empty()) {
+    size_t i = heads.top().second;
+    heads.pop();
+    const auto& timeline = timelines[i];
+    // Take all events up to the next timeline's head in one go
+    Head limit = heads.empty()
+        ? Head(std::numeric_limits<int64_t>::max(), timelines.size())
+        : heads.top();
+    size_t end = next[i] + 1;
+    while (end < timeline.size() &&
+           Head(timeline[end].timestamp, i) < limit) {
+      end++;
+    }
+    events.insert(
+        events.end(), timeline.begin() + next[i], timeline.begin() + end);
+    next[i] = end;
+    if (end < timeline.size()) {
+      heads.emplace(timeline[end].timestamp, i);
+    }
+  }
+  timelines.clear();
+
+  formatChunks(
+      events.size(),
+      [this, &events](std::string& out, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          formatHeldEvent(out, events[i]);
+        }
+      });
+
+  heldSpans_.clear();
+  heldCpuOps_.clear();
+  heldRuntime_.clear();
+  heldKernels_.clear();
+  heldMemcpys_.clear();
+  heldMemcpy2s_.clear();
+  heldMemsets_.clear();
 }
 
 void ChromeTraceLogger::finalizeTrace(
@@ -389,8 +784,10 @@ void ChromeTraceLogger::finalizeTrace(
     LOG(ERROR) << "Failed to write to log file!";
     return;
   }
-  // Replace trailing comma with "]"
-  traceOf_.seekp(-1, std::ios_base::cur);
+  if (timeOrdered_) {
+    writeHeldEvents();
+  }
+  // Events are preceded by a comma, so the array can simply be closed
   traceOf_ << std::endl << "]";
   traceOf_.close();
   LOG(INFO) << "Chrome Trace written to " << fileName_;
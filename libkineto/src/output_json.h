@@ -8,10 +8,14 @@
 #pragma once
 
 #include <fstream>
+#include <functional>
 #include <map>
 #include <ostream>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include <cupti.h>
 #include "ClientTraceActivity.h"
@@ -27,7 +31,16 @@ class Config;
 
 class ChromeTraceLogger : public libkineto::ActivityLogger {
  public:
-  explicit ChromeTraceLogger(const std::string& traceFileName);
+  // Batches of activities are formatted on up to formatThreads threads.
+  // By default one per core, up to 8.
+  // If timeOrdered is set, events are held until finalizeTrace and then
+  // written in order of time, after the process and thread metadata.
+  // Activities and the spans of CPU ops must then remain valid until
+  // finalizeTrace, which is the case for the buffers passed to it.
+  explicit ChromeTraceLogger(
+      const std::string& traceFileName,
+      int formatThreads = 0,
+      bool timeOrdered = false);
 
   // Note: the caller of these functions should handle concurrency
   // i.e., we these functions are not thread-safe
@@ -53,17 +66,116 @@ class ChromeTraceLogger : public libkineto::ActivityLogger {
   void handleGpuActivity(const GpuActivity<CUpti_ActivityMemcpy2>& activity) override;
   void handleGpuActivity(const GpuActivity<CUpti_ActivityMemset>& activity) override;
 
+  void handleRuntimeActivities(
+      const std::vector<RuntimeActivity>& activities) override;
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityKernel4>>& activities) override;
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy>>& activities) override;
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy2>>& activities) override;
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemset>>& activities) override;
+
   void finalizeTrace(const Config& config, std::unique_ptr<ActivityBuffers> buffers) override;
 
  private:
-  // Create a flow event to an external event
-  void handleLinkStart(const RuntimeActivity& s);
-  void handleLinkEnd(const TraceActivity& e);
+  // Events are appended to a buffer, each preceded by a comma.
+  // These only read immutable state, so can run on several threads.
+  void formatTraceSpan(std::string& out, const TraceSpan& span) const;
+  void formatIterationStart(std::string& out, const TraceSpan& span) const;
+  void formatEvent(
+      std::string& out,
+      const libkineto::ClientTraceActivity& op,
+      const TraceSpan& span) const;
+  void formatEvent(std::string& out, const RuntimeActivity& activity) const;
+  void formatEvent(
+      std::string& out,
+      const GpuActivity<CUpti_ActivityKernel4>& activity) const;
+  void formatEvent(
+      std::string& out,
+      const GpuActivity<CUpti_ActivityMemcpy>& activity) const;
+  void formatEvent(
+      std::string& out,
+      const GpuActivity<CUpti_ActivityMemcpy2>& activity) const;
+  void formatEvent(
+      std::string& out,
+      const GpuActivity<CUpti_ActivityMemset>& activity) const;
 
-  void logActivity(const CUpti_Activity* act);
+  // Create a flow event to an external event
+  void formatLinkStart(std::string& out, const RuntimeActivity& s) const;
+  void formatLinkEnd(std::string& out, const TraceActivity& e) const;
+
+  // Write formatted events, leaving out the comma before the first event
+  void writeEvents(const std::string& events);
+
+  template <class T>
+  void logEvent(const T& activity);
+
+  template <class T>
+  void logEvents(const std::vector<T>& activities);
+
+  // Split count events into chunks, which are formatted on worker threads
+  // and written in order as they complete.
+  void formatChunks(
+      size_t count,
+      const std::function<void(std::string&, size_t, size_t)>& format);
+
+  // Events held back to be written in order of time
+  enum class EventKind : uint8_t {
+    TraceSpan,
+    IterationStart,
+    Cpu,
+    Runtime,
+    Kernel,
+    Memcpy,
+    Memcpy2,
+    Memset
+  };
+  struct HeldEvent {
+    int64_t timestamp;
+    EventKind kind;
+    // Index into the activities of this kind
+    uint32_t index;
+  };
+  // Events are sorted per timeline, i.e. per (pid, tid) for the CPU
+  // and per (device, stream) for the GPU, and the timelines merged
+  using TimelineKey = std::tuple<int, int64_t, int64_t>;
+
+  void holdEvent(
+      const TimelineKey& timeline,
+      int64_t timestamp,
+      EventKind kind,
+      size_t index);
+
+  template <class T>
+  void holdGpuEvents(
+      std::vector<GpuActivity<T>>& held,
+      const std::vector<GpuActivity<T>>& activities,
+      EventKind kind);
+
+  void formatHeldEvent(std::string& out, const HeldEvent& event) const;
+
+  // Sort held events and write them
+  void writeHeldEvents();
 
   std::string fileName_;
   std::ofstream traceOf_;
+  bool eventWritten_{false};
+  int formatThreads_;
+  bool timeOrdered_;
+
+  std::map<TimelineKey, std::vector<HeldEvent>> timelines_;
+  std::vector<HeldEvent>* lastTimeline_{nullptr};
+  TimelineKey lastTimelineKey_;
+  std::vector<TraceSpan> heldSpans_;
+  std::vector<std::pair<const ClientTraceActivity*, const TraceSpan*>>
+      heldCpuOps_;
+  std::vector<RuntimeActivity> heldRuntime_;
+  std::vector<GpuActivity<CUpti_ActivityKernel4>> heldKernels_;
+  std::vector<GpuActivity<CUpti_ActivityMemcpy>> heldMemcpys_;
+  std::vector<GpuActivity<CUpti_ActivityMemcpy2>> heldMemcpy2s_;
+  std::vector<GpuActivity<CUpti_ActivityMemset>> heldMemsets_;
 
   // store the mapping of thread id vs. showing on the trace
   std::unordered_map<uint32_t, int> tidMap_;
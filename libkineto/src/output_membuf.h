@@ -75,6 +75,27 @@ class MemoryTraceLogger : public ActivityLogger {
     activities_.push_back(std::make_unique<GpuActivity<CUpti_ActivityMemset>>(activity));
   }
 
+  void handleRuntimeActivities(
+      const std::vector<RuntimeActivity>& activities) override {
+    append(activities);
+  }
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityKernel4>>& activities) override {
+    append(activities);
+  }
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy>>& activities) override {
+    append(activities);
+  }
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemcpy2>>& activities) override {
+    append(activities);
+  }
+  void handleGpuActivities(
+      const std::vector<GpuActivity<CUpti_ActivityMemset>>& activities) override {
+    append(activities);
+  }
+
   void finalizeTrace(const Config& config, std::unique_ptr<ActivityBuffers> buffers) override {
     buffers_ = std::move(buffers);
   }
@@ -105,6 +126,14 @@ class MemoryTraceLogger : public ActivityLogger {
 
  private:
 
+  template <class T>
+  void append(const std::vector<T>& activities) {
+    activities_.reserve(activities_.size() + activities.size());
+    for (const auto& activity : activities) {
+      activities_.push_back(std::make_unique<T>(activity));
+    }
+  }
+
   struct CpuActivityDecorator : public libkineto::TraceActivity {
     CpuActivityDecorator(
         const libkineto::ClientTraceActivity& activity,
@@ -117,6 +146,7 @@ class MemoryTraceLogger : public ActivityLogger {
     int64_t correlationId() const override {return wrappee_.correlationId();}
     ActivityType type() const override {return wrappee_.type();}
     const std::string name() const override {return wrappee_.name();}
+    StringView nameView() const override {return wrappee_.nameView();}
     const TraceActivity* linkedActivity() const override {
       return wrappee_.linkedActivity();
     }
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "output_shm.h"
+
+#include <fmt/format.h>
+#include <unistd.h>
+#include <chrono>
+#include <system_error>
+#include <thread>
+
+#include "Config.h"
+#include "CuptiActivity.h"
+#include "CuptiActivity.tpp"
+#include "TraceSpan.h"
+
+#include "Logger.h"
+
+using namespace std::chrono;
+using namespace libkineto;
+
+namespace KINETO_NAMESPACE {
+
+// Pages are only allocated when touched, and the aggregator drains the
+// ring while it is being written, so this is an upper bound.
+constexpr size_t kRingCapacity = 16 * 1024 * 1024;
+// Give up if the aggregator makes no progress for this long
+constexpr milliseconds kStallTimeout(1000);
+constexpr microseconds kFullRetryInterval(100);
+
+using Category = HostTraceRecord::Category;
+using Kind = HostTraceRecord::Kind;
+
+std::unique_ptr<SharedMemoryTraceLogger> SharedMemoryTraceLogger::create(
+    const Config& config) {
+  std::unique_ptr<SharedRing> ring;
+  try {
+    ring = SharedRing::create(
+        fmt::format("kineto_trace_{}", getpid()), kRingCapacity);
+  } catch (const std::system_error& e) {
+    LOG(ERROR) << "Failed to create host trace ring: " << e.what();
+    return nullptr;
+  }
+  if (!HostTraceAggregator::join(*ring, config.activitiesLogFile())) {
+    return nullptr;
+  }
+  return std::unique_ptr<SharedMemoryTraceLogger>(
+      new SharedMemoryTraceLogger(std::move(ring)));
+}
+
+SharedMemoryTraceLogger::SharedMemoryTraceLogger(
+    std::unique_ptr<SharedRing> ring)
+    : ring_(std::move(ring)), pid_(getpid()) {}
+
+void SharedMemoryTraceLogger::write(const HostTraceEvent& event) {
+  if (stalled_) {
+    dropped_++;
+    return;
+  }
+  event.encode(buf_);
+  auto start = steady_clock::now();
+  while (!ring_->write(buf_.data(), buf_.size())) {
+    if (steady_clock::now() - start > kStallTimeout) {
+      LOG(ERROR) << "Host trace aggregator is not responding";
+      stalled_ = true;
+      dropped_++;
+      return;
+    }
+    std::this_thread::sleep_for(kFullRetryInterval);
+  }
+}
+
+void SharedMemoryTraceLogger::handleProcessInfo(
+    const ProcessInfo& processInfo,
+    uint64_t time) {
+  HostTraceEvent event{};
+  event.record.kind = Kind::Process;
+  if (processInfo.pid != pid_) {
+    // Other processes are GPU rows, named by device id
+    event.record.category = Category::Gpu;
+  }
+  event.record.source = pid_;
+  event.record.pid = processInfo.pid;
+  event.record.ts = time;
+  event.name = processInfo.name;
+  event.arg = processInfo.label;
+  write(event);
+}
+
+void SharedMemoryTraceLogger::handleThreadInfo(
+    const ThreadInfo& threadInfo,
+    int64_t time) {
+  HostTraceEvent event{};
+  event.record.kind = Kind::Thread;
+  event.record.source = pid_;
+  event.record.pid = pid_;
+  event.record.tid = threadInfo.tid;
+  event.record.ts = time;
+  event.name = threadInfo.name;
+  write(event);
+}
+
+void SharedMemoryTraceLogger::handleTraceSpan(const TraceSpan& span) {
+  HostTraceEvent event{};
+  event.record.kind = Kind::Event;
+  event.record.category = Category::Trace;
+  event.record.source = pid_;
+  event.record.pid = pid_;
+  event.record.ts = span.startTime;
+  event.record.dur = span.endTime - span.startTime;
+  event.name = fmt::format("{}{} ({})", span.prefix, span.name, span.iteration);
+  event.arg = span.name;
+  write(event);
+}
+
+void SharedMemoryTraceLogger::handleIterationStart(const TraceSpan& span) {
+  HostTraceEvent event{};
+  event.record.kind = Kind::Instant;
+  event.record.source = pid_;
+  event.record.pid = pid_;
+  event.record.ts = span.startTime;
+  event.name = span.name;
+  write(event);
+}
+
+void SharedMemoryTraceLogger::handleActivity(
+    const TraceActivity& activity,
+    Category category) {
+  HostTraceEvent event{};
+  event.record.kind = Kind::Event;
+  event.record.category = category;
+  event.record.source = pid_;
+  // This process for CPU activities, and the GPU index for GPU activities,
+  // which the aggregator shows per process
+  event.record.pid = activity.deviceId();
+  event.record.tid = activity.resourceId();
+  event.record.ts = activity.timestamp();
+  event.record.dur = activity.duration();
+  event.record.correlation = activity.correlationId();
+  event.name = activity.name();
+  write(event);
+}
+
+void SharedMemoryTraceLogger::handleCpuActivity(
+    const libkineto::ClientTraceActivity& op,
+    const TraceSpan& /*unused*/) {
+  handleActivity(op, Category::Operator);
+}
+
+void SharedMemoryTraceLogger::handleRuntimeActivity(
+    const RuntimeActivity& activity) {
+  handleActivity(activity, Category::Runtime);
+}
+
+void SharedMemoryTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityKernel4>& activity) {
+  handleActivity(activity, Category::Kernel);
+}
+
+void SharedMemoryTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy>& activity) {
+  handleActivity(activity, Category::Memcpy);
+}
+
+void SharedMemoryTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemcpy2>& activity) {
+  handleActivity(activity, Category::Memcpy);
+}
+
+void SharedMemoryTraceLogger::handleGpuActivity(
+    const GpuActivity<CUpti_ActivityMemset>& activity) {
+  handleActivity(activity, Category::Memset);
+}
+
+void SharedMemoryTraceLogger::finalizeTrace(
+    const Config& /*unused*/,
+    std::unique_ptr<ActivityBuffers> /*unused*/) {
+  // The aggregator writes the trace once all processes are done
+  ring_->close();
+  LOG_IF(ERROR, dropped_ > 0)
+      << "Dropped " << dropped_ << " records from host trace";
+  LOG(INFO) << "Trace handed to host trace aggregator";
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <cupti.h>
+#include "ClientTraceActivity.h"
+#include "HostTraceAggregator.h"
+#include "SharedRing.h"
+#include "output_base.h"
+
+namespace libkineto {
+  class TraceSpan;
+}
+
+namespace KINETO_NAMESPACE {
+
+class Config;
+
+// Streams compact trace records into shared memory, where the host trace
+// aggregator merges them with traces from other processes on the host
+// into one trace file. See HostTraceAggregator.
+class SharedMemoryTraceLogger : public libkineto::ActivityLogger {
+ public:
+  // Returns nullptr if the aggregator cannot be joined, in which case
+  // the caller should log the trace by itself.
+  static std::unique_ptr<SharedMemoryTraceLogger> create(const Config& config);
+
+  // Note: the caller of these functions should handle concurrency
+  // i.e., we these functions are not thread-safe
+  void handleProcessInfo(
+      const ProcessInfo& processInfo,
+      uint64_t time) override;
+
+  void handleThreadInfo(const ThreadInfo& threadInfo, int64_t time) override;
+
+  void handleTraceSpan(const TraceSpan& span) override;
+
+  void handleIterationStart(const TraceSpan& span) override;
+
+  void handleCpuActivity(
+      const libkineto::ClientTraceActivity& activity,
+      const TraceSpan& span) override;
+
+  void handleRuntimeActivity(
+      const RuntimeActivity& activity) override;
+
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityKernel4>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemcpy>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemcpy2>& activity) override;
+  void handleGpuActivity(const GpuActivity<CUpti_ActivityMemset>& activity) override;
+
+  void finalizeTrace(const Config& config, std::unique_ptr<ActivityBuffers> buffers) override;
+
+ private:
+  explicit SharedMemoryTraceLogger(std::unique_ptr<SharedRing> ring);
+
+  void handleActivity(
+      const TraceActivity& activity,
+      HostTraceRecord::Category category);
+
+  // Waits for the aggregator while the ring is full
+  void write(const HostTraceEvent& event);
+
+  std::unique_ptr<SharedRing> ring_;
+  // Cache pid to avoid repeated calls to getpid()
+  pid_t pid_;
+  std::string buf_;
+  // Set when the aggregator stops draining the ring
+  bool stalled_{false};
+  int64_t dropped_{0};
+};
+
+} // namespace KINETO_NAMESPACE
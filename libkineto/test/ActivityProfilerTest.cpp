@@ -10,12 +10,16 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <chrono>
+#include <thread>
 
 #include "include/libkineto.h"
 #include "src/ActivityProfiler.h"
+#include "src/ActivityProfilerController.h"
 #include "src/Config.h"
 #include "src/CuptiActivityInterface.h"
 #include "src/output_json.h"
+#include "src/output_membuf.h"
+#include "time_since_epoch.h"
 
 #include "src/Logger.h"
 
@@ -24,6 +28,22 @@ using namespace KINETO_NAMESPACE;
 
 class MockCuptiActivities : public CuptiActivityInterface {};
 
+// Receives steps from libkineto::api() on behalf of the profiler under test,
+// passing on the simulated time of the step
+class StepProfiler : public libkineto::ActivityProfilerInterface {
+ public:
+  explicit StepProfiler(ActivityProfiler& profiler) : profiler_(profiler) {}
+
+  void step(int64_t stepCount) override {
+    profiler_.step(stepCount, now);
+  }
+
+  time_point<system_clock> now;
+
+ private:
+  ActivityProfiler& profiler_;
+};
+
 TEST(ActivityProfiler, PyTorchTrace) {
   std::vector<std::string> log_modules(
       {"ActivityProfiler.cpp", "output_json.cpp"});
@@ -82,3 +102,309 @@ TEST(ActivityProfiler, PyTorchTrace) {
   // Should expect at least 1MB
   EXPECT_GT(buf.st_size, 100);
 }
+
+// Wait for the controller to reach the given state, returning the time
+static time_point<system_clock> waitForActive(
+    ActivityProfilerController& controller, bool active) {
+  auto timeout = system_clock::now() + seconds(5);
+  while (controller.isActive() != active && system_clock::now() < timeout) {
+    std::this_thread::sleep_for(microseconds(50));
+  }
+  return system_clock::now();
+}
+
+TEST(ActivityProfilerController, TriggerRequests) {
+  // Each async request starts a trace, which ends on its own.
+  // Latency is measured by the TriggerLatency benchmark.
+  constexpr int kRequests = 3;
+  ActivityProfilerController controller(/*cpu only*/ true);
+
+  Config cfg;
+  bool success = cfg.parse(R"CFG(
+    ACTIVITIES_WARMUP_PERIOD_SECS = 0
+    ACTIVITIES_DURATION_MSECS = 200
+  )CFG");
+  EXPECT_TRUE(success);
+  cfg.setClientDefaults();
+
+  for (int i = 0; i < kRequests; i++) {
+    EXPECT_TRUE(controller.scheduleTrace(cfg));
+    waitForActive(controller, true);
+    EXPECT_TRUE(controller.isActive());
+    waitForActive(controller, false);
+    EXPECT_FALSE(controller.isActive());
+  }
+}
+
+TEST(ActivityProfilerController, QueuedRequests) {
+  // Requests received while tracing are run back to back, not dropped
+  ActivityProfilerController controller(/*cpu only*/ true);
+  // A synchronous trace keeps the profiler busy while requests are queued,
+  // so none of them starts before its duplicate arrives
+  Config busy;
+  EXPECT_TRUE(busy.parse("ACTIVITIES_DURATION_SECS = 60"));
+  controller.prepareTrace(busy);
+  controller.startTrace();
+
+  for (int i = 0; i < 3; i++) {
+    // Traces are kept in memory, so requests differ by duration only
+    Config cfg;
+    EXPECT_TRUE(cfg.parse(fmt::format(R"CFG(
+      ACTIVITIES_WARMUP_PERIOD_SECS = 0
+      ACTIVITIES_DURATION_MSECS = {}
+    )CFG", 20 + i)));
+    cfg.setClientDefaults();
+    EXPECT_TRUE(controller.scheduleTrace(cfg));
+    // Duplicates are coalesced
+    EXPECT_TRUE(controller.scheduleTrace(cfg));
+  }
+  auto status = controller.traceRequestStatus();
+  EXPECT_EQ(status.queued, 3u);
+  EXPECT_EQ(status.coalesced, 3);
+  controller.stopTrace();
+
+  auto timeout = system_clock::now() + seconds(5);
+  while (status.started < 3 && system_clock::now() < timeout) {
+    std::this_thread::sleep_for(milliseconds(1));
+    status = controller.traceRequestStatus();
+  }
+  waitForActive(controller, false);
+  EXPECT_EQ(status.started, 3);
+  EXPECT_EQ(status.rejected, 0);
+  EXPECT_EQ(status.queued, 0u);
+}
+
+TEST(ActivityProfiler, StepTrace) {
+  MockCuptiActivities activities;
+  ActivityProfiler profiler(activities, /*cpu only*/ true);
+
+  Config cfg;
+  bool success = cfg.parse(R"CFG(
+    ACTIVITIES_SKIP_STEPS = 1
+    ACTIVITIES_WARMUP_STEPS = 1
+    ACTIVITIES_STEPS = 2
+  )CFG");
+  EXPECT_TRUE(success);
+
+  auto stepProfiler = std::make_unique<StepProfiler>(profiler);
+  StepProfiler* steps = stepProfiler.get();
+  libkineto::api().registerProfiler(std::move(stepProfiler));
+
+  MemoryTraceLogger logger(cfg);
+  auto now = system_clock::now();
+  profiler.configure(cfg, now);
+  profiler.setLogger(&logger);
+
+  // Woken up when the last step is reached, without holding the profiler
+  // lock, since the controller may configure the profiler while waking up
+  int wakeups = 0;
+  profiler.setWakeupCallback([&]() {
+    wakeups++;
+    profiler.configure(cfg, now);
+  });
+
+  // One net iteration per step. The client ends each step with
+  // libkineto::api().step(), which only calls the profiler on the steps
+  // it waits for.
+  for (int i = 0; i < 5; i++) {
+    auto start = now + seconds(i);
+    // Step based traces are not started by time
+    profiler.performRunLoopStep(start, start);
+    steps->now = start;
+    libkineto::api().step();
+
+    auto trace = std::make_unique<libkineto::CpuTraceBuffer>();
+    trace->span = {timeSinceEpoch(start),
+                   timeSinceEpoch(start + milliseconds(900)),
+                   1, -1, "net", ""};
+    trace->gpuOpCount = -1;
+    trace->activities.resize(1);
+    auto& op = trace->activities.front();
+    op.startTime = timeSinceEpoch(start + milliseconds(100));
+    op.endTime = timeSinceEpoch(start + milliseconds(800));
+    op.correlation = 0;
+    op.device = 0;
+    op.threadId = pthread_self();
+    op.opType = fmt::format("op{}", i);
+    profiler.transferCpuTrace(std::move(trace));
+  }
+  auto end = now + seconds(5);
+  while (profiler.isActive()) {
+    profiler.performRunLoopStep(end, end);
+  }
+
+  // Skipped the first step, warmed up for one, then traced two
+  std::vector<std::string> names;
+  for (const auto& activity : *logger.traceActivities()) {
+    if (activity->type() == ActivityType::CPU_OP) {
+      names.push_back(activity->name());
+    }
+  }
+  EXPECT_EQ(names, std::vector<std::string>({"op1", "op2"}));
+  EXPECT_EQ(wakeups, 1);
+  libkineto::api().registerProfiler(nullptr);
+}
+
+TEST(ActivityProfiler, DetachedSession) {
+  MockCuptiActivities activities;
+  ActivityProfiler profiler(activities, /*cpu only*/ true);
+
+  Config cfg;
+  EXPECT_TRUE(cfg.parse(R"CFG(
+    ACTIVITIES_WARMUP_PERIOD_SECS = 0
+    ACTIVITIES_DURATION_SECS = 1
+  )CFG"));
+  auto now = system_clock::now();
+  profiler.configure(cfg, now);
+  profiler.performRunLoopStep(now, now);
+
+  auto trace = std::make_unique<libkineto::CpuTraceBuffer>();
+  trace->span = {timeSinceEpoch(now),
+                 timeSinceEpoch(now + milliseconds(500)),
+                 1, -1, "net", ""};
+  trace->gpuOpCount = -1;
+  trace->activities.resize(1);
+  auto& op = trace->activities.front();
+  op.startTime = timeSinceEpoch(now + milliseconds(100));
+  op.endTime = timeSinceEpoch(now + milliseconds(400));
+  op.correlation = 0;
+  op.device = 0;
+  op.threadId = pthread_self();
+  op.opType = "op";
+  profiler.transferCpuTrace(std::move(trace));
+
+  auto end = now + seconds(1);
+  profiler.performRunLoopStep(end, end);
+  EXPECT_TRUE(profiler.isProcessingTrace());
+
+  // The profiler takes the next request before the trace is processed
+  auto session = profiler.detachSession();
+  EXPECT_FALSE(profiler.isActive());
+  profiler.configure(cfg, end);
+  EXPECT_TRUE(profiler.isActive());
+
+  MemoryTraceLogger logger(session->config());
+  session->process(logger);
+  std::vector<std::string> names;
+  for (const auto& activity : *logger.traceActivities()) {
+    if (activity->type() == ActivityType::CPU_OP) {
+      names.push_back(activity->name());
+    }
+  }
+  EXPECT_EQ(names, std::vector<std::string>({"op"}));
+  profiler.reset();
+}
+
+TEST(ActivityProfiler, NetFilter) {
+  MockCuptiActivities activities;
+  ActivityProfiler profiler(activities, /*cpu only*/ true);
+  EXPECT_TRUE(profiler.applyNetFilter("init_net"));
+
+  Config cfg;
+  EXPECT_TRUE(cfg.parse(R"CFG(
+    ACTIVITIES_WARMUP_PERIOD_SECS = 0
+    ACTIVITIES_NET_FILTER = train, eval
+  )CFG"));
+  auto now = system_clock::now();
+  profiler.configure(cfg, now);
+  EXPECT_TRUE(profiler.applyNetFilter("dist_train_net"));
+  EXPECT_TRUE(profiler.applyNetFilter("eval_net"));
+  EXPECT_FALSE(profiler.applyNetFilter("init_net"));
+  // Cached
+  EXPECT_FALSE(profiler.applyNetFilter("init_net"));
+
+  // Cached decisions are dropped when the filter is replaced
+  profiler.reset();
+  EXPECT_TRUE(cfg.parse("ACTIVITIES_NET_FILTER = init"));
+  profiler.configure(cfg, now);
+  EXPECT_TRUE(profiler.applyNetFilter("init_net"));
+  EXPECT_FALSE(profiler.applyNetFilter("eval_net"));
+  profiler.reset();
+}
+
+TEST(CuptiActivityInterface, CorrelationMirroring) {
+  const std::set<ActivityType> activities{ActivityType::EXTERNAL_CORRELATION};
+  EXPECT_FALSE(CuptiActivityInterface::correlationMirroring());
+  // Only mirrored when external correlation is traced
+  CuptiActivityInterface::setCorrelationMirroring(
+      {ActivityType::CUDA_RUNTIME}, true);
+  EXPECT_FALSE(CuptiActivityInterface::correlationMirroring());
+  CuptiActivityInterface::setCorrelationMirroring(activities, true);
+  EXPECT_TRUE(CuptiActivityInterface::correlationMirroring());
+  CuptiActivityInterface::pushCorrelationID(1);
+  CuptiActivityInterface::popCorrelationID();
+  CuptiActivityInterface::setCorrelationMirroring(activities, false);
+  EXPECT_FALSE(CuptiActivityInterface::correlationMirroring());
+}
+
+// Correlation ids seen by CUPTI, in call order
+static std::vector<uint64_t> cuptiCorrelationPushes;
+static int cuptiCorrelationPops = 0;
+
+static CUptiResult recordCorrelationPush(
+    CUpti_ExternalCorrelationKind, uint64_t id) {
+  cuptiCorrelationPushes.push_back(id);
+  return CUPTI_SUCCESS;
+}
+
+static CUptiResult recordCorrelationPop(
+    CUpti_ExternalCorrelationKind, uint64_t*) {
+  cuptiCorrelationPops++;
+  return CUPTI_SUCCESS;
+}
+
+TEST(CuptiActivityInterface, CorrelationReplay) {
+  const std::set<ActivityType> activities{ActivityType::EXTERNAL_CORRELATION};
+  CuptiActivityInterface::setCorrelationFunctions(
+      recordCorrelationPush, recordCorrelationPop);
+  cuptiCorrelationPushes.clear();
+  cuptiCorrelationPops = 0;
+
+  // Ops in flight before recording starts are not seen by CUPTI...
+  CuptiActivityInterface::pushCorrelationID(1);
+  CuptiActivityInterface::pushCorrelationID(2);
+  EXPECT_TRUE(cuptiCorrelationPushes.empty());
+
+  // ...until the next push on the thread replays them
+  CuptiActivityInterface::setCorrelationMirroring(activities, true);
+  CuptiActivityInterface::pushCorrelationID(3);
+  EXPECT_EQ(cuptiCorrelationPushes, (std::vector<uint64_t>{1, 2, 3}));
+
+  // Pushed after recording stops, so not mirrored
+  CuptiActivityInterface::setCorrelationMirroring(activities, false);
+  CuptiActivityInterface::pushCorrelationID(4);
+  EXPECT_EQ(cuptiCorrelationPushes.size(), 3u);
+
+  // Exactly the mirrored ids are popped from CUPTI
+  CuptiActivityInterface::popCorrelationID();
+  EXPECT_EQ(cuptiCorrelationPops, 0);
+  for (int i = 1; i <= 3; i++) {
+    CuptiActivityInterface::popCorrelationID();
+    EXPECT_EQ(cuptiCorrelationPops, i);
+  }
+  // Unbalanced pops never reach CUPTI
+  CuptiActivityInterface::popCorrelationID();
+  EXPECT_EQ(cuptiCorrelationPops, 3);
+
+  CuptiActivityInterface::setCorrelationFunctions(nullptr, nullptr);
+}
+
+TEST(CuptiActivityInterface, StandbyBeforeDetach) {
+  MockCuptiActivities cupti;
+  const std::set<ActivityType> activities{ActivityType::CONCURRENT_KERNEL};
+  EXPECT_TRUE(cupti.addActivityBuffer((uint8_t*) malloc(16), 0));
+
+  // Buffers of the trace are kept, later ones are discarded
+  cupti.enterStandby(activities);
+  EXPECT_TRUE(cupti.inStandby());
+  uint8_t* late = (uint8_t*) malloc(16);
+  EXPECT_FALSE(cupti.addActivityBuffer(late, 0));
+  free(late);
+  auto buffers = cupti.activityBuffers();
+  ASSERT_NE(buffers, nullptr);
+  EXPECT_EQ(buffers->size(), 1u);
+
+  EXPECT_TRUE(cupti.exitStandby(activities));
+  EXPECT_TRUE(cupti.addActivityBuffer((uint8_t*) malloc(16), 0));
+  cupti.clearActivities();
+}
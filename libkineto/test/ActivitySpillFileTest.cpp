@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/ActivitySpillFile.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <list>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include "src/CuptiActivityBuffer.h"
+
+using namespace KINETO_NAMESPACE;
+
+TEST(ActivitySpillFileTest, AppendAndMap) {
+  // Smaller than the data, so the file has to grow
+  ActivitySpillFile file("/tmp", 1024);
+  std::vector<std::vector<uint8_t>> buffers;
+  std::vector<int64_t> offsets;
+  for (int i = 0; i < 10; i++) {
+    buffers.emplace_back(300 + i, 'a' + i);
+    offsets.push_back(file.append(buffers.back().data(), buffers.back().size()));
+  }
+  EXPECT_EQ(file.bufferCount(), 10);
+  EXPECT_EQ(offsets[0], 0);
+
+  auto mapping = file.map();
+  ASSERT_TRUE(mapping != nullptr);
+  // Nothing more can be appended once mapped
+  EXPECT_EQ(file.append(buffers[0].data(), buffers[0].size()), -1);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(
+        memcmp(mapping.get() + offsets[i], buffers[i].data(), buffers[i].size()),
+        0);
+  }
+}
+
+TEST(ActivitySpillFileTest, MappingOutlivesFile) {
+  std::shared_ptr<uint8_t> mapping;
+  std::vector<uint8_t> data(4096, 'x');
+  std::list<CuptiActivityBuffer> buffers;
+  {
+    ActivitySpillFile file("/tmp", 0);
+    buffers.emplace_back(file.append(data.data(), data.size()), data.size());
+    mapping = file.map();
+  }
+  ASSERT_TRUE(buffers.front().spilled());
+  buffers.front().setSpillMapping(mapping);
+  mapping = nullptr;
+  EXPECT_EQ(memcmp(buffers.front().data, data.data(), data.size()), 0);
+}
+
+TEST(ActivitySpillFileTest, Clear) {
+  ActivitySpillFile file("/tmp", 4096);
+  std::vector<uint8_t> data(100, 'a');
+  file.append(data.data(), data.size());
+  file.clear();
+  EXPECT_EQ(file.size(), 0);
+  EXPECT_EQ(file.map(), nullptr);
+  data.assign(100, 'b');
+  EXPECT_EQ(file.append(data.data(), data.size()), 0);
+  auto mapping = file.map();
+  ASSERT_TRUE(mapping != nullptr);
+  EXPECT_EQ(mapping.get()[0], 'b');
+}
+
+TEST(ActivitySpillFileTest, InvalidDirectory) {
+  EXPECT_THROW(
+      ActivitySpillFile("/nonexistent/kineto", 4096), std::system_error);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/output_aggregate.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "include/TraceSpan.h"
+#include "src/Config.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+using Category = AggregateTraceLogger::Category;
+
+static ClientTraceActivity makeOp(
+    const std::string& name, int64_t start, int64_t end) {
+  ClientTraceActivity op;
+  op.startTime = start;
+  op.endTime = end;
+  op.correlation = 0;
+  op.device = 0;
+  op.threadId = pthread_self();
+  op.opType = name;
+  return op;
+}
+
+static std::string summaryFileName() {
+  return "/tmp/libkineto_summary_test_" + std::to_string(getpid()) + ".json";
+}
+
+TEST(AggregateTraceLoggerTest, MergeTraces) {
+  AggregateTraceLogger logger(summaryFileName(), seconds(3600));
+  TraceSpan span;
+  Config config;
+  for (int trace = 0; trace < 3; trace++) {
+    logger.handleCpuActivity(makeOp("op1", 100, 110), span);
+    logger.handleCpuActivity(makeOp("op2", 100, 130 + trace), span);
+    logger.finalizeTrace(config, nullptr);
+  }
+
+  const auto* op1 = logger.stats(Category::Operator, "op1");
+  ASSERT_NE(op1, nullptr);
+  EXPECT_EQ(op1->count, 3);
+  EXPECT_EQ(op1->total, 30);
+  const auto* op2 = logger.stats(Category::Operator, "op2");
+  ASSERT_NE(op2, nullptr);
+  EXPECT_EQ(op2->count, 3);
+  EXPECT_EQ(op2->min, 30);
+  EXPECT_EQ(op2->max, 32);
+  EXPECT_EQ(logger.stats(Category::Kernel, "op1"), nullptr);
+
+  // Most expensive first
+  std::stringstream summary;
+  logger.writeSummary(summary);
+  auto str = summary.str();
+  EXPECT_NE(str.find("\"traces\": 3"), std::string::npos);
+  EXPECT_LT(str.find("\"op2\""), str.find("\"op1\""));
+}
+
+TEST(AggregateTraceLoggerTest, EscapeNames) {
+  AggregateTraceLogger logger(summaryFileName(), seconds(3600));
+  TraceSpan span;
+  Config config;
+  logger.handleCpuActivity(makeOp("op<\"a\\b\">\n", 100, 110), span);
+  logger.finalizeTrace(config, nullptr);
+
+  std::stringstream summary;
+  logger.writeSummary(summary);
+  EXPECT_NE(
+      summary.str().find(R"("name": "op<\"a\\b\">\u000a")"),
+      std::string::npos);
+}
+
+TEST(AggregateTraceLoggerTest, FlushPeriod) {
+  auto fileName = summaryFileName();
+  remove(fileName.c_str());
+  AggregateTraceLogger logger(fileName, seconds(0));
+  TraceSpan span;
+  Config config;
+  logger.handleCpuActivity(makeOp("op1", 100, 110), span);
+  logger.finalizeTrace(config, nullptr);
+
+  // Written and reset at the end of the period
+  std::ifstream file(fileName);
+  ASSERT_TRUE(file.good());
+  std::stringstream contents;
+  contents << file.rdbuf();
+  EXPECT_NE(contents.str().find("\"op1\""), std::string::npos);
+  EXPECT_EQ(logger.stats(Category::Operator, "op1"), nullptr);
+  remove(fileName.c_str());
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/output_json.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "include/TraceSpan.h"
+#include "src/Config.h"
+#include "src/CuptiActivity.h"
+
+using namespace KINETO_NAMESPACE;
+
+namespace {
+
+// CUPTI records for a trace, with the activities wrapping them
+struct TestTrace {
+  explicit TestTrace(int count) {
+    op.startTime = 100;
+    op.endTime = 200;
+    op.correlation = 1;
+    op.device = 0;
+    op.threadId = pthread_self();
+    op.opType = "op";
+    runtime.resize(count);
+    kernels.resize(count);
+    for (int i = 0; i < count; i++) {
+      runtime[i] = {};
+      runtime[i].cbid = CUPTI_RUNTIME_TRACE_CBID_cudaLaunchKernel_v7000;
+      runtime[i].start = 1000 * i;
+      runtime[i].end = 1000 * i + 500;
+      runtime[i].correlationId = i;
+      runtime[i].threadId = 7;
+      kernels[i] = {};
+      kernels[i].name = "_Z6kernelPfi";
+      kernels[i].start = 1000 * i + 600;
+      kernels[i].end = 1000 * i + 900;
+      kernels[i].streamId = i % 4;
+      kernels[i].correlationId = i;
+      kernels[i].gridX = kernels[i].gridY = kernels[i].gridZ = 2;
+      kernels[i].blockX = kernels[i].blockY = kernels[i].blockZ = 32;
+    }
+  }
+
+  void log(ActivityLogger& logger) const {
+    std::vector<RuntimeActivity> runtimeActivities;
+    std::vector<GpuActivity<CUpti_ActivityKernel4>> kernelActivities;
+    for (size_t i = 0; i < runtime.size(); i++) {
+      runtimeActivities.emplace_back(&runtime[i], op);
+      kernelActivities.emplace_back(&kernels[i], op);
+    }
+    logger.handleRuntimeActivities(runtimeActivities);
+    logger.handleGpuActivities(kernelActivities);
+  }
+
+  ClientTraceActivity op;
+  std::vector<CUpti_ActivityAPI> runtime;
+  std::vector<CUpti_ActivityKernel4> kernels;
+};
+
+std::string traceFileName(int threads) {
+  return "/tmp/libkineto_chrome_trace_test_" + std::to_string(getpid()) +
+      "_" + std::to_string(threads) + ".json";
+}
+
+std::string writeTrace(
+    const TestTrace& trace, int threads, bool timeOrdered = false) {
+  std::string fileName = traceFileName(threads);
+  {
+    ChromeTraceLogger logger(fileName, threads, timeOrdered);
+    TraceSpan span{100, 200, 1, 0, "net", ""};
+    logger.handleTraceSpan(span);
+    logger.handleCpuActivity(trace.op, span);
+    trace.log(logger);
+    Config config;
+    logger.finalizeTrace(config, nullptr);
+  }
+  std::ifstream file(fileName);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  remove(fileName.c_str());
+  return contents.str();
+}
+
+// Events in the trace, in the order they were written
+std::vector<std::string> traceEvents(const std::string& trace) {
+  std::vector<std::string> events;
+  size_t pos = trace.find("\n  {");
+  while (pos != std::string::npos) {
+    size_t end = trace.find("\n  }", pos);
+    events.push_back(trace.substr(pos, end - pos));
+    pos = trace.find("\n  {", end);
+  }
+  return events;
+}
+
+int64_t eventTimestamp(const std::string& event) {
+  return std::stoll(event.substr(event.find("\"ts\": ") + 6));
+}
+
+} // namespace
+
+TEST(ChromeTraceLoggerTest, ParallelFormatting) {
+  // Not a multiple of the chunk size
+  TestTrace trace(5000);
+  std::string serial = writeTrace(trace, 1);
+  EXPECT_EQ(serial.substr(0, 2), "[\n");
+  EXPECT_EQ(serial.back(), ']');
+  EXPECT_EQ(serial.find("},\n]"), std::string::npos);
+  EXPECT_EQ(serial.find("[\n,"), std::string::npos);
+  EXPECT_NE(serial.find("\"correlation\": 4999"), std::string::npos);
+
+  for (int threads : {2, 4, 8}) {
+    EXPECT_EQ(writeTrace(trace, threads), serial);
+  }
+}
+
+TEST(ChromeTraceLoggerTest, TimeOrdered) {
+  TestTrace trace(3000);
+  // Out of order within and across streams and threads
+  std::mt19937 rng(17);
+  for (int i = 0; i < 3000; i++) {
+    int64_t start = rng() % 1000000;
+    trace.runtime[i].start = start;
+    trace.runtime[i].end = start + 500;
+    trace.runtime[i].threadId = i % 3;
+    trace.kernels[i].start = start + 600;
+    trace.kernels[i].end = start + 900;
+  }
+  std::string ordered = writeTrace(trace, 1, true);
+  EXPECT_EQ(writeTrace(trace, 4, true), ordered);
+
+  auto events = traceEvents(ordered);
+  for (size_t i = 1; i < events.size(); i++) {
+    EXPECT_LE(eventTimestamp(events[i - 1]), eventTimestamp(events[i]));
+  }
+  // Same events as without ordering
+  auto expected = traceEvents(writeTrace(trace, 1));
+  EXPECT_EQ(events.size(), expected.size());
+  std::sort(events.begin(), events.end());
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(events, expected);
+}
+
+TEST(ChromeTraceLoggerTest, EmptyTrace) {
+  TestTrace trace(0);
+  std::string fileName = traceFileName(0);
+  {
+    ChromeTraceLogger logger(fileName, 4);
+    trace.log(logger);
+    Config config;
+    logger.finalizeTrace(config, nullptr);
+  }
+  std::ifstream file(fileName);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  remove(fileName.c_str());
+  EXPECT_EQ(contents.str(), "[\n\n]");
+}
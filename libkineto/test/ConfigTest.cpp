@@ -11,6 +11,9 @@
 #include <gtest/gtest.h>
 #include <time.h>
 #include <chrono>
+#include <memory>
+
+#include "src/VersionedSnapshot.h"
 
 using namespace std::chrono;
 using namespace KINETO_NAMESPACE;
@@ -316,3 +319,22 @@ TEST(ParseTest, RequestTime) {
                 .count();
   EXPECT_FALSE(cfg.parse(fmt::format("REQUEST_TIMESTAMP = {}", tbad_ms)));
 }
+
+TEST(VersionedSnapshotTest, Refresh) {
+  VersionedSnapshot<Config> snapshot(std::make_shared<Config>());
+  std::shared_ptr<const Config> config;
+  uint64_t version = 0;
+  EXPECT_TRUE(snapshot.refresh(config, version));
+  EXPECT_EQ(config, snapshot.get());
+  EXPECT_FALSE(snapshot.refresh(config, version));
+
+  auto update = std::make_shared<Config>();
+  EXPECT_TRUE(update->parse("SAMPLE_PERIOD_MSECS=200"));
+  auto old = config;
+  snapshot.publish(update);
+  EXPECT_TRUE(snapshot.refresh(config, version));
+  EXPECT_EQ(config->samplePeriod(), milliseconds(200));
+  // Readers keep their snapshot
+  EXPECT_EQ(old->samplePeriod(), milliseconds(1000));
+  EXPECT_FALSE(snapshot.refresh(config, version));
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/ControlServer.h"
+
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+
+#include "src/IpcSocket.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+TEST(IpcSocketTest, SendReceive) {
+  IpcSocket server("kineto_test_" + std::to_string(getpid()));
+  IpcSocket client;
+  EXPECT_FALSE(client.name().empty());
+
+  std::string message;
+  std::string src;
+  EXPECT_FALSE(server.recv(message, src));
+
+  // Larger than a typical stack buffer
+  std::string big(100000, 'x');
+  EXPECT_TRUE(client.send(server.name(), big));
+  EXPECT_TRUE(server.recv(message, src, milliseconds(1000)));
+  EXPECT_EQ(message, big);
+  EXPECT_EQ(src, client.name());
+
+  // Sender credentials
+  int fd;
+  struct ucred cred;
+  EXPECT_TRUE(client.send(server.name(), "hello"));
+  struct pollfd pfd = {server.fd(), POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+  EXPECT_TRUE(server.recv(message, src, fd, cred));
+  EXPECT_EQ(fd, -1);
+  EXPECT_EQ(cred.pid, getpid());
+  EXPECT_EQ(cred.uid, getuid());
+  EXPECT_TRUE(IpcSocket::trusted(cred));
+  cred.uid = geteuid() + 1;
+  EXPECT_EQ(IpcSocket::trusted(cred), cred.uid == 0);
+
+  EXPECT_TRUE(server.send(src, "reply"));
+  EXPECT_TRUE(client.recv(message, src, milliseconds(1000)));
+  EXPECT_EQ(message, "reply");
+
+  // No such socket
+  EXPECT_FALSE(client.send("kineto_test_no_such_socket", "hello"));
+}
+
+TEST(ControlServerTest, Request) {
+  std::string command;
+  std::string payload;
+  ControlServer::parseRequest("trace\nA=1\nB=2", command, payload);
+  EXPECT_EQ(command, "trace");
+  EXPECT_EQ(payload, "A=1\nB=2");
+  ControlServer::parseRequest("status", command, payload);
+  EXPECT_EQ(command, "status");
+  EXPECT_EQ(payload, "");
+
+  ControlServer server(
+      [](const std::string& command, const std::string& payload) {
+        return "OK " + command + ":" + payload;
+      });
+  IpcSocket client;
+  std::string reply;
+  std::string src;
+  ASSERT_TRUE(client.send(
+      ControlServer::socketName(getpid()), "trace\nACTIVITIES_ITERATIONS=1"));
+  EXPECT_TRUE(client.recv(reply, src, milliseconds(1000)));
+  EXPECT_EQ(reply, "OK trace:ACTIVITIES_ITERATIONS=1");
+  EXPECT_EQ(src, ControlServer::socketName(getpid()));
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/cupti_strings.h"
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+
+#include "src/Demangle.h"
+
+using namespace KINETO_NAMESPACE;
+
+TEST(CuptiStringsTest, MemoryNames) {
+  EXPECT_EQ(
+      memcpyName(
+          CUPTI_ACTIVITY_MEMCPY_KIND_HTOD,
+          CUPTI_ACTIVITY_MEMORY_KIND_PINNED,
+          CUPTI_ACTIVITY_MEMORY_KIND_DEVICE).str(),
+      "Memcpy HtoD (Pinned -> Device)");
+  EXPECT_EQ(
+      memsetName(CUPTI_ACTIVITY_MEMORY_KIND_DEVICE).str(),
+      "Memset (Device)");
+
+  // Kinds unknown to this version share one name
+  EXPECT_EQ(
+      memcpyName(200, 201, CUPTI_ACTIVITY_MEMORY_KIND_UNKNOWN).str(),
+      "Memcpy <unknown> (Unrecognized -> Unknown)");
+  EXPECT_EQ(memsetName(200).str(), "Memset (Unrecognized)");
+
+  // Precomputed, so the same storage is returned every time
+  auto name = memcpyName(
+      CUPTI_ACTIVITY_MEMCPY_KIND_DTOD,
+      CUPTI_ACTIVITY_MEMORY_KIND_DEVICE,
+      CUPTI_ACTIVITY_MEMORY_KIND_DEVICE);
+  EXPECT_EQ(
+      name.data(),
+      memcpyName(
+          CUPTI_ACTIVITY_MEMCPY_KIND_DTOD,
+          CUPTI_ACTIVITY_MEMORY_KIND_DEVICE,
+          CUPTI_ACTIVITY_MEMORY_KIND_DEVICE).data());
+}
+
+TEST(CuptiStringsTest, DemangleCached) {
+  const char* mangled = "_Z6kernelPfi";
+  auto name = demangleCached(mangled);
+  EXPECT_EQ(name.str(), demangle(mangled));
+  EXPECT_EQ(name.str(), "kernel(float*, int)");
+
+  // Looked up by content, not by pointer
+  std::string copy(mangled);
+  EXPECT_EQ(demangleCached(copy.c_str()).data(), name.data());
+
+  EXPECT_TRUE(demangleCached(nullptr).empty());
+  EXPECT_EQ(demangleCached("not_mangled").str(), "not_mangled");
+}
+
+TEST(CuptiStringsTest, DemangleCacheBounded) {
+  auto kernel = demangleCached("_Z6kernelPfi");
+  // Fill the cache with distinct names
+  for (int i = 0; i < 70000; i++) {
+    std::string id = fmt::format("kernel{}", i);
+    std::string mangled = fmt::format("_Z{}{}v", id.size(), id);
+    EXPECT_EQ(demangleCached(mangled.c_str()).str(), id + "()");
+  }
+  // Cached names are still shared
+  EXPECT_EQ(demangleCached("_Z6kernelPfi").data(), kernel.data());
+  // Names beyond the bound are still demangled
+  EXPECT_EQ(demangleCached("_Z8uncachedv").str(), "uncached()");
+}
@@ -45,6 +45,23 @@ TEST(PercentileTest, Create) {
   EXPECT_EQ(pct[3].second.getInt(), 80);
 }
 
+TEST(PercentileTest, Unordered) {
+  // Percentiles not in ascending order take the sorting path
+  PercentileList pct = {
+      {90, SampleValue(0)}, {10, SampleValue(0)}, {50, SampleValue(0)}};
+
+  std::vector<int> values = {80, 10, 20, 70, 60, 40, 90, 30, 50, 0, 100};
+  percentilesInPlace(values, pct);
+  EXPECT_EQ(pct[0].second.getInt(), 90);
+  EXPECT_EQ(pct[1].second.getInt(), 10);
+  EXPECT_EQ(pct[2].second.getInt(), 50);
+
+  // Empty input leaves values untouched
+  std::vector<int> empty;
+  percentilesInPlace(empty, pct);
+  EXPECT_EQ(pct[0].second.getInt(), 90);
+}
+
 TEST(PercentileTest, Normalize) {
   PercentileList pct = {
       {10, SampleValue(10)}, {50, SampleValue(100.0)}, {90, SampleValue(2000)}};
@@ -89,6 +106,12 @@ TEST(EventTest, SumSamples) {
   EXPECT_EQ(ev.sumAll({2, 1, 2}), 10000);
   EXPECT_EQ(ev.sumAll({0, 1, 2}), 11000);
   EXPECT_EQ(ev.sumAll({0, 0, 1}), 11110);
+
+  std::vector<int64_t> sums;
+  ev.sumInstances({0, 0, 1}, sums);
+  EXPECT_EQ(sums, std::vector<int64_t>({1111, 2222, 3333, 4444}));
+  ev.sumInstances({1, 1, 3}, sums);
+  EXPECT_EQ(sums, std::vector<int64_t>({100, 200, 300, 400}));
 }
 
 TEST(EventTest, Percentiles) {
@@ -223,6 +246,12 @@ class MockCuptiEvents : public CuptiEventInterface {
   MOCK_METHOD3(
       readEvent,
       void(CUpti_EventGroup g, CUpti_EventID id, std::vector<int64_t>& vals));
+  MOCK_METHOD3(
+      readAllEvents,
+      void(
+          CUpti_EventGroup g,
+          std::vector<int64_t>& vals,
+          std::vector<CUpti_EventID>& ids));
   MOCK_METHOD1(eventsInGroup, std::vector<CUpti_EventID>(CUpti_EventGroup g));
   MOCK_METHOD1(eventId, CUpti_EventID(const std::string& name));
 };
@@ -276,15 +305,26 @@ TEST(EventGroupSetTest, CollectSample) {
   group_set.setEnabled(false);
   group_set.setEnabled(true);
 
-  EXPECT_CALL(cupti_events, eventsInGroup(g1))
+  // All events in a group are read with a single call,
+  // and group membership is not queried again.
+  EXPECT_CALL(cupti_events, eventsInGroup(_)).Times(0);
+  EXPECT_CALL(cupti_events, readEvent(_, _, _)).Times(0);
+  EXPECT_CALL(cupti_events, readAllEvents(g1, _, _))
       .Times(1)
-      .WillOnce(Return(events_in_group1));
-  EXPECT_CALL(cupti_events, eventsInGroup(g2))
+      .WillOnce(Invoke([](CUpti_EventGroup g,
+                          std::vector<int64_t>& vals,
+                          std::vector<CUpti_EventID>& ids) {
+        EXPECT_EQ(vals.size(), 2 * 80);
+        EXPECT_EQ(ids.size(), 2);
+      }));
+  EXPECT_CALL(cupti_events, readAllEvents(g2, _, _))
       .Times(1)
-      .WillOnce(Return(events_in_group2));
-  EXPECT_CALL(cupti_events, readEvent(g1, 4, _)).Times(1);
-  EXPECT_CALL(cupti_events, readEvent(g1, 5, _)).Times(1);
-  EXPECT_CALL(cupti_events, readEvent(g2, 10, _)).Times(1);
+      .WillOnce(Invoke([](CUpti_EventGroup g,
+                          std::vector<int64_t>& vals,
+                          std::vector<CUpti_EventID>& ids) {
+        EXPECT_EQ(vals.size(), 40);
+        EXPECT_EQ(ids.size(), 1);
+      }));
   group_set.collectSample();
 
   EXPECT_EQ(events[4].sampleCount(), 1);
@@ -292,6 +332,81 @@ TEST(EventGroupSetTest, CollectSample) {
   EXPECT_EQ(events[10].sampleCount(), 1);
 }
 
+TEST(EventGroupSetTest, ScatterSamples) {
+  using ::testing::_;
+  using ::testing::Invoke;
+  using ::testing::Return;
+  const CUpti_EventGroup g1{nullptr};
+  CUpti_EventGroup groups[] = {g1};
+  CUpti_EventGroupSet set;
+  set.eventGroups = groups;
+  set.numEventGroups = 1;
+
+  std::map<CUpti_EventID, Event> events;
+  events[4] = Event("instructions");
+  events[5] = Event("cycles");
+
+  MockCuptiEvents cupti_events;
+  EXPECT_CALL(cupti_events, enablePerInstance(g1)).Times(1);
+  EXPECT_CALL(cupti_events, instanceCount(g1)).Times(1).WillOnce(Return(3));
+  std::vector<CUpti_EventID> events_in_group = {4, 5};
+  EXPECT_CALL(cupti_events, eventsInGroup(g1))
+      .Times(1)
+      .WillOnce(Return(events_in_group));
+  EventGroupSet group_set(set, events, cupti_events);
+
+  // Values are laid out by domain instance.
+  // Return events in reverse order to check that ids are honored.
+  EXPECT_CALL(cupti_events, readAllEvents(g1, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([](CUpti_EventGroup g,
+                                std::vector<int64_t>& vals,
+                                std::vector<CUpti_EventID>& ids) {
+        ids = {5, 4};
+        vals = {10, 1, 20, 2, 30, 3};
+      }));
+  group_set.collectSample();
+  group_set.collectSample();
+
+  EXPECT_EQ(events[4].sampleCount(), 2);
+  EXPECT_EQ(events[4].sumInstance(0, {0, 0, 1}), 2);
+  EXPECT_EQ(events[4].sumInstance(2, {0, 0, 1}), 6);
+  EXPECT_EQ(events[5].sumInstance(1, {0, 0, 1}), 40);
+  EXPECT_EQ(events[5].sumAll({0, 0, 2}), 60);
+
+  // Storage for erased samples is reused
+  events[4].eraseSamples(2);
+  EXPECT_EQ(events[4].sampleCount(), 0);
+  group_set.collectSample();
+  EXPECT_EQ(events[4].sampleCount(), 1);
+  EXPECT_EQ(events[4].sumAll({0, 0, 1}), 6);
+}
+
+TEST(LatencyHistogramTest, Buckets) {
+  LatencyHistogram h;
+  EXPECT_EQ(h.count(), 0);
+  EXPECT_EQ(h.percentile(50).count(), 0);
+
+  for (int i = 0; i < 98; i++) {
+    h.add(microseconds(100));
+  }
+  h.add(microseconds(3000));
+  h.add(microseconds(5000));
+
+  EXPECT_EQ(h.count(), 100);
+  EXPECT_EQ(h.max().count(), 5000);
+  EXPECT_EQ(h.mean().count(), (98 * 100 + 8000) / 100);
+  // 100us falls in the [64, 128) bucket
+  EXPECT_EQ(h.percentile(50).count(), 128);
+  EXPECT_EQ(h.percentile(98).count(), 128);
+  EXPECT_EQ(h.percentile(99).count(), 4096);
+  EXPECT_EQ(h.percentile(100).count(), 5000);
+
+  h.clear();
+  EXPECT_EQ(h.count(), 0);
+  EXPECT_EQ(h.max().count(), 0);
+}
+
 class MockLogger : public SampleListener {
  public:
   MOCK_METHOD2(handleSample, void(int device, const Sample& sample));
@@ -510,29 +625,30 @@ TEST_F(EventProfilerTest, ReportSample) {
       .Times(3)
       .WillRepeatedly(Return(4));
   std::vector<CUpti_EventID> ids_g1{3}, ids_g2{4}, ids_g3{5};
-  // These will be called by collectSample() as well, which is called twice
-  // per group set
+  // Group membership is only queried once, when configuring
   EXPECT_CALL(*cuptiEvents_, eventsInGroup(eventGroups_[0]))
-      .Times(3)
-      .WillRepeatedly(Return(ids_g1));
+      .Times(1)
+      .WillOnce(Return(ids_g1));
   EXPECT_CALL(*cuptiEvents_, eventsInGroup(eventGroups_[1]))
-      .Times(3)
-      .WillRepeatedly(Return(ids_g2));
+      .Times(1)
+      .WillOnce(Return(ids_g2));
   EXPECT_CALL(*cuptiEvents_, eventsInGroup(eventGroups_[2]))
-      .Times(3)
-      .WillRepeatedly(Return(ids_g3));
+      .Times(1)
+      .WillOnce(Return(ids_g3));
   EXPECT_CALL(*cuptiEvents_, enableGroupSet(_)).Times(1);
 
   profiler_->configure(cfg, on_demand_cfg);
 
   EXPECT_TRUE(profiler_->enabled());
 
-  EXPECT_CALL(*cuptiEvents_, readEvent(_, _, _))
+  // One event per group, so one batched read per group
+  EXPECT_CALL(*cuptiEvents_, readAllEvents(_, _, _))
       .Times(6)
-      .WillRepeatedly(Invoke(
-          [](CUpti_EventGroup g, CUpti_EventID id, std::vector<int64_t>& vals) {
-            vals = {1, 2, 3, 4};
-          }));
+      .WillRepeatedly(Invoke([](CUpti_EventGroup g,
+                                std::vector<int64_t>& vals,
+                                std::vector<CUpti_EventID>& ids) {
+        vals = {1, 2, 3, 4};
+      }));
 
   // Need to collect four times - twice for each group set
   profiler_->collectSample();
@@ -542,6 +658,7 @@ TEST_F(EventProfilerTest, ReportSample) {
   profiler_->enableNextCounterSet();
   profiler_->collectSample();
   profiler_->collectSample();
+  EXPECT_EQ(profiler_->sampleLatency().count(), 4);
 
   std::vector<CUpti_EventID> ipc_ids = {4, 5};
   // Called once for each instance (4) and once for the total.
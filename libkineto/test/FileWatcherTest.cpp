@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/FileWatcher.h"
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <vector>
+
+using namespace KINETO_NAMESPACE;
+
+static bool waitReadable(int fd, int timeout_ms = 1000) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+TEST(FileWatcherTest, WriteAndRename) {
+  char dir_template[] = "/tmp/kineto_watch_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_template), nullptr);
+  const std::string dir(dir_template);
+  const std::string path = fmt::format("{}/test.conf", dir);
+  const std::string other = fmt::format("{}/other.conf", dir);
+
+  FileWatcher watcher;
+  std::vector<std::string> changes;
+  EXPECT_TRUE(watcher.add(
+      path, [&](const std::string& p) { changes.push_back(p); }));
+  EXPECT_TRUE(watcher.watching(path));
+  EXPECT_FALSE(watcher.watching(other));
+
+  // Writes to other files in the directory are ignored
+  std::ofstream(other) << "A=1";
+  // The watched file does not exist yet
+  std::ofstream(path) << "A=1";
+  ASSERT_TRUE(waitReadable(watcher.fd()));
+  watcher.handleEvents();
+  EXPECT_EQ(changes, std::vector<std::string>({path}));
+
+  // Atomic replace
+  changes.clear();
+  std::ofstream(other) << "A=2";
+  ASSERT_EQ(rename(other.c_str(), path.c_str()), 0);
+  ASSERT_TRUE(waitReadable(watcher.fd()));
+  watcher.handleEvents();
+  EXPECT_EQ(changes, std::vector<std::string>({path}));
+
+  // Removing the file is not a change
+  changes.clear();
+  std::ofstream(other) << "A=3";
+  ASSERT_EQ(unlink(path.c_str()), 0);
+  waitReadable(watcher.fd(), 20);
+  watcher.handleEvents();
+  EXPECT_TRUE(changes.empty());
+
+  // Writing other existing files does not wake up the watcher
+  std::ofstream(other) << "A=4";
+  EXPECT_FALSE(waitReadable(watcher.fd(), 20));
+
+  // Recreated
+  std::ofstream(path) << "A=5";
+  ASSERT_TRUE(waitReadable(watcher.fd()));
+  watcher.handleEvents();
+  EXPECT_EQ(changes, std::vector<std::string>({path}));
+
+  // Written in place
+  changes.clear();
+  std::ofstream(path) << "A=6";
+  ASSERT_TRUE(waitReadable(watcher.fd()));
+  watcher.handleEvents();
+  EXPECT_EQ(changes, std::vector<std::string>({path}));
+
+  // No events after removing the watch
+  changes.clear();
+  watcher.remove(path);
+  EXPECT_FALSE(watcher.watching(path));
+  std::ofstream(path) << "A=7";
+  waitReadable(watcher.fd(), 20);
+  watcher.handleEvents();
+  EXPECT_TRUE(changes.empty());
+
+  unlink(path.c_str());
+  unlink(other.c_str());
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/HostTraceAggregator.h"
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/SharedRing.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+namespace {
+
+HostTraceEvent makeEvent(int32_t source, int64_t ts, const std::string& name) {
+  HostTraceEvent event{};
+  event.record.kind = HostTraceRecord::Kind::Event;
+  event.record.category = HostTraceRecord::Category::Operator;
+  event.record.source = source;
+  event.record.pid = source;
+  event.record.tid = source;
+  event.record.ts = ts;
+  event.record.dur = 1;
+  event.name = name;
+  return event;
+}
+
+std::vector<int64_t> timestamps(const std::string& trace) {
+  std::vector<int64_t> result;
+  std::regex re("\"ts\": ([0-9]+), \"dur\"");
+  for (auto it = std::sregex_iterator(trace.begin(), trace.end(), re);
+       it != std::sregex_iterator();
+       ++it) {
+    result.push_back(std::stoll((*it)[1]));
+  }
+  return result;
+}
+
+std::string readFile(const std::string& path) {
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+} // namespace
+
+TEST(SharedRingTest, WriteRead) {
+  auto ring = SharedRing::create("test_ring", 100);
+  // Rounded up to a power of two
+  EXPECT_EQ(ring->maxRecordSize(), 128 - sizeof(uint32_t));
+
+  std::string rec;
+  EXPECT_FALSE(ring->read(rec));
+  EXPECT_TRUE(ring->write("hello", 5));
+  EXPECT_TRUE(ring->write("", 0));
+  EXPECT_TRUE(ring->read(rec));
+  EXPECT_EQ(rec, "hello");
+  EXPECT_TRUE(ring->read(rec));
+  EXPECT_EQ(rec, "");
+  EXPECT_FALSE(ring->read(rec));
+}
+
+TEST(SharedRingTest, FullAndWraparound) {
+  auto ring = SharedRing::create("test_ring", 64);
+  std::deque<std::string> expected;
+  std::string rec;
+  // 24 bytes per record
+  for (int i = 0; i < 2; i++) {
+    expected.emplace_back(20, 'a' + i);
+    EXPECT_TRUE(ring->write(expected.back().data(), 20));
+  }
+  EXPECT_FALSE(ring->write(expected.back().data(), 20));
+  EXPECT_FALSE(ring->write(expected.back().data(), 100));
+  for (int i = 2; i < 12; i++) {
+    EXPECT_TRUE(ring->read(rec));
+    EXPECT_EQ(rec, expected.front());
+    expected.pop_front();
+    expected.emplace_back(20, 'a' + i);
+    // Wraps around the end of the buffer
+    EXPECT_TRUE(ring->write(expected.back().data(), 20));
+  }
+  while (!expected.empty()) {
+    EXPECT_TRUE(ring->read(rec));
+    EXPECT_EQ(rec, expected.front());
+    expected.pop_front();
+  }
+  EXPECT_FALSE(ring->read(rec));
+}
+
+TEST(SharedRingTest, AttachAndFinish) {
+  auto producer = SharedRing::create("test_ring", 1024);
+  auto consumer = SharedRing::attach(dup(producer->fd()));
+  EXPECT_TRUE(producer->write("one", 3));
+  producer->close();
+  EXPECT_FALSE(consumer->finished());
+  std::string rec;
+  EXPECT_TRUE(consumer->read(rec));
+  EXPECT_EQ(rec, "one");
+  EXPECT_TRUE(consumer->finished());
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  close(fds[1]);
+  EXPECT_THROW(SharedRing::attach(fds[0]), std::system_error);
+
+  // The size cannot change under the consumer's mapping
+  EXPECT_NE(ftruncate(producer->fd(), 16), 0);
+  EXPECT_NE(ftruncate(producer->fd(), 1 << 20), 0);
+  // Unsealed files are rejected, even with the right size
+  char path[] = "/tmp/kineto_ring_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  unlink(path);
+  ASSERT_EQ(ftruncate(fd, 4096 + 256), 0);
+  EXPECT_THROW(SharedRing::attach(fd), std::system_error);
+}
+
+TEST(HostTraceAggregatorTest, EncodeDecode) {
+  HostTraceEvent event = makeEvent(42, 1000, "aten::add");
+  event.arg = "label";
+  event.record.correlation = 7;
+  std::string buf;
+  event.encode(buf);
+
+  HostTraceEvent decoded;
+  ASSERT_TRUE(decoded.decode(buf));
+  EXPECT_EQ(decoded.name, "aten::add");
+  EXPECT_EQ(decoded.arg, "label");
+  EXPECT_EQ(decoded.record.source, 42);
+  EXPECT_EQ(decoded.record.ts, 1000);
+  EXPECT_EQ(decoded.record.correlation, 7);
+
+  buf.pop_back();
+  EXPECT_FALSE(decoded.decode(buf));
+}
+
+TEST(HostTraceAggregatorTest, MergeByTime) {
+  std::vector<std::vector<HostTraceEvent>> events(3);
+  // Each process streams events out of order
+  for (int p = 0; p < 3; p++) {
+    HostTraceEvent meta{};
+    meta.record.kind = HostTraceRecord::Kind::Thread;
+    meta.record.pid = p;
+    meta.record.tid = p;
+    meta.name = "worker";
+    for (int i = 9; i >= 0; i--) {
+      events[p].push_back(makeEvent(p, i * 3 + p, "op"));
+      events[p].push_back(meta);
+    }
+  }
+  std::stringstream out;
+  HostTraceAggregator::writeTrace(events, out);
+  std::string trace = out.str();
+  EXPECT_EQ(trace.front(), '[');
+  EXPECT_EQ(trace.back(), ']');
+  // Metadata is written once per thread
+  size_t count = 0;
+  for (size_t pos = 0; (pos = trace.find("thread_name", pos)) !=
+       std::string::npos;
+       pos++) {
+    count++;
+  }
+  EXPECT_EQ(count, 3);
+
+  auto ts = timestamps(trace);
+  ASSERT_EQ(ts.size(), 30);
+  for (int i = 0; i < 30; i++) {
+    EXPECT_EQ(ts[i], i);
+  }
+
+  std::vector<std::vector<HostTraceEvent>> none;
+  std::stringstream empty;
+  HostTraceAggregator::writeTrace(none, empty);
+  EXPECT_EQ(empty.str(), "[\n]");
+}
+
+TEST(HostTraceAggregatorTest, GpuRowsPerProcess) {
+  // Two processes sharing GPU 0
+  std::vector<std::vector<HostTraceEvent>> events(2);
+  for (int p = 0; p < 2; p++) {
+    // Process and GPU row metadata, as written by each process
+    HostTraceEvent process = makeEvent(100 + p, 0, "python");
+    process.record.kind = HostTraceRecord::Kind::Process;
+    process.record.category = HostTraceRecord::Category::None;
+    events[p].push_back(process);
+    process.record.category = HostTraceRecord::Category::Gpu;
+    process.record.pid = 0;
+    process.arg = "GPU 0";
+    events[p].push_back(process);
+
+    HostTraceEvent event = makeEvent(100 + p, p, "kernel");
+    event.record.category = HostTraceRecord::Category::Kernel;
+    event.record.pid = 0;
+    events[p].push_back(event);
+  }
+  std::stringstream out;
+  HostTraceAggregator::writeTrace(events, out);
+  std::string trace = out.str();
+  for (int p = 0; p < 2; p++) {
+    std::string gpuRow = fmt::format("\"pid\": \"GPU 0 (pid {})\"", 100 + p);
+    EXPECT_NE(
+        trace.find(R"("name": "kernel", )" + gpuRow), std::string::npos);
+    // Each GPU row is named and labeled
+    EXPECT_NE(
+        trace.find(R"("name": "process_name", "ph": "M", "ts": 0, )" + gpuRow),
+        std::string::npos);
+    EXPECT_NE(
+        trace.find(
+            R"("name": "process_labels", "ph": "M", "ts": 0, )" + gpuRow),
+        std::string::npos);
+    EXPECT_NE(
+        trace.find(fmt::format(
+            R"("name": "process_name", "ph": "M", "ts": 0, "pid": {},)",
+            100 + p)),
+        std::string::npos);
+  }
+}
+
+TEST(HostTraceAggregatorTest, CombinesProducers) {
+  const std::string name =
+      "kineto_test_host_trace_" + std::to_string(getpid());
+  const std::string file = "/tmp/kineto_host_trace_test.json";
+  constexpr int kProducers = 4;
+  constexpr int kEvents = 5000;
+  HostTraceAggregator aggregator(
+      name, file, milliseconds(200), seconds(10));
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&, p] {
+      // Small ring, to exercise draining while producing
+      auto ring = SharedRing::create("test_ring", 4096);
+      ASSERT_TRUE(HostTraceAggregator::join(*ring, file, name));
+      std::string buf;
+      for (int i = 0; i < kEvents; i++) {
+        makeEvent(p, i * kProducers + p, "op").encode(buf);
+        while (!ring->write(buf.data(), buf.size())) {
+          std::this_thread::sleep_for(microseconds(100));
+        }
+      }
+      // The aggregator keeps its own mapping after the ring is released
+      ring->close();
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  auto start = steady_clock::now();
+  while (!aggregator.done() && steady_clock::now() - start < seconds(10)) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  ASSERT_TRUE(aggregator.done());
+
+  auto ts = timestamps(readFile(file));
+  ASSERT_EQ(ts.size(), kProducers * kEvents);
+  for (int i = 0; i < kProducers * kEvents; i++) {
+    EXPECT_EQ(ts[i], i);
+  }
+  unlink(file.c_str());
+}
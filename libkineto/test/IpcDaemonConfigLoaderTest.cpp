@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/IpcDaemonConfigLoader.h"
+
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/IpcSocket.h"
+#include "tools/LocalDaemon.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+namespace {
+
+// Runs a daemon on a test-specific socket in a background thread
+class DaemonThread {
+ public:
+  explicit DaemonThread(milliseconds requestTimeout = milliseconds(2000))
+      : daemon_("kineto_test_daemon_" + std::to_string(getpid()),
+                requestTimeout),
+        thread_([this] {
+          while (!stop_) {
+            daemon_.step(milliseconds(10));
+          }
+        }) {}
+
+  ~DaemonThread() {
+    stop_ = true;
+    thread_.join();
+  }
+
+  const std::string& name() const {
+    return daemon_.name();
+  }
+
+ private:
+  LocalDaemon daemon_;
+  std::atomic_bool stop_{false};
+  std::thread thread_;
+};
+
+static bool waitReply(DaemonConfigLoader& loader, int timeout_ms = 1000) {
+  struct pollfd pfd = {loader.replyFd(), POLLIN, 0};
+  return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+// A client process. Registers a context on device 0 and polls the daemon,
+// reporting each received config on a pipe until killed.
+class ClientProcess {
+ public:
+  ClientProcess(const std::string& daemon, bool available) {
+    int fds[2];
+    EXPECT_EQ(pipe(fds), 0);
+    pid_ = fork();
+    if (pid_ == 0) {
+      close(fds[0]);
+      IpcDaemonConfigLoader loader(daemon);
+      loader.gpuContextCreated(0);
+      // Registered once the first poll is answered
+      loader.readOnDemandConfig(available, available);
+      waitReply(loader);
+      write(fds[1], "\n", 1);
+      while (true) {
+        loader.readOnDemandConfig(available, available);
+        waitReply(loader);
+        std::string config = loader.readReply();
+        if (!config.empty()) {
+          config += "\n";
+          write(fds[1], config.data(), config.size());
+        }
+        usleep(10000);
+      }
+    }
+    close(fds[1]);
+    fd_ = fds[0];
+  }
+
+  ~ClientProcess() {
+    kill();
+    close(fd_);
+  }
+
+  void kill() {
+    if (pid_ > 0) {
+      ::kill(pid_, SIGKILL);
+      waitpid(pid_, nullptr, 0);
+      pid_ = 0;
+    }
+  }
+
+  // Read next line written by the client
+  std::string readLine() {
+    std::string line;
+    char c;
+    while (read(fd_, &c, 1) == 1 && c != '\n') {
+      line += c;
+    }
+    return line;
+  }
+
+  pid_t pid() const {
+    return pid_;
+  }
+
+ private:
+  pid_t pid_;
+  int fd_;
+};
+
+} // namespace
+
+TEST(IpcDaemonConfigLoaderTest, NoDaemon) {
+  IpcDaemonConfigLoader loader("kineto_test_no_such_daemon");
+  EXPECT_EQ(loader.readOnDemandConfig(true, true), "");
+  EXPECT_FALSE(waitReply(loader, 20));
+  EXPECT_EQ(loader.readReply(), "");
+  EXPECT_EQ(loader.gpuContextCount(0), -1);
+}
+
+TEST(IpcDaemonConfigLoaderTest, ContextCount) {
+  DaemonThread daemon;
+  IpcDaemonConfigLoader loader(daemon.name());
+  EXPECT_EQ(loader.gpuContextCount(0), 0);
+
+  std::vector<std::unique_ptr<ClientProcess>> clients;
+  for (int i = 0; i < 3; i++) {
+    clients.push_back(std::make_unique<ClientProcess>(daemon.name(), true));
+    EXPECT_EQ(clients.back()->readLine(), "");
+  }
+  // Count includes the new context, as when enabling an event profiler
+  loader.gpuContextCreated(0);
+  EXPECT_EQ(loader.gpuContextCount(0), 4);
+  EXPECT_EQ(loader.gpuContextCount(1), 0);
+
+  // Contexts of exited processes are not counted
+  clients[0]->kill();
+  EXPECT_EQ(loader.gpuContextCount(0), 3);
+  loader.gpuContextDestroyed(0);
+  EXPECT_EQ(loader.gpuContextCount(0), 2);
+}
+
+TEST(IpcDaemonConfigLoaderTest, FanOut) {
+  DaemonThread daemon;
+  std::vector<std::unique_ptr<ClientProcess>> clients;
+  for (bool available : {true, true, false}) {
+    clients.push_back(
+        std::make_unique<ClientProcess>(daemon.name(), available));
+    EXPECT_EQ(clients.back()->readLine(), "");
+  }
+
+  const std::string config = "ACTIVITIES_DURATION_MSECS=100";
+  IpcSocket requester;
+  ASSERT_TRUE(requester.send(daemon.name(), "trace\n7\n" + config));
+  std::string reply;
+  std::string src;
+  ASSERT_TRUE(requester.recv(reply, src, milliseconds(2000)));
+
+  // One batched reply
+  EXPECT_EQ(reply.find("7\nOK 3 processes\n"), 0);
+  for (int i = 0; i < 3; i++) {
+    std::string outcome = std::to_string(clients[i]->pid()) +
+        (i < 2 ? " delivered\n" : " busy\n");
+    EXPECT_NE(reply.find(outcome), std::string::npos);
+  }
+  EXPECT_EQ(clients[0]->readLine(), config);
+  EXPECT_EQ(clients[1]->readLine(), config);
+}
+
+TEST(IpcDaemonConfigLoaderTest, FanOutTimeout) {
+  DaemonThread daemon(milliseconds(100));
+  ClientProcess client(daemon.name(), true);
+  EXPECT_EQ(client.readLine(), "");
+  // Stop polling without exiting
+  ::kill(client.pid(), SIGSTOP);
+
+  IpcSocket requester;
+  ASSERT_TRUE(requester.send(daemon.name(), "trace\n1\n"));
+  std::string reply;
+  std::string src;
+  ASSERT_TRUE(requester.recv(reply, src, milliseconds(2000)));
+  EXPECT_EQ(
+      reply,
+      "1\nOK 1 processes\n" + std::to_string(client.pid()) + " timeout\n");
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/IterationSampler.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace KINETO_NAMESPACE;
+
+static std::vector<int> sampledIterations(IterationSampler& sampler, int n) {
+  std::vector<int> res;
+  for (int i = 0; i < n; i++) {
+    if (sampler.sampled(i)) {
+      res.push_back(i);
+    }
+  }
+  return res;
+}
+
+TEST(IterationSamplerTest, Disabled) {
+  IterationSampler sampler;
+  EXPECT_FALSE(sampler.enabled());
+  EXPECT_EQ(sampledIterations(sampler, 5).size(), 5u);
+}
+
+TEST(IterationSamplerTest, Stride) {
+  IterationSampler sampler(10, 3, 0);
+  EXPECT_TRUE(sampler.enabled());
+  EXPECT_EQ(sampledIterations(sampler, 40), std::vector<int>({3, 13, 23, 33}));
+
+  // Offset is kept within the stride
+  IterationSampler clamped(4, 7, 0);
+  EXPECT_EQ(sampledIterations(clamped, 12), std::vector<int>({3, 7, 11}));
+}
+
+TEST(IterationSamplerTest, Jitter) {
+  IterationSampler sampler(10, 2, 5, /*seed*/ 42);
+  auto samples = sampledIterations(sampler, 10000);
+  ASSERT_EQ(samples.size(), 1000);
+  std::vector<int> counts(10);
+  for (int i = 0; i < 1000; i++) {
+    int offset = samples[i] - i * 10;
+    EXPECT_GE(offset, 2);
+    EXPECT_LE(offset, 7);
+    counts[offset]++;
+  }
+  // All offsets within the jitter are used
+  for (int offset = 2; offset <= 7; offset++) {
+    EXPECT_GT(counts[offset], 100);
+  }
+
+  // Repeated queries for the same iteration are consistent
+  IterationSampler repeat(10, 0, 9, /*seed*/ 1);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(repeat.sampled(i), repeat.sampled(i));
+  }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/NetFilter.h"
+
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace KINETO_NAMESPACE;
+
+TEST(NetFilterTest, Empty) {
+  NetFilter filter;
+  EXPECT_TRUE(filter.empty());
+  EXPECT_TRUE(filter.matches(""));
+  EXPECT_TRUE(filter.matches("net"));
+
+  // An empty substring matches everything too
+  NetFilter emptySubstring({""});
+  EXPECT_FALSE(emptySubstring.empty());
+  EXPECT_TRUE(emptySubstring.matches("net"));
+}
+
+TEST(NetFilterTest, Substrings) {
+  NetFilter filter({"train", "he", "she", "hers"});
+  EXPECT_TRUE(filter.matches("train_net"));
+  EXPECT_TRUE(filter.matches("dist_train"));
+  EXPECT_TRUE(filter.matches("ushers"));
+  EXPECT_TRUE(filter.matches("sh_he"));
+  EXPECT_FALSE(filter.matches("trai"));
+  EXPECT_FALSE(filter.matches("eval_net"));
+  EXPECT_FALSE(filter.matches(""));
+}
+
+TEST(NetFilterTest, SameAsFind) {
+  std::mt19937 rng(7);
+  auto randomString = [&rng](int maxLen) {
+    std::string s(std::uniform_int_distribution<int>(0, maxLen)(rng), 'a');
+    for (char& c : s) {
+      c = 'a' + std::uniform_int_distribution<int>(0, 2)(rng);
+    }
+    return s;
+  };
+  for (int i = 0; i < 100; i++) {
+    std::vector<std::string> substrings;
+    for (int j = 0; j < 4; j++) {
+      substrings.push_back(randomString(4) + "a");
+    }
+    NetFilter filter(substrings);
+    for (int j = 0; j < 100; j++) {
+      std::string name = randomString(12);
+      bool expected = false;
+      for (const auto& s : substrings) {
+        expected = expected || name.find(s) != name.npos;
+      }
+      EXPECT_EQ(filter.matches(name), expected);
+    }
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/RadixSort.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace KINETO_NAMESPACE;
+
+using Item = std::pair<uint64_t, int>;
+
+static uint64_t itemKey(const Item& item) {
+  return item.first;
+}
+
+TEST(RadixSortTest, MatchesStableSort) {
+  std::mt19937_64 rng(42);
+  std::vector<Item> items;
+  for (int i = 0; i < 10000; i++) {
+    // Few distinct keys, to check stability, with high bytes set
+    items.emplace_back((rng() % 100) << 40 | (rng() % 3), i);
+  }
+  auto expected = items;
+  std::stable_sort(
+      expected.begin(), expected.end(), [](const Item& a, const Item& b) {
+        return a.first < b.first;
+      });
+  radixSort(items, itemKey);
+  EXPECT_EQ(items, expected);
+}
+
+TEST(RadixSortTest, SortedAndEmpty) {
+  std::vector<Item> items;
+  radixSort(items, itemKey);
+  EXPECT_TRUE(items.empty());
+
+  for (int i = 0; i < 1000; i++) {
+    items.emplace_back(i / 2, i);
+  }
+  auto expected = items;
+  radixSort(items, itemKey);
+  EXPECT_EQ(items, expected);
+
+  // Narrow range of keys
+  std::reverse(items.begin(), items.end());
+  radixSort(items, itemKey);
+  for (size_t i = 1; i < items.size(); i++) {
+    EXPECT_LE(items[i - 1].first, items[i].first);
+  }
+  // Stable: equal keys keep their (reversed) order
+  EXPECT_EQ(items[0], Item(0, 1));
+  EXPECT_EQ(items[1], Item(0, 0));
+}
+
+TEST(RadixSortTest, SmallKeys) {
+  std::vector<uint32_t> items = {5, 3, 0xffffffff, 0, 3, 256, 255};
+  radixSort(items, [](uint32_t i) { return i; });
+  EXPECT_EQ(
+      items, std::vector<uint32_t>({0, 3, 3, 5, 255, 256, 0xffffffff}));
+}
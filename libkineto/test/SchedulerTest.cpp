@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/Scheduler.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+using TimePoint = Scheduler::TimePoint;
+
+// Wait for a condition with timeout, polling
+template <class Pred>
+static bool waitFor(Pred pred, milliseconds timeout = milliseconds(2000)) {
+  auto deadline = system_clock::now() + timeout;
+  while (!pred()) {
+    if (system_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  return true;
+}
+
+TEST(SchedulerTest, DeadlineOrder) {
+  Scheduler scheduler;
+  std::mutex mutex;
+  std::vector<int> order;
+  auto now = system_clock::now();
+  for (int i : {30, 10, 20, 70, 0}) {
+    scheduler.schedule(
+        "order", now + milliseconds(i), [&, i](const TimePoint& t) {
+          std::lock_guard<std::mutex> lock(mutex);
+          order.push_back(i);
+          return TimePoint::max();
+        });
+  }
+  EXPECT_TRUE(waitFor([&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    return order.size() == 5;
+  }));
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(order, std::vector<int>({0, 10, 20, 30, 70}));
+}
+
+TEST(SchedulerTest, PeriodicNeverEarly) {
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  std::atomic<int> early{0};
+  auto period = milliseconds(3);
+  auto first = system_clock::now() + period;
+  auto deadline = std::make_shared<TimePoint>(first);
+  scheduler.schedule("periodic", first, [&, deadline](const TimePoint& now) {
+    if (system_clock::now() < *deadline) {
+      early++;
+    }
+    if (++runs == 20) {
+      return TimePoint::max();
+    }
+    *deadline += period;
+    return *deadline;
+  });
+  EXPECT_TRUE(waitFor([&] { return runs == 20; }));
+  EXPECT_EQ(early, 0);
+
+  std::stringstream s;
+  scheduler.printLateness(s);
+  EXPECT_NE(s.str().find("periodic: count=20"), std::string::npos);
+}
+
+TEST(SchedulerTest, Cascade) {
+  // Deadlines beyond the first wheel level are cascaded down
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  std::atomic<int> early{0};
+  auto now = system_clock::now();
+  for (int ms : {65, 130, 300, 1100}) {
+    auto deadline = now + milliseconds(ms);
+    scheduler.schedule("cascade", deadline, [&, deadline](const TimePoint& t) {
+      if (system_clock::now() < deadline) {
+        early++;
+      }
+      runs++;
+      return TimePoint::max();
+    });
+  }
+  EXPECT_TRUE(waitFor([&] { return runs == 4; }));
+  EXPECT_EQ(early, 0);
+  EXPECT_LT(system_clock::now() - now, milliseconds(1500));
+}
+
+TEST(SchedulerTest, RescheduleEarly) {
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  auto id = scheduler.schedule(
+      "reschedule", system_clock::now() + seconds(100), [&](const TimePoint&) {
+        runs++;
+        return TimePoint::max();
+      });
+  std::this_thread::sleep_for(milliseconds(5));
+  EXPECT_EQ(runs, 0);
+  auto start = system_clock::now();
+  scheduler.reschedule(id, start);
+  EXPECT_TRUE(waitFor([&] { return runs == 1; }));
+  EXPECT_LT(system_clock::now() - start, milliseconds(100));
+}
+
+TEST(SchedulerTest, ParkAndWake) {
+  // A task returning max() with a pending wakeup stays scheduled
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  std::atomic<bool> proceed{false};
+  Scheduler::TaskId id = 0;
+  id = scheduler.schedule(
+      "park", system_clock::now(), [&](const TimePoint&) {
+        runs++;
+        while (runs == 1 && !proceed) {
+          std::this_thread::sleep_for(milliseconds(1));
+        }
+        return TimePoint::max();
+      });
+  EXPECT_TRUE(waitFor([&] { return runs == 1; }));
+  // Wake up while running
+  scheduler.reschedule(id, system_clock::now());
+  proceed = true;
+  EXPECT_TRUE(waitFor([&] { return runs == 2; }));
+}
+
+TEST(SchedulerTest, Cancel) {
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  auto id = scheduler.schedule(
+      "cancel", system_clock::now() + milliseconds(20), [&](const TimePoint&) {
+        runs++;
+        return TimePoint::max();
+      });
+  scheduler.cancel(id);
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_EQ(runs, 0);
+
+  // Cancel waits for a running task to complete
+  std::atomic<bool> running{false};
+  id = scheduler.schedule("cancel", system_clock::now(), [&](const TimePoint&) {
+    running = true;
+    std::this_thread::sleep_for(milliseconds(20));
+    runs++;
+    return system_clock::now();
+  });
+  EXPECT_TRUE(waitFor([&] { return running.load(); }));
+  scheduler.cancel(id);
+  EXPECT_EQ(runs, 1);
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_EQ(runs, 1);
+}
+
+TEST(SchedulerTest, WatchFd) {
+  Scheduler scheduler;
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::atomic<int> runs{0};
+  std::atomic<int> bytes{0};
+  auto id = scheduler.watch(
+      "pipe", fds[0], TimePoint::max(), [&](const TimePoint&) {
+        char buf[16];
+        bytes += read(fds[0], buf, sizeof(buf));
+        runs++;
+        return TimePoint::max();
+      });
+  std::this_thread::sleep_for(milliseconds(5));
+  EXPECT_EQ(runs, 0);
+
+  auto start = system_clock::now();
+  ASSERT_EQ(write(fds[1], "abc", 3), 3);
+  EXPECT_TRUE(waitFor([&] { return bytes == 3; }));
+  EXPECT_LT(system_clock::now() - start, milliseconds(100));
+  // Still watched after returning max()
+  ASSERT_EQ(write(fds[1], "de", 2), 2);
+  EXPECT_TRUE(waitFor([&] { return bytes == 5; }));
+  EXPECT_EQ(runs, 2);
+
+  scheduler.cancel(id);
+  ASSERT_EQ(write(fds[1], "f", 1), 1);
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_EQ(runs, 2);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(SchedulerTest, Stop) {
+  Scheduler scheduler;
+  std::atomic<int> runs{0};
+  auto id = scheduler.schedule(
+      "periodic", system_clock::now(), [&](const TimePoint& t) {
+        runs++;
+        return t + milliseconds(1);
+      });
+  EXPECT_TRUE(waitFor([&] { return runs > 0; }));
+  scheduler.stop();
+  int stopped = runs;
+  std::this_thread::sleep_for(milliseconds(10));
+  EXPECT_EQ(runs, stopped);
+  // Tasks can still be cancelled, e.g. during static destruction
+  scheduler.cancel(id);
+  scheduler.stop();
+}
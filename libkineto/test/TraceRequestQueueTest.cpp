@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/TraceRequestQueue.h"
+
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/Config.h"
+
+using namespace std::chrono;
+using namespace KINETO_NAMESPACE;
+
+static std::unique_ptr<Config> traceConfig(const std::string& logFile) {
+  auto config = std::make_unique<Config>();
+  EXPECT_TRUE(config->parse(
+      fmt::format("ACTIVITIES_LOG_FILE = /tmp/{}.json", logFile)));
+  return config;
+}
+
+TEST(TraceRequestQueueTest, Priority) {
+  TraceRequestQueue queue(4);
+  auto now = system_clock::now();
+  EXPECT_EQ(queue.pop(now), nullptr);
+
+  queue.push(*traceConfig("daemon"), TraceRequestSource::Daemon, now);
+  queue.push(*traceConfig("signal1"), TraceRequestSource::Signal, now);
+  queue.push(*traceConfig("api"), TraceRequestSource::Api, now);
+  queue.push(*traceConfig("signal2"), TraceRequestSource::Signal, now);
+
+  std::vector<std::string> order;
+  while (auto config = queue.pop(now)) {
+    order.push_back(config->activitiesLogFile());
+  }
+  EXPECT_EQ(
+      order,
+      std::vector<std::string>({"/tmp/api.json",
+                                "/tmp/signal1.json",
+                                "/tmp/signal2.json",
+                                "/tmp/daemon.json"}));
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.status().started, 4);
+}
+
+TEST(TraceRequestQueueTest, CoalesceAndReject) {
+  TraceRequestQueue queue(2);
+  auto now = system_clock::now();
+  using Result = TraceRequestQueue::Result;
+  EXPECT_EQ(
+      queue.push(*traceConfig("a"), TraceRequestSource::Daemon, now),
+      Result::Queued);
+  // Duplicate takes the higher priority
+  EXPECT_EQ(
+      queue.push(*traceConfig("a"), TraceRequestSource::Signal, now),
+      Result::Coalesced);
+  EXPECT_EQ(
+      queue.push(*traceConfig("b"), TraceRequestSource::Daemon, now),
+      Result::Queued);
+
+  // Full - lower or equal priority is rejected
+  EXPECT_FALSE(queue.accepts(TraceRequestSource::Daemon));
+  EXPECT_EQ(
+      queue.push(*traceConfig("c"), TraceRequestSource::Daemon, now),
+      Result::Rejected);
+  // Higher priority replaces the lowest priority request
+  EXPECT_TRUE(queue.accepts(TraceRequestSource::Api));
+  EXPECT_EQ(
+      queue.push(*traceConfig("d"), TraceRequestSource::Api, now),
+      Result::Queued);
+
+  EXPECT_EQ(queue.pop(now)->activitiesLogFile(), "/tmp/d.json");
+  EXPECT_EQ(queue.pop(now)->activitiesLogFile(), "/tmp/a.json");
+  EXPECT_EQ(queue.pop(now), nullptr);
+
+  auto status = queue.status();
+  EXPECT_EQ(status.queued, 0u);
+  EXPECT_EQ(status.capacity, 2u);
+  EXPECT_EQ(status.received, 5);
+  EXPECT_EQ(status.coalesced, 1);
+  EXPECT_EQ(status.rejected, 2);
+  EXPECT_EQ(status.started, 2);
+}
+
+TEST(TraceRequestQueueTest, CoalesceSameSettingsOnly) {
+  TraceRequestQueue queue(4);
+  auto now = system_clock::now();
+  using Result = TraceRequestQueue::Result;
+  EXPECT_EQ(
+      queue.push(*traceConfig("a"), TraceRequestSource::Daemon, now),
+      Result::Queued);
+  for (const char* option : {"ACTIVITIES_STANDBY = true",
+                             "ACTIVITIES_TIME_ORDERED = true",
+                             "ACTIVITIES_DURATION_MSECS = 1234"}) {
+    auto config = traceConfig("a");
+    EXPECT_TRUE(config->parse(option));
+    EXPECT_EQ(
+        queue.push(*config, TraceRequestSource::Daemon, now), Result::Queued);
+  }
+  EXPECT_EQ(queue.status().queued, 4u);
+  EXPECT_EQ(queue.status().coalesced, 0);
+}
+
+TEST(TraceRequestQueueTest, Deadline) {
+  TraceRequestQueue queue(4);
+  auto now = system_clock::now();
+  auto timestamp =
+      duration_cast<milliseconds>(now.time_since_epoch()).count() - 1000;
+  Config synced;
+  EXPECT_TRUE(synced.parse(fmt::format(
+      "ACTIVITIES_LOG_FILE = /tmp/synced.json\nREQUEST_TIMESTAMP = {}",
+      timestamp)));
+  queue.push(*traceConfig("unsynced"), TraceRequestSource::Signal, now);
+  queue.push(synced, TraceRequestSource::Signal, now);
+
+  // Earlier deadline first
+  EXPECT_EQ(queue.pop(now)->activitiesLogFile(), "/tmp/synced.json");
+
+  // Dropped once the synchronized start time has passed
+  queue.push(synced, TraceRequestSource::Signal, now);
+  auto later = now + synced.maxRequestAge();
+  EXPECT_EQ(queue.pop(later)->activitiesLogFile(), "/tmp/unsynced.json");
+  EXPECT_EQ(queue.status().expired, 1);
+  EXPECT_EQ(
+      queue.push(synced, TraceRequestSource::Signal, later),
+      TraceRequestQueue::Result::Rejected);
+  EXPECT_EQ(queue.status().expired, 2);
+}
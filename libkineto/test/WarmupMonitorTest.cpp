@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "src/WarmupMonitor.h"
+
+#include <gtest/gtest.h>
+
+using namespace KINETO_NAMESPACE;
+
+TEST(WarmupMonitorTest, NeedsFullWindow) {
+  WarmupMonitor monitor(3, 0.1);
+  monitor.addSample(1000, 1e6);
+  monitor.addSample(1000, 1e6);
+  EXPECT_FALSE(monitor.stable());
+  monitor.addSample(1000, 1e6);
+  EXPECT_TRUE(monitor.stable());
+  EXPECT_EQ(monitor.sampleCount(), 3);
+}
+
+TEST(WarmupMonitorTest, Stabilizes) {
+  WarmupMonitor monitor(3, 0.1);
+  // High and falling flush latency at first
+  monitor.addSample(50000, 1e6);
+  monitor.addSample(20000, 1e6);
+  monitor.addSample(5000, 1e6);
+  EXPECT_FALSE(monitor.stable());
+  monitor.addSample(2000, 1e6);
+  monitor.addSample(2100, 1e6);
+  EXPECT_FALSE(monitor.stable());
+  monitor.addSample(1900, 1e6);
+  EXPECT_TRUE(monitor.stable());
+
+  // Both series must be stable
+  monitor.addSample(2000, 4e6);
+  EXPECT_FALSE(monitor.stable());
+}
+
+TEST(WarmupMonitorTest, NoiseFloor) {
+  // Small absolute differences are within the noise
+  WarmupMonitor monitor(3, 0.1);
+  monitor.addSample(10, 1000);
+  monitor.addSample(60, 3000);
+  monitor.addSample(30, 2000);
+  EXPECT_TRUE(monitor.stable());
+}
+
+TEST(WarmupMonitorTest, IdleGpu) {
+  // No records completed - the overhead has not been observed yet
+  WarmupMonitor monitor(3, 0.1);
+  for (int i = 0; i < 5; i++) {
+    monitor.addSample(10, 0);
+  }
+  EXPECT_FALSE(monitor.stable());
+  monitor.addSample(10, 1e6);
+  monitor.addSample(10, 1e6);
+  EXPECT_FALSE(monitor.stable());
+  monitor.addSample(10, 1e6);
+  EXPECT_TRUE(monitor.stable());
+}
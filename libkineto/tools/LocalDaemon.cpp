@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "LocalDaemon.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+using namespace std::chrono;
+
+namespace KINETO_NAMESPACE {
+
+// Processes poll every 5s, so allow for a couple of missed polls
+constexpr seconds kRegistrationTimeout(15);
+
+static bool processAlive(pid_t pid) {
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// Split "<command>\n<seq>\n<payload>"
+static bool parseMessage(
+    const std::string& msg,
+    std::string& command,
+    std::string& seq,
+    std::string& payload) {
+  size_t end_command = msg.find('\n');
+  size_t end_seq = msg.find('\n', end_command + 1);
+  if (end_command == std::string::npos || end_seq == std::string::npos) {
+    return false;
+  }
+  command = msg.substr(0, end_command);
+  seq = msg.substr(end_command + 1, end_seq - end_command - 1);
+  payload = msg.substr(end_seq + 1);
+  return true;
+}
+
+LocalDaemon::LocalDaemon(
+    const std::string& name,
+    milliseconds requestTimeout)
+    : socket_(name), requestTimeout_(requestTimeout) {}
+
+void LocalDaemon::step(milliseconds timeout) {
+  struct pollfd pfd = {socket_.fd(), POLLIN, 0};
+  if (poll(&pfd, 1, timeout.count()) == 1) {
+    std::string msg;
+    std::string src;
+    int fd;
+    struct ucred cred;
+    // Drain without waiting
+    while (socket_.recv(msg, src, fd, cred)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      handleMessage(msg, src, cred);
+    }
+  }
+  if (!requests_.empty()) {
+    pruneProcesses();
+  }
+  completeRequests(Clock::now());
+}
+
+void LocalDaemon::handleMessage(
+    const std::string& msg,
+    const std::string& src,
+    const struct ucred& cred) {
+  std::string command;
+  std::string seq;
+  std::string payload;
+  if (cred.pid <= 0 || !parseMessage(msg, command, seq, payload)) {
+    std::cerr << "Ignoring malformed message from @" << src << std::endl;
+    return;
+  }
+  std::string reply;
+  if (command == "poll") {
+    reply = handlePoll(cred, payload);
+  } else if (command == "context") {
+    handleContext(cred, payload);
+    return;
+  } else if (command == "contexts") {
+    reply = std::to_string(contextCount(atoi(payload.c_str())));
+  } else if (command == "trace") {
+    handleTrace(seq, payload, src, cred.uid);
+    return;
+  } else if (command == "status") {
+    reply = status();
+  } else {
+    reply = "ERROR unknown command '" + command + "'";
+  }
+  if (!src.empty()) {
+    socket_.send(src, seq + "\n" + reply);
+  }
+}
+
+std::string LocalDaemon::handlePoll(
+    const struct ucred& cred,
+    const std::string& payload) {
+  pid_t pid = cred.pid;
+  Process& process = processes_[pid];
+  process.uid = cred.uid;
+  process.lastPoll = Clock::now();
+  int events = 0;
+  int activities = 0;
+  std::istringstream(payload) >> events >> activities;
+  // Deliver the oldest request pending for this process
+  for (auto& req : requests_) {
+    auto it = req.outcome.find(pid);
+    if (it == req.outcome.end() || !it->second.empty()) {
+      continue;
+    }
+    if (!events && !activities) {
+      it->second = "busy";
+      continue;
+    }
+    it->second = "delivered";
+    return req.config;
+  }
+  return "";
+}
+
+void LocalDaemon::handleContext(
+    const struct ucred& cred,
+    const std::string& payload) {
+  uint32_t device = 0;
+  int delta = 0;
+  std::istringstream(payload) >> device >> delta;
+  Process& process = processes_[cred.pid];
+  process.uid = cred.uid;
+  int& count = process.contexts[device];
+  count = std::max(0, count + delta);
+}
+
+int LocalDaemon::contextCount(uint32_t device) {
+  pruneProcesses();
+  int count = 0;
+  for (const auto& pair : processes_) {
+    auto it = pair.second.contexts.find(device);
+    if (it != pair.second.contexts.end()) {
+      count += it->second;
+    }
+  }
+  return count;
+}
+
+void LocalDaemon::handleTrace(
+    const std::string& seq,
+    const std::string& config,
+    const std::string& src,
+    uid_t uid) {
+  pruneProcesses();
+  TraceRequest req;
+  req.config = config;
+  req.requester = src;
+  req.seq = seq;
+  auto now = Clock::now();
+  req.deadline = now + requestTimeout_;
+  for (const auto& pair : processes_) {
+    // Only root may trace other users' processes
+    bool permitted = uid == 0 || uid == pair.second.uid;
+    if (permitted && now - pair.second.lastPoll < kRegistrationTimeout) {
+      req.outcome[pair.first] = "";
+    }
+  }
+  std::cerr << "Trace request from @" << src << " for "
+            << req.outcome.size() << " processes" << std::endl;
+  requests_.push_back(std::move(req));
+}
+
+void LocalDaemon::completeRequests(Clock::time_point now) {
+  for (auto it = requests_.begin(); it != requests_.end();) {
+    bool expired = now >= it->deadline;
+    bool pending = false;
+    for (auto& pair : it->outcome) {
+      if (pair.second.empty()) {
+        if (expired) {
+          pair.second = "timeout";
+        } else {
+          pending = true;
+        }
+      }
+    }
+    if (pending) {
+      ++it;
+      continue;
+    }
+    // One reply for all processes
+    std::stringstream s;
+    s << it->seq << "\nOK " << it->outcome.size() << " processes"
+      << std::endl;
+    for (const auto& pair : it->outcome) {
+      s << pair.first << " " << pair.second << std::endl;
+    }
+    if (!it->requester.empty() && !socket_.send(it->requester, s.str())) {
+      std::cerr << "Failed to reply to @" << it->requester << std::endl;
+    }
+    it = requests_.erase(it);
+  }
+}
+
+void LocalDaemon::pruneProcesses() {
+  for (auto it = processes_.begin(); it != processes_.end();) {
+    if (processAlive(it->first)) {
+      ++it;
+      continue;
+    }
+    // Exited processes can no longer respond
+    for (auto& req : requests_) {
+      auto outcome = req.outcome.find(it->first);
+      if (outcome != req.outcome.end() && outcome->second.empty()) {
+        outcome->second = "exited";
+      }
+    }
+    it = processes_.erase(it);
+  }
+}
+
+std::string LocalDaemon::status() {
+  pruneProcesses();
+  std::stringstream s;
+  s << "OK" << std::endl;
+  auto now = Clock::now();
+  std::map<uint32_t, int> contexts;
+  for (const auto& pair : processes_) {
+    s << "pid=" << pair.first << " registered="
+      << (now - pair.second.lastPoll < kRegistrationTimeout ? "yes" : "no")
+      << std::endl;
+    for (const auto& ctx : pair.second.contexts) {
+      contexts[ctx.first] += ctx.second;
+    }
+  }
+  for (const auto& pair : contexts) {
+    s << "gpu=" << pair.first << " contexts=" << pair.second << std::endl;
+  }
+  s << "pending_requests=" << requests_.size() << std::endl;
+  return s.str();
+}
+
+} // namespace KINETO_NAMESPACE
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <chrono>
+#include <list>
+#include <map>
+#include <string>
+
+#include "src/IpcDaemonConfigLoader.h"
+#include "src/IpcSocket.h"
+
+namespace KINETO_NAMESPACE {
+
+// Stand-in for a host-wide profiling daemon, serving IpcDaemonConfigLoader
+// clients in all processes on the host. See IpcDaemonConfigLoader.h for
+// the client protocol. In addition, it accepts
+//
+//   trace   "<config>" -> one reply once all processes have responded
+//   status  ""         -> registered processes and contexts per GPU
+//
+// A trace request is fanned out to every process of the requesting user
+// that has polled recently, or to all of them if requested by root, and
+// delivered with the reply to its next poll. The reply to the requester
+// batches the outcome for each process: "<pid> delivered", "<pid> busy" if
+// the profilers were not available, "<pid> exited" or "<pid> timeout".
+//
+// Processes are identified by the pid and uid that the kernel attaches to
+// each message. Contexts are counted per GPU across processes from context
+// notifications.
+// Processes that have exited are pruned along with their contexts.
+// Single threaded: call step() in a loop.
+class LocalDaemon {
+ public:
+  // Throws std::system_error if the socket cannot be created
+  explicit LocalDaemon(
+      const std::string& name = IpcDaemonConfigLoader::kDaemonSocketName,
+      std::chrono::milliseconds requestTimeout = std::chrono::seconds(15));
+
+  // Handle messages arriving within timeout and complete expired requests
+  void step(std::chrono::milliseconds timeout);
+
+  const std::string& name() const {
+    return socket_.name();
+  }
+
+  // Total contexts on a GPU in live processes
+  int contextCount(uint32_t device);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Process {
+    uid_t uid;
+    Clock::time_point lastPoll;
+    std::map<uint32_t, int> contexts;
+  };
+
+  struct TraceRequest {
+    std::string config;
+    std::string requester;
+    std::string seq;
+    Clock::time_point deadline;
+    // Outcome by pid, empty while pending
+    std::map<pid_t, std::string> outcome;
+  };
+
+  void handleMessage(
+      const std::string& msg,
+      const std::string& src,
+      const struct ucred& cred);
+  std::string handlePoll(const struct ucred& cred, const std::string& payload);
+  void handleContext(const struct ucred& cred, const std::string& payload);
+  void handleTrace(
+      const std::string& seq,
+      const std::string& config,
+      const std::string& src,
+      uid_t uid);
+  std::string status();
+
+  // Reply to requests that are complete or expired
+  void completeRequests(Clock::time_point now);
+  // Forget processes that have exited
+  void pruneProcesses();
+
+  IpcSocket socket_;
+  std::chrono::milliseconds requestTimeout_;
+  std::map<pid_t, Process> processes_;
+  std::list<TraceRequest> requests_;
+};
+
+} // namespace KINETO_NAMESPACE
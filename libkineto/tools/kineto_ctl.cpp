@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Send requests to the control socket of a process using libkineto.
+// The process must have ENABLE_IPC_CONTROL=true in its base config.
+//
+//   kineto_ctl <pid> status
+//   kineto_ctl <pid> stats
+//   kineto_ctl <pid> trace [config file]
+//
+// For trace requests, the config is read from the given file, or from
+// stdin if the file is "-". Without a file, the default trace is requested.
+
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include "src/ControlServer.h"
+#include "src/IpcSocket.h"
+
+using namespace KINETO_NAMESPACE;
+
+constexpr std::chrono::milliseconds kReplyTimeout(5000);
+
+static int usage(const char* name) {
+  std::cerr << "Usage: " << name << " <pid> status|stats|trace [config file]"
+            << std::endl;
+  return 2;
+}
+
+static std::string readAll(std::istream& in) {
+  return std::string(
+      std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    return usage(argv[0]);
+  }
+  pid_t pid = atoi(argv[1]);
+  std::string command = argv[2];
+  std::string payload;
+  if (argc > 3) {
+    if (command != "trace") {
+      return usage(argv[0]);
+    }
+    if (std::string(argv[3]) == "-") {
+      payload = readAll(std::cin);
+    } else {
+      std::ifstream file(argv[3]);
+      if (!file) {
+        std::cerr << "Failed to open " << argv[3] << std::endl;
+        return 1;
+      }
+      payload = readAll(file);
+    }
+  }
+
+  try {
+    IpcSocket socket;
+    std::string dest = ControlServer::socketName(pid);
+    if (!socket.send(dest, command + "\n" + payload)) {
+      std::cerr << "No control socket @" << dest
+                << " - is ENABLE_IPC_CONTROL set?" << std::endl;
+      return 1;
+    }
+    std::string reply;
+    std::string src;
+    if (!socket.recv(reply, src, kReplyTimeout)) {
+      std::cerr << "No reply from @" << dest << std::endl;
+      return 1;
+    }
+    std::cout << reply;
+    if (reply.empty() || reply.back() != '\n') {
+      std::cout << std::endl;
+    }
+    return reply.compare(0, 2, "OK") == 0 ? 0 : 1;
+  } catch (const std::system_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
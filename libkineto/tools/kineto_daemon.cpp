@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Minimal host-local daemon for processes using libkineto with
+// ENABLE_IPC_DAEMON=true in their base config.
+//
+//   kineto_daemon                      run the daemon
+//   kineto_daemon status               list processes and contexts per GPU
+//   kineto_daemon trace [config file]  trace the caller's processes
+//
+// For trace requests, the config is read from the given file, or from
+// stdin if the file is "-". The reply lists the outcome per process.
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+#include "tools/LocalDaemon.h"
+
+using namespace KINETO_NAMESPACE;
+
+// Allow for the trace request timeout in the daemon
+constexpr std::chrono::milliseconds kReplyTimeout(20000);
+
+static int usage(const char* name) {
+  std::cerr << "Usage: " << name << " [status|trace [config file]]"
+            << std::endl;
+  return 2;
+}
+
+static std::string readAll(std::istream& in) {
+  return std::string(
+      std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static int serve() {
+  LocalDaemon daemon;
+  std::cerr << "Listening on @" << daemon.name() << std::endl;
+  while (true) {
+    daemon.step(std::chrono::milliseconds(1000));
+  }
+}
+
+static int request(const std::string& command, const std::string& payload) {
+  IpcSocket socket;
+  const std::string dest = IpcDaemonConfigLoader::kDaemonSocketName;
+  if (!socket.send(dest, command + "\n1\n" + payload)) {
+    std::cerr << "Daemon @" << dest << " is not running" << std::endl;
+    return 1;
+  }
+  std::string reply;
+  std::string src;
+  if (!socket.recv(reply, src, kReplyTimeout)) {
+    std::cerr << "No reply from @" << dest << std::endl;
+    return 1;
+  }
+  // Strip sequence number
+  reply = reply.substr(reply.find('\n') + 1);
+  std::cout << reply;
+  return reply.compare(0, 2, "OK") == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  try {
+    if (argc == 1) {
+      return serve();
+    }
+    std::string command = argv[1];
+    std::string payload;
+    if (command == "trace" && argc == 3) {
+      if (std::string(argv[2]) == "-") {
+        payload = readAll(std::cin);
+      } else {
+        std::ifstream file(argv[2]);
+        if (!file) {
+          std::cerr << "Failed to open " << argv[2] << std::endl;
+          return 1;
+        }
+        payload = readAll(file);
+      }
+    } else if (argc > 2 || (command != "trace" && command != "status")) {
+      return usage(argv[0]);
+    }
+    return request(command, payload);
+  } catch (const std::system_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}